@@ -0,0 +1,95 @@
+/*
+ * Geoclue-provider-hybris
+ * assistance.c - Time, location and XTRA data for faster fixes
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/timex.h>
+
+#include <syslog.h>
+
+#include "assistance.h"
+
+/* XTRA files are a few 10 kB, anything much larger is not one */
+#define MAX_XTRA_SIZE (1024 * 1024)
+
+void
+assistance_get_time (GpsUtcTime *time, int64_t *reference,
+                     int *uncertainty, int unsynchronized)
+{
+    struct timespec real, boot;
+    struct timex tx;
+    int state;
+
+    memset (&tx, 0, sizeof (tx));
+    state = adjtimex (&tx);
+    clock_gettime (CLOCK_REALTIME, &real);
+    clock_gettime (CLOCK_BOOTTIME, &boot);
+
+    *time = (GpsUtcTime) real.tv_sec * 1000 + real.tv_nsec / 1000000;
+    *reference = (int64_t) boot.tv_sec * 1000 + boot.tv_nsec / 1000000;
+    if (state == -1 || state == TIME_ERROR || (tx.status & STA_UNSYNC)) {
+        /* set by hand or from the network time, nobody keeps track */
+        *uncertainty = unsynchronized;
+    }
+    else {
+        /* maxerror is in us */
+        *uncertainty = MAX (1, tx.maxerror / 1000);
+    }
+}
+
+char *
+assistance_load_xtra (const char *path, guint max_age, time_t *mtime,
+                      gsize *length)
+{
+    GError *error = NULL;
+    struct stat st;
+    char *data;
+
+    if (stat (path, &st) < 0) {
+        if (errno != ENOENT) {
+            syslog(LOG_WARNING, "Cannot read XTRA data %s: %s", path, g_strerror (errno));
+        }
+        return NULL;
+    }
+    if (st.st_mtime == *mtime) {
+        /* already injected */
+        return NULL;
+    }
+    if (max_age && time (NULL) - st.st_mtime > (time_t) max_age) {
+        syslog(LOG_INFO, "XTRA data %s is too old", path);
+        return NULL;
+    }
+    if (st.st_size == 0 || st.st_size > MAX_XTRA_SIZE) {
+        syslog(LOG_WARNING, "Not XTRA data: %s", path);
+        return NULL;
+    }
+    if (!g_file_get_contents (path, &data, length, &error)) {
+        syslog(LOG_WARNING, "Cannot read XTRA data: %s", error->message);
+        g_error_free (error);
+        return NULL;
+    }
+    *mtime = st.st_mtime;
+    return data;
+}
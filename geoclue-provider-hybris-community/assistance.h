@@ -0,0 +1,54 @@
+/*
+ * Geoclue-provider-hybris
+ * assistance.h - Time, location and XTRA data for faster fixes
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef ASSISTANCE_H
+#define ASSISTANCE_H
+
+#include <time.h>
+
+#include <android-config.h>
+#include <hardware/gps.h>
+
+#include <glib.h>
+
+/* A fix worth injecting on the next start, kept in the state cache */
+typedef struct {
+    double latitude;
+    double longitude;
+    /* m */
+    double accuracy;
+    /* ms since the epoch */
+    GpsUtcTime timestamp;
+} AssistanceFix;
+
+/* Arguments for GpsInterface.inject_time: the UTC time in ms, the
+ * CLOCK_BOOTTIME time it was taken at in ms and its uncertainty in ms.
+ * unsynchronized is the uncertainty used when the kernel does not know
+ * the clock to be synchronized. */
+void assistance_get_time (GpsUtcTime *time, int64_t *reference,
+                          int *uncertainty, int unsynchronized);
+
+/* Reads path when it is at most max_age seconds old and its modification
+ * time differs from *mtime, which is updated. Returns NULL otherwise. */
+char *assistance_load_xtra (const char *path, guint max_age, time_t *mtime,
+                            gsize *length);
+
+#endif /* ASSISTANCE_H */
@@ -0,0 +1,145 @@
+/*
+ * Geoclue-provider-hybris
+ * callback-ring.c - Handing reports from the hal threads to the main loop
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <config.h>
+
+#include <stddef.h>
+
+#include "callback-ring.h"
+
+/* The sequence of a slot is its position while free, position + 1 once
+ * committed, and position + size once consumed, which is the next position
+ * it is free for. */
+typedef struct {
+    guint sequence;
+    /* set by the producer that claimed the slot */
+    guint position;
+    /* the record, 8 byte aligned */
+    gint64 data[];
+} CallbackSlot;
+
+struct _CallbackRing {
+    guint mask;
+    gsize stride;
+    /* next position to claim, by the producers */
+    guint enqueue;
+    /* next position to consume, by the consumer only */
+    guint dequeue;
+    gint dropped;
+    char *slots;
+};
+
+#define SLOT(ring, position) \
+    ((CallbackSlot *) ((ring)->slots + ((position) & (ring)->mask) * (ring)->stride))
+
+CallbackRing *
+callback_ring_new (guint n_records, gsize record_size)
+{
+    CallbackRing *ring;
+    guint i;
+
+    g_return_val_if_fail (n_records && !(n_records & (n_records - 1)), NULL);
+
+    ring = g_new0 (CallbackRing, 1);
+    ring->mask = n_records - 1;
+    ring->stride = (sizeof (CallbackSlot) + record_size + 7) & ~(gsize) 7;
+    ring->slots = g_malloc0 (ring->stride * n_records);
+    for (i = 0; i < n_records; i++) {
+        SLOT (ring, i)->sequence = i;
+    }
+    return ring;
+}
+
+void
+callback_ring_free (CallbackRing *ring)
+{
+    if (ring) {
+        g_free (ring->slots);
+        g_free (ring);
+    }
+}
+
+gpointer
+callback_ring_reserve (CallbackRing *ring)
+{
+    guint position = __atomic_load_n (&ring->enqueue, __ATOMIC_RELAXED);
+    CallbackSlot *slot;
+    gint diff;
+
+    for (;;) {
+        slot = SLOT (ring, position);
+        diff = (gint) (__atomic_load_n (&slot->sequence, __ATOMIC_ACQUIRE) - position);
+        if (diff == 0) {
+            /* free for this position, claim it unless another producer did */
+            if (__atomic_compare_exchange_n (&ring->enqueue, &position, position + 1,
+                                             TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                slot->position = position;
+                return slot->data;
+            }
+        }
+        else if (diff < 0) {
+            /* still holds the record from a lap ago, the consumer is not
+             * keeping up: drop the newest report */
+            __atomic_fetch_add (&ring->dropped, 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+        else {
+            /* claimed meanwhile */
+            position = __atomic_load_n (&ring->enqueue, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void
+callback_ring_commit (CallbackRing *ring, gpointer record)
+{
+    CallbackSlot *slot = (CallbackSlot *) ((char *) record - offsetof (CallbackSlot, data));
+
+    /* the record is visible before the sequence */
+    __atomic_store_n (&slot->sequence, slot->position + 1, __ATOMIC_RELEASE);
+}
+
+gpointer
+callback_ring_peek (CallbackRing *ring)
+{
+    CallbackSlot *slot = SLOT (ring, ring->dequeue);
+
+    if (__atomic_load_n (&slot->sequence, __ATOMIC_ACQUIRE) != ring->dequeue + 1) {
+        return NULL;
+    }
+    return slot->data;
+}
+
+void
+callback_ring_pop (CallbackRing *ring)
+{
+    CallbackSlot *slot = SLOT (ring, ring->dequeue);
+
+    /* the record is consumed before the slot is handed back */
+    __atomic_store_n (&slot->sequence, ring->dequeue + ring->mask + 1, __ATOMIC_RELEASE);
+    ring->dequeue++;
+}
+
+guint
+callback_ring_take_dropped (CallbackRing *ring)
+{
+    return __atomic_exchange_n (&ring->dropped, 0, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,52 @@
+/*
+ * Geoclue-provider-hybris
+ * callback-ring.h - Handing reports from the hal threads to the main loop
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef CALLBACK_RING_H
+#define CALLBACK_RING_H
+
+#include <glib.h>
+
+/* A bounded queue of fixed-size records with any number of producers and
+ * one consumer. A producer claims a slot with callback_ring_reserve, so
+ * two threads never fill the same record, and publishes it with
+ * callback_ring_commit through the sequence number of the slot, so the
+ * consumer only sees complete records. Records are consumed in the order
+ * their slots were claimed. Nothing locks or makes a syscall. */
+typedef struct _CallbackRing CallbackRing;
+
+/* n_records is a power of two */
+CallbackRing *callback_ring_new (guint n_records, gsize record_size);
+void callback_ring_free (CallbackRing *ring);
+
+/* From any thread. NULL when the ring is full, the report is then counted
+ * as dropped. */
+gpointer callback_ring_reserve (CallbackRing *ring);
+void callback_ring_commit (CallbackRing *ring, gpointer record);
+
+/* From the consumer. The oldest record if it has been committed, NULL
+ * otherwise; callback_ring_pop hands its slot back to the producers. */
+gpointer callback_ring_peek (CallbackRing *ring);
+void callback_ring_pop (CallbackRing *ring);
+
+/* The reports dropped since the last call */
+guint callback_ring_take_dropped (CallbackRing *ring);
+
+#endif /* CALLBACK_RING_H */
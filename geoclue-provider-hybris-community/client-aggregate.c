@@ -0,0 +1,61 @@
+/*
+ * Geoclue-provider-hybris
+ * client-aggregate.c - What the clients want of the engine together
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include "client-aggregate.h"
+
+void
+client_aggregate_init (ClientAggregate *aggregate)
+{
+    memset (aggregate, 0, sizeof (ClientAggregate));
+    aggregate->single_shot = TRUE;
+}
+
+void
+client_aggregate_add (ClientAggregate *aggregate, const ClientRequest *request)
+{
+    guint interval;
+
+    aggregate->n_clients++;
+    /* a subscriber does not need fixes faster than it gets them */
+    interval = request->interval ? request->interval : request->min_interval;
+    if (!interval && !request->fence_only) {
+        /* it still gets the default rate, a slower client cannot take it away */
+        interval = DEFAULT_FIX_INTERVAL;
+    }
+    if (interval && (!aggregate->interval || interval < aggregate->interval)) {
+        aggregate->interval = interval;
+    }
+    if (request->accuracy &&
+        (!aggregate->accuracy || request->accuracy < aggregate->accuracy)) {
+        aggregate->accuracy = request->accuracy;
+    }
+    aggregate->single_shot &= request->single_shot;
+    if (request->batching) {
+        aggregate->batching = TRUE;
+    }
+    else if (!request->fence_only) {
+        aggregate->tracking = TRUE;
+    }
+}
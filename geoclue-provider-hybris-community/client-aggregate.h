@@ -0,0 +1,60 @@
+/*
+ * Geoclue-provider-hybris
+ * client-aggregate.h - What the clients want of the engine together
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef CLIENT_AGGREGATE_H
+#define CLIENT_AGGREGATE_H
+
+#include <glib.h>
+
+/* ms, for a client without an interval preference */
+#define DEFAULT_FIX_INTERVAL 1000
+
+/* What one referenced client asks for */
+typedef struct {
+    /* SetOptions preferences, 0 means no preference */
+    guint interval;
+    guint accuracy;
+    gboolean single_shot;
+    /* the Subscription interface minimum interval, 0 unless subscribed */
+    guint min_interval;
+    gboolean batching;
+    /* only has geofences, which the hal may monitor with the engine off */
+    gboolean fence_only;
+} ClientRequest;
+
+/* What the clients want together */
+typedef struct {
+    int n_clients;
+    /* fastest interval and tightest accuracy, 0 when nobody cares; a
+     * tracking client without a preference counts as DEFAULT_FIX_INTERVAL */
+    guint interval;
+    guint accuracy;
+    gboolean single_shot;
+    /* some client needs fixes from the GPS engine */
+    gboolean tracking;
+    /* some client batches */
+    gboolean batching;
+} ClientAggregate;
+
+void client_aggregate_init (ClientAggregate *aggregate);
+void client_aggregate_add (ClientAggregate *aggregate, const ClientRequest *request);
+
+#endif /* CLIENT_AGGREGATE_H */
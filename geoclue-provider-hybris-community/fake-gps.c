@@ -0,0 +1,1197 @@
+/*
+ * Geoclue-provider-hybris
+ * fake-gps.c - Scripted GPS HAL for testing without hardware
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <syslog.h>
+
+#include <glib.h>
+
+#include "fake-gps.h"
+#include "geofence.h"
+#include "hal-trace.h"
+
+/* A pass over the records takes at least this long, a trace or script
+ * without any silence would otherwise spin the replay thread */
+#define FAKE_MIN_PASS G_USEC_PER_SEC
+
+#define FAKE_MAX_FENCES 64
+#define FAKE_FLP_BATCH_SIZE 32
+
+typedef enum {
+    FAKE_RECORD_STATUS,
+    FAKE_RECORD_SV_STATUS,
+    FAKE_RECORD_NMEA,
+    FAKE_RECORD_LOCATION,
+    /* replayed from the trace of a GNSS hal */
+    FAKE_RECORD_GNSS_SV_STATUS,
+    FAKE_RECORD_WAIT,
+} FakeRecordType;
+
+typedef struct {
+    FakeRecordType type;
+    /* silence after the record, in us */
+    gint64 delay;
+    union {
+        GpsStatusValue status;
+        GpsSvStatus sv_status;
+#if ANDROID_VERSION_MAJOR>=7
+        GnssSvStatus gnss_sv_status;
+#endif
+        GpsLocation location;
+        char *nmea;
+    } u;
+} FakeRecord;
+
+#if ANDROID_VERSION_MAJOR>=5
+typedef struct {
+    int32_t id;
+    double latitude;
+    double longitude;
+    double radius;
+    int monitor;
+    /* the last transition, GPS_GEOFENCE_UNCERTAIN until the first fix */
+    int last;
+    gboolean paused;
+} FakeFence;
+#endif
+
+static struct {
+    GpsCallbacks *callbacks;
+    GPtrArray *records;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    gboolean started;
+    gboolean quit;
+    FILE *stamps;
+    guint delivered[FAKE_RECORD_WAIT];
+    uint32_t capabilities;
+#if ANDROID_VERSION_MAJOR>=5
+    /* the extensions, all but the callbacks under lock */
+    GpsGeofenceCallbacks *geofence_callbacks;
+    FakeFence fences[FAKE_MAX_FENCES];
+    guint n_fences;
+    FlpCallbacks *flp_callbacks;
+    gboolean batching;
+    FlpBatchOptions batch_options;
+    FlpLocation batch[FAKE_FLP_BATCH_SIZE];
+    guint batch_len;
+    /* of the last fix batched */
+    GpsUtcTime batch_time;
+    GpsMeasurementCallbacks *measurement_callbacks;
+    /* filled on the replay thread only */
+    GpsData gps_data;
+#if ANDROID_VERSION_MAJOR>=7
+    GnssData gnss_data;
+#endif
+#endif
+} fake = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/* Script parsing */
+
+static const struct {
+    const char *name;
+    GpsStatusValue status;
+} status_names[] = {
+    { "none", GPS_STATUS_NONE },
+    { "session_begin", GPS_STATUS_SESSION_BEGIN },
+    { "session_end", GPS_STATUS_SESSION_END },
+    { "engine_on", GPS_STATUS_ENGINE_ON },
+    { "engine_off", GPS_STATUS_ENGINE_OFF },
+};
+
+static gboolean
+parse_sv_status (char *list, GpsSvStatus *sv_status)
+{
+    char *saveptr = NULL;
+    char *token;
+    int used;
+
+    sv_status->size = sizeof (GpsSvStatus);
+    for (token = strtok_r (list, " \t", &saveptr); token;
+         token = strtok_r (NULL, " \t", &saveptr)) {
+        GpsSvInfo *sv = &sv_status->sv_list[sv_status->num_svs];
+
+        if (sv_status->num_svs == GPS_MAX_SVS) {
+            return FALSE;
+        }
+        sv->size = sizeof (GpsSvInfo);
+        if (sscanf (token, "%d:%f:%f:%f:%d", &sv->prn, &sv->snr,
+                    &sv->elevation, &sv->azimuth, &used) != 5) {
+            return FALSE;
+        }
+        if (used && sv->prn >= 1 && sv->prn <= 32) {
+            sv_status->used_in_fix_mask |= 1u << (sv->prn - 1);
+        }
+        sv_status->num_svs++;
+    }
+    return TRUE;
+}
+
+#if ANDROID_VERSION_MAJOR>=7
+static gboolean
+parse_gnss_sv_status (char *list, GnssSvStatus *sv_status)
+{
+    char *saveptr = NULL;
+    char *token;
+    int constellation, svid, used;
+
+    sv_status->size = sizeof (GnssSvStatus);
+    for (token = strtok_r (list, " \t", &saveptr); token;
+         token = strtok_r (NULL, " \t", &saveptr)) {
+        GnssSvInfo *sv = &sv_status->gnss_sv_list[sv_status->num_svs];
+
+        if (sv_status->num_svs == GNSS_MAX_SVS) {
+            return FALSE;
+        }
+        sv->size = sizeof (GnssSvInfo);
+        if (sscanf (token, "%d:%d:%f:%f:%f:%d", &constellation, &svid,
+                    &sv->c_n0_dbhz, &sv->elevation, &sv->azimuth, &used) != 6) {
+            return FALSE;
+        }
+        sv->constellation = constellation;
+        sv->svid = svid;
+        sv->flags = used ? GNSS_SV_FLAGS_USED_IN_FIX : GNSS_SV_FLAGS_NONE;
+        sv_status->num_svs++;
+    }
+    return TRUE;
+}
+#endif
+
+static FakeRecord *
+parse_line (char *line, double *rate)
+{
+    FakeRecord *record = g_new0 (FakeRecord, 1);
+    char keyword[16];
+    char name[32];
+    int offset = 0;
+    unsigned int ms;
+    guint i;
+
+    if (sscanf (line, "%15s %n", keyword, &offset) != 1) {
+        goto error;
+    }
+
+    if (strcmp (keyword, "rate") == 0) {
+        if (sscanf (line + offset, "%lf", rate) != 1 || *rate <= 0) {
+            goto error;
+        }
+        g_free (record);
+        return NULL;
+    }
+    else if (strcmp (keyword, "status") == 0) {
+        record->type = FAKE_RECORD_STATUS;
+        if (sscanf (line + offset, "%31s", name) != 1) {
+            goto error;
+        }
+        for (i = 0; i < G_N_ELEMENTS (status_names); i++) {
+            if (strcmp (name, status_names[i].name) == 0) {
+                break;
+            }
+        }
+        if (i == G_N_ELEMENTS (status_names)) {
+            goto error;
+        }
+        record->u.status = status_names[i].status;
+    }
+    else if (strcmp (keyword, "sv") == 0) {
+        record->type = FAKE_RECORD_SV_STATUS;
+        if (!parse_sv_status (line + offset, &record->u.sv_status)) {
+            goto error;
+        }
+    }
+#if ANDROID_VERSION_MAJOR>=7
+    else if (strcmp (keyword, "gnss") == 0) {
+        record->type = FAKE_RECORD_GNSS_SV_STATUS;
+        if (!parse_gnss_sv_status (line + offset, &record->u.gnss_sv_status)) {
+            goto error;
+        }
+    }
+#endif
+    else if (strcmp (keyword, "nmea") == 0) {
+        record->type = FAKE_RECORD_NMEA;
+        record->u.nmea = g_strdup_printf ("%s\r\n", line + offset);
+    }
+    else if (strcmp (keyword, "location") == 0) {
+        GpsLocation *location = &record->u.location;
+
+        record->type = FAKE_RECORD_LOCATION;
+        record->delay = G_USEC_PER_SEC / *rate;
+        location->size = sizeof (GpsLocation);
+        location->flags = GPS_LOCATION_HAS_LAT_LONG | GPS_LOCATION_HAS_ALTITUDE |
+                          GPS_LOCATION_HAS_SPEED | GPS_LOCATION_HAS_BEARING |
+                          GPS_LOCATION_HAS_ACCURACY;
+        if (sscanf (line + offset, "%lf %lf %lf %f %f %f",
+                    &location->latitude, &location->longitude,
+                    &location->altitude, &location->speed,
+                    &location->bearing, &location->accuracy) != 6) {
+            goto error;
+        }
+    }
+    else if (strcmp (keyword, "wait") == 0) {
+        record->type = FAKE_RECORD_WAIT;
+        if (sscanf (line + offset, "%u", &ms) != 1) {
+            goto error;
+        }
+        record->delay = (gint64) ms * 1000;
+    }
+    else {
+        goto error;
+    }
+    return record;
+
+error:
+    g_free (record);
+    return (FakeRecord *) -1;
+}
+
+static void
+free_record (gpointer data)
+{
+    FakeRecord *record = data;
+
+    if (record->type == FAKE_RECORD_NMEA) {
+        g_free (record->u.nmea);
+    }
+    g_free (record);
+}
+
+static GPtrArray *
+load_script (const char *path, double rate_override)
+{
+    GPtrArray *records;
+    char *contents;
+    char **lines;
+    double rate = 1.0;
+    int i;
+
+    if (!g_file_get_contents (path, &contents, NULL, NULL)) {
+        syslog(LOG_ERR, "Cannot read fake GPS script %s", path);
+        return NULL;
+    }
+    lines = g_strsplit (contents, "\n", -1);
+    g_free (contents);
+
+    records = g_ptr_array_new_with_free_func (free_record);
+    for (i = 0; lines[i]; i++) {
+        char *line = g_strstrip (lines[i]);
+        FakeRecord *record;
+
+        if (line[0] == '\0' || line[0] == '#') {
+            continue;
+        }
+        record = parse_line (line, &rate);
+        if (record == (FakeRecord *) -1) {
+            syslog(LOG_ERR, "%s:%d: invalid fake GPS record", path, i + 1);
+            g_ptr_array_free (records, TRUE);
+            records = NULL;
+            break;
+        }
+        if (record) {
+            if (record->type == FAKE_RECORD_LOCATION && rate_override > 0) {
+                record->delay = G_USEC_PER_SEC / rate_override;
+            }
+            g_ptr_array_add (records, record);
+        }
+    }
+    g_strfreev (lines);
+
+    if (records && records->len == 0) {
+        syslog(LOG_ERR, "Fake GPS script %s has no records", path);
+        g_ptr_array_free (records, TRUE);
+        records = NULL;
+    }
+    return records;
+}
+
+/* HAL traces, see hal-trace.h */
+
+static GPtrArray *
+load_trace (HalTraceReader *reader, double speed)
+{
+    GPtrArray *records = g_ptr_array_new_with_free_func (free_record);
+    FakeRecord *previous = NULL;
+    gint64 previous_time = 0;
+    HalTraceType type;
+    const void *data;
+    gsize length;
+    gint64 time;
+
+    while (hal_trace_reader_next (reader, &type, &time, &data, &length)) {
+        FakeRecord *record = g_new0 (FakeRecord, 1);
+
+        switch (type)
+        {
+            case HAL_TRACE_LOCATION:
+            record->type = FAKE_RECORD_LOCATION;
+            memcpy (&record->u.location, data, MIN (length, sizeof (GpsLocation)));
+            break;
+            case HAL_TRACE_STATUS:
+            record->type = FAKE_RECORD_STATUS;
+            record->u.status = ((const GpsStatus *) data)->status;
+            break;
+            case HAL_TRACE_SV_STATUS:
+            record->type = FAKE_RECORD_SV_STATUS;
+            memcpy (&record->u.sv_status, data, MIN (length, sizeof (GpsSvStatus)));
+            break;
+#if ANDROID_VERSION_MAJOR>=7
+            case HAL_TRACE_GNSS_SV_STATUS:
+            record->type = FAKE_RECORD_GNSS_SV_STATUS;
+            memcpy (&record->u.gnss_sv_status, data, MIN (length, sizeof (GnssSvStatus)));
+            break;
+#endif
+            case HAL_TRACE_NMEA:
+            if (length < sizeof (GpsUtcTime)) {
+                g_free (record);
+                continue;
+            }
+            record->type = FAKE_RECORD_NMEA;
+            record->u.nmea = g_strndup ((const char *) data + sizeof (GpsUtcTime),
+                                        length - sizeof (GpsUtcTime));
+            break;
+            case HAL_TRACE_CAPABILITIES:
+            memcpy (&fake.capabilities, data, sizeof (uint32_t));
+            /* fall through */
+            default:
+            g_free (record);
+            continue;
+        }
+
+        /* keep the recorded spacing, the first record of a session may
+         * follow the last one of the previous session by hours */
+        if (previous && time > previous_time) {
+            previous->delay = MIN (time - previous_time, 10 * G_USEC_PER_SEC) / speed;
+        }
+        previous = record;
+        previous_time = time;
+        g_ptr_array_add (records, record);
+    }
+
+    if (records->len == 0) {
+        g_ptr_array_free (records, TRUE);
+        records = NULL;
+    }
+    return records;
+}
+
+/* Adds silence after the last record when a pass has less than
+ * FAKE_MIN_PASS, the replay loops */
+static void
+pad_records (GPtrArray *records)
+{
+    FakeRecord *last = g_ptr_array_index (records, records->len - 1);
+    gint64 total = 0;
+    guint i;
+
+    for (i = 0; i < records->len; i++) {
+        total += ((FakeRecord *) g_ptr_array_index (records, i))->delay;
+    }
+    if (total < FAKE_MIN_PASS) {
+        last->delay += FAKE_MIN_PASS - total;
+    }
+}
+
+#if ANDROID_VERSION_MAJOR>=5
+
+/* GPS_GEOFENCING_INTERFACE, the fences are evaluated against the replayed
+ * fixes, the engine need not be started */
+
+static FakeFence *
+fake_fence_lookup_locked (int32_t id)
+{
+    guint i;
+
+    for (i = 0; i < fake.n_fences; i++) {
+        if (fake.fences[i].id == id) {
+            return &fake.fences[i];
+        }
+    }
+    return NULL;
+}
+
+/* From the replay thread */
+static void
+fake_geofence_update (GpsLocation *location)
+{
+    struct {
+        int32_t id;
+        int32_t transition;
+    } events[FAKE_MAX_FENCES];
+    guint n_events = 0;
+    guint i;
+
+    if (!(location->flags & GPS_LOCATION_HAS_LAT_LONG)) {
+        return;
+    }
+
+    pthread_mutex_lock (&fake.lock);
+    for (i = 0; i < fake.n_fences; i++) {
+        FakeFence *fence = &fake.fences[i];
+        int transition;
+
+        if (fence->paused) {
+            continue;
+        }
+        transition = geofence_distance (location->latitude, location->longitude,
+                                        fence->latitude, fence->longitude) <= fence->radius ?
+                     GPS_GEOFENCE_ENTERED : GPS_GEOFENCE_EXITED;
+        if (transition == fence->last) {
+            continue;
+        }
+        fence->last = transition;
+        if (fence->monitor & transition) {
+            events[n_events].id = fence->id;
+            events[n_events].transition = transition;
+            n_events++;
+        }
+    }
+    pthread_mutex_unlock (&fake.lock);
+
+    for (i = 0; i < n_events; i++) {
+        fake.geofence_callbacks->geofence_transition_callback (events[i].id, location,
+                                                               events[i].transition,
+                                                               location->timestamp);
+    }
+}
+
+static void
+fake_geofence_init (GpsGeofenceCallbacks *callbacks)
+{
+    fake.geofence_callbacks = callbacks;
+    callbacks->geofence_status_callback (GPS_GEOFENCE_AVAILABLE, NULL);
+}
+
+static void
+fake_geofence_add (int32_t geofence_id, double latitude, double longitude,
+                   double radius_meters, int last_transition,
+                   int monitor_transitions, int notification_responsiveness_ms,
+                   int unknown_timer_ms)
+{
+    int32_t status = GPS_GEOFENCE_OPERATION_SUCCESS;
+    FakeFence *fence;
+
+    pthread_mutex_lock (&fake.lock);
+    if (fake_fence_lookup_locked (geofence_id)) {
+        status = GPS_GEOFENCE_ERROR_ID_EXISTS;
+    }
+    else if (fake.n_fences == FAKE_MAX_FENCES) {
+        status = GPS_GEOFENCE_ERROR_TOO_MANY_GEOFENCES;
+    }
+    else {
+        fence = &fake.fences[fake.n_fences++];
+        fence->id = geofence_id;
+        fence->latitude = latitude;
+        fence->longitude = longitude;
+        fence->radius = radius_meters;
+        fence->monitor = monitor_transitions;
+        fence->last = last_transition;
+        fence->paused = FALSE;
+        /* replay for it */
+        pthread_cond_broadcast (&fake.cond);
+    }
+    pthread_mutex_unlock (&fake.lock);
+
+    fake.geofence_callbacks->geofence_add_callback (geofence_id, status);
+}
+
+static void
+fake_geofence_pause (int32_t geofence_id)
+{
+    int32_t status = GPS_GEOFENCE_ERROR_ID_UNKNOWN;
+    FakeFence *fence;
+
+    pthread_mutex_lock (&fake.lock);
+    fence = fake_fence_lookup_locked (geofence_id);
+    if (fence) {
+        fence->paused = TRUE;
+        status = GPS_GEOFENCE_OPERATION_SUCCESS;
+    }
+    pthread_mutex_unlock (&fake.lock);
+
+    fake.geofence_callbacks->geofence_pause_callback (geofence_id, status);
+}
+
+static void
+fake_geofence_resume (int32_t geofence_id, int monitor_transitions)
+{
+    int32_t status = GPS_GEOFENCE_ERROR_ID_UNKNOWN;
+    FakeFence *fence;
+
+    pthread_mutex_lock (&fake.lock);
+    fence = fake_fence_lookup_locked (geofence_id);
+    if (fence) {
+        fence->paused = FALSE;
+        fence->monitor = monitor_transitions;
+        status = GPS_GEOFENCE_OPERATION_SUCCESS;
+        pthread_cond_broadcast (&fake.cond);
+    }
+    pthread_mutex_unlock (&fake.lock);
+
+    fake.geofence_callbacks->geofence_resume_callback (geofence_id, status);
+}
+
+static void
+fake_geofence_remove (int32_t geofence_id)
+{
+    int32_t status = GPS_GEOFENCE_ERROR_ID_UNKNOWN;
+    FakeFence *fence;
+
+    pthread_mutex_lock (&fake.lock);
+    fence = fake_fence_lookup_locked (geofence_id);
+    if (fence) {
+        *fence = fake.fences[--fake.n_fences];
+        status = GPS_GEOFENCE_OPERATION_SUCCESS;
+    }
+    pthread_mutex_unlock (&fake.lock);
+
+    fake.geofence_callbacks->geofence_remove_callback (geofence_id, status);
+}
+
+static const GpsGeofencingInterface fake_geofencing_interface = {
+    sizeof (GpsGeofencingInterface),
+    fake_geofence_init,
+    fake_geofence_add,
+    fake_geofence_pause,
+    fake_geofence_resume,
+    fake_geofence_remove,
+};
+
+/* FlpLocationInterface, the replayed fixes are batched at the batching
+ * period until the batch is flushed or fills up */
+
+static void
+fake_flp_deliver (FlpLocation *locations, guint n_locations)
+{
+    FlpLocation *pointers[FAKE_FLP_BATCH_SIZE];
+    guint i;
+
+    for (i = 0; i < n_locations; i++) {
+        pointers[i] = &locations[i];
+    }
+    fake.flp_callbacks->acquire_wakelock_cb ();
+    fake.flp_callbacks->location_cb (n_locations, pointers);
+    fake.flp_callbacks->release_wakelock_cb ();
+}
+
+/* From the replay thread */
+static void
+fake_flp_append (GpsLocation *location)
+{
+    FlpLocation full[FAKE_FLP_BATCH_SIZE];
+    FlpLocation *entry;
+    guint n_full = 0;
+
+    pthread_mutex_lock (&fake.lock);
+    if (!fake.batching) {
+        pthread_mutex_unlock (&fake.lock);
+        return;
+    }
+    if (fake.batch_time &&
+        (location->timestamp - fake.batch_time) * 1000000 < fake.batch_options.period_ns) {
+        pthread_mutex_unlock (&fake.lock);
+        return;
+    }
+    fake.batch_time = location->timestamp;
+    if (fake.batch_len == FAKE_FLP_BATCH_SIZE) {
+        /* the FIFO overwrites its oldest fix unless it wakes up when full */
+        memmove (fake.batch, fake.batch + 1, (FAKE_FLP_BATCH_SIZE - 1) * sizeof (FlpLocation));
+        fake.batch_len--;
+    }
+    entry = &fake.batch[fake.batch_len++];
+    entry->size = sizeof (FlpLocation);
+    entry->flags = location->flags;
+    entry->latitude = location->latitude;
+    entry->longitude = location->longitude;
+    entry->altitude = location->altitude;
+    entry->speed = location->speed;
+    entry->bearing = location->bearing;
+    entry->accuracy = location->accuracy;
+    entry->timestamp = location->timestamp;
+    entry->sources_used = FLP_TECH_MASK_GNSS;
+    if (fake.batch_len == FAKE_FLP_BATCH_SIZE &&
+        (fake.batch_options.flags & FLP_BATCH_WAKEUP_ON_FIFO_FULL)) {
+        memcpy (full, fake.batch, sizeof (full));
+        n_full = fake.batch_len;
+        fake.batch_len = 0;
+    }
+    pthread_mutex_unlock (&fake.lock);
+
+    if (n_full) {
+        fake_flp_deliver (full, n_full);
+    }
+}
+
+static int
+fake_flp_init (FlpCallbacks *callbacks)
+{
+    fake.flp_callbacks = callbacks;
+    return FLP_RESULT_SUCCESS;
+}
+
+static int
+fake_flp_get_batch_size (void)
+{
+    return FAKE_FLP_BATCH_SIZE;
+}
+
+static int
+fake_flp_update_batching_options (int id, FlpBatchOptions *options)
+{
+    pthread_mutex_lock (&fake.lock);
+    fake.batch_options = *options;
+    pthread_mutex_unlock (&fake.lock);
+    return FLP_RESULT_SUCCESS;
+}
+
+static int
+fake_flp_start_batching (int id, FlpBatchOptions *options)
+{
+    pthread_mutex_lock (&fake.lock);
+    fake.batching = TRUE;
+    fake.batch_options = *options;
+    fake.batch_len = 0;
+    fake.batch_time = 0;
+    /* replay for it */
+    pthread_cond_broadcast (&fake.cond);
+    pthread_mutex_unlock (&fake.lock);
+    return FLP_RESULT_SUCCESS;
+}
+
+static int
+fake_flp_stop_batching (int id)
+{
+    pthread_mutex_lock (&fake.lock);
+    fake.batching = FALSE;
+    fake.batch_len = 0;
+    pthread_mutex_unlock (&fake.lock);
+    return FLP_RESULT_SUCCESS;
+}
+
+static void
+fake_flp_cleanup (void)
+{
+    fake_flp_stop_batching (0);
+}
+
+/* The last fixes of the batch, which keeps them */
+static void
+fake_flp_get_batched_location (int last_n_locations)
+{
+    FlpLocation last[FAKE_FLP_BATCH_SIZE];
+    guint n;
+
+    pthread_mutex_lock (&fake.lock);
+    n = MIN ((guint) MAX (last_n_locations, 0), fake.batch_len);
+    memcpy (last, fake.batch + fake.batch_len - n, n * sizeof (FlpLocation));
+    pthread_mutex_unlock (&fake.lock);
+
+    if (n) {
+        fake_flp_deliver (last, n);
+    }
+}
+
+static int
+fake_flp_inject_location (FlpLocation *location)
+{
+    return FLP_RESULT_SUCCESS;
+}
+
+static const void *
+fake_flp_get_extension (const char *name)
+{
+    return NULL;
+}
+
+static void
+fake_flp_flush_batched_locations (void)
+{
+    FlpLocation all[FAKE_FLP_BATCH_SIZE];
+    guint n;
+
+    pthread_mutex_lock (&fake.lock);
+    n = fake.batch_len;
+    memcpy (all, fake.batch, n * sizeof (FlpLocation));
+    fake.batch_len = 0;
+    pthread_mutex_unlock (&fake.lock);
+
+    if (n) {
+        fake_flp_deliver (all, n);
+    }
+}
+
+static const FlpLocationInterface fake_flp_interface = {
+    sizeof (FlpLocationInterface),
+    fake_flp_init,
+    fake_flp_get_batch_size,
+    fake_flp_start_batching,
+    fake_flp_update_batching_options,
+    fake_flp_stop_batching,
+    fake_flp_cleanup,
+    fake_flp_get_batched_location,
+    fake_flp_inject_location,
+    fake_flp_get_extension,
+    fake_flp_flush_batched_locations,
+};
+
+/* GPS_MEASUREMENT_INTERFACE, one measurement per satellite of each SV
+ * report while somebody listens */
+
+static GpsMeasurementCallbacks *
+fake_measurement_callbacks (void)
+{
+    GpsMeasurementCallbacks *callbacks;
+
+    pthread_mutex_lock (&fake.lock);
+    callbacks = fake.measurement_callbacks;
+    pthread_mutex_unlock (&fake.lock);
+    return callbacks;
+}
+
+static void
+fake_measurement_report (const GpsSvStatus *sv_status)
+{
+    GpsMeasurementCallbacks *callbacks = fake_measurement_callbacks ();
+    GpsData *data = &fake.gps_data;
+    int i;
+
+    if (!callbacks || !callbacks->measurement_callback) {
+        return;
+    }
+
+    memset (data, 0, sizeof (GpsData));
+    data->size = sizeof (GpsData);
+    data->clock.size = sizeof (GpsClock);
+    data->clock.time_ns = g_get_monotonic_time () * 1000;
+    data->measurement_count = MIN (sv_status->num_svs, GPS_MAX_MEASUREMENT);
+    for (i = 0; i < data->measurement_count; i++) {
+        const GpsSvInfo *sv = &sv_status->sv_list[i];
+        GpsMeasurement *m = &data->measurements[i];
+
+        m->size = sizeof (GpsMeasurement);
+        m->prn = sv->prn;
+        m->c_n0_dbhz = sv->snr;
+        m->elevation_deg = sv->elevation;
+        m->azimuth_deg = sv->azimuth;
+        m->used_in_fix = sv->prn >= 1 && sv->prn <= 32 &&
+                         (sv_status->used_in_fix_mask & (1u << (sv->prn - 1)));
+    }
+    callbacks->measurement_callback (data);
+}
+
+#if ANDROID_VERSION_MAJOR>=7
+static void
+fake_measurement_report_gnss (const GnssSvStatus *sv_status)
+{
+    GpsMeasurementCallbacks *callbacks = fake_measurement_callbacks ();
+    GnssData *data = &fake.gnss_data;
+    int i;
+
+    if (!callbacks || !callbacks->gnss_measurement_callback) {
+        return;
+    }
+
+    memset (data, 0, sizeof (GnssData));
+    data->size = sizeof (GnssData);
+    data->clock.size = sizeof (GnssClock);
+    data->clock.time_ns = g_get_monotonic_time () * 1000;
+    data->measurement_count = MIN (sv_status->num_svs, GNSS_MAX_MEASUREMENT);
+    for (i = 0; i < data->measurement_count; i++) {
+        const GnssSvInfo *sv = &sv_status->gnss_sv_list[i];
+        GnssMeasurement *m = &data->measurements[i];
+
+        m->size = sizeof (GnssMeasurement);
+        m->svid = sv->svid;
+        m->constellation = sv->constellation;
+        m->c_n0_dbhz = sv->c_n0_dbhz;
+    }
+    callbacks->gnss_measurement_callback (data);
+}
+#endif
+
+static int
+fake_measurement_init (GpsMeasurementCallbacks *callbacks)
+{
+    int status = GPS_MEASUREMENT_OPERATION_SUCCESS;
+
+    pthread_mutex_lock (&fake.lock);
+    if (fake.measurement_callbacks) {
+        status = GPS_MEASUREMENT_ERROR_ALREADY_INIT;
+    }
+    else {
+        fake.measurement_callbacks = callbacks;
+    }
+    pthread_mutex_unlock (&fake.lock);
+    return status;
+}
+
+static void
+fake_measurement_close (void)
+{
+    pthread_mutex_lock (&fake.lock);
+    fake.measurement_callbacks = NULL;
+    pthread_mutex_unlock (&fake.lock);
+}
+
+static const GpsMeasurementInterface fake_measurement_interface = {
+    sizeof (GpsMeasurementInterface),
+    fake_measurement_init,
+    fake_measurement_close,
+};
+
+#endif
+
+/* Replay thread, created through the HAL create_thread callback */
+
+static void
+report_status (GpsStatusValue value)
+{
+    GpsStatus status;
+
+    status.size = sizeof (GpsStatus);
+    status.status = value;
+    fake.callbacks->status_cb (&status);
+}
+
+/* While the engine is off only the extensions see the fixes */
+static void
+deliver_record (FakeRecord *record, gboolean engine_on)
+{
+    static const char stamp_types[FAKE_RECORD_WAIT] = { 'T', 'S', 'N', 'L', 'G' };
+    GpsLocation location;
+    gint64 now = g_get_monotonic_time ();
+
+    if (record->type == FAKE_RECORD_LOCATION) {
+        location = record->u.location;
+        location.timestamp = g_get_real_time () / 1000;
+#if ANDROID_VERSION_MAJOR>=5
+        fake_geofence_update (&location);
+        fake_flp_append (&location);
+#endif
+    }
+    if (!engine_on) {
+        return;
+    }
+
+    switch (record->type)
+    {
+        case FAKE_RECORD_STATUS:
+        report_status (record->u.status);
+        break;
+        case FAKE_RECORD_SV_STATUS:
+        fake.callbacks->sv_status_cb (&record->u.sv_status);
+#if ANDROID_VERSION_MAJOR>=5
+        fake_measurement_report (&record->u.sv_status);
+#endif
+        break;
+#if ANDROID_VERSION_MAJOR>=7
+        case FAKE_RECORD_GNSS_SV_STATUS:
+        fake.callbacks->gnss_sv_status_cb (&record->u.gnss_sv_status);
+        fake_measurement_report_gnss (&record->u.gnss_sv_status);
+        break;
+#endif
+        case FAKE_RECORD_NMEA:
+        fake.callbacks->nmea_cb (g_get_real_time () / 1000, record->u.nmea,
+                                 strlen (record->u.nmea));
+        break;
+        case FAKE_RECORD_LOCATION:
+        fake.callbacks->location_cb (&location);
+        break;
+        default:
+        return;
+    }
+
+    if (fake.stamps) {
+        fprintf (fake.stamps, "%c %u %" G_GINT64_FORMAT "\n",
+                 stamp_types[record->type], fake.delivered[record->type]++, now);
+    }
+}
+
+static void
+timespec_add_us (struct timespec *ts, gint64 us)
+{
+    ts->tv_sec += us / G_USEC_PER_SEC;
+    ts->tv_nsec += (us % G_USEC_PER_SEC) * 1000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+static gboolean
+fake_gps_replaying_locked (void)
+{
+#if ANDROID_VERSION_MAJOR>=5
+    guint i;
+
+    /* the hal fences and the FLP batch are fed with the engine off */
+    if (fake.batching) {
+        return TRUE;
+    }
+    for (i = 0; i < fake.n_fences; i++) {
+        if (!fake.fences[i].paused) {
+            return TRUE;
+        }
+    }
+#endif
+    return fake.started;
+}
+
+static void
+fake_gps_thread (void *arg)
+{
+    struct timespec deadline;
+    struct timespec now;
+    gboolean running = FALSE;
+    gboolean replaying = FALSE;
+    guint index = 0;
+
+    pthread_mutex_lock (&fake.lock);
+    while (!fake.quit) {
+        FakeRecord *record;
+
+        if (fake.started != running) {
+            running = fake.started;
+            pthread_mutex_unlock (&fake.lock);
+            report_status (running ? GPS_STATUS_ENGINE_ON : GPS_STATUS_SESSION_END);
+            report_status (running ? GPS_STATUS_SESSION_BEGIN : GPS_STATUS_ENGINE_OFF);
+            pthread_mutex_lock (&fake.lock);
+            continue;
+        }
+        if (!fake_gps_replaying_locked ()) {
+            replaying = FALSE;
+            pthread_cond_wait (&fake.cond, &fake.lock);
+            continue;
+        }
+        if (!replaying) {
+            replaying = TRUE;
+            clock_gettime (CLOCK_MONOTONIC, &deadline);
+        }
+
+        record = g_ptr_array_index (fake.records, index);
+        index = (index + 1) % fake.records->len;
+
+        pthread_mutex_unlock (&fake.lock);
+        deliver_record (record, running);
+        pthread_mutex_lock (&fake.lock);
+
+        if (!record->delay) {
+            continue;
+        }
+        /* sleep on absolute deadlines so the rate does not drift, but do
+         * not try to catch up after falling far behind */
+        timespec_add_us (&deadline, record->delay);
+        clock_gettime (CLOCK_MONOTONIC, &now);
+        if (now.tv_sec > deadline.tv_sec + 1) {
+            deadline = now;
+        }
+        while (!fake.quit && fake.started == running && fake_gps_replaying_locked () &&
+               pthread_cond_timedwait (&fake.cond, &fake.lock, &deadline) != ETIMEDOUT);
+    }
+    pthread_mutex_unlock (&fake.lock);
+
+    if (running) {
+        report_status (GPS_STATUS_SESSION_END);
+        report_status (GPS_STATUS_ENGINE_OFF);
+    }
+}
+
+/* GpsInterface */
+
+static void
+fake_gps_set_state (gboolean started, gboolean quit)
+{
+    pthread_mutex_lock (&fake.lock);
+    fake.started = started;
+    fake.quit = quit;
+    pthread_cond_broadcast (&fake.cond);
+    pthread_mutex_unlock (&fake.lock);
+}
+
+static int
+fake_gps_init (GpsCallbacks *callbacks)
+{
+    pthread_condattr_t attr;
+
+    fake.callbacks = callbacks;
+    fake.started = FALSE;
+    fake.quit = FALSE;
+
+    pthread_condattr_init (&attr);
+    pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+    pthread_cond_init (&fake.cond, &attr);
+    pthread_condattr_destroy (&attr);
+
+    callbacks->set_capabilities_cb (fake.capabilities);
+
+    fake.thread = callbacks->create_thread_cb ("fake-gps", fake_gps_thread, NULL);
+    if (!fake.thread) {
+        syslog(LOG_ERR, "Cannot create fake GPS thread");
+        return -1;
+    }
+    return 0;
+}
+
+static int
+fake_gps_start (void)
+{
+    fake_gps_set_state (TRUE, FALSE);
+    return 0;
+}
+
+static int
+fake_gps_stop (void)
+{
+    fake_gps_set_state (FALSE, FALSE);
+    return 0;
+}
+
+static void
+fake_gps_cleanup (void)
+{
+    if (!fake.thread) {
+        return;
+    }
+    fake_gps_set_state (FALSE, TRUE);
+    pthread_join (fake.thread, NULL);
+    fake.thread = 0;
+    pthread_cond_destroy (&fake.cond);
+
+    if (fake.stamps) {
+        fclose (fake.stamps);
+        fake.stamps = NULL;
+    }
+}
+
+static int
+fake_gps_inject_time (GpsUtcTime time, int64_t time_reference, int uncertainty)
+{
+    return 0;
+}
+
+static int
+fake_gps_inject_location (double latitude, double longitude, float accuracy)
+{
+    return 0;
+}
+
+static void
+fake_gps_delete_aiding_data (GpsAidingData flags)
+{
+}
+
+static int
+fake_gps_set_position_mode (GpsPositionMode mode,
+                            GpsPositionRecurrence recurrence,
+                            uint32_t min_interval,
+                            uint32_t preferred_accuracy,
+                            uint32_t preferred_time)
+{
+    /* the script decides the rate */
+    return 0;
+}
+
+static const void *
+fake_gps_get_extension (const char *name)
+{
+#if ANDROID_VERSION_MAJOR>=5
+    if (strcmp (name, GPS_GEOFENCING_INTERFACE) == 0) {
+        return &fake_geofencing_interface;
+    }
+    if (strcmp (name, GPS_MEASUREMENT_INTERFACE) == 0) {
+        return &fake_measurement_interface;
+    }
+#endif
+    return NULL;
+}
+
+static const GpsInterface fake_gps_interface = {
+    sizeof (GpsInterface),
+    fake_gps_init,
+    fake_gps_start,
+    fake_gps_stop,
+    fake_gps_cleanup,
+    fake_gps_inject_time,
+    fake_gps_inject_location,
+    fake_gps_delete_aiding_data,
+    fake_gps_set_position_mode,
+    fake_gps_get_extension,
+};
+
+const GpsInterface *
+fake_gps_get_interface (const char *path, double rate, double speed,
+                        const char *stamps)
+{
+    HalTraceReader *reader;
+
+    if (!fake.records) {
+        reader = hal_trace_reader_open (path);
+        if (reader) {
+            fake.records = load_trace (reader, speed > 0 ? speed : 1.0);
+            hal_trace_reader_close (reader);
+            if (!fake.records) {
+                syslog(LOG_ERR, "HAL trace %s has no records", path);
+            }
+        }
+        else {
+            fake.records = load_script (path, rate);
+#if ANDROID_VERSION_MAJOR>=5
+            fake.capabilities = GPS_CAPABILITY_GEOFENCING | GPS_CAPABILITY_MEASUREMENTS;
+#endif
+        }
+        if (!fake.records) {
+            return NULL;
+        }
+        pad_records (fake.records);
+    }
+    if (stamps && !fake.stamps) {
+        fake.stamps = fopen (stamps, "w");
+        if (!fake.stamps) {
+            syslog(LOG_ERR, "Cannot open fake GPS stamp file %s", stamps);
+            return NULL;
+        }
+        /* lines are written after the callback returned, a line buffer
+         * keeps them if the provider does not exit cleanly */
+        setvbuf (fake.stamps, NULL, _IOLBF, 0);
+    }
+    syslog(LOG_INFO, "Replaying %s (%u records)", path,
+           fake.records->len);
+
+    return &fake_gps_interface;
+}
+
+#if ANDROID_VERSION_MAJOR>=5
+const FlpLocationInterface *
+fake_flp_get_interface (void)
+{
+    return &fake_flp_interface;
+}
+#endif
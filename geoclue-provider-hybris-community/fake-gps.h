@@ -0,0 +1,65 @@
+/*
+ * Geoclue-provider-hybris
+ * fake-gps.h - Scripted GPS HAL for testing without hardware
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef FAKE_GPS_H
+#define FAKE_GPS_H
+
+#include <android-config.h>
+#include <hardware/gps.h>
+#if ANDROID_VERSION_MAJOR>=5
+#include <hardware/fused_location.h>
+#endif
+
+/* Returns a GpsInterface replaying the script or HAL trace (see
+ * hal-trace.h) at path, or NULL if it cannot be loaded. rate overrides the
+ * fix rate (Hz) of a script when > 0. A trace is replayed with its
+ * recorded timing divided by speed when > 0, gaps are capped to 10 s.
+ * When stamps is set, a "<L|S|G|T|N> <n> <us>" line is appended to
+ * that file after the n-th location/SV/GNSS SV/status/NMEA record of the
+ * run has been delivered, us being the CLOCK_MONOTONIC time in
+ * microseconds just before the callback was invoked.
+ *
+ * Script format, one record per line, '#' starts a comment:
+ *   rate <hz>                         fix rate for the following records
+ *   status <none|session_begin|session_end|engine_on|engine_off>
+ *   sv <prn>:<snr>:<elevation>:<azimuth>:<used> ...
+ *   gnss <constellation>:<svid>:<c/n0>:<elevation>:<azimuth>:<used> ...
+ *                                     GNSS SV report, Android 7 and later
+ *   nmea <sentence>
+ *   location <lat> <lon> <alt> <speed> <bearing> <accuracy>
+ *   wait <ms>
+ * Records are delivered while the engine is started, each location ends
+ * a fix epoch and is followed by 1/rate seconds of silence. The script
+ * loops when it reaches its end, a pass lasts at least a second.
+ *
+ * The geofencing and measurement extensions and the FLP interface work on
+ * the replayed records: hal fences and FLP batches are fed the fixes while
+ * the engine is stopped, and each SV report is also reported as one
+ * measurement per satellite.
+ */
+const GpsInterface *fake_gps_get_interface (const char *path, double rate,
+                                           double speed, const char *stamps);
+
+#if ANDROID_VERSION_MAJOR>=5
+const FlpLocationInterface *fake_flp_get_interface (void);
+#endif
+
+#endif /* FAKE_GPS_H */
@@ -0,0 +1,760 @@
+/*
+ * Geoclue-provider-hybris
+ * geoclue-hybris-bench.c - End-to-end benchmark of the provider
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+/* Runs the provider against the fake GPS HAL on a private bus (start it
+ * with dbus-run-session, see "make bench") and measures:
+ *  - HAL callback to signal latency of PositionChanged, VelocityChanged
+ *    and SatelliteChanged, from the callback stamps of the fake HAL
+ *  - CPU time of the provider per fix
+ *  - the highest fix rate at which every fix is still delivered
+ *  - GetPosition/GetSatellite throughput with concurrent clients
+ * The benchmark also plays connman, so that the provider enables the GPS.
+ *
+ * With --warm-start it only checks that GetPosition answers from the state
+ * cache after a restart, before the engine has a fix, and exits with 0 when
+ * it does. "make check" runs that.
+ *
+ * Each fix n of a run is encoded in the data: the location has altitude
+ * and speed n, the first satellite has azimuth n % 360 and elevation
+ * n / 360 % 90.
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <dbus/dbus.h>
+
+#define PROVIDER_SERVICE "org.freedesktop.Geoclue.Providers.Hybris"
+#define PROVIDER_PATH "/org/freedesktop/Geoclue/Providers/Hybris"
+
+enum {
+    KIND_POSITION,
+    KIND_VELOCITY,
+    KIND_SATELLITE,
+    N_KINDS
+};
+
+static const char *kind_names[N_KINDS] = {
+    "PositionChanged",
+    "VelocityChanged",
+    "SatelliteChanged",
+};
+
+typedef struct {
+    const char *provider;
+    char *workdir;
+    /* the state cache of the provider, NULL for none */
+    char *state_file;
+    DBusConnection *conn;
+    pid_t pid;
+    guint n_fixes;
+    /* receive time of signal n, 0 if not received */
+    gint64 *received[N_KINDS];
+    guint n_received[N_KINDS];
+} Bench;
+
+static gint64
+now_us (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (gint64) ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+/* Private bus handling */
+
+static void
+record_signal (Bench *bench, int kind, gint64 n, gint64 when)
+{
+    if (n < 0 || n >= bench->n_fixes || bench->received[kind][n]) {
+        return;
+    }
+    bench->received[kind][n] = when;
+    bench->n_received[kind]++;
+}
+
+static void
+handle_satellite_changed (Bench *bench, DBusMessage *msg, gint64 when)
+{
+    DBusMessageIter iter, array, sat;
+    dbus_int32_t values[4];
+    int i;
+
+    /* (i timestamp, i used, i visible, ai used_prn, a(iiii) sat_info) */
+    dbus_message_iter_init (msg, &iter);
+    for (i = 0; i < 4; i++) {
+        dbus_message_iter_next (&iter);
+    }
+    if (dbus_message_iter_get_arg_type (&iter) != DBUS_TYPE_ARRAY) {
+        return;
+    }
+    dbus_message_iter_recurse (&iter, &array);
+    if (dbus_message_iter_get_arg_type (&array) != DBUS_TYPE_STRUCT) {
+        return;
+    }
+    dbus_message_iter_recurse (&array, &sat);
+    for (i = 0; i < 4; i++) {
+        dbus_message_iter_get_basic (&sat, &values[i]);
+        dbus_message_iter_next (&sat);
+    }
+    /* prn, azimuth, elevation, snr */
+    record_signal (bench, KIND_SATELLITE, values[2] * 360 + values[1], when);
+}
+
+static DBusHandlerResult
+bench_filter (DBusConnection *conn, DBusMessage *msg, void *user_data)
+{
+    Bench *bench = user_data;
+    gint64 when = now_us ();
+    dbus_int32_t fields, timestamp;
+    double a, b, c;
+
+    if (dbus_message_is_signal (msg, "org.freedesktop.Geoclue.Position",
+                                "PositionChanged")) {
+        if (dbus_message_get_args (msg, NULL,
+                                   DBUS_TYPE_INT32, &fields,
+                                   DBUS_TYPE_INT32, &timestamp,
+                                   DBUS_TYPE_DOUBLE, &a,
+                                   DBUS_TYPE_DOUBLE, &b,
+                                   DBUS_TYPE_DOUBLE, &c,
+                                   DBUS_TYPE_INVALID)) {
+            record_signal (bench, KIND_POSITION, (gint64) c, when);
+        }
+        return DBUS_HANDLER_RESULT_HANDLED;
+    }
+    if (dbus_message_is_signal (msg, "org.freedesktop.Geoclue.Velocity",
+                                "VelocityChanged")) {
+        if (dbus_message_get_args (msg, NULL,
+                                   DBUS_TYPE_INT32, &fields,
+                                   DBUS_TYPE_INT32, &timestamp,
+                                   DBUS_TYPE_DOUBLE, &a,
+                                   DBUS_TYPE_DOUBLE, &b,
+                                   DBUS_TYPE_DOUBLE, &c,
+                                   DBUS_TYPE_INVALID)) {
+            record_signal (bench, KIND_VELOCITY, (gint64) (a + 0.5), when);
+        }
+        return DBUS_HANDLER_RESULT_HANDLED;
+    }
+    if (dbus_message_is_signal (msg, "org.freedesktop.Geoclue.Satellite",
+                                "SatelliteChanged")) {
+        handle_satellite_changed (bench, msg, when);
+        return DBUS_HANDLER_RESULT_HANDLED;
+    }
+
+    /* pretend to be connman with GPS enabled */
+    if (dbus_message_is_method_call (msg, "net.connman.Technology", "GetProperties")) {
+        DBusMessage *reply = dbus_message_new_method_return (msg);
+        DBusMessageIter iter, dict, entry, variant;
+        const char *key = "Powered";
+        dbus_bool_t powered = TRUE;
+
+        dbus_message_iter_init_append (reply, &iter);
+        dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY, "{sv}", &dict);
+        dbus_message_iter_open_container (&dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+        dbus_message_iter_append_basic (&entry, DBUS_TYPE_STRING, &key);
+        dbus_message_iter_open_container (&entry, DBUS_TYPE_VARIANT, "b", &variant);
+        dbus_message_iter_append_basic (&variant, DBUS_TYPE_BOOLEAN, &powered);
+        dbus_message_iter_close_container (&entry, &variant);
+        dbus_message_iter_close_container (&dict, &entry);
+        dbus_message_iter_close_container (&iter, &dict);
+        dbus_connection_send (conn, reply, NULL);
+        dbus_message_unref (reply);
+        return DBUS_HANDLER_RESULT_HANDLED;
+    }
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+static DBusConnection *
+bench_connect (Bench *bench)
+{
+    DBusConnection *conn;
+    DBusError error;
+
+    dbus_error_init (&error);
+    conn = dbus_bus_get_private (DBUS_BUS_SESSION, &error);
+    if (!conn) {
+        fprintf (stderr, "Cannot connect to the bus: %s\n", error.message);
+        fprintf (stderr, "Run the benchmark under dbus-run-session\n");
+        exit (1);
+    }
+    dbus_connection_set_exit_on_disconnect (conn, FALSE);
+
+    if (bench) {
+        if (dbus_bus_request_name (conn, "net.connman", 0, &error) !=
+            DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER) {
+            fprintf (stderr, "Cannot own net.connman on the private bus\n");
+            exit (1);
+        }
+        dbus_bus_add_match (conn, "type='signal',sender='" PROVIDER_SERVICE "'", &error);
+        dbus_connection_add_filter (conn, bench_filter, bench, NULL);
+    }
+    return conn;
+}
+
+static void
+bench_iterate (Bench *bench, int timeout_ms)
+{
+    dbus_connection_read_write_dispatch (bench->conn, timeout_ms);
+}
+
+static gboolean
+call_provider (DBusConnection *conn, const char *interface, const char *method)
+{
+    DBusMessage *msg, *reply;
+    DBusError error;
+
+    msg = dbus_message_new_method_call (PROVIDER_SERVICE, PROVIDER_PATH,
+                                        interface, method);
+    dbus_error_init (&error);
+    reply = dbus_connection_send_with_reply_and_block (conn, msg, 5000, &error);
+    dbus_message_unref (msg);
+    if (!reply) {
+        dbus_error_free (&error);
+        return FALSE;
+    }
+    dbus_message_unref (reply);
+    return TRUE;
+}
+
+/* Provider process */
+
+/* The files of the provider, removed when the benchmark exits */
+static char *workdir;
+
+static void
+remove_workdir (void)
+{
+    DIR *dir = opendir (workdir);
+    struct dirent *entry;
+
+    if (dir) {
+        while ((entry = readdir (dir))) {
+            if (strcmp (entry->d_name, ".") && strcmp (entry->d_name, "..")) {
+                char *path = g_build_filename (workdir, entry->d_name, NULL);
+
+                unlink (path);
+                g_free (path);
+            }
+        }
+        closedir (dir);
+    }
+    rmdir (workdir);
+}
+
+static char *
+write_file (Bench *bench, const char *name, const char *contents)
+{
+    char *path = g_build_filename (bench->workdir, name, NULL);
+
+    if (!g_file_set_contents (path, contents, -1, NULL)) {
+        fprintf (stderr, "Cannot write %s\n", path);
+        exit (1);
+    }
+    return path;
+}
+
+static char *
+write_script (Bench *bench, double rate)
+{
+    GString *script = g_string_new (NULL);
+    char *path;
+    guint n;
+
+    g_string_append_printf (script, "rate %f\n", rate);
+    for (n = 0; n < bench->n_fixes; n++) {
+        g_string_append_printf (script,
+                                "sv 1:40:%u:%u:1 7:35:45:100:1 13:30:30:200:1 22:25:15:300:0\n",
+                                n / 360 % 90, n % 360);
+        g_string_append_printf (script, "location %.7f 24.9 %u.0 %u.0 0.0 5.0\n",
+                                60.0 + n * 1e-6, n, n);
+    }
+    /* do not loop */
+    g_string_append (script, "wait 3600000\n");
+
+    path = write_file (bench, "script", script->str);
+    g_string_free (script, TRUE);
+    return path;
+}
+
+static void
+provider_start (Bench *bench, double rate, guint n_fixes)
+{
+    char *script, *stamps, *config, *contents;
+    const char *address;
+    gint64 deadline;
+    int kind;
+
+    bench->n_fixes = n_fixes;
+    for (kind = 0; kind < N_KINDS; kind++) {
+        g_free (bench->received[kind]);
+        bench->received[kind] = g_new0 (gint64, n_fixes);
+        bench->n_received[kind] = 0;
+    }
+
+    script = write_script (bench, rate);
+    stamps = g_build_filename (bench->workdir, "stamps", NULL);
+    unlink (stamps);
+    /* every fix has to make it out for the latency to be measurable */
+    contents = g_strdup_printf ("[Satellite]\n"
+                                "SnrHysteresis=0\n"
+                                "AngleHysteresis=0\n"
+                                "CoalesceWindow=0\n"
+                                /* exit when the benchmark removes its reference */
+                                "[Lifetime]\n"
+                                "IdleTimeout=0\n"
+                                /* no state from earlier runs unless asked for */
+                                "[State]\n"
+                                "File=%s\n",
+                                bench->state_file ? bench->state_file : "");
+    config = write_file (bench, "geoclue-hybris.conf", contents);
+    g_free (contents);
+
+    address = g_getenv ("DBUS_SESSION_BUS_ADDRESS");
+    bench->pid = fork ();
+    if (bench->pid == 0) {
+        /* connman is looked up on the system bus */
+        setenv ("DBUS_SYSTEM_BUS_ADDRESS", address, 1);
+        setenv ("GEOCLUE_HYBRIS_FAKE_GPS", script, 1);
+        setenv ("GEOCLUE_HYBRIS_FAKE_GPS_STAMPS", stamps, 1);
+        setenv ("GEOCLUE_HYBRIS_CONFIG", config, 1);
+        execl (bench->provider, bench->provider, (char *) NULL);
+        perror ("exec");
+        _exit (1);
+    }
+    g_free (script);
+    g_free (stamps);
+    g_free (config);
+
+    deadline = now_us () + 10 * G_USEC_PER_SEC;
+    while (!dbus_bus_name_has_owner (bench->conn, PROVIDER_SERVICE, NULL)) {
+        if (now_us () > deadline) {
+            fprintf (stderr, "Provider did not show up on the bus\n");
+            exit (1);
+        }
+        bench_iterate (bench, 10);
+    }
+    if (!call_provider (bench->conn, "org.freedesktop.Geoclue", "AddReference")) {
+        fprintf (stderr, "AddReference failed\n");
+        exit (1);
+    }
+}
+
+static void
+provider_stop (Bench *bench)
+{
+    gint64 deadline = now_us () + 5 * G_USEC_PER_SEC;
+    int status;
+
+    call_provider (bench->conn, "org.freedesktop.Geoclue", "RemoveReference");
+    while (waitpid (bench->pid, &status, WNOHANG) == 0) {
+        if (now_us () > deadline) {
+            /* the provider may linger, that is fine for the benchmark */
+            kill (bench->pid, SIGTERM);
+            waitpid (bench->pid, &status, 0);
+            break;
+        }
+        bench_iterate (bench, 10);
+    }
+    bench->pid = 0;
+}
+
+static void
+wait_for_fixes (Bench *bench, double rate)
+{
+    gint64 deadline = now_us () + (gint64) (bench->n_fixes / rate * G_USEC_PER_SEC) +
+                      3 * G_USEC_PER_SEC;
+
+    while (bench->n_received[KIND_POSITION] < bench->n_fixes && now_us () < deadline) {
+        bench_iterate (bench, 10);
+    }
+    /* let trailing velocity and satellite signals arrive */
+    deadline = now_us () + 200000;
+    while (now_us () < deadline) {
+        bench_iterate (bench, 10);
+    }
+}
+
+/* CPU time (utime + stime) of the provider in us */
+static gint64
+provider_cpu_time (Bench *bench)
+{
+    char *path = g_strdup_printf ("/proc/%d/stat", bench->pid);
+    char *contents = NULL;
+    unsigned long utime = 0, stime = 0;
+    char *p;
+
+    if (g_file_get_contents (path, &contents, NULL, NULL) &&
+        (p = strrchr (contents, ')'))) {
+        /* skip state and fields 4-13 */
+        sscanf (p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                &utime, &stime);
+    }
+    g_free (contents);
+    g_free (path);
+
+    return (gint64) (utime + stime) * G_USEC_PER_SEC / sysconf (_SC_CLK_TCK);
+}
+
+/* Latency */
+
+static int
+compare_int64 (const void *a, const void *b)
+{
+    gint64 x = *(const gint64 *) a, y = *(const gint64 *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void
+report_latency (Bench *bench)
+{
+    static const char stamp_types[N_KINDS] = { 'L', 'L', 'S' };
+    char *path = g_build_filename (bench->workdir, "stamps", NULL);
+    char *contents = NULL;
+    gint64 *sent[2];
+    char **lines;
+    int kind, i;
+
+    if (!g_file_get_contents (path, &contents, NULL, NULL)) {
+        fprintf (stderr, "No callback stamps in %s\n", path);
+        g_free (path);
+        return;
+    }
+    g_free (path);
+
+    sent[0] = g_new0 (gint64, bench->n_fixes);
+    sent[1] = g_new0 (gint64, bench->n_fixes);
+    lines = g_strsplit (contents, "\n", -1);
+    for (i = 0; lines[i]; i++) {
+        char type;
+        guint n;
+        gint64 when;
+
+        if (sscanf (lines[i], "%c %u %" G_GINT64_FORMAT, &type, &n, &when) == 3 &&
+            n < bench->n_fixes) {
+            if (type == 'L') {
+                sent[0][n] = when;
+            }
+            else if (type == 'S' || type == 'G') {
+                sent[1][n] = when;
+            }
+        }
+    }
+    g_strfreev (lines);
+    g_free (contents);
+
+    printf ("%-18s %8s %8s %8s %8s %8s %8s\n", "signal", "count", "p50", "p90",
+            "p99", "max", "lost");
+    for (kind = 0; kind < N_KINDS; kind++) {
+        gint64 *from = sent[stamp_types[kind] == 'L' ? 0 : 1];
+        gint64 *latency = g_new (gint64, bench->n_fixes);
+        guint n, count = 0;
+
+        for (n = 0; n < bench->n_fixes; n++) {
+            if (from[n] && bench->received[kind][n]) {
+                latency[count++] = bench->received[kind][n] - from[n];
+            }
+        }
+        if (count) {
+            qsort (latency, count, sizeof (gint64), compare_int64);
+            printf ("%-18s %8u %6" G_GINT64_FORMAT "us %6" G_GINT64_FORMAT "us %6"
+                    G_GINT64_FORMAT "us %6" G_GINT64_FORMAT "us %8u\n",
+                    kind_names[kind], count,
+                    latency[count / 2], latency[count * 9 / 10],
+                    latency[count * 99 / 100], latency[count - 1],
+                    bench->n_fixes - count);
+        }
+        else {
+            printf ("%-18s %8u\n", kind_names[kind], 0);
+        }
+        g_free (latency);
+    }
+    g_free (sent[0]);
+    g_free (sent[1]);
+}
+
+static void
+run_latency (Bench *bench, double rate, guint n_fixes)
+{
+    gint64 cpu;
+
+    printf ("\n== Latency, %u fixes at %.0f Hz\n", n_fixes, rate);
+    provider_start (bench, rate, n_fixes);
+    cpu = provider_cpu_time (bench);
+    wait_for_fixes (bench, rate);
+    cpu = provider_cpu_time (bench) - cpu;
+    provider_stop (bench);
+
+    report_latency (bench);
+    if (bench->n_received[KIND_POSITION]) {
+        printf ("CPU per fix: %" G_GINT64_FORMAT " us\n",
+                cpu / bench->n_received[KIND_POSITION]);
+    }
+}
+
+/* Sustained rate */
+
+static void
+run_max_rate (Bench *bench, const char *rates, double seconds)
+{
+    char **list = g_strsplit (rates, ",", -1);
+    double best = 0;
+    int i;
+
+    printf ("\n== Sustained fix rate, %.0f s per rate\n", seconds);
+    printf ("%10s %10s %10s\n", "rate", "sent", "delivered");
+    for (i = 0; list[i]; i++) {
+        double rate = g_ascii_strtod (list[i], NULL);
+        guint n_fixes;
+
+        if (rate <= 0) {
+            continue;
+        }
+        n_fixes = MAX (1, (guint) (rate * seconds));
+        provider_start (bench, rate, n_fixes);
+        wait_for_fixes (bench, rate);
+        provider_stop (bench);
+
+        printf ("%8.0fHz %10u %10u\n", rate, n_fixes, bench->n_received[KIND_POSITION]);
+        if (bench->n_received[KIND_POSITION] >= n_fixes * 99 / 100) {
+            best = MAX (best, rate);
+        }
+    }
+    g_strfreev (list);
+    printf ("Highest rate with >= 99%% of the fixes delivered: %.0f Hz\n", best);
+}
+
+/* Warm start */
+
+/* Runs the provider for a few fixes, then again without any: GetPosition
+ * has to return the last fix of the first run, with its fields */
+static gboolean
+run_warm_start (Bench *bench)
+{
+    DBusMessage *msg, *reply;
+    dbus_int32_t fields = 0, timestamp;
+    double latitude, longitude, altitude = 0;
+    guint n_fixes = 5;
+    gboolean ok;
+
+    printf ("\n== Warm start\n");
+    bench->state_file = g_build_filename (bench->workdir, "state", NULL);
+    provider_start (bench, 10, n_fixes);
+    wait_for_fixes (bench, 10);
+    provider_stop (bench);
+
+    provider_start (bench, 10, 0);
+    msg = dbus_message_new_method_call (PROVIDER_SERVICE, PROVIDER_PATH,
+                                        "org.freedesktop.Geoclue.Position", "GetPosition");
+    reply = dbus_connection_send_with_reply_and_block (bench->conn, msg, 5000, NULL);
+    dbus_message_unref (msg);
+    /* (i fields, i timestamp, d latitude, d longitude, d altitude, accuracy) */
+    ok = reply && dbus_message_get_args (reply, NULL,
+                                         DBUS_TYPE_INT32, &fields,
+                                         DBUS_TYPE_INT32, &timestamp,
+                                         DBUS_TYPE_DOUBLE, &latitude,
+                                         DBUS_TYPE_DOUBLE, &longitude,
+                                         DBUS_TYPE_DOUBLE, &altitude,
+                                         DBUS_TYPE_INVALID);
+    if (reply) {
+        dbus_message_unref (reply);
+    }
+    provider_stop (bench);
+    g_free (bench->state_file);
+    bench->state_file = NULL;
+
+    /* latitude, longitude and altitude, the altitude of fix n is n */
+    ok = ok && (fields & 7) == 7 && altitude == n_fixes - 1;
+    printf ("GetPosition after a restart: fields %d, altitude %.1f: %s\n",
+            fields, altitude, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+/* Method call throughput */
+
+typedef struct {
+    const char *interface;
+    const char *method;
+    gint64 deadline;
+    guint calls;
+    guint failures;
+} ClientThread;
+
+static void *
+client_thread (void *data)
+{
+    ClientThread *client = data;
+    DBusConnection *conn = bench_connect (NULL);
+
+    while (now_us () < client->deadline) {
+        if (call_provider (conn, client->interface, client->method)) {
+            client->calls++;
+        }
+        else {
+            client->failures++;
+        }
+    }
+    dbus_connection_close (conn);
+    dbus_connection_unref (conn);
+    return NULL;
+}
+
+static void
+run_throughput (Bench *bench, const char *interface, const char *method,
+                guint n_clients, double seconds)
+{
+    ClientThread *clients = g_new0 (ClientThread, n_clients);
+    pthread_t *threads = g_new0 (pthread_t, n_clients);
+    guint calls = 0, failures = 0;
+    gint64 deadline;
+    guint i;
+
+    /* a slow, endless fix stream so the provider has data to return */
+    provider_start (bench, 1, 3600);
+
+    deadline = now_us () + (gint64) (seconds * G_USEC_PER_SEC);
+    for (i = 0; i < n_clients; i++) {
+        clients[i].interface = interface;
+        clients[i].method = method;
+        clients[i].deadline = deadline;
+        pthread_create (&threads[i], NULL, client_thread, &clients[i]);
+    }
+    while (now_us () < deadline) {
+        bench_iterate (bench, 10);
+    }
+    for (i = 0; i < n_clients; i++) {
+        pthread_join (threads[i], NULL);
+        calls += clients[i].calls;
+        failures += clients[i].failures;
+    }
+    provider_stop (bench);
+
+    printf ("%-14s %8u clients %10.0f calls/s %8u failed\n", method, n_clients,
+            calls / seconds, failures);
+    g_free (clients);
+    g_free (threads);
+}
+
+static void
+usage (const char *name)
+{
+    fprintf (stderr,
+             "Usage: %s --provider PATH [options]\n"
+             "  --fixes N        fixes in the latency run (1000)\n"
+             "  --rate HZ        fix rate of the latency run (10)\n"
+             "  --rates LIST     fix rates to probe for the sustained rate (1,10,50,100,200,500)\n"
+             "  --seconds S      duration of each rate probe and throughput run (5)\n"
+             "  --clients N      concurrent clients for the throughput run (4)\n"
+             "  --warm-start     only check GetPosition after a restart\n",
+             name);
+}
+
+int
+main (int argc, char **argv)
+{
+    static const struct option options[] = {
+        { "provider", required_argument, NULL, 'p' },
+        { "fixes", required_argument, NULL, 'f' },
+        { "rate", required_argument, NULL, 'r' },
+        { "rates", required_argument, NULL, 'R' },
+        { "seconds", required_argument, NULL, 's' },
+        { "clients", required_argument, NULL, 'c' },
+        { "warm-start", no_argument, NULL, 'w' },
+        { NULL, 0, NULL, 0 }
+    };
+    Bench bench;
+    const char *rates = "1,10,50,100,200,500";
+    double rate = 10;
+    double seconds = 5;
+    guint n_fixes = 1000;
+    guint n_clients = 4;
+    gboolean warm_start = FALSE;
+    char template[] = "/tmp/geoclue-hybris-bench-XXXXXX";
+    int opt;
+
+    memset (&bench, 0, sizeof (bench));
+    while ((opt = getopt_long (argc, argv, "", options, NULL)) != -1) {
+        switch (opt)
+        {
+            case 'p': bench.provider = optarg; break;
+            case 'f': n_fixes = MAX (1, atoi (optarg)); break;
+            case 'r': rate = g_ascii_strtod (optarg, NULL); break;
+            case 'R': rates = optarg; break;
+            case 's': seconds = g_ascii_strtod (optarg, NULL); break;
+            case 'c': n_clients = MAX (1, atoi (optarg)); break;
+            case 'w': warm_start = TRUE; break;
+            default: usage (argv[0]); return 1;
+        }
+    }
+    if (!bench.provider || rate <= 0 || seconds <= 0) {
+        usage (argv[0]);
+        return 1;
+    }
+    if (!g_getenv ("DBUS_SESSION_BUS_ADDRESS")) {
+        fprintf (stderr, "Run the benchmark under dbus-run-session\n");
+        return 1;
+    }
+
+    dbus_threads_init_default ();
+    bench.workdir = mkdtemp (template);
+    if (!bench.workdir) {
+        perror ("mkdtemp");
+        return 1;
+    }
+    workdir = bench.workdir;
+    atexit (remove_workdir);
+    bench.conn = bench_connect (&bench);
+
+    if (warm_start) {
+        return run_warm_start (&bench) ? 0 : 1;
+    }
+
+    run_latency (&bench, rate, n_fixes);
+    run_max_rate (&bench, rates, seconds);
+
+    printf ("\n== Method call throughput, %.0f s\n", seconds);
+    run_throughput (&bench, "org.freedesktop.Geoclue.Position", "GetPosition",
+                    1, seconds);
+    run_throughput (&bench, "org.freedesktop.Geoclue.Position", "GetPosition",
+                    n_clients, seconds);
+    run_throughput (&bench, "org.freedesktop.Geoclue.Satellite", "GetSatellite",
+                    n_clients, seconds);
+
+    dbus_connection_close (bench.conn);
+    dbus_connection_unref (bench.conn);
+
+    return 0;
+}
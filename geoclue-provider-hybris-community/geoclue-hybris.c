@@ -42,6 +42,9 @@
 #include <syslog.h>
 
 #include <hardware/gps.h>
+#if ANDROID_VERSION_MAJOR>=5
+#include <hardware/fused_location.h>
+#endif
 
 #include <geoclue/gc-provider.h>
 #include <geoclue/geoclue-error.h>
@@ -50,30 +53,204 @@
 #include <geoclue/gc-iface-satellite.h>
 #include <geoclue/gc-iface-velocity.h>
 
+#include "assistance.h"
+#include "callback-ring.h"
+#include "client-aggregate.h"
+#include "geofence.h"
+#include "hal-threads.h"
+#include "hal-trace.h"
+#include "hybris-dbus.h"
+#include "location-batch.h"
+#include "location-filter.h"
+#include "measurement-stream.h"
+#include "metrics.h"
+#include "nmea-stream.h"
+#include "startup.h"
+#include "state-cache.h"
+#include "subscription-filter.h"
+#include "sv-report.h"
+#include "wakelock.h"
+#ifdef ENABLE_FAKE_GPS
+#include "fake-gps.h"
+#endif
+
 #define GEOCLUE_TYPE_HYBRIS (geoclue_hybris_get_type ())
 #define GEOCLUE_HYBRIS(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), GEOCLUE_TYPE_HYBRIS, GeoclueHybris))
 
+/* Structure-of-arrays copy of the last SV report, indexed by constellation
+ * and svid so that a report is compared against it whatever the order of
+ * the satellites. The (iiii) tuples handed to dbus-glib for the a(iiii)
+ * payload are allocated once and rewritten in place, so storing a report
+ * does not allocate. alloc_count counts the heap blocks of the table, those
+ * made at init and any made by the payload arrays growing; marshalling the
+ * signal is left to dbus-glib and is not counted. */
+typedef struct {
+    /* sv_entry_prn, for the Geoclue interface */
+    int prn[SV_MAX];
+    int azimuth[SV_MAX];
+    int elevation[SV_MAX];
+    int snr[SV_MAX];
+    gboolean used[SV_MAX];
+    /* the GNSS hal numbering, see sv-report.h */
+    int constellation[SV_MAX];
+    int svid[SV_MAX];
+    double carrier_frequency[SV_MAX];
+    SvIndex index;
+    GValueArray *tuples[SV_MAX];
+    guint alloc_count;
+    gint64 last_emit_time;
+    guint coalesce_source;
+} SatelliteTable;
+
+/* Per-connection state, stored in GeoclueHybris.connections by unique name */
+typedef struct {
+    char *sender;
+    int ref_count;
+    /* when the client showed up, monotonic us, and the fix count and
+     * engine on-time then, the statistics are the difference */
+    gint64 since;
+    guint first_fix;
+    guint64 engine_on_time_start;
+    /* SetOptions preferences, 0 means no preference */
+    guint interval;
+    guint accuracy;
+    gboolean single_shot;
+    /* Batch interface, batch_size is 0 unless batching */
+    guint batch_size;
+    guint batch_timeout;
+    guint64 batch_next;
+    guint batch_source;
+    gboolean batch_flush;
+    /* Geofence interface */
+    guint n_geofences;
+    /* Subscription interface, subscriptions is 0 unless subscribed */
+    guint subscriptions;
+    SubscriptionLimits limits;
+    /* the last signal sent, per subscription */
+    SubscriptionSent sent_position;
+    SubscriptionSent sent_velocity;
+    SubscriptionSent sent_satellites;
+    SubscriptionSent sent_fix;
+} GeoclueHybrisClient;
+
+/* The reports of one fix epoch for FixChanged, parts are FIX_EPOCH_*.
+ * expected are the parts the previous epoch had, which is what the HAL
+ * is assumed to send for this one. */
+typedef struct {
+    guint parts;
+    guint expected;
+    GpsLocation location;
+    guint window_source;
+} FixEpoch;
+
+#define FIX_EPOCH_LOCATION   (1 << 0)
+#define FIX_EPOCH_SATELLITES (1 << 1)
+
+/* A client fence, monitored by the HAL or else in geofence_index */
+typedef struct {
+    Geofence fence;
+    char *owner;
+    gboolean hardware;
+    gboolean paused;
+    /* hardware fences: paused in the HAL, by the client or the settings */
+    gboolean hal_paused;
+    /* hardware fences: dwell timer and the location of the last transition */
+    guint dwell_source;
+    GpsLocation location;
+} GeoclueHybrisGeofence;
+
+/* The interfaces opened by the hal-open thread, taken over on the main
+ * loop once it is done */
+typedef struct {
+    GThread *thread;
+    const GpsInterface *gps;
+    const GpsXtraInterface *xtra;
+#if ANDROID_VERSION_MAJOR>=5
+    const FlpLocationInterface *flp;
+    const GpsGeofencingInterface *geofencing;
+    const GpsMeasurementInterface *measurement;
+    const GpsNavigationMessageInterface *navigation;
+#endif
+} HalOpen;
+
 typedef struct {
     GcProvider parent;
     GMainLoop *loop;
 
-    char *owner;
     int last_timestamp;
     double last_altitude;
     double last_bearing;
     double last_latitude;
     double last_longitude;
     double last_speed;
+    double last_climb;
     int last_satellite_used;
     int last_satellite_visible;
     GArray *last_used_prn;
     GPtrArray *last_sat_info;
+    SatelliteTable sat_table;
     GeoclueAccuracy *last_accuracy;
     GeocluePositionFields last_pos_fields;
     GeoclueVelocityFields last_velo_fields;
     GeoclueStatus last_status;
+    /* the last position and velocity come from the state cache, the engine
+     * has not reported a fix since the start */
+    gboolean cached_fix;
     GHashTable *connections;
     DBusConnection *conn;
+    DBusConnection *provider_conn;
+    char *options_sender;
+    GSource *callback_source;
+    /* while the hal-open thread runs, NULL once the hal is taken over */
+    HalOpen *hal_open;
+    /* no GPS hal could be opened, the provider exits with an error */
+    gboolean hal_failed;
+    /* when the name was claimed and the first AddReference came, monotonic
+     * us, for the startup timing */
+    gint64 bus_ready;
+    gint64 first_reference;
+    /* no client since the engine linger ended, or yet */
+    gboolean idle;
+    guint linger_source;
+    guint idle_source;
+    gboolean powered;
+    gboolean engine_on;
+    gint64 engine_on_since;
+    gint64 engine_on_time;
+    guint fix_count;
+    /* aggregate of the client options */
+    GpsPositionRecurrence requested_recurrence;
+    guint requested_interval;
+    guint requested_accuracy;
+    /* position mode currently programmed into the HAL */
+    GpsPositionRecurrence mode_recurrence;
+    guint mode_interval;
+    guint mode_accuracy;
+    /* adaptive tracking */
+    guint tracking_interval;
+    int stationary_fixes;
+    double accuracy_average;
+    gboolean duty_cycling;
+    guint duty_cycle_source;
+    LocationFilter filter;
+    LocationBatch batch;
+    gboolean hal_batching;
+    GHashTable *geofences;
+    GeofenceIndex geofence_index;
+    guint geofence_next_id;
+    /* clients with a subscription, and those with SUBSCRIBE_FIX */
+    guint subscribers;
+    guint fix_subscribers;
+    FixEpoch fix_epoch;
+    /* kept across runs, see state-cache.h */
+    StateCacheData state;
+    /* time to first fix of each engine start, ms */
+    gint64 ttff_start;
+    guint ttff_last;
+    guint ttff_min;
+    guint ttff_max;
+    guint64 ttff_total;
+    guint ttff_count;
 } GeoclueHybris;
 
 typedef struct {
@@ -86,9 +263,26 @@ static void geoclue_hybris_position_init (GcIfacePositionClass *iface);
 static void geoclue_hybris_satellite_init (GcIfaceSatelliteClass *iface);
 static void geoclue_hybris_velocity_init (GcIfaceVelocityClass *iface);
 static void geoclue_hybris_update_position (GeoclueHybris *hybris, GpsLocation* location);
-static void geoclue_hybris_update_velocity (GeoclueHybris *hybris, GpsLocation* location);
-static void geoclue_hybris_update_satellites (GeoclueHybris *hybris, GpsSvStatus* sv_info);
+static void geoclue_hybris_update_velocity (GeoclueHybris *hybris, GpsLocation* location,
+                                            double climb);
+static void geoclue_hybris_update_satellites (GeoclueHybris *hybris, const SvReport *report);
 static void geoclue_hybris_update_status (GeoclueHybris *hybris, GeoclueStatus status);
+static void satellite_table_init (GeoclueHybris *hybris);
+static void satellite_table_free (GeoclueHybris *hybris);
+static void geoclue_hybris_adapt_interval (GeoclueHybris *hybris, GpsLocation* location);
+static void geoclue_hybris_ttff_fix (GeoclueHybris *hybris, GpsLocation *location);
+static void geoclue_hybris_update_good_fix (GeoclueHybris *hybris, GpsLocation *location);
+static gboolean geoclue_hybris_dispatch_position (GeoclueHybris *hybris, GpsLocation *location);
+static gboolean geoclue_hybris_dispatch_velocity (GeoclueHybris *hybris, GpsLocation *location);
+static gboolean geoclue_hybris_dispatch_satellites (GeoclueHybris *hybris);
+static void geoclue_hybris_add_fix_epoch (GeoclueHybris *hybris, guint part,
+                                          GpsLocation *location);
+static void geoclue_hybris_set_subscriptions (GeoclueHybris *hybris,
+                                              GeoclueHybrisClient *client,
+                                              guint subscriptions);
+
+static DBusHandlerResult provider_message_filter (DBusConnection *connection,
+                                                  DBusMessage *msg, void *user_data);
 
 G_DEFINE_TYPE_WITH_CODE (GeoclueHybris, geoclue_hybris, GC_TYPE_PROVIDER,
                          G_IMPLEMENT_INTERFACE (GC_TYPE_IFACE_GEOCLUE,
@@ -102,18 +296,337 @@ G_DEFINE_TYPE_WITH_CODE (GeoclueHybris, geoclue_hybris, GC_TYPE_PROVIDER,
 
 GeoclueHybris *hybris = NULL;
 
+/* Configuration */
+
+#define CONFIG_FILE SYSCONFDIR "/geoclue-hybris.conf"
+#define DEFAULT_STATE_FILE LOCALSTATEDIR "/lib/geoclue-hybris/state"
+
+typedef struct {
+    /* [Satellite] */
+    int sat_snr_hysteresis;
+    int sat_angle_hysteresis;
+    guint sat_coalesce_window;
+    /* [Tracking] */
+    gboolean tracking_adaptive;
+    guint tracking_min_interval;
+    guint tracking_max_interval;
+    double tracking_stationary_speed;
+    double tracking_moving_speed;
+    guint tracking_duty_cycle_interval;
+    /* [Trace] */
+    char *trace_file;
+    guint trace_size;
+    /* [Nmea] */
+    char *nmea_socket;
+    /* [Metrics] */
+    char *metrics_socket;
+    /* [Wakelock] */
+    gboolean wakelock_enabled;
+    /* [Filter] */
+    gboolean filter_enabled;
+    LocationFilterParams filter;
+    /* [Batch] */
+    guint batch_capacity;
+    /* [Geofence] */
+    gboolean geofence_hardware;
+    guint geofence_responsiveness;
+    /* [Subscription] */
+    guint subscription_fix_window;
+    /* [Lifetime] */
+    guint lifetime_engine_linger;
+    int lifetime_idle_timeout;
+    /* [State] */
+    char *state_file;
+    /* [Assistance] */
+    guint assistance_fix_max_age;
+    guint assistance_time_uncertainty;
+    char *assistance_xtra_file;
+    guint assistance_xtra_max_age;
+    gboolean assistance_ms_based;
+} GeoclueHybrisConfig;
+
+static GeoclueHybrisConfig config = {
+    .sat_snr_hysteresis = 1,
+    .sat_angle_hysteresis = 1,
+    .sat_coalesce_window = 1000,
+    .tracking_adaptive = FALSE,
+    .tracking_min_interval = 1000,
+    .tracking_max_interval = 60000,
+    .tracking_stationary_speed = 0.5,
+    .tracking_moving_speed = 5.0,
+    .tracking_duty_cycle_interval = 30000,
+    .trace_file = NULL,
+    .trace_size = 1024,
+    .nmea_socket = NULL,
+    .metrics_socket = NULL,
+    .wakelock_enabled = TRUE,
+    .filter_enabled = FALSE,
+    .filter = {
+        .process_noise = 0.5,
+        .velocity_noise = 0.5,
+        .max_gap = 10000,
+    },
+    .batch_capacity = 600,
+    .geofence_hardware = TRUE,
+    .geofence_responsiveness = 5000,
+    .subscription_fix_window = 100,
+    .lifetime_engine_linger = 10,
+    .lifetime_idle_timeout = 300,
+    /* DEFAULT_STATE_FILE, set by geoclue_hybris_load_config */
+    .state_file = NULL,
+    .assistance_fix_max_age = 7 * 24 * 3600,
+    .assistance_time_uncertainty = 1000,
+    .assistance_xtra_file = NULL,
+    .assistance_xtra_max_age = 7 * 24 * 3600,
+    .assistance_ms_based = TRUE,
+};
+
+static int
+config_get_integer (GKeyFile *keyfile, const char *group, const char *key,
+                    int default_value)
+{
+    GError *error = NULL;
+    int value = g_key_file_get_integer (keyfile, group, key, &error);
+
+    if (error) {
+        g_error_free (error);
+        return default_value;
+    }
+    return value;
+}
+
+static double
+config_get_double (GKeyFile *keyfile, const char *group, const char *key,
+                   double default_value)
+{
+    GError *error = NULL;
+    double value = g_key_file_get_double (keyfile, group, key, &error);
+
+    if (error) {
+        g_error_free (error);
+        return default_value;
+    }
+    return value;
+}
+
+static gboolean
+config_get_boolean (GKeyFile *keyfile, const char *group, const char *key,
+                    gboolean default_value)
+{
+    GError *error = NULL;
+    gboolean value = g_key_file_get_boolean (keyfile, group, key, &error);
+
+    if (error) {
+        g_error_free (error);
+        return default_value;
+    }
+    return value;
+}
+
+/* A file name, NULL when unset or empty */
+static char *
+config_get_path (GKeyFile *keyfile, const char *group, const char *key)
+{
+    char *value = g_key_file_get_string (keyfile, group, key, NULL);
+
+    if (value && !*value) {
+        g_free (value);
+        return NULL;
+    }
+    return value;
+}
+
+#define THREAD_GROUP_PREFIX "Thread "
+
+/* Nice, RealtimePriority and Cpus of a [Threads] or [Thread <glob>] group */
+static void
+config_add_thread_policy (GKeyFile *keyfile, const char *group, const char *pattern)
+{
+    char *cpus = g_key_file_get_string (keyfile, group, "Cpus", NULL);
+
+    hal_threads_add_policy (pattern,
+                            CLAMP (config_get_integer (keyfile, group, "Nice", 0), -20, 19),
+                            CLAMP (config_get_integer (keyfile, group, "RealtimePriority", 0),
+                                   0, 99),
+                            cpus);
+    g_free (cpus);
+}
+
+static void
+geoclue_hybris_load_config (void)
+{
+    GKeyFile *keyfile = g_key_file_new ();
+    const char *path = g_getenv ("GEOCLUE_HYBRIS_CONFIG");
+    char **groups;
+    int i;
+
+    if (!path) {
+        path = CONFIG_FILE;
+    }
+    /* allocated, like a path read from the file */
+    g_free (config.state_file);
+    config.state_file = g_strdup (DEFAULT_STATE_FILE);
+    if (!g_key_file_load_from_file (keyfile, path, G_KEY_FILE_NONE, NULL)) {
+        /* no configuration, keep the defaults */
+        g_key_file_free (keyfile);
+        return;
+    }
+    syslog(LOG_INFO, "Using configuration from %s", path);
+
+    config.sat_snr_hysteresis =
+        MAX (0, config_get_integer (keyfile, "Satellite", "SnrHysteresis",
+                                    config.sat_snr_hysteresis));
+    config.sat_angle_hysteresis =
+        MAX (0, config_get_integer (keyfile, "Satellite", "AngleHysteresis",
+                                    config.sat_angle_hysteresis));
+    config.sat_coalesce_window =
+        MAX (0, config_get_integer (keyfile, "Satellite", "CoalesceWindow",
+                                    config.sat_coalesce_window));
+
+    config.tracking_adaptive =
+        config_get_boolean (keyfile, "Tracking", "Adaptive",
+                            config.tracking_adaptive);
+    config.tracking_min_interval =
+        MAX (100, config_get_integer (keyfile, "Tracking", "MinInterval",
+                                      config.tracking_min_interval));
+    config.tracking_max_interval =
+        MAX (config.tracking_min_interval,
+             config_get_integer (keyfile, "Tracking", "MaxInterval",
+                                 config.tracking_max_interval));
+    config.tracking_stationary_speed =
+        config_get_double (keyfile, "Tracking", "StationarySpeed",
+                           config.tracking_stationary_speed);
+    config.tracking_moving_speed =
+        config_get_double (keyfile, "Tracking", "MovingSpeed",
+                           config.tracking_moving_speed);
+    config.tracking_duty_cycle_interval =
+        MAX (0, config_get_integer (keyfile, "Tracking", "DutyCycleInterval",
+                                    config.tracking_duty_cycle_interval));
+
+    g_free (config.trace_file);
+    config.trace_file = config_get_path (keyfile, "Trace", "File");
+    config.trace_size =
+        MAX (4, config_get_integer (keyfile, "Trace", "Size", config.trace_size));
+
+    g_free (config.nmea_socket);
+    config.nmea_socket = config_get_path (keyfile, "Nmea", "Socket");
+
+    g_free (config.metrics_socket);
+    config.metrics_socket = config_get_path (keyfile, "Metrics", "Socket");
+
+    config.wakelock_enabled =
+        config_get_boolean (keyfile, "Wakelock", "Enabled", config.wakelock_enabled);
+
+    config.filter_enabled =
+        config_get_boolean (keyfile, "Filter", "Enabled", config.filter_enabled);
+    config.filter.process_noise =
+        MAX (0.001, config_get_double (keyfile, "Filter", "ProcessNoise",
+                                       config.filter.process_noise));
+    config.filter.velocity_noise =
+        MAX (0.01, config_get_double (keyfile, "Filter", "VelocityNoise",
+                                      config.filter.velocity_noise));
+    config.filter.max_gap =
+        MAX (0, config_get_integer (keyfile, "Filter", "MaxGap",
+                                    config.filter.max_gap));
+
+    config.batch_capacity =
+        MAX (1, config_get_integer (keyfile, "Batch", "Size", config.batch_capacity));
+
+    config.geofence_hardware =
+        config_get_boolean (keyfile, "Geofence", "Hardware", config.geofence_hardware);
+    config.geofence_responsiveness =
+        MAX (0, config_get_integer (keyfile, "Geofence", "Responsiveness",
+                                    config.geofence_responsiveness));
+
+    config.subscription_fix_window =
+        MAX (0, config_get_integer (keyfile, "Subscription", "FixWindow",
+                                    config.subscription_fix_window));
+
+    config.lifetime_engine_linger =
+        MAX (0, config_get_integer (keyfile, "Lifetime", "EngineLinger",
+                                    config.lifetime_engine_linger));
+    config.lifetime_idle_timeout =
+        MAX (-1, config_get_integer (keyfile, "Lifetime", "IdleTimeout",
+                                     config.lifetime_idle_timeout));
+
+    if (g_key_file_has_key (keyfile, "State", "File", NULL)) {
+        g_free (config.state_file);
+        config.state_file = config_get_path (keyfile, "State", "File");
+    }
+    else if (g_key_file_has_key (keyfile, "Assistance", "LastFixFile", NULL)) {
+        /* deprecated, the last fix file became the state file */
+        syslog(LOG_WARNING, "[Assistance] LastFixFile is deprecated, use [State] File");
+        g_free (config.state_file);
+        config.state_file = config_get_path (keyfile, "Assistance", "LastFixFile");
+    }
+
+    config.assistance_fix_max_age =
+        MAX (0, config_get_integer (keyfile, "Assistance", "LastFixMaxAge",
+                                    config.assistance_fix_max_age));
+    config.assistance_time_uncertainty =
+        MAX (1, config_get_integer (keyfile, "Assistance", "TimeUncertainty",
+                                    config.assistance_time_uncertainty));
+    g_free (config.assistance_xtra_file);
+    config.assistance_xtra_file = g_key_file_get_string (keyfile, "Assistance",
+                                                         "XtraFile", NULL);
+    config.assistance_xtra_max_age =
+        MAX (0, config_get_integer (keyfile, "Assistance", "XtraMaxAge",
+                                    config.assistance_xtra_max_age));
+    config.assistance_ms_based =
+        config_get_boolean (keyfile, "Assistance", "MsBased", config.assistance_ms_based);
+
+    /* in file order, the first matching group wins, [Threads] is the fallback */
+    groups = g_key_file_get_groups (keyfile, NULL);
+    for (i = 0; groups[i]; i++) {
+        if (g_str_has_prefix (groups[i], THREAD_GROUP_PREFIX)) {
+            config_add_thread_policy (keyfile, groups[i],
+                                      groups[i] + strlen (THREAD_GROUP_PREFIX));
+        }
+    }
+    g_strfreev (groups);
+    if (g_key_file_has_group (keyfile, "Threads")) {
+        config_add_thread_policy (keyfile, "Threads", NULL);
+    }
+
+    g_key_file_free (keyfile);
+}
+
 /* Hybris GPS */
 
+/* ms, for the hal threads to return after cleanup */
+#define HAL_THREADS_JOIN_TIMEOUT 1000
+
 const GpsInterface* gps = NULL;
+/* reported through set_capabilities_callback, possibly from a HAL thread */
+static gint hal_capabilities = 0;
 
 static const GpsInterface*
 get_gps_interface()
 {
+    const GpsInterface* interface = NULL;
+#ifdef HAVE_HYBRIS
     int error;
     hw_module_t* module;
-    const GpsInterface* interface = NULL;
     struct gps_device_t *device;
+#endif
+
+#ifdef ENABLE_FAKE_GPS
+    const char *script = g_getenv ("GEOCLUE_HYBRIS_FAKE_GPS");
+    if (script) {
+        const char *rate = g_getenv ("GEOCLUE_HYBRIS_FAKE_GPS_RATE");
+        const char *speed = g_getenv ("GEOCLUE_HYBRIS_FAKE_GPS_SPEED");
+
+        interface = fake_gps_get_interface (script, rate ? g_ascii_strtod (rate, NULL) : 0,
+                                            speed ? g_ascii_strtod (speed, NULL) : 0,
+                                            g_getenv ("GEOCLUE_HYBRIS_FAKE_GPS_STAMPS"));
+        if (!interface) {
+            syslog(LOG_ERR, "Fake GPS script not usable\n");
+        }
+        return interface;
+    }
+#endif
 
+#ifdef HAVE_HYBRIS
     error = hw_get_module(GPS_HARDWARE_MODULE_ID, (hw_module_t const**)&module);
 
     if (!error)
@@ -134,63 +647,496 @@ get_gps_interface()
     }
     else
     {
-        syslog(LOG_ERR, "GPS interface not found, terminating\n");
-        exit(1);
+        syslog(LOG_ERR, "GPS interface not found\n");
     }
+#else
+    syslog(LOG_ERR, "Built without hybris and no fake GPS script set\n");
+#endif
 
     return interface;
 }
 
+static void geoclue_hybris_deliver_batches (GeoclueHybris *hybris, gboolean flushed);
+static void geoclue_hybris_software_transition (Geofence *fence, guint transition,
+                                                const GpsLocation *location,
+                                                gpointer data);
+
 static void
-location_callback(GpsLocation* location)
+batch_fix_from_gps_location (BatchFix *fix, const GpsLocation *location)
+{
+    fix->timestamp = location->timestamp;
+    fix->latitude = (location->flags & GPS_LOCATION_HAS_LAT_LONG) ?
+                    location->latitude : NAN;
+    fix->longitude = (location->flags & GPS_LOCATION_HAS_LAT_LONG) ?
+                     location->longitude : NAN;
+    fix->altitude = (location->flags & GPS_LOCATION_HAS_ALTITUDE) ?
+                    location->altitude : NAN;
+    fix->speed = (location->flags & GPS_LOCATION_HAS_SPEED) ? location->speed : NAN;
+    fix->bearing = (location->flags & GPS_LOCATION_HAS_BEARING) ? location->bearing : NAN;
+    fix->accuracy = (location->flags & GPS_LOCATION_HAS_ACCURACY) ?
+                    location->accuracy : NAN;
+}
+
+/* Hybris FLP, batches fixes in the GPS chip while the application
+ * processor sleeps */
+
+#if ANDROID_VERSION_MAJOR>=5
+#define FLP_BATCH_ID 1
+
+const FlpLocationInterface* flp = NULL;
+static gint flp_batch_pending = 0;
+
+static const FlpLocationInterface*
+get_flp_interface()
+{
+#ifdef HAVE_HYBRIS
+    hw_module_t* module;
+    struct flp_device_t *device;
+#endif
+
+#ifdef ENABLE_FAKE_GPS
+    if (g_getenv ("GEOCLUE_HYBRIS_FAKE_GPS")) {
+        return fake_flp_get_interface ();
+    }
+#endif
+#ifdef HAVE_HYBRIS
+    if (hw_get_module(FUSED_LOCATION_HARDWARE_MODULE_ID, (hw_module_t const**)&module) != 0) {
+        return NULL;
+    }
+    if (module->methods->open(module, FUSED_LOCATION_HARDWARE_MODULE_ID,
+                              (struct hw_device_t **) &device) != 0) {
+        syslog(LOG_WARNING, "Unable to open FLP device\n");
+        return NULL;
+    }
+    return device->get_flp_interface(device);
+#else
+    return NULL;
+#endif
+}
+
+static gboolean
+flp_batch_idle (gpointer data)
 {
-    geoclue_hybris_update_status (hybris, GEOCLUE_STATUS_AVAILABLE);
-    geoclue_hybris_update_position (hybris, location);
-    geoclue_hybris_update_velocity (hybris, location);
+    g_atomic_int_set (&flp_batch_pending, 0);
+    geoclue_hybris_deliver_batches (hybris, TRUE);
+    wakelock_release ();
+    return FALSE;
 }
 
+/* From an FLP thread, with the batched fixes after a flush or when the
+ * FIFO of the chip is full */
 static void
-status_callback(GpsStatus* status)
+flp_locations_callback(int32_t num_locations, FlpLocation** locations)
+{
+    int i;
+
+    for (i = 0; i < num_locations; i++) {
+        FlpLocation *location = locations[i];
+        BatchFix fix;
+
+        /* the FLP location flags match the GPS ones */
+        fix.timestamp = location->timestamp;
+        fix.latitude = (location->flags & GPS_LOCATION_HAS_LAT_LONG) ?
+                       location->latitude : NAN;
+        fix.longitude = (location->flags & GPS_LOCATION_HAS_LAT_LONG) ?
+                        location->longitude : NAN;
+        fix.altitude = (location->flags & GPS_LOCATION_HAS_ALTITUDE) ?
+                       location->altitude : NAN;
+        fix.speed = (location->flags & GPS_LOCATION_HAS_SPEED) ? location->speed : NAN;
+        fix.bearing = (location->flags & GPS_LOCATION_HAS_BEARING) ? location->bearing : NAN;
+        fix.accuracy = (location->flags & GPS_LOCATION_HAS_ACCURACY) ?
+                       location->accuracy : NAN;
+        location_batch_append (&hybris->batch, &fix);
+    }
+    /* one wakeup of the main loop per batch, awake until it is sent */
+    if (g_atomic_int_compare_and_exchange (&flp_batch_pending, 0, 1)) {
+        wakelock_acquire ();
+        g_idle_add (flp_batch_idle, NULL);
+    }
+}
+
+/* Like the GPS hal one, a single reference */
+static gint flp_wakelock = 0;
+
+static void
+flp_acquire_wakelock_callback()
+{
+    if (g_atomic_int_compare_and_exchange (&flp_wakelock, 0, 1)) {
+        wakelock_acquire ();
+    }
+}
+
+static void
+flp_release_wakelock_callback()
+{
+    if (g_atomic_int_compare_and_exchange (&flp_wakelock, 1, 0)) {
+        wakelock_release ();
+    }
+}
+
+static int
+flp_set_thread_event_callback(int event)
+{
+    /* no JVM to attach to */
+    return FLP_RESULT_SUCCESS;
+}
+
+#if ANDROID_VERSION_MAJOR>=6
+static void
+flp_set_capabilities_callback(int capabilities)
+{
+    syslog(LOG_INFO, "FLP hal capabilities 0x%x", capabilities);
+}
+
+static void
+flp_status_changed_callback(int32_t status)
+{
+    /* do nothing */
+}
+#endif
+
+FlpCallbacks flp_callbacks = {
+    sizeof(FlpCallbacks),
+    flp_locations_callback,
+    flp_acquire_wakelock_callback,
+    flp_release_wakelock_callback,
+    flp_set_thread_event_callback,
+#if ANDROID_VERSION_MAJOR>=6
+    flp_set_capabilities_callback,
+    flp_status_changed_callback,
+#endif
+};
+#endif
+
+/* HAL callback handoff
+ *
+ * The HAL invokes the callbacks below from threads it created through
+ * create_thread_callback, several of them at once. They only copy the
+ * report into a slot of the multi-producer callback ring and wake up the
+ * main context; the ring is drained by callback_source on the main loop,
+ * so the provider state is only touched and signals are only emitted
+ * from one thread. A callback invoked from the main thread itself (some
+ * HALs report status synchronously from start/stop) is handled inline
+ * after draining the ring to keep the ordering intact.
+ *
+ * The ring holds one reference on the wakelock while it has records, so
+ * the system does not suspend between the callback and the signals. It is
+ * taken by the record that makes the ring non-empty and dropped once a
+ * drain empties it.
+ */
+
+#define CALLBACK_RING_SIZE 32 /* must be a power of two */
+
+typedef enum {
+    CALLBACK_RECORD_LOCATION,
+    CALLBACK_RECORD_STATUS,
+    CALLBACK_RECORD_SV_STATUS,
+    /* an NMEA epoch ended, no data */
+    CALLBACK_RECORD_NMEA_EPOCH,
+} CallbackRecordType;
+
+typedef struct {
+    CallbackRecordType type;
+    /* monotonic time of the callback, us */
+    gint64 received;
+    union {
+        GpsLocation location;
+        GpsStatus status;
+        /* both SV callbacks, converted on the hal thread */
+        SvReport sv_report;
+    } u;
+} CallbackRecord;
+
+static CallbackRing *callback_ring;
+/* records committed and not processed yet */
+static gint callback_pending;
+static pthread_t main_thread;
+
+static void geoclue_hybris_process_record (CallbackRecord *record);
+static void geoclue_hybris_duty_cycle_fix (GeoclueHybris *hybris);
+
+/* Reserves the record of a callback and stamps it with the time of the
+ * callback */
+static CallbackRecord *
+callback_record_reserve (CallbackRecord *local)
+{
+    CallbackRecord *record;
+
+    if (pthread_equal (pthread_self (), main_thread)) {
+        /* handled inline, do not take a slot of the HAL threads */
+        record = local;
+    }
+    else {
+        record = callback_ring_reserve (callback_ring);
+        if (!record) {
+            metrics_inc (METRIC_REPORTS_DROPPED);
+            return NULL;
+        }
+    }
+    record->received = g_get_monotonic_time ();
+    return record;
+}
+
+static void
+callback_ring_drain (void)
+{
+    CallbackRecord *record;
+    guint dropped;
+    gint processed = 0;
+
+    while ((record = callback_ring_peek (callback_ring))) {
+        geoclue_hybris_process_record (record);
+        callback_ring_pop (callback_ring);
+        processed++;
+    }
+    /* a record committed meanwhile keeps the wakelock for the next drain */
+    if (processed && g_atomic_int_add (&callback_pending, -processed) == processed) {
+        wakelock_release ();
+    }
+
+    dropped = callback_ring_take_dropped (callback_ring);
+    if (dropped) {
+        syslog(LOG_WARNING, "Dropped %u GPS reports, main loop is too slow", dropped);
+    }
+}
+
+static void
+callback_record_submit (CallbackRecord *record, CallbackRecord *local)
+{
+    if (record == local) {
+        callback_ring_drain ();
+        geoclue_hybris_process_record (record);
+    }
+    else {
+        /* counted before the commit, the drain cannot release first */
+        if (g_atomic_int_add (&callback_pending, 1) == 0) {
+            wakelock_acquire ();
+        }
+        callback_ring_commit (callback_ring, record);
+        g_main_context_wakeup (NULL);
+    }
+}
+
+static gboolean
+callback_source_prepare (GSource *source, gint *timeout)
+{
+    *timeout = -1;
+    return callback_ring_peek (callback_ring) != NULL;
+}
+
+static gboolean
+callback_source_check (GSource *source)
+{
+    return callback_ring_peek (callback_ring) != NULL;
+}
+
+static gboolean
+callback_source_dispatch (GSource *source, GSourceFunc callback, gpointer user_data)
+{
+    callback_ring_drain ();
+    return TRUE;
+}
+
+static GSourceFuncs callback_source_funcs = {
+    callback_source_prepare,
+    callback_source_check,
+    callback_source_dispatch,
+    NULL
+};
+
+/* Callback to the end of the handling of its record */
+static const MetricHistogram record_latency[] = {
+    [CALLBACK_RECORD_LOCATION] = METRIC_FIX_LATENCY,
+    [CALLBACK_RECORD_STATUS] = METRIC_STATUS_LATENCY,
+    [CALLBACK_RECORD_SV_STATUS] = METRIC_SATELLITE_LATENCY,
+    [CALLBACK_RECORD_NMEA_EPOCH] = METRIC_NMEA_LATENCY,
+};
+
+/* Runs on the main loop only */
+static void
+geoclue_hybris_process_record (CallbackRecord *record)
 {
-    switch (status->status)
+    BatchFix fix;
+    double climb;
+
+    switch (record->type)
     {
-        case GPS_STATUS_NONE:
-        geoclue_hybris_update_status (hybris, GEOCLUE_STATUS_UNAVAILABLE);
-        break;
-        case GPS_STATUS_SESSION_BEGIN:
-        syslog(LOG_INFO, "GPS session started");
-        geoclue_hybris_update_status (hybris, GEOCLUE_STATUS_ACQUIRING);
+        case CALLBACK_RECORD_LOCATION:
+        /* a fix ends the NMEA epoch */
+        nmea_stream_flush ();
+        hybris->fix_count++;
+        hybris->cached_fix = FALSE;
+        metrics_inc (METRIC_FIXES_RECEIVED);
+        geoclue_hybris_ttff_fix (hybris, &record->u.location);
+        geoclue_hybris_update_status (hybris, GEOCLUE_STATUS_AVAILABLE);
+        /* the raw velocity doubles as motion signal for adaptive tracking */
+        geoclue_hybris_adapt_interval (hybris, &record->u.location);
+        /* even when the filter or an unchanged position suppresses the
+         * signals, the fix is the newest one */
+        hybris->last_timestamp = (int)(record->u.location.timestamp/1000+0.5);
+        climb = NAN;
+        if (!config.filter_enabled ||
+            location_filter_update (&hybris->filter, &config.filter,
+                                    &record->u.location, &climb)) {
+            geoclue_hybris_update_position (hybris, &record->u.location);
+            geoclue_hybris_update_velocity (hybris, &record->u.location, climb);
+        }
+        geoclue_hybris_add_fix_epoch (hybris, FIX_EPOCH_LOCATION, &record->u.location);
+        geoclue_hybris_update_good_fix (hybris, &record->u.location);
+        geofence_index_update (&hybris->geofence_index, &record->u.location,
+                               geoclue_hybris_software_transition, hybris);
+        batch_fix_from_gps_location (&fix, &record->u.location);
+        location_batch_append (&hybris->batch, &fix);
+        geoclue_hybris_deliver_batches (hybris, FALSE);
+        geoclue_hybris_duty_cycle_fix (hybris);
+        state_cache_write (&hybris->state);
         break;
-        case GPS_STATUS_SESSION_END:
-        syslog(LOG_INFO, "GPS session stopped");
-        geoclue_hybris_update_status (hybris, GEOCLUE_STATUS_UNAVAILABLE);
+        case CALLBACK_RECORD_STATUS:
+        if (hybris->duty_cycling) {
+            /* the engine is stopped and started for every fix, that
+             * does not make the position unavailable */
+            break;
+        }
+        switch (record->u.status.status)
+        {
+            case GPS_STATUS_NONE:
+            geoclue_hybris_update_status (hybris, GEOCLUE_STATUS_UNAVAILABLE);
+            break;
+            case GPS_STATUS_SESSION_BEGIN:
+            syslog(LOG_INFO, "GPS session started");
+            geoclue_hybris_update_status (hybris, GEOCLUE_STATUS_ACQUIRING);
+            break;
+            case GPS_STATUS_SESSION_END:
+            syslog(LOG_INFO, "GPS session stopped");
+            geoclue_hybris_update_status (hybris, GEOCLUE_STATUS_UNAVAILABLE);
+            break;
+            case GPS_STATUS_ENGINE_ON:
+            geoclue_hybris_update_status (hybris, GEOCLUE_STATUS_ACQUIRING);
+            break;
+            case GPS_STATUS_ENGINE_OFF:
+            geoclue_hybris_update_status (hybris, GEOCLUE_STATUS_UNAVAILABLE);
+            break;
+            default:
+            break;
+        }
         break;
-        case GPS_STATUS_ENGINE_ON:
-        geoclue_hybris_update_status (hybris, GEOCLUE_STATUS_ACQUIRING);
+        case CALLBACK_RECORD_SV_STATUS:
+        geoclue_hybris_update_satellites (hybris, &record->u.sv_report);
+        geoclue_hybris_add_fix_epoch (hybris, FIX_EPOCH_SATELLITES, NULL);
+        state_cache_write (&hybris->state);
         break;
-        case GPS_STATUS_ENGINE_OFF:
-        geoclue_hybris_update_status (hybris, GEOCLUE_STATUS_UNAVAILABLE);
+        case CALLBACK_RECORD_NMEA_EPOCH:
+        nmea_stream_send ();
         break;
         default:
-        break;
+        return;
+    }
+    metrics_observe (record_latency[record->type], g_get_monotonic_time () - record->received);
+}
+
+static void
+location_callback(GpsLocation* location)
+{
+    CallbackRecord local;
+    CallbackRecord *record;
+
+    hal_trace_location (location);
+    record = callback_record_reserve (&local);
+    if (!record) {
+        return;
+    }
+    record->type = CALLBACK_RECORD_LOCATION;
+    memcpy (&record->u.location, location,
+            MIN (location->size, sizeof (GpsLocation)));
+    callback_record_submit (record, &local);
+}
+
+static void
+status_callback(GpsStatus* status)
+{
+    CallbackRecord local;
+    CallbackRecord *record;
+
+    hal_trace_status (status);
+    metrics_inc (METRIC_STATUS_REPORTS);
+    record = callback_record_reserve (&local);
+    if (!record) {
+        return;
     }
+    record->type = CALLBACK_RECORD_STATUS;
+    record->u.status.status = status->status;
+    callback_record_submit (record, &local);
 }
 
 static void
 sv_status_callback(GpsSvStatus* sv_info)
 {
-    geoclue_hybris_update_satellites (hybris, sv_info);
+    CallbackRecord local;
+    CallbackRecord *record;
+
+    hal_trace_sv_status (sv_info);
+    metrics_inc (METRIC_SV_REPORTS);
+    record = callback_record_reserve (&local);
+    if (!record) {
+        return;
+    }
+    record->type = CALLBACK_RECORD_SV_STATUS;
+    sv_report_from_gps (&record->u.sv_report, sv_info);
+    callback_record_submit (record, &local);
+}
+
+#if ANDROID_VERSION_MAJOR>=7
+/* Called instead of sv_status_callback by the GNSS hals */
+static void
+gnss_sv_info_callback(GnssSvStatus* sv_info)
+{
+    CallbackRecord local;
+    CallbackRecord *record;
+
+    hal_trace_gnss_sv_status (sv_info);
+    metrics_inc (METRIC_SV_REPORTS);
+    record = callback_record_reserve (&local);
+    if (!record) {
+        return;
+    }
+    record->type = CALLBACK_RECORD_SV_STATUS;
+    sv_report_from_gnss (&record->u.sv_report, sv_info);
+    callback_record_submit (record, &local);
+}
+
+static void
+set_system_info_callback(const GnssSystemInfo* info)
+{
+    syslog(LOG_INFO, "GNSS hardware of %u", info->year_of_hw);
 }
+#endif
 
 static void
 nmea_callback(GpsUtcTime timestamp, const char* nmea, int length)
 {
-    /* do nothing */
+    CallbackRecord local;
+    CallbackRecord *record;
+
+    hal_trace_nmea (timestamp, nmea, length);
+    metrics_inc (METRIC_NMEA_SENTENCES);
+    if (!nmea_stream_append (timestamp, nmea, length)) {
+        return;
+    }
+    /* the subscribers are written to from the main loop */
+    record = callback_record_reserve (&local);
+    if (!record) {
+        return;
+    }
+    record->type = CALLBACK_RECORD_NMEA_EPOCH;
+    callback_record_submit (record, &local);
 }
 
 static void
 set_capabilities_callback(uint32_t capabilities)
 {
+    hal_trace_capabilities (capabilities);
+    g_atomic_int_set (&hal_capabilities, capabilities);
+
     syslog(LOG_INFO, "GPS hal supported capabilities:");
     int bitmask = capabilities;
     int mask = 1;
@@ -231,59 +1177,197 @@ set_capabilities_callback(uint32_t capabilities)
     }
 }
 
+/* The hal does not count its requests, one reference stands for them */
+static gint hal_wakelock = 0;
+
 static void
 acquire_wakelock_callback()
 {
-    /* do nothing */
+    if (g_atomic_int_compare_and_exchange (&hal_wakelock, 0, 1)) {
+        wakelock_acquire ();
+    }
 }
 
 static void
 release_wakelock_callback()
 {
-    /* do nothing */
-}
-
-struct ThreadWrapperContext {
-    void (*func)(void *);
-    void *user_data;
-};
-
-static void *
-thread_wrapper_context_main_func(void *user_data)
-{
-  struct ThreadWrapperContext *ctx = (struct ThreadWrapperContext *)user_data;
-
-  ctx->func(ctx->user_data);
-
-  free(ctx);
-
-  return NULL;
+    if (g_atomic_int_compare_and_exchange (&hal_wakelock, 1, 0)) {
+        wakelock_release ();
+    }
 }
 
 static pthread_t
 create_thread_callback(const char* name, void (*start)(void *), void* arg)
 {
-  pthread_t thread_id;
-  int error = 0;
+    return hal_threads_create (name, start, arg);
+}
 
-  /* Wrap thread function, so we can return void * to pthread and log start/end of thread */
-  struct ThreadWrapperContext *ctx = calloc(1, sizeof(struct ThreadWrapperContext));
-  ctx->func = start;
-  ctx->user_data = arg;
+/* Assistance
+ *
+ * Before each start the HAL gets the time, with its uncertainty, and the
+ * last good fix from the state cache, with an accuracy grown with its age.
+ * XTRA data cached in [Assistance] XtraFile by whatever downloads it is
+ * injected at init and when the HAL asks for data. Requests from HAL
+ * threads are handled on the main loop.
+ */
 
-  /* Do not use a pthread_attr_t (we'd have to take care of bionic/glibc differences) */
-  error = pthread_create(&thread_id, NULL, thread_wrapper_context_main_func, ctx);
+/* a fix is kept for injection when it is at least this accurate, m */
+#define GOOD_FIX_ACCURACY 200.0
+/* how fast an injected fix gets worse, m/s */
+#define GOOD_FIX_DECAY 1.0
+#define GOOD_FIX_MAX_ACCURACY 100000.0
 
-  if(error != 0)
-    return 0;
+static void
+geoclue_hybris_inject_time (void)
+{
+    GpsUtcTime time;
+    int64_t reference;
+    int uncertainty;
 
-  return thread_id;
+    assistance_get_time (&time, &reference, &uncertainty,
+                         config.assistance_time_uncertainty);
+    gps->inject_time(time, reference, uncertainty);
 }
 
-/* Hybris GPS callbacks */
-GpsCallbacks callbacks = {
-  sizeof(GpsCallbacks),
-  location_callback,
+static gboolean
+time_request_idle (gpointer data)
+{
+    if (gps) {
+        geoclue_hybris_inject_time ();
+    }
+    return FALSE;
+}
+
+static void
+request_utc_time_callback()
+{
+    g_idle_add (time_request_idle, NULL);
+}
+
+static void
+geoclue_hybris_inject_location (GeoclueHybris *hybris)
+{
+    AssistanceFix *fix = &hybris->state.good_fix;
+    gint64 age;
+
+    if (!fix->timestamp) {
+        return;
+    }
+    age = g_get_real_time () / 1000 - fix->timestamp;
+    if (age < 0 || (config.assistance_fix_max_age &&
+                    age > (gint64) config.assistance_fix_max_age * 1000)) {
+        return;
+    }
+    gps->inject_location(fix->latitude, fix->longitude,
+                         MIN (fix->accuracy + age / 1000 * GOOD_FIX_DECAY,
+                              GOOD_FIX_MAX_ACCURACY));
+}
+
+static void
+geoclue_hybris_update_good_fix (GeoclueHybris *hybris, GpsLocation *location)
+{
+    if ((location->flags & (GPS_LOCATION_HAS_LAT_LONG | GPS_LOCATION_HAS_ACCURACY)) !=
+        (GPS_LOCATION_HAS_LAT_LONG | GPS_LOCATION_HAS_ACCURACY) ||
+        isnan (location->latitude) || isnan (location->longitude) ||
+        !(location->accuracy <= GOOD_FIX_ACCURACY)) {
+        return;
+    }
+    hybris->state.good_fix.latitude = location->latitude;
+    hybris->state.good_fix.longitude = location->longitude;
+    hybris->state.good_fix.accuracy = location->accuracy;
+    hybris->state.good_fix.timestamp = location->timestamp;
+}
+
+static const GpsXtraInterface* xtra = NULL;
+static time_t xtra_mtime = 0;
+
+static gboolean
+geoclue_hybris_inject_xtra (void)
+{
+    char *data;
+    gsize length;
+
+    if (!xtra || !config.assistance_xtra_file) {
+        return FALSE;
+    }
+    data = assistance_load_xtra (config.assistance_xtra_file,
+                                 config.assistance_xtra_max_age,
+                                 &xtra_mtime, &length);
+    if (!data) {
+        return FALSE;
+    }
+    if (xtra->inject_xtra_data(data, length) != 0) {
+        syslog(LOG_WARNING, "GPS hal rejected XTRA data %s", config.assistance_xtra_file);
+        /* try again on the next request */
+        xtra_mtime = 0;
+    }
+    else {
+        syslog(LOG_INFO, "Injected XTRA data %s", config.assistance_xtra_file);
+    }
+    g_free (data);
+    return xtra_mtime != 0;
+}
+
+static gboolean
+xtra_download_idle (gpointer data)
+{
+    if (!geoclue_hybris_inject_xtra ()) {
+        syslog(LOG_INFO, "GPS hal wants XTRA data, none newer in %s",
+               config.assistance_xtra_file ? config.assistance_xtra_file : "(unset)");
+    }
+    return FALSE;
+}
+
+static void
+xtra_download_request_callback()
+{
+    g_idle_add (xtra_download_idle, NULL);
+}
+
+GpsXtraCallbacks xtra_callbacks = {
+  xtra_download_request_callback,
+  create_thread_callback,
+};
+
+static GpsPositionMode
+geoclue_hybris_get_hal_mode (void)
+{
+    /* MS-based uses the injected assistance data */
+    if (config.assistance_ms_based &&
+        (g_atomic_int_get (&hal_capabilities) & GPS_CAPABILITY_MSB)) {
+        return GPS_POSITION_MODE_MS_BASED;
+    }
+    return GPS_POSITION_MODE_STANDALONE;
+}
+
+/* Called for every fix */
+static void
+geoclue_hybris_ttff_fix (GeoclueHybris *hybris, GpsLocation *location)
+{
+    guint ttff;
+
+    if (!hybris->ttff_start || !(location->flags & GPS_LOCATION_HAS_LAT_LONG)) {
+        return;
+    }
+    ttff = (g_get_monotonic_time () - hybris->ttff_start) / 1000;
+    startup_phase_done (STARTUP_FIRST_FIX, hybris->ttff_start);
+    hybris->ttff_start = 0;
+
+    hybris->ttff_last = ttff;
+    hybris->ttff_min = hybris->ttff_count ? MIN (hybris->ttff_min, ttff) : ttff;
+    hybris->ttff_max = MAX (hybris->ttff_max, ttff);
+    hybris->ttff_total += ttff;
+    hybris->ttff_count++;
+    metrics_observe (METRIC_TTFF, ttff);
+    if (!hybris->duty_cycling) {
+        syslog(LOG_INFO, "GPS time to first fix %u ms", ttff);
+    }
+}
+
+/* Hybris GPS callbacks */
+GpsCallbacks callbacks = {
+  sizeof(GpsCallbacks),
+  location_callback,
   status_callback,
   sv_status_callback,
   nmea_callback,
@@ -291,479 +1375,2734 @@ GpsCallbacks callbacks = {
   acquire_wakelock_callback,
   release_wakelock_callback,
   create_thread_callback,
+  request_utc_time_callback,
+#if ANDROID_VERSION_MAJOR>=7
+  set_system_info_callback,
+  gnss_sv_info_callback,
+#endif
 };
 
-/* Geoclue interfaces implementations */
+/* Hybris geofencing, the callbacks are handed over to the main loop in
+ * idle sources, they are rare */
 
-static gboolean
-equal_or_nan (double a, double b)
+static void geoclue_hybris_emit_transition (GeoclueHybris *hybris,
+                                            GeoclueHybrisGeofence *fence,
+                                            guint transition,
+                                            const GpsLocation *location);
+static void geoclue_hybris_update_engine (GeoclueHybris *hybris);
+
+static void
+geofence_cancel_dwell (GeoclueHybrisGeofence *fence)
 {
-    if (isnan (a) && isnan (b)) {
-        return TRUE;
+    if (fence->dwell_source) {
+        g_source_remove (fence->dwell_source);
+        fence->dwell_source = 0;
     }
-    return a == b;
 }
 
-/* General  */
+#if ANDROID_VERSION_MAJOR>=5
+/* time after which the HAL reports a fence uncertain, ms */
+#define GEOFENCE_UNKNOWN_TIMER 30000
 
-static void
-geoclue_hybris_update_status (GeoclueHybris *hybris, GeoclueStatus status)
+const GpsGeofencingInterface* geofencing = NULL;
+
+typedef struct {
+    guint id;
+    int32_t transition;
+    GpsLocation location;
+} GeofenceHalTransition;
+
+static gboolean
+geofence_dwell_timeout (gpointer data)
 {
-    if (status != hybris->last_status) {
-        switch (status)
-        {
-            case GEOCLUE_STATUS_ACQUIRING:
-            syslog(LOG_INFO, "GPS acquiring location");
-            break;
-            case GEOCLUE_STATUS_AVAILABLE:
-            syslog(LOG_INFO, "GPS location acquired");
-            break;
-            case GEOCLUE_STATUS_UNAVAILABLE:
-            syslog(LOG_INFO, "GPS location unavailable");
-            break;
-            case GEOCLUE_STATUS_ERROR:
-            syslog(LOG_INFO, "GPS error");
-            break;
-            default:
+    GeoclueHybrisGeofence *fence = data;
+
+    fence->dwell_source = 0;
+    geoclue_hybris_emit_transition (hybris, fence, GEOFENCE_DWELL, &fence->location);
+    return FALSE;
+}
+
+static gboolean
+geofence_transition_idle (gpointer data)
+{
+    GeofenceHalTransition *event = data;
+    GeoclueHybrisGeofence *fence;
+
+    fence = g_hash_table_lookup (hybris->geofences, GUINT_TO_POINTER (event->id));
+    if (!fence || !fence->hardware || fence->paused) {
+        /* removed or moved to software meanwhile */
+        return FALSE;
+    }
+    fence->location = event->location;
+    switch (event->transition)
+    {
+        case GPS_GEOFENCE_ENTERED:
+        if (fence->fence.inside) {
             break;
         }
-        hybris->last_status = status;
-        /* make position and velocity invalid if no fix */
-        if (status != GEOCLUE_STATUS_AVAILABLE) {
-            hybris->last_pos_fields = GEOCLUE_POSITION_FIELDS_NONE;
-            hybris->last_velo_fields = GEOCLUE_VELOCITY_FIELDS_NONE;
+        fence->fence.inside = TRUE;
+        geoclue_hybris_emit_transition (hybris, fence, GEOFENCE_ENTER, &event->location);
+        /* the HAL has no dwell transition */
+        if (fence->fence.transitions & GEOFENCE_DWELL) {
+            fence->dwell_source = g_timeout_add (fence->fence.dwell_time,
+                                                 geofence_dwell_timeout, fence);
         }
-        gc_iface_geoclue_emit_status_changed (GC_IFACE_GEOCLUE (hybris),
-                                              status);
+        break;
+        case GPS_GEOFENCE_EXITED:
+        if (!fence->fence.inside) {
+            break;
+        }
+        fence->fence.inside = FALSE;
+        geofence_cancel_dwell (fence);
+        geoclue_hybris_emit_transition (hybris, fence, GEOFENCE_EXIT, &event->location);
+        break;
+        default:
+        /* uncertain is not reported */
+        break;
     }
+    return FALSE;
 }
 
 static gboolean
-geoclue_hybris_get_status (GcIfaceGeoclue *iface,
-                          GeoclueStatus  *status,
-                          GError        **error)
+geofence_add_failed_idle (gpointer data)
 {
-    GeoclueHybris *hybris = GEOCLUE_HYBRIS (iface);
-
-    *status = hybris->last_status;
+    GeoclueHybrisGeofence *fence = g_hash_table_lookup (hybris->geofences, data);
 
-    return TRUE;
+    if (!fence || !fence->hardware) {
+        return FALSE;
+    }
+    syslog(LOG_INFO, "Geofence %u evaluated in software", fence->fence.id);
+    fence->hardware = FALSE;
+    fence->fence.inside = FALSE;
+    geofence_cancel_dwell (fence);
+    if (!fence->paused) {
+        geofence_index_add (&hybris->geofence_index, &fence->fence);
+    }
+    geoclue_hybris_update_engine (hybris);
+    return FALSE;
 }
 
-static gboolean
-geoclue_hybris_set_options (GcIfaceGeoclue *gc,
-             GHashTable     *options,
-             GError        **error)
+static void
+geofence_transition_free (gpointer data)
 {
-    return TRUE;
+    g_free (data);
+    wakelock_release ();
 }
 
-/* Deinitialization */
-
+/* The chip wakes the system up for these, it stays awake until the
+ * transition is signalled */
 static void
-geoclue_hybris_shutdown (GcProvider *provider)
+geofence_transition_callback(int32_t geofence_id, GpsLocation* location,
+                             int32_t transition, GpsUtcTime timestamp)
 {
-    GeoclueHybris *hybris = GEOCLUE_HYBRIS (provider);
+    GeofenceHalTransition *event = g_new0 (GeofenceHalTransition, 1);
 
-    g_main_loop_quit (hybris->loop);
+    event->id = geofence_id;
+    event->transition = transition;
+    if (location) {
+        event->location = *location;
+    }
+    event->location.timestamp = timestamp;
+    wakelock_acquire ();
+    g_idle_add_full (G_PRIORITY_DEFAULT_IDLE, geofence_transition_idle, event,
+                     geofence_transition_free);
 }
 
 static void
-geoclue_hybris_dispose (GObject *obj)
+geofence_status_callback(int32_t status, GpsLocation* last_location)
 {
-    ((GObjectClass *) geoclue_hybris_parent_class)->dispose (obj);
+    syslog(LOG_INFO, "GPS hal geofencing %s",
+           status == GPS_GEOFENCE_AVAILABLE ? "available" : "unavailable");
 }
 
 static void
-geoclue_hybris_finalize (GObject *obj)
+geofence_add_callback(int32_t geofence_id, int32_t status)
 {
-    GeoclueHybris *hybris = GEOCLUE_HYBRIS (obj);
-    int i = 0;
+    if (status != GPS_GEOFENCE_OPERATION_SUCCESS) {
+        syslog(LOG_WARNING, "GPS hal cannot add geofence %d: %d", geofence_id, status);
+        g_idle_add (geofence_add_failed_idle, GUINT_TO_POINTER (geofence_id));
+    }
+}
 
-    if (gps) {
-        gps->stop();
-        gps->cleanup();
-        gps = NULL;
+static void
+geofence_operation_callback(int32_t geofence_id, int32_t status)
+{
+    if (status != GPS_GEOFENCE_OPERATION_SUCCESS &&
+        status != GPS_GEOFENCE_ERROR_ID_UNKNOWN) {
+        syslog(LOG_WARNING, "GPS hal geofence %d operation failed: %d",
+               geofence_id, status);
     }
+}
+
+GpsGeofenceCallbacks geofence_callbacks = {
+  geofence_transition_callback,
+  geofence_status_callback,
+  geofence_add_callback,
+  geofence_operation_callback,
+  geofence_operation_callback,
+  geofence_operation_callback,
+  create_thread_callback,
+};
+
+/* Transitions the HAL reports for a fence, dwelling is timed from enter to
+ * exit */
+static int
+geofence_hal_transitions (GeoclueHybrisGeofence *fence)
+{
+    int transitions = 0;
 
-    if (hybris->last_used_prn->len) {
-        g_array_remove_range (hybris->last_used_prn, 0, hybris->last_used_prn->len);
+    if (fence->fence.transitions & (GEOFENCE_ENTER | GEOFENCE_DWELL)) {
+        transitions |= GPS_GEOFENCE_ENTERED;
     }
-    if (hybris->last_sat_info->len) {
-        for (i = 0; i < hybris->last_sat_info->len; i++) {
-            g_value_array_free(g_ptr_array_index(hybris->last_sat_info, i));
-        }
-        g_ptr_array_remove_range (hybris->last_sat_info, 0, hybris->last_sat_info->len);
+    if (fence->fence.transitions & (GEOFENCE_EXIT | GEOFENCE_DWELL)) {
+        transitions |= GPS_GEOFENCE_EXITED;
     }
-    g_array_free (hybris->last_used_prn, TRUE);
-    hybris->last_used_prn = NULL;
-    g_ptr_array_free (hybris->last_sat_info, TRUE);
-    hybris->last_sat_info = NULL;
-    geoclue_accuracy_free (hybris->last_accuracy);
-    hybris->last_accuracy = NULL;
-    g_hash_table_destroy (hybris->connections);
-    hybris->connections = NULL;
-    free(hybris->owner);
-    hybris->owner = NULL;
-
-    ((GObjectClass *) geoclue_hybris_parent_class)->finalize (obj);
+    return transitions;
 }
 
-/* Position interface */
-
+/* Pauses a hardware fence in the HAL while the client has it paused or the
+ * GPS is disabled in the settings, and resumes it otherwise */
 static void
-geoclue_hybris_update_position (GeoclueHybris *hybris, GpsLocation* location)
+geofence_sync_hal (GeoclueHybrisGeofence *fence)
 {
-    if (!hybris->last_accuracy) {
+    gboolean pause = fence->paused || !hybris->powered;
+
+    if (!fence->hardware || pause == fence->hal_paused) {
         return;
     }
-    if (equal_or_nan (location->latitude, hybris->last_latitude) &&
-        equal_or_nan (location->longitude, hybris->last_longitude) &&
-        equal_or_nan (location->altitude, hybris->last_altitude)) {
-        /* position has not changed */
-        return;
+    if (pause) {
+        geofencing->pause_geofence (fence->fence.id);
+        fence->fence.inside = FALSE;
+        geofence_cancel_dwell (fence);
+    }
+    else {
+        geofencing->resume_geofence (fence->fence.id,
+                                     geofence_hal_transitions (fence));
     }
+    fence->hal_paused = pause;
+}
+#endif
 
-    hybris->last_latitude = location->latitude;
-    hybris->last_longitude = location->longitude;
-    hybris->last_altitude = location->altitude;
-    hybris->last_timestamp = (int)(location->timestamp/1000+0.5);
-    hybris->last_pos_fields = GEOCLUE_POSITION_FIELDS_LATITUDE | GEOCLUE_POSITION_FIELDS_LONGITUDE | GEOCLUE_POSITION_FIELDS_ALTITUDE;
-    geoclue_accuracy_set_details (hybris->last_accuracy,
-                                  GEOCLUE_ACCURACY_LEVEL_DETAILED,
-                                  location->accuracy, location->accuracy);
+/* Hybris raw measurements, the hal only measures while somebody reads
+ * them. The callbacks write straight into the ring of measurement-stream.c. */
 
-    hybris->last_pos_fields = GEOCLUE_POSITION_FIELDS_NONE;
-    hybris->last_pos_fields |= (isnan (location->latitude)) ?
-                             0 : GEOCLUE_POSITION_FIELDS_LATITUDE;
-    hybris->last_pos_fields |= (isnan (location->longitude)) ?
-                             0 : GEOCLUE_POSITION_FIELDS_LONGITUDE;
-    hybris->last_pos_fields |= (isnan (location->altitude)) ?
-                             0 : GEOCLUE_POSITION_FIELDS_ALTITUDE;
+#if ANDROID_VERSION_MAJOR>=5
+const GpsMeasurementInterface* measurement = NULL;
+const GpsNavigationMessageInterface* navigation = NULL;
+static gboolean measuring = FALSE;
 
-    gc_iface_position_emit_position_changed
-        (GC_IFACE_POSITION (hybris),
-         GEOCLUE_POSITION_FIELDS_LATITUDE | GEOCLUE_POSITION_FIELDS_LONGITUDE | GEOCLUE_POSITION_FIELDS_ALTITUDE,
-         (int)(location->timestamp/1000+0.5),
-         location->latitude, location->longitude, location->altitude,
-         hybris->last_accuracy);
+static void
+measurement_callback(GpsData* data)
+{
+    measurement_stream_add_gps (data);
 }
 
-static gboolean
-geoclue_hybris_get_position (GcIfacePosition *gc,
-              GeocluePositionFields *fields,
-              int                   *timestamp,
-              double                *latitude,
-              double                *longitude,
-              double                *altitude,
-              GeoclueAccuracy      **accuracy,
-              GError               **error)
+static void
+navigation_message_callback(GpsNavigationMessage* message)
 {
-    if (!hybris->last_accuracy) {
-        return FALSE;
-    }
-    *timestamp = (int)(hybris->last_timestamp+0.5);
-    *fields =  hybris->last_pos_fields;
-    *accuracy = geoclue_accuracy_copy (hybris->last_accuracy);
-    *latitude = hybris->last_latitude;
-    *longitude = hybris->last_longitude;
-    *altitude = hybris->last_altitude;
+    measurement_stream_add_gps_navigation (message);
+}
 
-    return TRUE;
+#if ANDROID_VERSION_MAJOR>=7
+static void
+gnss_measurement_data_callback(GnssData* data)
+{
+    measurement_stream_add_gnss (data);
+}
+
+static void
+gnss_navigation_data_callback(GnssNavigationMessage* message)
+{
+    measurement_stream_add_gnss_navigation (message);
+}
+#endif
+
+GpsMeasurementCallbacks measurement_callbacks = {
+  sizeof(GpsMeasurementCallbacks),
+  measurement_callback,
+#if ANDROID_VERSION_MAJOR>=7
+  gnss_measurement_data_callback,
+#endif
+};
+
+GpsNavigationMessageCallbacks navigation_callbacks = {
+  sizeof(GpsNavigationMessageCallbacks),
+  navigation_message_callback,
+#if ANDROID_VERSION_MAJOR>=7
+  gnss_navigation_data_callback,
+#endif
+};
+
+/* From measurement-stream.c, with the first subscriber and after the last */
+static void
+geoclue_hybris_set_measuring (gboolean active)
+{
+    int status;
+
+    if (active == measuring) {
+        return;
+    }
+    measuring = active;
+    if (active) {
+        syslog(LOG_INFO, "Starting GPS hal measurements");
+        if (measurement) {
+            status = measurement->init (&measurement_callbacks);
+            if (status != GPS_MEASUREMENT_OPERATION_SUCCESS) {
+                syslog(LOG_WARNING, "GPS hal measurement init failed: %d", status);
+            }
+        }
+        if (navigation) {
+            status = navigation->init (&navigation_callbacks);
+            if (status != GPS_NAVIGATION_MESSAGE_OPERATION_SUCCESS) {
+                syslog(LOG_WARNING, "GPS hal navigation message init failed: %d", status);
+            }
+        }
+    }
+    else {
+        syslog(LOG_INFO, "Stopping GPS hal measurements");
+        if (measurement) {
+            measurement->close ();
+        }
+        if (navigation) {
+            navigation->close ();
+        }
+    }
+}
+#endif
+
+/* Client geofences, stored in GeoclueHybris.geofences by id */
+
+#define HYBRIS_GEOFENCE_INTERFACE HYBRIS_DBUS_INTERFACE_PREFIX ".Geofence"
+
+static void
+geoclue_hybris_emit_transition (GeoclueHybris *hybris, GeoclueHybrisGeofence *fence,
+                                guint transition, const GpsLocation *location)
+{
+    if (!(fence->fence.transitions & transition) || !hybris->provider_conn) {
+        return;
+    }
+    hybris_dbus_emit_signal (hybris->provider_conn, fence->owner,
+                             HYBRIS_GEOFENCE_INTERFACE, "Transition",
+                             g_variant_new ("(uuxddd)", fence->fence.id, transition,
+                                            (gint64) location->timestamp,
+                                            location->latitude, location->longitude,
+                                            (location->flags & GPS_LOCATION_HAS_ACCURACY) ?
+                                            location->accuracy : NAN));
+}
+
+/* geofence_index callback */
+static void
+geoclue_hybris_software_transition (Geofence *fence, guint transition,
+                                    const GpsLocation *location, gpointer data)
+{
+    geoclue_hybris_emit_transition (data, (GeoclueHybrisGeofence *) fence,
+                                    transition, location);
+}
+
+static void
+geoclue_hybris_geofence_free (gpointer data)
+{
+    GeoclueHybrisGeofence *fence = data;
+
+#if ANDROID_VERSION_MAJOR>=5
+    if (fence->hardware && geofencing) {
+        geofencing->remove_geofence_area (fence->fence.id);
+    }
+#endif
+    geofence_cancel_dwell (fence);
+    geofence_index_remove (&hybris->geofence_index, &fence->fence);
+    g_free (fence->owner);
+    g_free (fence);
+}
+
+static gboolean
+geofence_has_owner (gpointer key, gpointer value, gpointer data)
+{
+    GeoclueHybrisGeofence *fence = value;
+
+    return strcmp (fence->owner, data) == 0;
+}
+
+static void
+geoclue_hybris_remove_geofences (GeoclueHybris *hybris, const char *owner)
+{
+    g_hash_table_foreach_remove (hybris->geofences, geofence_has_owner, (gpointer) owner);
+}
+
+/* Hardware fences are paused while the GPS is disabled in the settings */
+static void
+geoclue_hybris_power_geofences (GeoclueHybris *hybris)
+{
+#if ANDROID_VERSION_MAJOR>=5
+    GHashTableIter iter;
+    GeoclueHybrisGeofence *fence;
+
+    if (!geofencing) {
+        return;
+    }
+    g_hash_table_iter_init (&iter, hybris->geofences);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &fence)) {
+        geofence_sync_hal (fence);
+    }
+#endif
+}
+
+/* Engine control */
+
+static void
+geoclue_hybris_start_engine (GeoclueHybris *hybris)
+{
+    if (hybris->hal_batching) {
+        /* the FLP takes the fixes */
+        return;
+    }
+    if (!gps) {
+        /* started once the hal is taken over */
+        return;
+    }
+    if (!hybris->engine_on) {
+        if (!hybris->duty_cycling && hybris->state.ephemeris_time) {
+            syslog(LOG_INFO, "Starting with ephemeris of %d satellites from %" G_GINT64_FORMAT " s ago",
+                   __builtin_popcount (hybris->state.ephemeris_mask),
+                   (g_get_real_time () / 1000 - hybris->state.ephemeris_time) / 1000);
+        }
+        geoclue_hybris_inject_time ();
+        geoclue_hybris_inject_location (hybris);
+        gps->start();
+        startup_phase_done (STARTUP_ENGINE_START, hybris->first_reference);
+        metrics_inc (METRIC_ENGINE_STARTS);
+        hybris->engine_on = TRUE;
+        hybris->engine_on_since = g_get_monotonic_time ();
+        hybris->ttff_start = hybris->engine_on_since;
+    }
+}
+
+static void
+geoclue_hybris_stop_engine (GeoclueHybris *hybris)
+{
+    if (hybris->engine_on) {
+        gps->stop();
+        hybris->engine_on = FALSE;
+        hybris->engine_on_time += g_get_monotonic_time () - hybris->engine_on_since;
+        hybris->ttff_start = 0;
+    }
+}
+
+/* total engine on-time in ms, including the current session */
+static guint64
+geoclue_hybris_get_engine_on_time (GeoclueHybris *hybris)
+{
+    gint64 on_time = hybris->engine_on_time;
+
+    if (hybris->engine_on) {
+        on_time += g_get_monotonic_time () - hybris->engine_on_since;
+    }
+    return on_time / 1000;
+}
+
+static void
+geoclue_hybris_program_position_mode (GeoclueHybris *hybris,
+                                      GpsPositionRecurrence recurrence,
+                                      guint interval,
+                                      guint accuracy)
+{
+    gboolean restart = hybris->engine_on;
+
+    syslog(LOG_INFO, "GPS position mode: %s%s, interval %u ms, accuracy %u m",
+           recurrence == GPS_POSITION_RECURRENCE_SINGLE ? "single shot" : "periodic",
+           geoclue_hybris_get_hal_mode () == GPS_POSITION_MODE_MS_BASED ? " MS-based" : "",
+           interval, accuracy);
+
+    hybris->mode_recurrence = recurrence;
+    hybris->mode_interval = interval;
+    hybris->mode_accuracy = accuracy;
+
+    /* programmed when the hal is taken over */
+    if (!gps) {
+        return;
+    }
+    /* the mode only takes effect when the engine is (re)started */
+    if (restart) {
+        geoclue_hybris_stop_engine (hybris);
+    }
+    gps->set_position_mode(geoclue_hybris_get_hal_mode (),
+                           recurrence, interval, accuracy, 0);
+    if (restart) {
+        geoclue_hybris_start_engine (hybris);
+    }
+}
+
+/* Adaptive tracking
+ *
+ * With [Tracking] Adaptive enabled the fix interval follows the motion seen
+ * in the fixes: it doubles after a few stationary fixes with stable
+ * accuracy, up to MaxInterval, and drops back to what the clients asked for
+ * when the device moves fast. At DutyCycleInterval and above the engine is
+ * stopped after each fix and restarted by a timer, instead of letting the
+ * HAL schedule fixes on a running engine.
+ */
+
+#define STATIONARY_FIXES 3
+
+static void duty_cycle_cancel (GeoclueHybris *hybris);
+
+static void
+geoclue_hybris_apply_position_mode (GeoclueHybris *hybris)
+{
+    GpsPositionRecurrence recurrence = hybris->requested_recurrence;
+    guint interval = hybris->requested_interval;
+    gboolean duty_cycling = FALSE;
+
+    if (config.tracking_adaptive &&
+        recurrence == GPS_POSITION_RECURRENCE_PERIODIC) {
+        interval = MAX (interval, hybris->tracking_interval);
+        duty_cycling = config.tracking_duty_cycle_interval &&
+                       interval >= config.tracking_duty_cycle_interval;
+    }
+
+    if (duty_cycling != hybris->duty_cycling) {
+        syslog(LOG_INFO, "GPS duty cycling %s", duty_cycling ? "started" : "stopped");
+        hybris->duty_cycling = duty_cycling;
+        if (!duty_cycling && hybris->duty_cycle_source) {
+            /* engine is sleeping between fixes, wake it up now */
+            duty_cycle_cancel (hybris);
+            if (hybris->powered) {
+                geoclue_hybris_start_engine (hybris);
+            }
+        }
+    }
+    /* while duty cycling the engine runs only until it gets a fix,
+     * get that fix as fast as the clients allow */
+    if (duty_cycling) {
+        interval = hybris->requested_interval;
+    }
+
+    if (recurrence == hybris->mode_recurrence &&
+        interval == hybris->mode_interval &&
+        hybris->requested_accuracy == hybris->mode_accuracy) {
+        return;
+    }
+    geoclue_hybris_program_position_mode (hybris, recurrence, interval,
+                                          hybris->requested_accuracy);
+}
+
+static guint
+geoclue_hybris_get_fix_interval (GeoclueHybris *hybris)
+{
+    if (hybris->duty_cycling) {
+        return MAX (hybris->requested_interval, hybris->tracking_interval);
+    }
+    return hybris->mode_interval;
+}
+
+static void
+geoclue_hybris_adapt_interval (GeoclueHybris *hybris, GpsLocation* location)
+{
+    guint interval = hybris->tracking_interval;
+    gboolean degrading;
+
+    if (!config.tracking_adaptive || isnan (location->speed) ||
+        !(location->flags & GPS_LOCATION_HAS_SPEED)) {
+        return;
+    }
+
+    /* accuracy getting worse, do not trust that we are standing still */
+    degrading = hybris->accuracy_average > 0 &&
+                location->accuracy > 1.5 * hybris->accuracy_average;
+    hybris->accuracy_average = hybris->accuracy_average > 0 ?
+        0.8 * hybris->accuracy_average + 0.2 * location->accuracy :
+        location->accuracy;
+
+    if (location->speed >= config.tracking_moving_speed) {
+        hybris->stationary_fixes = 0;
+        interval = config.tracking_min_interval;
+    }
+    else if (location->speed < config.tracking_stationary_speed && !degrading) {
+        if (++hybris->stationary_fixes >= STATIONARY_FIXES) {
+            hybris->stationary_fixes = 0;
+            interval = MIN (interval * 2, config.tracking_max_interval);
+        }
+    }
+    else {
+        hybris->stationary_fixes = 0;
+        interval = MAX (interval / 2, config.tracking_min_interval);
+    }
+
+    if (interval != hybris->tracking_interval) {
+        syslog(LOG_INFO, "GPS tracking interval %u ms (speed %.1f m/s)",
+               interval, location->speed);
+        hybris->tracking_interval = interval;
+        geoclue_hybris_apply_position_mode (hybris);
+    }
+}
+
+static gboolean
+duty_cycle_timeout (gpointer data)
+{
+    GeoclueHybris *hybris = data;
+
+    hybris->duty_cycle_source = 0;
+    if (hybris->powered) {
+        geoclue_hybris_start_engine (hybris);
+    }
+    return FALSE;
+}
+
+static void
+duty_cycle_cancel (GeoclueHybris *hybris)
+{
+    if (hybris->duty_cycle_source) {
+        g_source_remove (hybris->duty_cycle_source);
+        hybris->duty_cycle_source = 0;
+    }
+}
+
+/* Called for every fix, puts the engine to sleep until the next one */
+static void
+geoclue_hybris_duty_cycle_fix (GeoclueHybris *hybris)
+{
+    if (!hybris->duty_cycling || !hybris->engine_on) {
+        return;
+    }
+    geoclue_hybris_stop_engine (hybris);
+    duty_cycle_cancel (hybris);
+    hybris->duty_cycle_source =
+        g_timeout_add (geoclue_hybris_get_fix_interval (hybris),
+                       duty_cycle_timeout, hybris);
+}
+
+/* Engine arbitration
+ *
+ * Batching clients are served by the FLP hal and clients that only monitor
+ * geofences by the hardware geofences. While every client is one of those,
+ * the GPS engine is off. Fences evaluated in software need the fixes.
+ */
+
+static gboolean
+geoclue_hybris_client_fence_only (GeoclueHybrisClient *client)
+{
+    /* a client that wants positions as well asks for an interval */
+    return client->n_geofences && !client->interval && !client->batch_size;
+}
+
+/* What the referenced clients want together, clients without a reference
+ * (SetOptions before AddReference) do not count */
+static void
+geoclue_hybris_aggregate_clients (GeoclueHybris *hybris, ClientAggregate *aggregate)
+{
+    GHashTableIter iter;
+    GeoclueHybrisClient *client;
+    ClientRequest request;
+
+    client_aggregate_init (aggregate);
+
+    g_hash_table_iter_init (&iter, hybris->connections);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &client)) {
+        if (client->ref_count == 0) {
+            continue;
+        }
+        request.interval = client->interval;
+        request.accuracy = client->accuracy;
+        request.single_shot = client->single_shot;
+        request.min_interval = client->limits.min_interval;
+        request.batching = client->batch_size != 0;
+        request.fence_only = geoclue_hybris_client_fence_only (client);
+        client_aggregate_add (aggregate, &request);
+    }
+}
+
+static void
+geoclue_hybris_update_engine (GeoclueHybris *hybris)
+{
+    ClientAggregate aggregate;
+    gboolean tracking;
+    gboolean batching;
+#if ANDROID_VERSION_MAJOR>=5
+    FlpBatchOptions options;
+#endif
+
+    geoclue_hybris_aggregate_clients (hybris, &aggregate);
+    batching = aggregate.batching;
+    /* the engine runs from the first AddReference until the clients say
+     * otherwise, and for the engine linger after the last one left */
+    tracking = aggregate.tracking ||
+               (aggregate.n_clients == 0 && !hybris->idle) ||
+               geofence_index_size (&hybris->geofence_index) > 0;
+
+#if ANDROID_VERSION_MAJOR>=5
+    if (flp && hybris->powered && batching && !tracking) {
+        memset (&options, 0, sizeof (options));
+        options.sources_to_use = FLP_TECH_MASK_GNSS;
+        options.flags = FLP_BATCH_WAKEUP_ON_FIFO_FULL;
+        options.period_ns = (int64_t) hybris->requested_interval * 1000000;
+        if (hybris->hal_batching) {
+            flp->update_batching_options (FLP_BATCH_ID, &options);
+        }
+        else {
+            duty_cycle_cancel (hybris);
+            geoclue_hybris_stop_engine (hybris);
+            if (flp->start_batching (FLP_BATCH_ID, &options) == FLP_RESULT_SUCCESS) {
+                syslog(LOG_INFO, "GPS batching in the FLP hal");
+                hybris->hal_batching = TRUE;
+            }
+            else {
+                syslog(LOG_WARNING, "FLP hal batching failed, using the GPS");
+            }
+        }
+    }
+    else if (hybris->hal_batching) {
+        syslog(LOG_INFO, "GPS batching stopped");
+        flp->stop_batching (FLP_BATCH_ID);
+        hybris->hal_batching = FALSE;
+    }
+#endif
+
+    if (hybris->powered && (tracking || (batching && !hybris->hal_batching))) {
+        /* while duty cycling the timer starts it */
+        if (!hybris->duty_cycle_source) {
+            geoclue_hybris_start_engine (hybris);
+        }
+    }
+    else {
+        duty_cycle_cancel (hybris);
+        geoclue_hybris_stop_engine (hybris);
+    }
+}
+
+/* Compute the fastest interval and tightest accuracy requested by any
+ * referenced client and reprogram the HAL when that aggregate changes */
+static void
+geoclue_hybris_update_position_mode (GeoclueHybris *hybris)
+{
+    ClientAggregate aggregate;
+    GpsPositionRecurrence recurrence;
+
+    geoclue_hybris_aggregate_clients (hybris, &aggregate);
+    if (aggregate.n_clients == 0) {
+        /* keep the HAL as it is until someone needs it */
+        return;
+    }
+
+    recurrence = GPS_POSITION_RECURRENCE_PERIODIC;
+    if (aggregate.single_shot &&
+        (g_atomic_int_get (&hal_capabilities) & GPS_CAPABILITY_SINGLE_SHOT)) {
+        recurrence = GPS_POSITION_RECURRENCE_SINGLE;
+    }
+
+    hybris->requested_recurrence = recurrence;
+    hybris->requested_interval = aggregate.interval ? aggregate.interval :
+                                 DEFAULT_FIX_INTERVAL;
+    hybris->requested_accuracy = aggregate.accuracy;
+    geoclue_hybris_apply_position_mode (hybris);
+    geoclue_hybris_update_engine (hybris);
+}
+
+/* The bus tells when a client goes away, also when it crashes without
+ * removing its reference */
+#define NAME_OWNER_CHANGED_RULE \
+    "type='signal',sender='" DBUS_SERVICE_DBUS "',interface='" DBUS_INTERFACE_DBUS "'," \
+    "member='NameOwnerChanged'"
+
+static void geoclue_hybris_client_vanished (GeoclueHybris *hybris, const char *name);
+
+static void
+name_owner_cb (DBusPendingCall *pc, gpointer data)
+{
+    DBusMessage *message = dbus_pending_call_steal_reply (pc);
+
+    /* NameHasNoOwner, the client was gone before the match was added */
+    if (dbus_message_get_type (message) == DBUS_MESSAGE_TYPE_ERROR) {
+        geoclue_hybris_client_vanished (hybris, data);
+    }
+    dbus_message_unref (message);
+    dbus_pending_call_unref (pc);
+}
+
+static void
+geoclue_hybris_watch_client (GeoclueHybris *hybris, const char *sender, gboolean watch)
+{
+    DBusMessage *methodcall;
+    DBusPendingCall *pending = NULL;
+    char *rule;
+
+    if (!hybris->provider_conn) {
+        return;
+    }
+    rule = g_strdup_printf (NAME_OWNER_CHANGED_RULE ",arg0='%s'", sender);
+    /* without an error the call does not wait for the reply */
+    if (!watch) {
+        dbus_bus_remove_match (hybris->provider_conn, rule, NULL);
+        g_free (rule);
+        return;
+    }
+    dbus_bus_add_match (hybris->provider_conn, rule, NULL);
+    g_free (rule);
+
+    /* the bus handles messages in order, the reply tells whether the
+     * client left before the match was in place */
+    methodcall = dbus_message_new_method_call (DBUS_SERVICE_DBUS, DBUS_PATH_DBUS,
+                                               DBUS_INTERFACE_DBUS, "GetNameOwner");
+    if (!methodcall) {
+        return;
+    }
+    dbus_message_append_args (methodcall, DBUS_TYPE_STRING, &sender, DBUS_TYPE_INVALID);
+    if (dbus_connection_send_with_reply (hybris->provider_conn, methodcall, &pending, -1) &&
+        pending) {
+        dbus_pending_call_set_notify (pending, name_owner_cb, g_strdup (sender), g_free);
+    }
+    dbus_message_unref (methodcall);
+}
+
+static GeoclueHybrisClient *
+geoclue_hybris_lookup_client (GeoclueHybris *hybris, const char *sender)
+{
+    GeoclueHybrisClient *client;
+
+    client = g_hash_table_lookup (hybris->connections, sender);
+    if (!client) {
+        client = g_new0 (GeoclueHybrisClient, 1);
+        client->sender = g_strdup (sender);
+        client->since = g_get_monotonic_time ();
+        client->first_fix = hybris->fix_count;
+        client->engine_on_time_start = geoclue_hybris_get_engine_on_time (hybris);
+        g_hash_table_insert (hybris->connections, g_strdup (sender), client);
+        geoclue_hybris_watch_client (hybris, sender, TRUE);
+    }
+    return client;
+}
+
+static void
+geoclue_hybris_client_free (gpointer data)
+{
+    GeoclueHybrisClient *client = data;
+
+    geoclue_hybris_watch_client (hybris, client->sender, FALSE);
+    geoclue_hybris_set_subscriptions (hybris, client, 0);
+    if (client->batch_source) {
+        g_source_remove (client->batch_source);
+    }
+    if (client->n_geofences) {
+        geoclue_hybris_remove_geofences (hybris, client->sender);
+    }
+    nmea_stream_unsubscribe (client->sender);
+#if ANDROID_VERSION_MAJOR>=5
+    measurement_stream_unsubscribe (client->sender);
+#endif
+    g_free (client->sender);
+    g_free (client);
+}
+
+/* Lifetime
+ *
+ * When the last client leaves the engine keeps running for EngineLinger,
+ * so that a client coming back right away gets a fix without a restart.
+ * After that the engine is stopped but the hal stays initialized, with the
+ * ephemeris it has, until the process exits after IdleTimeout without
+ * clients.
+ */
+
+static void
+geoclue_hybris_cancel_linger (GeoclueHybris *hybris)
+{
+    if (hybris->linger_source) {
+        g_source_remove (hybris->linger_source);
+        hybris->linger_source = 0;
+    }
+    if (hybris->idle_source) {
+        g_source_remove (hybris->idle_source);
+        hybris->idle_source = 0;
+    }
+}
+
+static gboolean
+engine_linger_timeout (gpointer data)
+{
+    GeoclueHybris *hybris = data;
+
+    hybris->linger_source = 0;
+    syslog(LOG_INFO, "No clients, GPS engine idle");
+    hybris->idle = TRUE;
+    geoclue_hybris_update_engine (hybris);
+    return FALSE;
+}
+
+static gboolean
+idle_timeout (gpointer data)
+{
+    GeoclueHybris *hybris = data;
+
+    hybris->idle_source = 0;
+    syslog(LOG_INFO, "No clients for %d s, terminating", config.lifetime_idle_timeout);
+    geoclue_hybris_stop_engine (hybris);
+    g_main_loop_quit (hybris->loop);
+    return FALSE;
+}
+
+/* Called when a client removed its last reference or went away */
+static void
+geoclue_hybris_client_left (GeoclueHybris *hybris)
+{
+    ClientAggregate aggregate;
+
+    geoclue_hybris_aggregate_clients (hybris, &aggregate);
+    if (aggregate.n_clients > 0) {
+        geoclue_hybris_update_position_mode (hybris);
+        return;
+    }
+    if (config.lifetime_idle_timeout == 0) {
+        geoclue_hybris_stop_engine (hybris);
+        g_main_loop_quit (hybris->loop);
+        return;
+    }
+
+    geoclue_hybris_cancel_linger (hybris);
+    hybris->idle = FALSE;
+    if (config.lifetime_engine_linger) {
+        hybris->linger_source = g_timeout_add_seconds (config.lifetime_engine_linger,
+                                                       engine_linger_timeout, hybris);
+    }
+    else {
+        hybris->idle = TRUE;
+    }
+    if (config.lifetime_idle_timeout > 0) {
+        hybris->idle_source = g_timeout_add_seconds (config.lifetime_idle_timeout,
+                                                     idle_timeout, hybris);
+    }
+    /* stops batching and fences-only operation of the clients that left */
+    geoclue_hybris_update_engine (hybris);
+}
+
+/* The client left the bus, whatever references it held */
+static void
+geoclue_hybris_client_vanished (GeoclueHybris *hybris, const char *name)
+{
+    GeoclueHybrisClient *client;
+    int ref_count;
+
+    if (!hybris->connections ||
+        !(client = g_hash_table_lookup (hybris->connections, name))) {
+        return;
+    }
+    ref_count = client->ref_count;
+    g_hash_table_remove (hybris->connections, name);
+    /* a client that only set options does not restart the lifetime
+     * timers */
+    if (ref_count) {
+        syslog(LOG_INFO, "Client %s disconnected with %d references", name, ref_count);
+        geoclue_hybris_client_left (hybris);
+    }
+}
+
+/* Geoclue interfaces implementations */
+
+static gboolean
+equal_or_nan (double a, double b)
+{
+    if (isnan (a) && isnan (b)) {
+        return TRUE;
+    }
+    return a == b;
+}
+
+/* General  */
+
+static void
+geoclue_hybris_update_status (GeoclueHybris *hybris, GeoclueStatus status)
+{
+    if (status != hybris->last_status) {
+        switch (status)
+        {
+            case GEOCLUE_STATUS_ACQUIRING:
+            syslog(LOG_INFO, "GPS acquiring location");
+            break;
+            case GEOCLUE_STATUS_AVAILABLE:
+            syslog(LOG_INFO, "GPS location acquired");
+            break;
+            case GEOCLUE_STATUS_UNAVAILABLE:
+            syslog(LOG_INFO, "GPS location unavailable");
+            break;
+            case GEOCLUE_STATUS_ERROR:
+            syslog(LOG_INFO, "GPS error");
+            break;
+            default:
+            break;
+        }
+        hybris->last_status = status;
+        /* make position and velocity invalid if no fix, the cached ones
+         * stay valid until the engine has a new one */
+        if (status != GEOCLUE_STATUS_AVAILABLE && !hybris->cached_fix) {
+            hybris->last_pos_fields = GEOCLUE_POSITION_FIELDS_NONE;
+            hybris->last_velo_fields = GEOCLUE_VELOCITY_FIELDS_NONE;
+        }
+        gc_iface_geoclue_emit_status_changed (GC_IFACE_GEOCLUE (hybris),
+                                              status);
+    }
+}
+
+static gboolean
+geoclue_hybris_get_status (GcIfaceGeoclue *iface,
+                          GeoclueStatus  *status,
+                          GError        **error)
+{
+    GeoclueHybris *hybris = GEOCLUE_HYBRIS (iface);
+
+    *status = hybris->last_status;
+
+    return TRUE;
+}
+
+/* Options understood by SetOptions, per calling connection:
+ *   OPTION_PREFIX "UpdateInterval"    (u) wanted fix interval in ms
+ *   OPTION_PREFIX "PreferredAccuracy" (u) wanted accuracy in meters
+ *   OPTION_PREFIX "SingleShot"        (b) only one fix is needed */
+#define OPTION_PREFIX "org.freedesktop.Geoclue.Providers.Hybris."
+
+static guint
+option_get_uint (GHashTable *options, const char *key, guint default_value)
+{
+    GValue *value = g_hash_table_lookup (options, key);
+
+    if (!value) {
+        return default_value;
+    }
+    if (G_VALUE_HOLDS_UINT (value)) {
+        return g_value_get_uint (value);
+    }
+    if (G_VALUE_HOLDS_INT (value)) {
+        return MAX (0, g_value_get_int (value));
+    }
+    return default_value;
+}
+
+static gboolean
+geoclue_hybris_set_options (GcIfaceGeoclue *gc,
+             GHashTable     *options,
+             GError        **error)
+{
+    GeoclueHybris *hybris = GEOCLUE_HYBRIS (gc);
+    GeoclueHybrisClient *client;
+    GValue *value;
+
+    /* dbus-glib does not tell us the caller, provider_message_filter
+     * remembered it when the message was dispatched */
+    if (!hybris->options_sender || !hybris->connections) {
+        return TRUE;
+    }
+    client = geoclue_hybris_lookup_client (hybris, hybris->options_sender);
+
+    client->interval = option_get_uint (options, OPTION_PREFIX "UpdateInterval",
+                                        client->interval);
+    client->accuracy = option_get_uint (options, OPTION_PREFIX "PreferredAccuracy",
+                                        client->accuracy);
+    value = g_hash_table_lookup (options, OPTION_PREFIX "SingleShot");
+    if (value && G_VALUE_HOLDS_BOOLEAN (value)) {
+        client->single_shot = g_value_get_boolean (value);
+    }
+
+    geoclue_hybris_update_position_mode (hybris);
+
+    return TRUE;
+}
+
+/* Startup
+ *
+ * The provider is D-Bus activated, so everything before the main loop
+ * runs delays the first client. The name is claimed and served from the
+ * state cache right away while the hal-open thread opens the GPS hal and
+ * runs the init of it and its extensions, the slow part of a cold start.
+ * Its interfaces are only taken over on the main loop, until then gps
+ * and the extensions are NULL: the position mode is just recorded, the
+ * engine stays off and fences are evaluated in software. The engine then
+ * waits for the first AddReference. Each phase is timed, see startup.h.
+ */
+
+/* On the main loop, with the hal-open thread joined */
+static void
+geoclue_hybris_adopt_hal (GeoclueHybris *hybris)
+{
+    HalOpen *open = hybris->hal_open;
+
+    gps = open->gps;
+    xtra = open->xtra;
+#if ANDROID_VERSION_MAJOR>=5
+    flp = open->flp;
+    geofencing = open->geofencing;
+    measurement = open->measurement;
+    navigation = open->navigation;
+#endif
+    hybris->hal_open = NULL;
+    g_free (open);
+}
+
+static gboolean
+hal_opened_idle (gpointer data)
+{
+    HalOpen *open = data;
+    gint64 started = g_get_monotonic_time ();
+
+    g_thread_join (open->thread);
+    geoclue_hybris_adopt_hal (hybris);
+    if (!gps) {
+        /* the hal-open thread cannot exit, the shutdown closes the state
+         * cache and the sockets */
+        syslog(LOG_ERR, "No GPS hal, terminating");
+        hybris->hal_failed = TRUE;
+        geoclue_hybris_update_status (hybris, GEOCLUE_STATUS_ERROR);
+        g_main_loop_quit (hybris->loop);
+        return FALSE;
+    }
+
+    geoclue_hybris_inject_xtra ();
+    /* need to be done before starting gps or no info will come out */
+    gps->set_position_mode(geoclue_hybris_get_hal_mode (), hybris->mode_recurrence,
+                           hybris->mode_interval, hybris->mode_accuracy, 0);
+    /* help gps by injecting time information */
+    geoclue_hybris_inject_time ();
+#if ANDROID_VERSION_MAJOR>=5
+    if (measuring) {
+        /* subscribed while the hal was opening */
+        measuring = FALSE;
+        geoclue_hybris_set_measuring (TRUE);
+    }
+#endif
+    startup_phase_done (STARTUP_HAL_READY, started);
+
+    geoclue_hybris_update_engine (hybris);
+    return FALSE;
+}
+
+/* Only fills in the HalOpen, the main loop takes it over */
+static gpointer
+hal_open_thread (gpointer data)
+{
+    HalOpen *open = data;
+    gint64 started = g_get_monotonic_time ();
+    int status;
+
+    open->gps = get_gps_interface();
+    startup_phase_done (STARTUP_HAL_OPEN, started);
+    if (!open->gps) {
+        g_idle_add (hal_opened_idle, open);
+        return NULL;
+    }
+
+    started = g_get_monotonic_time ();
+    status = open->gps->init(&callbacks);
+    if (status != 0) {
+        syslog(LOG_WARNING, "GPS hal init failed: %d", status);
+    }
+
+    if (open->gps->get_extension) {
+        open->xtra = open->gps->get_extension(GPS_XTRA_INTERFACE);
+        if (open->xtra && open->xtra->init(&xtra_callbacks) != 0) {
+            syslog(LOG_WARNING, "GPS hal XTRA init failed\n");
+            open->xtra = NULL;
+        }
+    }
+
+#if ANDROID_VERSION_MAJOR>=5
+    open->flp = get_flp_interface();
+    if (open->flp && open->flp->init(&flp_callbacks) != 0) {
+        syslog(LOG_WARNING, "FLP hal init failed, batching in software\n");
+        open->flp = NULL;
+    }
+    if (config.geofence_hardware && open->gps->get_extension) {
+        open->geofencing = open->gps->get_extension(GPS_GEOFENCING_INTERFACE);
+        if (open->geofencing) {
+            syslog(LOG_INFO, "Using the GPS hal geofencing");
+            open->geofencing->init(&geofence_callbacks);
+        }
+    }
+    if (open->gps->get_extension) {
+        open->measurement = open->gps->get_extension(GPS_MEASUREMENT_INTERFACE);
+        open->navigation = open->gps->get_extension(GPS_NAVIGATION_MESSAGE_INTERFACE);
+    }
+#endif
+    startup_phase_done (STARTUP_HAL_INIT, started);
+
+    g_idle_add (hal_opened_idle, open);
+    return NULL;
+}
+
+static void
+geoclue_hybris_open_hal (GeoclueHybris *hybris)
+{
+    hybris->hal_open = g_new0 (HalOpen, 1);
+    hybris->hal_open->thread = g_thread_new ("hal-open", hal_open_thread,
+                                             hybris->hal_open);
+}
+
+/* Deinitialization */
+
+static void
+geoclue_hybris_shutdown (GcProvider *provider)
+{
+    GeoclueHybris *hybris = GEOCLUE_HYBRIS (provider);
+
+    g_main_loop_quit (hybris->loop);
+}
+
+static void
+geoclue_hybris_dispose (GObject *obj)
+{
+    ((GObjectClass *) geoclue_hybris_parent_class)->dispose (obj);
+}
+
+static void
+geoclue_hybris_finalize (GObject *obj)
+{
+    GeoclueHybris *hybris = GEOCLUE_HYBRIS (obj);
+
+    duty_cycle_cancel (hybris);
+    geoclue_hybris_cancel_linger (hybris);
+    if (hybris->hal_open) {
+        /* still opening, wait for it so that what it opened is cleaned up */
+        g_thread_join (hybris->hal_open->thread);
+        g_idle_remove_by_data (hybris->hal_open);
+        geoclue_hybris_adopt_hal (hybris);
+    }
+#if ANDROID_VERSION_MAJOR>=5
+    if (flp) {
+        if (hybris->hal_batching) {
+            flp->stop_batching (FLP_BATCH_ID);
+            hybris->hal_batching = FALSE;
+        }
+        flp->cleanup();
+        flp = NULL;
+    }
+#endif
+    /* closes the measurements of the HAL */
+    measurement_stream_shutdown ();
+    if (gps) {
+        /* takes the fences out of the HAL */
+        g_hash_table_remove_all (hybris->geofences);
+#if ANDROID_VERSION_MAJOR>=5
+        geofencing = NULL;
+        measurement = NULL;
+        navigation = NULL;
+#endif
+        geoclue_hybris_stop_engine (hybris);
+        xtra = NULL;
+        gps->cleanup();
+        gps = NULL;
+    }
+    /* the hal threads should have returned with the cleanups */
+    hal_threads_join (HAL_THREADS_JOIN_TIMEOUT);
+    state_cache_write (&hybris->state);
+    state_cache_close ();
+    hal_trace_close ();
+    nmea_stream_shutdown ();
+    metrics_shutdown ();
+    wakelock_shutdown ();
+
+    if (hybris->provider_conn) {
+        dbus_connection_remove_filter (hybris->provider_conn,
+                                       provider_message_filter, hybris);
+        dbus_connection_unref (hybris->provider_conn);
+        hybris->provider_conn = NULL;
+    }
+    g_free (hybris->options_sender);
+    hybris->options_sender = NULL;
+
+    if (hybris->callback_source) {
+        g_source_destroy (hybris->callback_source);
+        g_source_unref (hybris->callback_source);
+        hybris->callback_source = NULL;
+    }
+    /* callback_ring stays, a hal thread left behind may still report */
+
+    satellite_table_free (hybris);
+    g_array_free (hybris->last_used_prn, TRUE);
+    hybris->last_used_prn = NULL;
+    g_ptr_array_free (hybris->last_sat_info, TRUE);
+    hybris->last_sat_info = NULL;
+    geoclue_accuracy_free (hybris->last_accuracy);
+    hybris->last_accuracy = NULL;
+    g_hash_table_destroy (hybris->connections);
+    hybris->connections = NULL;
+    g_hash_table_destroy (hybris->geofences);
+    hybris->geofences = NULL;
+    geofence_index_free (&hybris->geofence_index);
+    location_batch_free (&hybris->batch);
+
+    ((GObjectClass *) geoclue_hybris_parent_class)->finalize (obj);
+}
+
+/* Position interface */
+
+static void
+geoclue_hybris_update_position (GeoclueHybris *hybris, GpsLocation* location)
+{
+    if (!hybris->last_accuracy) {
+        return;
+    }
+    if (equal_or_nan (location->latitude, hybris->last_latitude) &&
+        equal_or_nan (location->longitude, hybris->last_longitude) &&
+        equal_or_nan (location->altitude, hybris->last_altitude)) {
+        /* position has not changed */
+        metrics_inc (METRIC_POSITIONS_UNCHANGED);
+        return;
+    }
+
+    hybris->last_latitude = location->latitude;
+    hybris->last_longitude = location->longitude;
+    hybris->last_altitude = location->altitude;
+    hybris->last_timestamp = (int)(location->timestamp/1000+0.5);
+    hybris->last_pos_fields = GEOCLUE_POSITION_FIELDS_LATITUDE | GEOCLUE_POSITION_FIELDS_LONGITUDE | GEOCLUE_POSITION_FIELDS_ALTITUDE;
+    geoclue_accuracy_set_details (hybris->last_accuracy,
+                                  GEOCLUE_ACCURACY_LEVEL_DETAILED,
+                                  location->accuracy, location->accuracy);
+
+    hybris->last_pos_fields = GEOCLUE_POSITION_FIELDS_NONE;
+    hybris->last_pos_fields |= (isnan (location->latitude)) ?
+                             0 : GEOCLUE_POSITION_FIELDS_LATITUDE;
+    hybris->last_pos_fields |= (isnan (location->longitude)) ?
+                             0 : GEOCLUE_POSITION_FIELDS_LONGITUDE;
+    hybris->last_pos_fields |= (isnan (location->altitude)) ?
+                             0 : GEOCLUE_POSITION_FIELDS_ALTITUDE;
+
+    hybris->state.position_time = location->timestamp;
+    hybris->state.position_fields = hybris->last_pos_fields;
+    hybris->state.latitude = location->latitude;
+    hybris->state.longitude = location->longitude;
+    hybris->state.altitude = location->altitude;
+    hybris->state.accuracy = location->accuracy;
+
+    if (!geoclue_hybris_dispatch_position (hybris, location)) {
+        return;
+    }
+    gc_iface_position_emit_position_changed
+        (GC_IFACE_POSITION (hybris),
+         GEOCLUE_POSITION_FIELDS_LATITUDE | GEOCLUE_POSITION_FIELDS_LONGITUDE | GEOCLUE_POSITION_FIELDS_ALTITUDE,
+         (int)(location->timestamp/1000+0.5),
+         location->latitude, location->longitude, location->altitude,
+         hybris->last_accuracy);
+    metrics_inc (METRIC_POSITIONS_EMITTED);
+}
+
+static gboolean
+geoclue_hybris_get_position (GcIfacePosition *gc,
+              GeocluePositionFields *fields,
+              int                   *timestamp,
+              double                *latitude,
+              double                *longitude,
+              double                *altitude,
+              GeoclueAccuracy      **accuracy,
+              GError               **error)
+{
+    if (!hybris->last_accuracy) {
+        return FALSE;
+    }
+    *timestamp = (int)(hybris->last_timestamp+0.5);
+    *fields =  hybris->last_pos_fields;
+    *accuracy = geoclue_accuracy_copy (hybris->last_accuracy);
+    *latitude = hybris->last_latitude;
+    *longitude = hybris->last_longitude;
+    *altitude = hybris->last_altitude;
+
+    return TRUE;
+}
+
+/* Velocity interface */
+
+/* The climb is only known while the filter runs; the signals carry 0 with
+ * the CLIMB field unset otherwise, never NaN */
+static double
+geoclue_hybris_climb (GeoclueHybris *hybris)
+{
+    if (!(hybris->last_velo_fields & GEOCLUE_VELOCITY_FIELDS_CLIMB) ||
+        isnan (hybris->last_climb)) {
+        return 0;
+    }
+    return hybris->last_climb;
+}
+
+static void
+geoclue_hybris_update_velocity (GeoclueHybris *hybris, GpsLocation* location,
+                                double climb)
+{
+    if (equal_or_nan (location->speed, hybris->last_speed) &&
+        equal_or_nan (location->bearing, hybris->last_bearing) &&
+        equal_or_nan (climb, hybris->last_climb)) {
+        /* velocity has not changed */
+        return;
+    }
+
+    hybris->last_speed = location->speed;
+    hybris->last_bearing = location->bearing;
+    hybris->last_climb = climb;
+
+    hybris->last_velo_fields = GEOCLUE_VELOCITY_FIELDS_NONE;
+    hybris->last_velo_fields |= (isnan (hybris->last_bearing)) ?
+        0 : GEOCLUE_VELOCITY_FIELDS_DIRECTION;
+    hybris->last_velo_fields |= (isnan (hybris->last_speed)) ?
+        0 : GEOCLUE_VELOCITY_FIELDS_SPEED;
+    hybris->last_velo_fields |= (isnan (hybris->last_climb)) ?
+        0 : GEOCLUE_VELOCITY_FIELDS_CLIMB;
+
+    hybris->state.velocity_fields = hybris->last_velo_fields;
+    hybris->state.speed = hybris->last_speed;
+    hybris->state.bearing = hybris->last_bearing;
+    hybris->state.climb = hybris->last_climb;
+
+    if (!geoclue_hybris_dispatch_velocity (hybris, location)) {
+        return;
+    }
+    gc_iface_velocity_emit_velocity_changed
+        (GC_IFACE_VELOCITY (hybris), hybris->last_velo_fields,
+         (int)(hybris->last_timestamp+0.5),
+         hybris->last_speed, hybris->last_bearing,
+         geoclue_hybris_climb (hybris));
+    metrics_inc (METRIC_VELOCITIES_EMITTED);
+}
+
+static gboolean
+geoclue_hybris_get_velocity (GcIfaceVelocity       *gc,
+              GeoclueVelocityFields *fields,
+              int                   *timestamp,
+              double                *speed,
+              double                *direction,
+              double                *climb,
+              GError               **error)
+{
+    GeoclueHybris *hybris = GEOCLUE_HYBRIS (gc);
+
+    *timestamp = (int)(hybris->last_timestamp+0.5);
+    *speed = hybris->last_speed;
+    *direction = hybris->last_bearing;
+    *climb = geoclue_hybris_climb (hybris);
+    *fields = hybris->last_velo_fields;
+
+    return TRUE;
+}
+
+/* Satellite interface */
+
+static void
+satellite_table_init (GeoclueHybris *hybris)
+{
+    SatelliteTable *table = &hybris->sat_table;
+    GValue val = G_VALUE_INIT;
+    int i, j;
+
+    g_value_init (&val, G_TYPE_INT);
+    for (i = 0; i < SV_MAX; i++) {
+        table->tuples[i] = g_value_array_new (4);
+        for (j = 0; j < 4; j++) {
+            g_value_array_append (table->tuples[i], &val);
+        }
+        /* the array and its preallocated values */
+        table->alloc_count += 2;
+    }
+    g_value_unset (&val);
+
+    hybris->last_sat_info = g_ptr_array_sized_new (SV_MAX);
+    hybris->last_used_prn = g_array_sized_new (FALSE, FALSE, sizeof (gint), SV_MAX);
+    /* each array and its data */
+    table->alloc_count += 4;
+}
+
+static void
+satellite_table_free (GeoclueHybris *hybris)
+{
+    SatelliteTable *table = &hybris->sat_table;
+    int i;
+
+    if (table->coalesce_source) {
+        g_source_remove (table->coalesce_source);
+        table->coalesce_source = 0;
+    }
+
+    for (i = 0; i < SV_MAX; i++) {
+        if (table->tuples[i]) {
+            g_value_array_free (table->tuples[i]);
+            table->tuples[i] = NULL;
+        }
+    }
+}
+
+static gboolean
+angle_changed (int a, int b)
+{
+    int diff = abs (a - b) % 360;
+
+    return MIN (diff, 360 - diff) > config.sat_angle_hysteresis;
+}
+
+/* Compare a report against the table, ignoring differences within the
+ * configured SNR and angle hysteresis and the order of the satellites */
+static gboolean
+satellite_table_changed (GeoclueHybris *hybris, const SvReport *report)
+{
+    SatelliteTable *table = &hybris->sat_table;
+    int i;
+
+    if (report->num_svs != hybris->last_satellite_visible) {
+        return TRUE;
+    }
+    for (i = 0; i < report->num_svs; i++) {
+        const SvEntry *sv = &report->svs[i];
+        int j = sv_index_lookup (&table->index, sv);
+
+        if (j < 0) {
+            return TRUE;
+        }
+        if (((sv->flags & SV_FLAG_USED_IN_FIX) != 0) != table->used[j] ||
+            abs ((int)sv->snr - table->snr[j]) > config.sat_snr_hysteresis ||
+            abs ((int)sv->elevation - table->elevation[j]) > config.sat_angle_hysteresis ||
+            angle_changed ((int)sv->azimuth, table->azimuth[j])) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static void
+geoclue_hybris_emit_satellites (GeoclueHybris *hybris)
+{
+    hybris->sat_table.last_emit_time = g_get_monotonic_time ();
+
+    if (!geoclue_hybris_dispatch_satellites (hybris)) {
+        return;
+    }
+    gc_iface_satellite_emit_satellite_changed (GC_IFACE_SATELLITE(hybris),
+        (int)(hybris->last_timestamp+0.5),
+        hybris->last_satellite_used,
+        hybris->last_satellite_visible,
+        hybris->last_used_prn,
+        hybris->last_sat_info);
+    metrics_inc (METRIC_SATELLITES_EMITTED);
+}
+
+static gboolean
+satellite_coalesce_timeout (gpointer data)
+{
+    GeoclueHybris *hybris = data;
+
+    hybris->sat_table.coalesce_source = 0;
+    geoclue_hybris_emit_satellites (hybris);
+
+    return FALSE;
+}
+
+/* Copies a report into the table and the arrays handed out over D-Bus */
+static void
+satellite_table_store (GeoclueHybris *hybris, const SvReport *report)
+{
+    SatelliteTable *table = &hybris->sat_table;
+    gchar *used_prn_data;
+    gpointer *sat_info_data;
+    int i = 0;
+
+    used_prn_data = hybris->last_used_prn->data;
+    sat_info_data = hybris->last_sat_info->pdata;
+
+    /* both arrays were sized for SV_MAX, this does not reallocate */
+    g_array_set_size (hybris->last_used_prn, 0);
+    g_ptr_array_set_size (hybris->last_sat_info, report->num_svs);
+
+    for (i = 0; i < hybris->last_satellite_visible; i++) {
+        sv_index_remove (&table->index, table->constellation[i], table->svid[i]);
+    }
+    sv_index_update (&table->index, NULL, 0, report->svs, report->num_svs);
+
+    for(i=0; i < report->num_svs; i++)
+    {
+        GValue *tuple = table->tuples[i]->values;
+        const SvEntry *sv = &report->svs[i];
+
+        table->prn[i] = sv_entry_prn (sv);
+        table->azimuth[i] = sv->azimuth;
+        table->elevation[i] = sv->elevation;
+        table->snr[i] = sv->snr;
+        table->used[i] = (sv->flags & SV_FLAG_USED_IN_FIX) != 0;
+        table->constellation[i] = sv->constellation;
+        table->svid[i] = sv->svid;
+        table->carrier_frequency[i] = sv_entry_carrier_frequency (sv);
+        if (table->used[i]) {
+            g_array_append_val (hybris->last_used_prn, table->prn[i]);
+        }
+        g_value_set_int (&tuple[0], table->prn[i]);
+        g_value_set_int (&tuple[1], table->azimuth[i]);
+        g_value_set_int (&tuple[2], table->elevation[i]);
+        g_value_set_int (&tuple[3], table->snr[i]);
+        g_ptr_array_index (hybris->last_sat_info, i) = table->tuples[i];
+    }
+
+    if (hybris->last_used_prn->data != used_prn_data ||
+        hybris->last_sat_info->pdata != sat_info_data) {
+        table->alloc_count += (hybris->last_used_prn->data != used_prn_data) +
+                              (hybris->last_sat_info->pdata != sat_info_data);
+        syslog(LOG_WARNING, "Satellite table reallocated (%u allocations)",
+               table->alloc_count);
+    }
+
+    hybris->last_satellite_used = hybris->last_used_prn->len;
+    hybris->last_satellite_visible = report->num_svs;
+}
+
+static void
+geoclue_hybris_update_satellites (GeoclueHybris *hybris, const SvReport *report)
+{
+    SatelliteTable *table = &hybris->sat_table;
+    gint64 elapsed;
+    int i;
+
+    if (!hybris->last_sat_info || !hybris->last_used_prn) {
+        return;
+    }
+
+    if (report->ephemeris_mask) {
+        hybris->state.ephemeris_time = g_get_real_time () / 1000;
+        hybris->state.ephemeris_mask = report->ephemeris_mask;
+    }
+
+    if (!satellite_table_changed (hybris, report)) {
+        metrics_inc (METRIC_SV_REPORTS_SUPPRESSED);
+        return;
+    }
+    satellite_table_store (hybris, report);
+
+    hybris->state.satellite_time = g_get_real_time () / 1000;
+    hybris->state.satellite_visible = hybris->last_satellite_visible;
+    hybris->state.satellite_used = hybris->last_satellite_used;
+    for (i = 0; i < report->num_svs; i++) {
+        hybris->state.satellites[i].constellation = table->constellation[i];
+        hybris->state.satellites[i].svid = table->svid[i];
+        hybris->state.satellites[i].azimuth = table->azimuth[i];
+        hybris->state.satellites[i].elevation = table->elevation[i];
+        hybris->state.satellites[i].snr = table->snr[i];
+        hybris->state.satellites[i].used = table->used[i];
+    }
+
+    /* emit right away unless a signal went out within the coalescing
+     * window, in which case one signal is sent at the end of the window */
+    if (table->coalesce_source) {
+        return;
+    }
+    elapsed = (g_get_monotonic_time () - table->last_emit_time) / 1000;
+    if (elapsed >= config.sat_coalesce_window) {
+        geoclue_hybris_emit_satellites (hybris);
+    }
+    else {
+        table->coalesce_source =
+            g_timeout_add (config.sat_coalesce_window - elapsed,
+                           satellite_coalesce_timeout, hybris);
+    }
+}
+
+static gboolean
+geoclue_hybris_get_satellite (GcIfaceSatellite *gc,
+               int              *timestamp,
+               int              *satellite_used,
+               int              *satellite_visible,
+               GArray          **used_prn,
+               GPtrArray       **sat_info,
+               GError          **error)
+{
+    if (!hybris->last_sat_info || !hybris->last_used_prn) {
+        return FALSE;
+    }
+    *timestamp = (int)(hybris->last_timestamp+0.5);
+    *satellite_used =  hybris->last_satellite_used;
+    *satellite_visible = hybris->last_satellite_visible;
+    *used_prn = hybris->last_used_prn;
+    *sat_info = hybris->last_sat_info;
+
+    return TRUE;
+}
+
+static gboolean
+geoclue_hybris_get_last_satellite (GcIfaceSatellite *gc,
+                    int              *timestamp,
+                    int              *satellite_used,
+                    int              *satellite_visible,
+                    GArray          **used_prn,
+                    GPtrArray       **sat_info,
+                    GError          **error)
+{
+    if (!hybris->last_sat_info || !hybris->last_used_prn) {
+        return FALSE;
+    }
+    *timestamp = (int)(hybris->last_timestamp+0.5);
+    *satellite_used =  hybris->last_satellite_used;
+    *satellite_visible = hybris->last_satellite_visible;
+    *used_prn = hybris->last_used_prn;
+    *sat_info = hybris->last_sat_info;
+
+    return TRUE;
+}
+
+/* State cache */
+
+/* Answers GetPosition, GetVelocity and GetLastSatellite from the last
+ * run until the engine reports again, with the cached timestamps */
+static void
+geoclue_hybris_restore_state (GeoclueHybris *hybris)
+{
+    SvReport report;
+    int i;
+
+    if (hybris->state.position_time) {
+        hybris->last_latitude = hybris->state.latitude;
+        hybris->last_longitude = hybris->state.longitude;
+        hybris->last_altitude = hybris->state.altitude;
+        hybris->last_timestamp = (int)(hybris->state.position_time/1000+0.5);
+        hybris->last_pos_fields = hybris->state.position_fields;
+        geoclue_accuracy_set_details (hybris->last_accuracy,
+                                      GEOCLUE_ACCURACY_LEVEL_DETAILED,
+                                      hybris->state.accuracy, hybris->state.accuracy);
+        hybris->last_speed = hybris->state.speed;
+        hybris->last_bearing = hybris->state.bearing;
+        hybris->last_velo_fields = hybris->state.velocity_fields;
+        hybris->cached_fix = TRUE;
+        hybris->last_climb =
+            (hybris->last_velo_fields & GEOCLUE_VELOCITY_FIELDS_CLIMB) ?
+            hybris->state.climb : NAN;
+    }
+
+    if (hybris->state.satellite_time) {
+        memset (&report, 0, sizeof (report));
+        report.num_svs = CLAMP (hybris->state.satellite_visible, 0, SV_MAX);
+        for (i = 0; i < report.num_svs; i++) {
+            StateCacheSatellite *sat = &hybris->state.satellites[i];
+
+            report.svs[i].constellation = sat->constellation;
+            report.svs[i].svid = sat->svid;
+            report.svs[i].azimuth = sat->azimuth;
+            report.svs[i].elevation = sat->elevation;
+            report.svs[i].snr = sat->snr;
+            report.svs[i].flags = sat->used ? SV_FLAG_USED_IN_FIX : 0;
+        }
+        satellite_table_store (hybris, &report);
+    }
+
+    syslog(LOG_INFO, "Restored state: fix from %" G_GINT64_FORMAT " s ago, %d satellites",
+           hybris->state.position_time ?
+           (g_get_real_time () / 1000 - hybris->state.position_time) / 1000 : -1,
+           hybris->last_satellite_visible);
+}
+
+/* Geoclue interface */
+
+static gboolean
+geoclue_hybris_get_provider_info (GcIfaceGeoclue  *gc,
+                   gchar          **name,
+                   gchar          **description,
+                   GError         **error)
+{
+    if (name) {
+        *name = g_strdup ("Hybris");
+    }
+    if (description) {
+        *description = g_strdup ("Hybris GPS provider");
+    }
+    if (error) {
+        *error = NULL;
+    }
+
+    return TRUE;
+}
+
+static void
+geoclue_hybris_add_reference (GcIfaceGeoclue        *gc,
+               DBusGMethodInvocation *context)
+{
+    char *sender;
+    GeoclueHybrisClient *client;
+    if (!hybris->connections) {
+        dbus_g_method_return (context);
+        return;
+    }
+
+    /* Update the hash of open connections */
+    sender = dbus_g_method_get_sender (context);
+    client = geoclue_hybris_lookup_client (hybris, sender);
+    client->ref_count++;
+    if (!hybris->first_reference) {
+        hybris->first_reference = g_get_monotonic_time ();
+        startup_phase_done (STARTUP_FIRST_CLIENT, hybris->bus_ready);
+        syslog(LOG_INFO, "First client, starting GPS engine");
+    }
+    else if (hybris->idle || hybris->linger_source) {
+        syslog(LOG_INFO, "Client back, %s", hybris->idle ? "restarting GPS engine" :
+               "GPS engine still running");
+    }
+    /* also the idle timer armed at startup */
+    geoclue_hybris_cancel_linger (hybris);
+    hybris->idle = FALSE;
+    free (sender);
+    geoclue_hybris_update_position_mode (hybris);
+    dbus_g_method_return (context);
+}
+
+static void
+geoclue_hybris_remove_reference (GcIfaceGeoclue        *gc,
+                  DBusGMethodInvocation *context)
+{
+    char *sender;
+    GeoclueHybrisClient *client;
+    if (!hybris->connections) {
+        dbus_g_method_return (context);
+        return;
+    }
+
+    sender = dbus_g_method_get_sender (context);
+    client = g_hash_table_lookup (hybris->connections, sender);
+    if (!client || client->ref_count == 0) {
+        /* still a reply, the caller would wait for it */
+        syslog(LOG_WARNING, "RemoveReference from %s without a reference", sender);
+        free (sender);
+        dbus_g_method_return (context);
+        return;
+    }
+
+    client->ref_count--;
+    if (client->ref_count == 0) {
+        g_hash_table_remove (hybris->connections, sender);
+    }
+    geoclue_hybris_client_left (hybris);
+    free (sender);
+    dbus_g_method_return (context);
+}
+
+static void
+process_property_name_value(DBusMessageIter *iter)
+{
+    const char *property;
+    gboolean state = 0;
+    DBusMessageIter sub;
+    dbus_message_iter_get_basic(iter, &property);
+    dbus_message_iter_next (iter);
+    if (strcmp(property, "Powered") == 0) {
+        if (dbus_message_iter_get_arg_type (iter) == DBUS_TYPE_VARIANT) {
+            dbus_message_iter_recurse(iter, &sub);
+        }
+        dbus_message_iter_get_basic(&sub, &state);
+        syslog(LOG_INFO, "GPS %s from settings", state ? "enabled" : "disabled");
+        hybris->powered = state;
+        geoclue_hybris_update_engine (hybris);
+        geoclue_hybris_power_geofences (hybris);
+    }
+}
+
+static void
+process_property_message(DBusMessage *msg)
+{
+    DBusMessageIter main_iter;
+    DBusMessageIter iter;
+    dbus_message_iter_init (msg, &main_iter);
+
+    if (dbus_message_iter_get_arg_type (&main_iter) == DBUS_TYPE_ARRAY) {
+        dbus_message_iter_recurse(&main_iter, &iter);
+    }
+    else {
+        dbus_message_iter_init (msg, &iter);
+    }
+    do {
+        if (dbus_message_iter_get_arg_type (&iter) == DBUS_TYPE_DICT_ENTRY) {
+            DBusMessageIter dict_iter;
+            dbus_message_iter_recurse(&iter, &dict_iter);
+            process_property_name_value(&dict_iter);
+        }
+        else {
+            process_property_name_value(&iter);
+        }
+    }
+    while (dbus_message_iter_next(&iter));
+}
+
+static DBusHandlerResult
+property_changed_signal(DBusConnection *connection,
+                        DBusMessage *msg, void *user_data)
+{
+    if (dbus_message_is_signal(msg, "net.connman.Technology",
+                               "PropertyChanged")) {
+        process_property_message(msg);
+    }
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+static void
+get_properties_cb (DBusPendingCall *pc, gpointer data)
+{
+    DBusMessage *message = dbus_pending_call_steal_reply (pc);
+
+    if (dbus_message_get_type (message) == DBUS_MESSAGE_TYPE_ERROR) {
+        syslog(LOG_ERR, "No reply from DBus");
+        //finalize((GObject *)hybris);
+        g_main_loop_quit (hybris->loop);
+    }
+    else {
+        startup_phase_done (STARTUP_SETTINGS, hybris->bus_ready);
+        process_property_message(message);
+    }
+
+    dbus_message_unref (message);
+    dbus_pending_call_unref (pc);
+}
+
+/* Stats interface */
+
+#define HYBRIS_STATS_INTERFACE HYBRIS_DBUS_INTERFACE_PREFIX ".Stats"
+
+/* GetTrackingStats () -> (u interval, b duty_cycling, t engine_on_time, u fixes)
+ * interval and engine_on_time are in ms, fixes counts every fix received */
+static GVariant *
+stats_get_tracking_stats (const char *sender, GVariant *parameters, GError **error)
+{
+    return g_variant_new ("(ubtu)",
+                          geoclue_hybris_get_fix_interval (hybris),
+                          hybris->duty_cycling,
+                          geoclue_hybris_get_engine_on_time (hybris),
+                          hybris->fix_count);
+}
+
+/* GetTtffStats () -> (u last, u min, u max, u average, u starts)
+ * time to first fix in ms of the engine starts that got a fix */
+static GVariant *
+stats_get_ttff_stats (const char *sender, GVariant *parameters, GError **error)
+{
+    return g_variant_new ("(uuuuu)",
+                          hybris->ttff_last,
+                          hybris->ttff_min,
+                          hybris->ttff_max,
+                          hybris->ttff_count ?
+                          (guint) (hybris->ttff_total / hybris->ttff_count) : 0,
+                          hybris->ttff_count);
+}
+
+/* GetClientStats () -> (a(suuubtut) clients)
+ * per client: unique name, references, interval and accuracy asked for
+ * (0 for none), single shot, time known (ms), fixes and engine on-time
+ * (ms) since then */
+static GVariant *
+stats_get_client_stats (const char *sender, GVariant *parameters, GError **error)
+{
+    GVariantBuilder builder;
+    GHashTableIter iter;
+    GeoclueHybrisClient *client;
+    guint64 engine_on_time = geoclue_hybris_get_engine_on_time (hybris);
+    gint64 now = g_get_monotonic_time ();
+    GVariant *clients;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(suuubtut)"));
+    g_hash_table_iter_init (&iter, hybris->connections);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &client)) {
+        g_variant_builder_add (&builder, "(suuubtut)",
+                               client->sender,
+                               (guint) client->ref_count,
+                               client->interval,
+                               client->accuracy,
+                               client->single_shot,
+                               (guint64) (now - client->since) / 1000,
+                               hybris->fix_count - client->first_fix,
+                               engine_on_time - client->engine_on_time_start);
+    }
+    clients = g_variant_builder_end (&builder);
+    return g_variant_new_tuple (&clients, 1);
+}
+
+/* GetWakelockStats () -> (b available, b held, u acquisitions, t held_time)
+ * held_time is the total time the wakelock was held, in ms */
+static GVariant *
+stats_get_wakelock_stats (const char *sender, GVariant *parameters, GError **error)
+{
+    gboolean available, held;
+    guint acquisitions;
+    guint64 held_time;
+
+    wakelock_get_stats (&available, &held, &acquisitions, &held_time);
+    return g_variant_new ("(bbut)", available, held, acquisitions, held_time / 1000);
+}
+
+/* GetThreads () -> (a(sub(iis)) threads)
+ * per thread the hal created: name, thread id, running, and the nice
+ * level, SCHED_FIFO priority and CPUs of its policy */
+static GVariant *
+stats_get_threads (const char *sender, GVariant *parameters, GError **error)
+{
+    GVariant *threads = hal_threads_describe ();
+
+    return g_variant_new_tuple (&threads, 1);
+}
+
+/* GetStartup () -> (a(stt) phases)
+ * per startup phase done so far, see startup.h: name, and duration and
+ * end since the launch, in us */
+static GVariant *
+stats_get_startup (const char *sender, GVariant *parameters, GError **error)
+{
+    GVariant *phases = startup_describe ();
+
+    return g_variant_new_tuple (&phases, 1);
+}
+
+/* GetMetrics () -> (a{st} counters, a(satatt) histograms)
+ * the counters of metrics.h by name, and per histogram its name, upper
+ * bounds, cumulative counts per bound and for all samples, and sum */
+static GVariant *
+stats_get_metrics (const char *sender, GVariant *parameters, GError **error)
+{
+    return g_variant_new ("(@a{st}@a(satatt))", metrics_get_counters (),
+                          metrics_get_histograms ());
+}
+
+/* Provider state on the metrics socket */
+static void
+geoclue_hybris_metrics_gauges (GString *page)
+{
+    ClientAggregate aggregate;
+    gboolean available, held;
+    guint acquisitions;
+    guint64 held_time;
+
+    geoclue_hybris_aggregate_clients (hybris, &aggregate);
+    wakelock_get_stats (&available, &held, &acquisitions, &held_time);
+    g_string_append_printf (page,
+        "# TYPE geoclue_hybris_engine_on gauge\n"
+        "geoclue_hybris_engine_on %d\n"
+        "# TYPE geoclue_hybris_engine_on_seconds_total counter\n"
+        "geoclue_hybris_engine_on_seconds_total %.3f\n"
+        "# TYPE geoclue_hybris_fix_interval_ms gauge\n"
+        "geoclue_hybris_fix_interval_ms %u\n"
+        "# TYPE geoclue_hybris_clients gauge\n"
+        "geoclue_hybris_clients %d\n"
+        "# TYPE geoclue_hybris_subscribers gauge\n"
+        "geoclue_hybris_subscribers %u\n"
+        "# TYPE geoclue_hybris_geofences gauge\n"
+        "geoclue_hybris_geofences %u\n"
+        "# TYPE geoclue_hybris_satellite_table_allocations_total counter\n"
+        "geoclue_hybris_satellite_table_allocations_total %u\n"
+        "# TYPE geoclue_hybris_wakelock_held gauge\n"
+        "geoclue_hybris_wakelock_held %d\n"
+        "# TYPE geoclue_hybris_wakelock_held_seconds_total counter\n"
+        "geoclue_hybris_wakelock_held_seconds_total %.3f\n",
+        hybris->engine_on,
+        geoclue_hybris_get_engine_on_time (hybris) / 1000.0,
+        geoclue_hybris_get_fix_interval (hybris),
+        aggregate.n_clients,
+        hybris->subscribers,
+        g_hash_table_size (hybris->geofences),
+        hybris->sat_table.alloc_count,
+        held, held_time / 1e6);
+}
+
+static const HybrisDBusMethod stats_methods[] = {
+    { "GetTrackingStats", "()", stats_get_tracking_stats },
+    { "GetTtffStats", "()", stats_get_ttff_stats },
+    { "GetClientStats", "()", stats_get_client_stats },
+    { "GetWakelockStats", "()", stats_get_wakelock_stats },
+    { "GetMetrics", "()", stats_get_metrics },
+    { "GetThreads", "()", stats_get_threads },
+    { "GetStartup", "()", stats_get_startup },
+    { NULL }
+};
+
+static GeoclueHybrisClient *
+lookup_referenced_client (const char *sender, GError **error)
+{
+    GeoclueHybrisClient *client = g_hash_table_lookup (hybris->connections, sender);
+
+    if (!client || client->ref_count == 0) {
+        g_set_error (error, GEOCLUE_ERROR, GEOCLUE_ERROR_FAILED,
+                     "AddReference is needed first");
+        return NULL;
+    }
+    return client;
+}
+
+/* Nmea interface */
+
+#define HYBRIS_NMEA_INTERFACE HYBRIS_DBUS_INTERFACE_PREFIX ".Nmea"
+
+/* Open () -> (h stream)
+ * stream is a socket carrying the NMEA sentences, see nmea-stream.h. The
+ * caller needs a reference, the stream is closed when it removes the last
+ * one or leaves the bus. */
+static GVariant *
+nmea_open (const char *sender, GVariant *parameters, GError **error)
+{
+    int fd;
+
+    if (!lookup_referenced_client (sender, error)) {
+        return NULL;
+    }
+    fd = nmea_stream_subscribe (sender);
+    if (fd < 0) {
+        g_set_error (error, GEOCLUE_ERROR, GEOCLUE_ERROR_FAILED,
+                     "Cannot create NMEA stream");
+        return NULL;
+    }
+    return g_variant_new ("(h)", fd);
+}
+
+static const HybrisDBusMethod nmea_methods[] = {
+    { "Open", "()", nmea_open },
+    { NULL }
+};
+
+/* Measurements interface
+ *
+ * Open () -> (h ring, h notify)
+ *   ring is the shared memory with the raw measurements and navigation
+ *   messages of the GPS hal, to be mapped read-only, and notify the socket
+ *   telling about new records, see measurement-stream.h. The caller needs
+ *   a reference, its notify sockets are closed when it removes the last
+ *   one or leaves the bus. The hal measures while a subscriber keeps notify
+ *   open and the engine runs for a client. Fails when the hal cannot
+ *   measure. */
+
+#if ANDROID_VERSION_MAJOR>=5
+#define HYBRIS_MEASUREMENTS_INTERFACE HYBRIS_DBUS_INTERFACE_PREFIX ".Measurements"
+
+static GVariant *
+measurements_open (const char *sender, GVariant *parameters, GError **error)
+{
+    int ring_fd, notify_fd;
+
+    if (!lookup_referenced_client (sender, error)) {
+        return NULL;
+    }
+    /* while the hal is opening the measurements start once it is ready */
+    if (!hybris->hal_open && !measurement && !navigation) {
+        g_set_error (error, GEOCLUE_ERROR, GEOCLUE_ERROR_NOT_IMPLEMENTED,
+                     "GPS hal has no measurements");
+        return NULL;
+    }
+    if (!measurement_stream_subscribe (sender, &ring_fd, &notify_fd)) {
+        g_set_error (error, GEOCLUE_ERROR, GEOCLUE_ERROR_FAILED,
+                     "Cannot create measurement stream");
+        return NULL;
+    }
+    return g_variant_new ("(hh)", ring_fd, notify_fd);
+}
+
+static const HybrisDBusMethod measurements_methods[] = {
+    { "Open", "()", measurements_open },
+    { NULL }
+};
+#endif
+
+/* Batch interface
+ *
+ * Start (u fixes, u seconds)
+ *   Batch the fixes for the caller, which needs a reference, and send them
+ *   in a PositionsBatch signal every fixes fixes or seconds seconds,
+ *   whichever comes first. 0 fixes means as many as the buffer holds, 0
+ *   seconds no time limit. While every client batches, the FLP hal does
+ *   the batching if present and the GPS engine is off.
+ * Stop ()
+ *   Sends what is pending and stops batching.
+ * Flush () -> (a(xdddddd) fixes)
+ *   Returns the pending fixes instead of signalling them.
+ * PositionsBatch (a(xdddddd) fixes)
+ *   Unicast to the batching client. Each fix is timestamp (ms since the
+ *   epoch), latitude, longitude, altitude, speed (m/s), bearing (degrees)
+ *   and accuracy (m), NaN when unknown. */
+
+#define HYBRIS_BATCH_INTERFACE HYBRIS_DBUS_INTERFACE_PREFIX ".Batch"
+
+static void
+geoclue_hybris_send_batch (GeoclueHybris *hybris, GeoclueHybrisClient *client)
+{
+    GVariant *fixes;
+
+    if (!location_batch_pending (&hybris->batch, client->batch_next)) {
+        return;
+    }
+    fixes = location_batch_collect (&hybris->batch, &client->batch_next);
+    hybris_dbus_emit_signal (hybris->provider_conn, client->sender,
+                             HYBRIS_BATCH_INTERFACE, "PositionsBatch",
+                             g_variant_new_tuple (&fixes, 1));
+}
+
+/* Called when fixes were added, flushed is set when they come from a
+ * flush of the FLP hal */
+static void
+geoclue_hybris_deliver_batches (GeoclueHybris *hybris, gboolean flushed)
+{
+    GHashTableIter iter;
+    GeoclueHybrisClient *client;
+
+    g_hash_table_iter_init (&iter, hybris->connections);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &client)) {
+        if (!client->batch_size || client->ref_count == 0) {
+            continue;
+        }
+        if ((flushed && client->batch_flush) ||
+            location_batch_pending (&hybris->batch, client->batch_next) >= client->batch_size) {
+            geoclue_hybris_send_batch (hybris, client);
+        }
+        if (flushed) {
+            client->batch_flush = FALSE;
+        }
+    }
+}
+
+static gboolean
+batch_timeout (gpointer data)
+{
+    GeoclueHybrisClient *client = data;
+
+#if ANDROID_VERSION_MAJOR>=5
+    if (hybris->hal_batching) {
+        /* sent when the fixes arrive in flp_locations_callback */
+        client->batch_flush = TRUE;
+        flp->flush_batched_locations ();
+        return TRUE;
+    }
+#endif
+    geoclue_hybris_send_batch (hybris, client);
+    return TRUE;
+}
+
+static GVariant *
+batch_start (const char *sender, GVariant *parameters, GError **error)
+{
+    GeoclueHybrisClient *client = lookup_referenced_client (sender, error);
+    guint fixes, seconds;
+
+    if (!client) {
+        return NULL;
+    }
+    g_variant_get (parameters, "(uu)", &fixes, &seconds);
+
+    if (!client->batch_size) {
+        client->batch_next = location_batch_head (&hybris->batch);
+    }
+    client->batch_size = fixes ? MIN (fixes, config.batch_capacity) : config.batch_capacity;
+    client->batch_timeout = seconds;
+    if (client->batch_source) {
+        g_source_remove (client->batch_source);
+        client->batch_source = 0;
+    }
+    if (seconds) {
+        client->batch_source = g_timeout_add_seconds (seconds, batch_timeout, client);
+    }
+    geoclue_hybris_update_position_mode (hybris);
+    return NULL;
+}
+
+static GVariant *
+batch_stop (const char *sender, GVariant *parameters, GError **error)
+{
+    GeoclueHybrisClient *client = lookup_referenced_client (sender, error);
+
+    if (!client || !client->batch_size) {
+        return NULL;
+    }
+    geoclue_hybris_send_batch (hybris, client);
+    client->batch_size = 0;
+    client->batch_timeout = 0;
+    client->batch_flush = FALSE;
+    if (client->batch_source) {
+        g_source_remove (client->batch_source);
+        client->batch_source = 0;
+    }
+    geoclue_hybris_update_position_mode (hybris);
+    return NULL;
+}
+
+static GVariant *
+batch_flush (const char *sender, GVariant *parameters, GError **error)
+{
+    GeoclueHybrisClient *client = lookup_referenced_client (sender, error);
+    GVariant *fixes;
+
+    if (!client) {
+        return NULL;
+    }
+    if (!client->batch_size) {
+        g_set_error (error, GEOCLUE_ERROR, GEOCLUE_ERROR_FAILED, "Not batching");
+        return NULL;
+    }
+    fixes = location_batch_collect (&hybris->batch, &client->batch_next);
+    return g_variant_new_tuple (&fixes, 1);
 }
 
-/* Velocity interface */
+static const HybrisDBusMethod batch_methods[] = {
+    { "Start", "(uu)", batch_start },
+    { "Stop", "()", batch_stop },
+    { "Flush", "()", batch_flush },
+    { NULL }
+};
 
-static void
-geoclue_hybris_update_velocity (GeoclueHybris *hybris, GpsLocation* location)
+/* Geofence interface
+ *
+ * Add (d latitude, d longitude, d radius, u transitions, u dwell_time) -> (u id)
+ *   Monitors a circle of radius meters for the caller, which needs a
+ *   reference. transitions is a mask of 1 (enter), 2 (exit) and 4 (dwell,
+ *   inside for dwell_time ms). The fence starts outside. It goes to the GPS
+ *   hal when that supports geofencing, else the fixes are checked against
+ *   it. A client with fences and without an UpdateInterval option does not
+ *   keep the GPS engine on for hardware fences.
+ * Remove (u id), Pause (u id), Resume (u id)
+ *   Fences are removed as well with the last reference of their client.
+ * Transition (u id, u transition, x timestamp, d latitude, d longitude,
+ *             d accuracy)
+ *   Unicast to the owner of the fence, timestamp is in ms since the epoch,
+ *   accuracy in m or NaN. */
+
+static GVariant *
+geofence_add (const char *sender, GVariant *parameters, GError **error)
 {
-    if (equal_or_nan (location->speed, hybris->last_speed) &&
-        equal_or_nan (location->bearing, hybris->last_bearing)) {
-        /* velocity has not changed */
-        return;
+    GeoclueHybrisClient *client = lookup_referenced_client (sender, error);
+    GeoclueHybrisGeofence *fence;
+    double latitude, longitude, radius;
+    guint transitions, dwell_time;
+
+    if (!client) {
+        return NULL;
+    }
+    g_variant_get (parameters, "(ddduu)", &latitude, &longitude, &radius,
+                   &transitions, &dwell_time);
+    if (!(fabs (latitude) <= 90) || !(fabs (longitude) <= 180) ||
+        !(radius > 0) || !transitions || (transitions & ~GEOFENCE_TRANSITIONS)) {
+        g_set_error (error, GEOCLUE_ERROR, GEOCLUE_ERROR_FAILED, "Invalid geofence");
+        return NULL;
     }
 
-    hybris->last_speed = location->speed;
-    hybris->last_bearing = location->bearing;
+    fence = g_new0 (GeoclueHybrisGeofence, 1);
+    do {
+        fence->fence.id = hybris->geofence_next_id;
+        /* the HAL takes int32 ids */
+        hybris->geofence_next_id = hybris->geofence_next_id % G_MAXINT32 + 1;
+    } while (g_hash_table_contains (hybris->geofences, GUINT_TO_POINTER (fence->fence.id)));
+    fence->fence.latitude = latitude;
+    fence->fence.longitude = longitude;
+    fence->fence.radius = radius;
+    fence->fence.transitions = transitions;
+    fence->fence.dwell_time = dwell_time;
+    fence->owner = g_strdup (sender);
+    g_hash_table_insert (hybris->geofences, GUINT_TO_POINTER (fence->fence.id), fence);
+    client->n_geofences++;
 
-    hybris->last_velo_fields = GEOCLUE_VELOCITY_FIELDS_NONE;
-    hybris->last_velo_fields |= (isnan (hybris->last_bearing)) ?
-        0 : GEOCLUE_VELOCITY_FIELDS_DIRECTION;
-    hybris->last_velo_fields |= (isnan (hybris->last_speed)) ?
-        0 : GEOCLUE_VELOCITY_FIELDS_SPEED;
+#if ANDROID_VERSION_MAJOR>=5
+    if (geofencing) {
+        /* moved to software by geofence_add_callback if this fails */
+        fence->hardware = TRUE;
+        geofencing->add_geofence_area (fence->fence.id, latitude, longitude, radius,
+                                       GPS_GEOFENCE_UNCERTAIN,
+                                       geofence_hal_transitions (fence),
+                                       config.geofence_responsiveness,
+                                       GEOFENCE_UNKNOWN_TIMER);
+        geofence_sync_hal (fence);
+    }
+#endif
+    if (!fence->hardware) {
+        geofence_index_add (&hybris->geofence_index, &fence->fence);
+    }
+    geoclue_hybris_update_engine (hybris);
 
-    gc_iface_velocity_emit_velocity_changed
-        (GC_IFACE_VELOCITY (hybris), hybris->last_velo_fields,
-         (int)(hybris->last_timestamp+0.5),
-         hybris->last_speed, hybris->last_bearing, 0);
+    return g_variant_new ("(u)", fence->fence.id);
 }
 
-static gboolean
-geoclue_hybris_get_velocity (GcIfaceVelocity       *gc,
-              GeoclueVelocityFields *fields,
-              int                   *timestamp,
-              double                *speed,
-              double                *direction,
-              double                *climb,
-              GError               **error)
+static GeoclueHybrisGeofence *
+geofence_lookup (const char *sender, GVariant *parameters, GError **error)
 {
-    GeoclueHybris *hybris = GEOCLUE_HYBRIS (gc);
+    GeoclueHybrisGeofence *fence;
+    guint id;
+
+    g_variant_get (parameters, "(u)", &id);
+    fence = g_hash_table_lookup (hybris->geofences, GUINT_TO_POINTER (id));
+    if (!fence || strcmp (fence->owner, sender) != 0) {
+        g_set_error (error, GEOCLUE_ERROR, GEOCLUE_ERROR_FAILED,
+                     "Unknown geofence %u", id);
+        return NULL;
+    }
+    return fence;
+}
 
-    *timestamp = (int)(hybris->last_timestamp+0.5);
-    *speed = hybris->last_speed;
-    *direction = hybris->last_bearing;
-    *climb = 0;
-    *fields = hybris->last_velo_fields;
+static GVariant *
+geofence_remove (const char *sender, GVariant *parameters, GError **error)
+{
+    GeoclueHybrisGeofence *fence = geofence_lookup (sender, parameters, error);
+    GeoclueHybrisClient *client;
 
-    return TRUE;
+    if (!fence) {
+        return NULL;
+    }
+    client = g_hash_table_lookup (hybris->connections, sender);
+    if (client) {
+        client->n_geofences--;
+    }
+    g_hash_table_remove (hybris->geofences, GUINT_TO_POINTER (fence->fence.id));
+    geoclue_hybris_update_engine (hybris);
+    return NULL;
 }
 
-/* Satellite interface */
-
-static void
-geoclue_hybris_update_satellites (GeoclueHybris *hybris, GpsSvStatus* sv_info)
+static GVariant *
+geofence_pause (const char *sender, GVariant *parameters, GError **error)
 {
-    int i = 0;
-    GValue val = G_VALUE_INIT;
-    g_value_init (&val, G_TYPE_INT);
+    GeoclueHybrisGeofence *fence = geofence_lookup (sender, parameters, error);
 
-    if (!hybris->last_sat_info || !hybris->last_used_prn) {
-        return;
+    if (!fence || fence->paused) {
+        return NULL;
     }
+    fence->paused = TRUE;
+#if ANDROID_VERSION_MAJOR>=5
+    geofence_sync_hal (fence);
+#endif
+    geofence_index_remove (&hybris->geofence_index, &fence->fence);
+    geoclue_hybris_update_engine (hybris);
+    return NULL;
+}
 
-    if (hybris->last_sat_info->len) {
-        for (i = 0; i < hybris->last_sat_info->len; i++) {
-            g_value_array_free(g_ptr_array_index(hybris->last_sat_info, i));
-        }
-        g_ptr_array_remove_range (hybris->last_sat_info, 0, hybris->last_sat_info->len);
+static GVariant *
+geofence_resume (const char *sender, GVariant *parameters, GError **error)
+{
+    GeoclueHybrisGeofence *fence = geofence_lookup (sender, parameters, error);
+
+    if (!fence || !fence->paused) {
+        return NULL;
     }
-    if (hybris->last_used_prn->len) {
-        g_array_remove_range (hybris->last_used_prn, 0, hybris->last_used_prn->len);
+    fence->paused = FALSE;
+#if ANDROID_VERSION_MAJOR>=5
+    geofence_sync_hal (fence);
+#endif
+    if (!fence->hardware) {
+        geofence_index_add (&hybris->geofence_index, &fence->fence);
     }
+    geoclue_hybris_update_engine (hybris);
+    return NULL;
+}
 
-    i = 0;
-    for(i=0; i < sv_info->num_svs; i++)
-    {
-        if (sv_info->used_in_fix_mask & (1 << (sv_info->sv_list[i].prn-1))) {
-            g_array_append_val (hybris->last_used_prn, sv_info->sv_list[i].prn);
-        }
-        GValueArray *sat = g_value_array_new (4);
-        g_value_set_int (&val, sv_info->sv_list[i].prn);
-        g_value_array_append (sat, &val);
-        g_value_set_int (&val, sv_info->sv_list[i].azimuth);
-        g_value_array_append (sat, &val);
-        g_value_set_int (&val, sv_info->sv_list[i].elevation);
-        g_value_array_append (sat, &val);
-        g_value_set_int (&val, sv_info->sv_list[i].snr);
-        g_value_array_append (sat, &val);
-        g_ptr_array_add (hybris->last_sat_info, sat);
-    }
-    g_value_unset (&val);
+static const HybrisDBusMethod geofence_methods[] = {
+    { "Add", "(ddduu)", geofence_add },
+    { "Remove", "(u)", geofence_remove },
+    { "Pause", "(u)", geofence_pause },
+    { "Resume", "(u)", geofence_resume },
+    { NULL }
+};
 
-    hybris->last_satellite_used = hybris->last_used_prn->len,
-    hybris->last_satellite_visible = sv_info->num_svs,
+/* Subscription interface
+ *
+ * Subscribe (u interfaces, u min_interval, d min_distance)
+ *   Instead of the broadcast Geoclue signals, the caller, which needs a
+ *   reference, gets the signals below for the interfaces (SUBSCRIBE_*)
+ *   unicast, at most one per min_interval ms and, for the position, only
+ *   after moving min_distance m. The engine runs at the fastest interval
+ *   asked by SetOptions or, without one, by Subscribe. While every client
+ *   is subscribed to an interface, its broadcast signal is not sent.
+ * Unsubscribe ()
+ * PositionChanged (i fields, x timestamp, d latitude, d longitude,
+ *                  d altitude, d accuracy)
+ * VelocityChanged (i fields, x timestamp, d speed, d direction, d climb)
+ * SatelliteChanged (x timestamp, i used, i visible,
+ *                   a(iiiibynd) prn, azimuth, elevation, snr, used,
+ *                               constellation, svid, carrier_frequency)
+ * FixChanged (i status, i position_fields, x timestamp, d latitude,
+ *             d longitude, d altitude, d accuracy, i velocity_fields,
+ *             d speed, d direction, d climb, i used, i visible)
+ *   With SUBSCRIBE_FIX, one signal per fix epoch in place of the position,
+ *   velocity and satellite signals, broadcast or not, that are not
+ *   subscribed to as well. StatusChanged is still broadcast. The epoch is
+ *   sent once the location and SV report the HAL sent for the previous
+ *   one have arrived, or FixWindow ms after its first report.
+ *   Timestamps are in ms since the epoch, fields are the Geoclue ones.
+ *   prn is the number of the Geoclue interface, constellation and svid
+ *   those of the GNSS hal, see sv-report.h, the carrier is in Hz. */
+
+#define HYBRIS_SUBSCRIPTION_INTERFACE HYBRIS_DBUS_INTERFACE_PREFIX ".Subscription"
+
+#define SUBSCRIBE_POSITION  (1 << 0)
+#define SUBSCRIBE_VELOCITY  (1 << 1)
+#define SUBSCRIBE_SATELLITE (1 << 2)
+#define SUBSCRIBE_FIX       (1 << 3)
+#define SUBSCRIBE_ALL (SUBSCRIBE_POSITION | SUBSCRIBE_VELOCITY | SUBSCRIBE_SATELLITE | \
+                       SUBSCRIBE_FIX)
+
+/* Sends body to the subscribers of the interface that are due, location
+ * is checked against min_distance from the last signal of the same
+ * interface. Returns whether a referenced client
+ * depends on the broadcast signal. */
+static gboolean
+geoclue_hybris_dispatch (GeoclueHybris *hybris, guint subscription, const char *member,
+                         gint64 timestamp, GpsLocation *location, GVariant *body)
+{
+    GHashTableIter iter;
+    GeoclueHybrisClient *client;
+    gboolean broadcast = FALSE;
+    int n_clients = 0;
+    SubscriptionSent *sent;
+
+    g_variant_ref_sink (body);
+    g_hash_table_iter_init (&iter, hybris->connections);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &client)) {
+        if (client->ref_count == 0) {
+            continue;
+        }
+        n_clients++;
+        if (!(client->subscriptions & subscription)) {
+            /* FixChanged has it */
+            if (!(client->subscriptions & SUBSCRIBE_FIX)) {
+                broadcast = TRUE;
+            }
+            continue;
+        }
+        sent = subscription == SUBSCRIBE_POSITION ? &client->sent_position :
+               subscription == SUBSCRIBE_VELOCITY ? &client->sent_velocity :
+               subscription == SUBSCRIBE_SATELLITE ? &client->sent_satellites :
+               &client->sent_fix;
+        if (!subscription_filter (sent, &client->limits, timestamp, location != NULL,
+                                  location ? location->latitude : 0,
+                                  location ? location->longitude : 0)) {
+            continue;
+        }
+        hybris_dbus_emit_signal (hybris->provider_conn, client->sender,
+                                 HYBRIS_SUBSCRIPTION_INTERFACE, member, body);
+        metrics_inc (METRIC_UNICAST_SIGNALS);
+    }
+    g_variant_unref (body);
 
-    gc_iface_satellite_emit_satellite_changed (GC_IFACE_SATELLITE(hybris),
-        (int)(hybris->last_timestamp+0.5),
-        hybris->last_satellite_used,
-        hybris->last_satellite_visible,
-        hybris->last_used_prn,
-        hybris->last_sat_info);
+    return broadcast || n_clients == 0;
 }
 
 static gboolean
-geoclue_hybris_get_satellite (GcIfaceSatellite *gc,
-               int              *timestamp,
-               int              *satellite_used,
-               int              *satellite_visible,
-               GArray          **used_prn,
-               GPtrArray       **sat_info,
-               GError          **error)
+geoclue_hybris_dispatch_position (GeoclueHybris *hybris, GpsLocation *location)
 {
-    if (!hybris->last_sat_info || !hybris->last_used_prn) {
-        return FALSE;
+    if (!hybris->subscribers) {
+        return TRUE;
     }
-    *timestamp = (int)(hybris->last_timestamp+0.5);
-    *satellite_used =  hybris->last_satellite_used;
-    *satellite_visible = hybris->last_satellite_visible;
-    *used_prn = hybris->last_used_prn;
-    *sat_info = hybris->last_sat_info;
-
-    return TRUE;
+    return geoclue_hybris_dispatch (hybris, SUBSCRIBE_POSITION, "PositionChanged",
+                                    location->timestamp,
+                                    isnan (location->latitude) ? NULL : location,
+                                    g_variant_new ("(ixdddd)", hybris->last_pos_fields,
+                                                   (gint64) location->timestamp,
+                                                   location->latitude, location->longitude,
+                                                   location->altitude, location->accuracy));
 }
 
 static gboolean
-geoclue_hybris_get_last_satellite (GcIfaceSatellite *gc,
-                    int              *timestamp,
-                    int              *satellite_used,
-                    int              *satellite_visible,
-                    GArray          **used_prn,
-                    GPtrArray       **sat_info,
-                    GError          **error)
+geoclue_hybris_dispatch_velocity (GeoclueHybris *hybris, GpsLocation *location)
 {
-    if (!hybris->last_sat_info || !hybris->last_used_prn) {
-        return FALSE;
+    if (!hybris->subscribers) {
+        return TRUE;
     }
-    *timestamp = (int)(hybris->last_timestamp+0.5);
-    *satellite_used =  hybris->last_satellite_used;
-    *satellite_visible = hybris->last_satellite_visible;
-    *used_prn = hybris->last_used_prn;
-    *sat_info = hybris->last_sat_info;
-
-    return TRUE;
+    return geoclue_hybris_dispatch (hybris, SUBSCRIBE_VELOCITY, "VelocityChanged",
+                                    location->timestamp, NULL,
+                                    g_variant_new ("(ixddd)", hybris->last_velo_fields,
+                                                   (gint64) location->timestamp,
+                                                   hybris->last_speed, hybris->last_bearing,
+                                                   geoclue_hybris_climb (hybris)));
 }
 
-/* Geoclue interface */
-
 static gboolean
-geoclue_hybris_get_provider_info (GcIfaceGeoclue  *gc,
-                   gchar          **name,
-                   gchar          **description,
-                   GError         **error)
+geoclue_hybris_dispatch_satellites (GeoclueHybris *hybris)
 {
-    if (name) {
-        *name = g_strdup ("Hybris");
-    }
-    if (description) {
-        *description = g_strdup ("Hybris GPS provider");
+    SatelliteTable *table = &hybris->sat_table;
+    GVariantBuilder builder;
+    gint64 timestamp;
+    int i;
+
+    if (!hybris->subscribers) {
+        return TRUE;
     }
-    if (error) {
-        *error = NULL;
+    timestamp = g_get_real_time () / 1000;
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(iiiibynd)"));
+    for (i = 0; i < hybris->last_satellite_visible; i++) {
+        g_variant_builder_add (&builder, "(iiiibynd)", table->prn[i], table->azimuth[i],
+                               table->elevation[i], table->snr[i], table->used[i],
+                               (guint8) table->constellation[i], (gint16) table->svid[i],
+                               table->carrier_frequency[i]);
     }
-
-    return TRUE;
+    return geoclue_hybris_dispatch (hybris, SUBSCRIBE_SATELLITE, "SatelliteChanged",
+                                    timestamp, NULL,
+                                    g_variant_new ("(xiia(iiiibynd))", timestamp,
+                                                   hybris->last_satellite_used,
+                                                   hybris->last_satellite_visible,
+                                                   &builder));
 }
 
 static void
-geoclue_hybris_add_reference (GcIfaceGeoclue        *gc,
-               DBusGMethodInvocation *context)
+fix_epoch_cancel (GeoclueHybris *hybris)
 {
-    char *sender;
-    int *pcount;
-    if (!hybris->connections)
-        return;
+    FixEpoch *epoch = &hybris->fix_epoch;
 
-    /* Update the hash of open connections */
-    sender = dbus_g_method_get_sender (context);
-    pcount = g_hash_table_lookup (hybris->connections, sender);
-    if (!pcount) {
-        pcount = g_malloc0 (sizeof (int));
-        g_hash_table_insert (hybris->connections, sender, pcount);
-    }
-    else {
-        free(sender);
+    if (epoch->window_source) {
+        g_source_remove (epoch->window_source);
+        epoch->window_source = 0;
     }
-    (*pcount)++;
-    if (g_hash_table_size (hybris->connections) == 1 && *pcount == 1) {
-        hybris->owner = strdup(sender);
-    }
-    dbus_g_method_return (context);
+    epoch->parts = 0;
 }
 
 static void
-geoclue_hybris_remove_reference (GcIfaceGeoclue        *gc,
-                  DBusGMethodInvocation *context)
+geoclue_hybris_flush_fix_epoch (GeoclueHybris *hybris)
 {
-    char *sender;
-    int *pcount;
-    if (!hybris->connections)
-        return;
+    FixEpoch *epoch = &hybris->fix_epoch;
+    GpsLocation *location = NULL;
+    gint64 timestamp;
 
-    sender = dbus_g_method_get_sender (context);
-    pcount = g_hash_table_lookup (hybris->connections, sender);
-    if (!pcount) {
-        free (sender);
+    if (!epoch->parts) {
         return;
     }
-
-    (*pcount)--;
-    if (*pcount == 0) {
-        g_hash_table_remove (hybris->connections, sender);
+    metrics_inc (METRIC_FIX_EPOCHS);
+    if ((epoch->parts & epoch->expected) != epoch->expected) {
+        metrics_inc (METRIC_FIX_EPOCHS_PARTIAL);
     }
-    if (g_hash_table_size (hybris->connections) == 0 || strcmp(sender, hybris->owner) == 0) {
-        gps->stop();
-        g_main_loop_quit (hybris->loop);
+    if (epoch->parts & FIX_EPOCH_LOCATION) {
+        timestamp = epoch->location.timestamp;
+        if (!isnan (epoch->location.latitude)) {
+            location = &epoch->location;
+        }
     }
-    free (sender);
-    dbus_g_method_return (context);
+    else {
+        timestamp = g_get_real_time () / 1000;
+    }
+    epoch->expected = epoch->parts;
+    fix_epoch_cancel (hybris);
+
+    geoclue_hybris_dispatch (hybris, SUBSCRIBE_FIX, "FixChanged", timestamp, location,
+                             g_variant_new ("(iixddddidddii)", hybris->last_status,
+                                            hybris->last_pos_fields, timestamp,
+                                            hybris->last_latitude, hybris->last_longitude,
+                                            hybris->last_altitude, hybris->state.accuracy,
+                                            hybris->last_velo_fields,
+                                            hybris->last_speed, hybris->last_bearing,
+                                            geoclue_hybris_climb (hybris),
+                                            hybris->last_satellite_used,
+                                            hybris->last_satellite_visible));
+}
+
+static gboolean
+fix_epoch_timeout (gpointer data)
+{
+    GeoclueHybris *hybris = data;
+
+    hybris->fix_epoch.window_source = 0;
+    geoclue_hybris_flush_fix_epoch (hybris);
+    return FALSE;
 }
 
+/* Called once the location or SV report of the HAL has been handled */
 static void
-process_property_name_value(DBusMessageIter *iter)
+geoclue_hybris_add_fix_epoch (GeoclueHybris *hybris, guint part, GpsLocation *location)
 {
-    const char *property;
-    gboolean state = 0;
-    DBusMessageIter sub;
-    dbus_message_iter_get_basic(iter, &property);
-    dbus_message_iter_next (iter);
-    if (strcmp(property, "Powered") == 0) {
-        if (dbus_message_iter_get_arg_type (iter) == DBUS_TYPE_VARIANT) {
-            dbus_message_iter_recurse(iter, &sub);
-        }
-        dbus_message_iter_get_basic(&sub, &state);
-        syslog(LOG_INFO, "GPS %s from settings", state ? "enabled" : "disabled");
-        if (state) {
-            gps->start();
-        }
-        else {
-            gps->stop();
-        }
+    FixEpoch *epoch = &hybris->fix_epoch;
+
+    if (!hybris->fix_subscribers) {
+        return;
+    }
+    /* a second report of a kind starts the next epoch */
+    if (epoch->parts & part) {
+        geoclue_hybris_flush_fix_epoch (hybris);
+    }
+    epoch->parts |= part;
+    if (location) {
+        epoch->location = *location;
+    }
+    if ((epoch->parts & epoch->expected) == epoch->expected ||
+        config.subscription_fix_window == 0) {
+        geoclue_hybris_flush_fix_epoch (hybris);
+    }
+    else if (!epoch->window_source) {
+        epoch->window_source = g_timeout_add (config.subscription_fix_window,
+                                              fix_epoch_timeout, hybris);
     }
 }
 
+/* Keeps the subscriber counts */
 static void
-process_property_message(DBusMessage *msg)
+geoclue_hybris_set_subscriptions (GeoclueHybris *hybris, GeoclueHybrisClient *client,
+                                  guint subscriptions)
 {
-    DBusMessageIter main_iter;
-    DBusMessageIter iter;
-    dbus_message_iter_init (msg, &main_iter);
-
-    if (dbus_message_iter_get_arg_type (&main_iter) == DBUS_TYPE_ARRAY) {
-        dbus_message_iter_recurse(&main_iter, &iter);
+    if (subscriptions && !client->subscriptions) {
+        hybris->subscribers++;
     }
-    else {
-        dbus_message_iter_init (msg, &iter);
+    else if (!subscriptions && client->subscriptions) {
+        hybris->subscribers--;
     }
-    do {
-        if (dbus_message_iter_get_arg_type (&iter) == DBUS_TYPE_DICT_ENTRY) {
-            DBusMessageIter dict_iter;
-            dbus_message_iter_recurse(&iter, &dict_iter);
-            process_property_name_value(&dict_iter);
-        }
-        else {
-            process_property_name_value(&iter);
-        }
+    if ((subscriptions & SUBSCRIBE_FIX) && !(client->subscriptions & SUBSCRIBE_FIX)) {
+        hybris->fix_subscribers++;
     }
-    while (dbus_message_iter_next(&iter));
+    else if (!(subscriptions & SUBSCRIBE_FIX) && (client->subscriptions & SUBSCRIBE_FIX) &&
+             --hybris->fix_subscribers == 0) {
+        /* nobody waits for the epoch in progress */
+        fix_epoch_cancel (hybris);
+    }
+    client->subscriptions = subscriptions;
 }
 
-static DBusHandlerResult
-property_changed_signal(DBusConnection *connection,
-                        DBusMessage *msg, void *user_data)
+static GVariant *
+subscription_subscribe (const char *sender, GVariant *parameters, GError **error)
 {
-    if (dbus_message_is_signal(msg, "net.connman.Technology",
-                               "PropertyChanged")) {
-        process_property_message(msg);
+    GeoclueHybrisClient *client = lookup_referenced_client (sender, error);
+    guint subscriptions, min_interval;
+    double min_distance;
+
+    if (!client) {
+        return NULL;
     }
-    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    g_variant_get (parameters, "(uud)", &subscriptions, &min_interval, &min_distance);
+    subscriptions &= SUBSCRIBE_ALL;
+    if (!subscriptions || isnan (min_distance) || min_distance < 0) {
+        g_set_error (error, GEOCLUE_ERROR, GEOCLUE_ERROR_FAILED,
+                     "Invalid subscription");
+        return NULL;
+    }
+    geoclue_hybris_set_subscriptions (hybris, client, subscriptions);
+    client->limits.min_interval = min_interval;
+    client->limits.min_distance = min_distance;
+    subscription_sent_reset (&client->sent_position);
+    subscription_sent_reset (&client->sent_velocity);
+    subscription_sent_reset (&client->sent_satellites);
+    subscription_sent_reset (&client->sent_fix);
+
+    geoclue_hybris_update_position_mode (hybris);
+    return NULL;
 }
 
-static void
-get_properties_cb (DBusPendingCall *pc, gpointer data)
+static GVariant *
+subscription_unsubscribe (const char *sender, GVariant *parameters, GError **error)
 {
-    DBusMessage *message = dbus_pending_call_steal_reply (pc);
+    GeoclueHybrisClient *client = lookup_referenced_client (sender, error);
 
-    if (dbus_message_get_type (message) == DBUS_MESSAGE_TYPE_ERROR) {
-        syslog(LOG_ERR, "No reply from DBus");
-        //finalize((GObject *)hybris);
-        g_main_loop_quit (hybris->loop);
+    if (!client) {
+        return NULL;
     }
-    else {
-        process_property_message(message);
+    if (client->subscriptions) {
+        geoclue_hybris_set_subscriptions (hybris, client, 0);
+        client->limits.min_interval = 0;
+        geoclue_hybris_update_position_mode (hybris);
     }
+    return NULL;
+}
 
-    dbus_message_unref (message);
-    dbus_pending_call_unref (pc);
+static const HybrisDBusMethod subscription_methods[] = {
+    { "Subscribe", "(uud)", subscription_subscribe },
+    { "Unsubscribe", "()", subscription_unsubscribe },
+    { NULL }
+};
+
+/* Remembers the caller of SetOptions, which dbus-glib does not pass on to
+ * geoclue_hybris_set_options, and serves the provider specific interfaces.
+ * Filters run before the message is dispatched to the object on the same
+ * thread. */
+static DBusHandlerResult
+provider_message_filter (DBusConnection *connection,
+                         DBusMessage *msg, void *user_data)
+{
+    GeoclueHybris *hybris = user_data;
+    const char *name, *old_owner, *new_owner;
+
+    if (dbus_message_is_signal (msg, DBUS_INTERFACE_DBUS, "NameOwnerChanged")) {
+        if (dbus_message_get_args (msg, NULL,
+                                   DBUS_TYPE_STRING, &name,
+                                   DBUS_TYPE_STRING, &old_owner,
+                                   DBUS_TYPE_STRING, &new_owner,
+                                   DBUS_TYPE_INVALID) &&
+            !*new_owner) {
+            geoclue_hybris_client_vanished (hybris, name);
+        }
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    }
+    if (dbus_message_is_method_call (msg, "org.freedesktop.Geoclue", "SetOptions") &&
+        dbus_message_has_path (msg, "/org/freedesktop/Geoclue/Providers/Hybris")) {
+        g_free (hybris->options_sender);
+        hybris->options_sender = g_strdup (dbus_message_get_sender (msg));
+    }
+    return hybris_dbus_dispatch (connection, msg);
 }
 
 /* Initialization */
@@ -785,32 +4124,72 @@ geoclue_hybris_class_init (GeoclueHybrisClass *klass)
 static void
 geoclue_hybris_init (GeoclueHybris *hybris)
 {
-    gc_provider_set_details (GC_PROVIDER (hybris),
-                            "org.freedesktop.Geoclue.Providers.Hybris",
-                            "/org/freedesktop/Geoclue/Providers/Hybris",
-                            "Hybris", "Hybris GPS provider");
+    gint64 started = g_get_monotonic_time ();
+
+    geoclue_hybris_load_config ();
+    startup_phase_done (STARTUP_CONFIG, started);
 
-    struct timeval tv;
     DBusError error;
     DBusMessage *methodcall;
     DBusPendingCall *pending;
-    int initok = 0;
+    started = g_get_monotonic_time ();
     hybris->last_accuracy = geoclue_accuracy_new (GEOCLUE_ACCURACY_LEVEL_NONE, 0, 0);
     hybris->last_latitude = 1.0;
     hybris->last_longitude = 1.0;
     hybris->last_altitude = 1.0;
     hybris->last_speed = 1.0;
     hybris->last_bearing = 1.0;
+    hybris->last_climb = NAN;
     hybris->last_timestamp = time(NULL);
     hybris->last_pos_fields = GEOCLUE_POSITION_FIELDS_NONE;
     hybris->last_velo_fields = GEOCLUE_VELOCITY_FIELDS_NONE;
     hybris->connections = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                                 g_free, g_free);
+                                                 g_free, geoclue_hybris_client_free);
+    hybris->engine_on = FALSE;
+    hybris->powered = FALSE;
+    /* until the first AddReference, the process exits if none comes */
+    hybris->idle = TRUE;
+    if (config.lifetime_idle_timeout > 0) {
+        hybris->idle_source = g_timeout_add_seconds (config.lifetime_idle_timeout,
+                                                     idle_timeout, hybris);
+    }
+    hybris->tracking_interval = config.tracking_min_interval;
 
     hybris->last_satellite_used = 0;
     hybris->last_satellite_visible = 0;
-    hybris->last_sat_info = g_ptr_array_new ();
-    hybris->last_used_prn = g_array_new (FALSE, FALSE, sizeof (gint));
+    satellite_table_init (hybris);
+    if (config.state_file && state_cache_open (config.state_file) &&
+        state_cache_read (&hybris->state)) {
+        geoclue_hybris_restore_state (hybris);
+    }
+    location_batch_init (&hybris->batch, config.batch_capacity);
+    hybris->geofences = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                               NULL, geoclue_hybris_geofence_free);
+    geofence_index_init (&hybris->geofence_index);
+    hybris->geofence_next_id = 1;
+    hybris->fix_epoch.expected = FIX_EPOCH_LOCATION | FIX_EPOCH_SATELLITES;
+    /* need to be programmed before starting gps or no info will come out,
+     * reprogrammed from the client options later */
+    hybris->requested_recurrence = GPS_POSITION_RECURRENCE_PERIODIC;
+    hybris->requested_interval = DEFAULT_FIX_INTERVAL;
+    hybris->requested_accuracy = 0;
+    geoclue_hybris_program_position_mode (hybris, GPS_POSITION_RECURRENCE_PERIODIC,
+                                          DEFAULT_FIX_INTERVAL, 0);
+    startup_phase_done (STARTUP_STATE, started);
+
+    /* HAL callbacks are handed over to the main loop */
+    main_thread = pthread_self ();
+    callback_ring = callback_ring_new (CALLBACK_RING_SIZE, sizeof (CallbackRecord));
+    hybris->callback_source = g_source_new (&callback_source_funcs, sizeof (GSource));
+    g_source_set_priority (hybris->callback_source, G_PRIORITY_HIGH);
+    g_source_attach (hybris->callback_source, NULL);
+
+    started = g_get_monotonic_time ();
+    /* claims the name, the calls are dispatched once the main loop runs */
+    gc_provider_set_details (GC_PROVIDER (hybris),
+                            "org.freedesktop.Geoclue.Providers.Hybris",
+                            "/org/freedesktop/Geoclue/Providers/Hybris",
+                            "Hybris", "Hybris GPS provider");
 
     dbus_error_init(&error);
 
@@ -835,17 +4214,45 @@ geoclue_hybris_init (GeoclueHybris *hybris)
 
     dbus_connection_add_filter(hybris->conn, property_changed_signal, NULL, NULL);
 
-    gps = get_gps_interface();
-
-    initok = gps->init(&callbacks);
+    /* the shared connection dbus-glib exports the provider on */
+    hybris->provider_conn = dbus_bus_get(GEOCLUE_DBUS_BUS, &error);
+    if (dbus_error_is_set(&error)) {
+        syslog(LOG_ERR, "Cannot get provider BUS connection: %s", error.message);
+        dbus_error_free(&error);
+    }
+    else {
+        hybris_dbus_add_interface (HYBRIS_STATS_INTERFACE, stats_methods);
+        hybris_dbus_add_interface (HYBRIS_NMEA_INTERFACE, nmea_methods);
+        hybris_dbus_add_interface (HYBRIS_BATCH_INTERFACE, batch_methods);
+        hybris_dbus_add_interface (HYBRIS_GEOFENCE_INTERFACE, geofence_methods);
+        hybris_dbus_add_interface (HYBRIS_SUBSCRIPTION_INTERFACE, subscription_methods);
+#if ANDROID_VERSION_MAJOR>=5
+        hybris_dbus_add_interface (HYBRIS_MEASUREMENTS_INTERFACE, measurements_methods);
+#endif
+        dbus_connection_add_filter(hybris->provider_conn, provider_message_filter,
+                                   hybris, NULL);
+    }
+    hybris->bus_ready = g_get_monotonic_time ();
+    startup_phase_done (STARTUP_BUS, started);
 
-    /* need to be done before starting gps or no info will come out */
-    gps->set_position_mode(GPS_POSITION_MODE_STANDALONE,
-                           GPS_POSITION_RECURRENCE_PERIODIC, 1000, 0, 0);
+    /* ready before the hal starts calling back */
+    if (config.trace_file) {
+        hal_trace_open (config.trace_file, (gsize) config.trace_size * 1024);
+    }
+    if (config.nmea_socket) {
+        nmea_stream_listen (config.nmea_socket);
+    }
+    if (config.metrics_socket) {
+        metrics_listen (config.metrics_socket, geoclue_hybris_metrics_gauges);
+    }
+    if (config.wakelock_enabled) {
+        wakelock_init ("geoclue-hybris");
+    }
 
-    /* help gps by injecting time information */
-    gettimeofday(&tv, NULL);
-    gps->inject_time(tv.tv_sec, tv.tv_sec, 0);
+#if ANDROID_VERSION_MAJOR>=5
+    measurement_stream_init (geoclue_hybris_set_measuring);
+#endif
+    geoclue_hybris_open_hal (hybris);
 
     geoclue_hybris_update_status (hybris, GEOCLUE_STATUS_UNAVAILABLE);
 
@@ -858,7 +4265,7 @@ geoclue_hybris_init (GeoclueHybris *hybris)
     if (methodcall == NULL) {
         syslog(LOG_ERR, "Cannot allocate DBus message!\n");
     }
-    /* now do a sync call and expect reply using pending call object */
+    /* the reply is handled once the main loop runs */
     if (!dbus_connection_send_with_reply(hybris->conn, methodcall, &pending, -1)) {
         syslog(LOG_ERR, "Failed to send DBus message!\n");
     }
@@ -905,6 +4312,9 @@ geoclue_hybris_satellite_init (GcIfaceSatelliteClass *iface)
 int
 main()
 {
+    gboolean failed;
+
+    startup_begin ();
     g_type_init();
     hybris = g_object_new (GEOCLUE_TYPE_HYBRIS, NULL);
 
@@ -912,9 +4322,13 @@ main()
 
     g_main_loop_run (hybris->loop);
 
+    failed = hybris->hal_failed;
     g_main_loop_unref (hybris->loop);
     g_object_unref (hybris);
 
+    if (failed) {
+        return 1;
+    }
     syslog(LOG_INFO, "Terminated successfully");
 
     return 0;
@@ -0,0 +1,275 @@
+/*
+ * Geoclue-provider-hybris
+ * geofence.c - Software geofence evaluation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <config.h>
+
+#include <math.h>
+
+#include "geofence.h"
+
+#define EARTH_RADIUS 6371000.0
+/* grid cell size, degrees, about 1 km north-south */
+#define CELL_SIZE 0.01
+#define LATITUDE_CELLS ((guint) (180 / CELL_SIZE))
+#define LONGITUDE_CELLS ((guint) (360 / CELL_SIZE))
+/* fences covering more cells go to the large list */
+#define MAX_FENCE_CELLS 64
+
+static double
+deg_to_rad (double deg)
+{
+    return deg * M_PI / 180.0;
+}
+
+static double
+rad_to_deg (double rad)
+{
+    return rad * 180.0 / M_PI;
+}
+
+double
+geofence_distance (double latitude1, double longitude1,
+                   double latitude2, double longitude2)
+{
+    double dlat = deg_to_rad (latitude2 - latitude1) / 2;
+    double dlon = deg_to_rad (longitude2 - longitude1) / 2;
+    double a = sin (dlat) * sin (dlat) +
+               cos (deg_to_rad (latitude1)) * cos (deg_to_rad (latitude2)) *
+               sin (dlon) * sin (dlon);
+
+    return 2 * EARTH_RADIUS * asin (MIN (1.0, sqrt (a)));
+}
+
+static guint
+cell_row (double latitude)
+{
+    return MIN ((guint) ((latitude + 90) / CELL_SIZE), LATITUDE_CELLS - 1);
+}
+
+static guint
+cell_column (double longitude)
+{
+    return MIN ((guint) ((longitude + 180) / CELL_SIZE), LONGITUDE_CELLS - 1);
+}
+
+static gpointer
+cell_key (guint row, guint column)
+{
+    return GUINT_TO_POINTER (row * LONGITUDE_CELLS + column);
+}
+
+/* Cells covered by the bounding box of the fence, FALSE when it does not
+ * fit the grid */
+static gboolean
+fence_cells (Geofence *fence, guint *row_min, guint *row_max,
+             guint *column_min, guint *column_max)
+{
+    double dlat = rad_to_deg (fence->radius / EARTH_RADIUS);
+    double max_latitude = fabs (fence->latitude) + dlat;
+    double dlon;
+
+    if (max_latitude >= 89) {
+        return FALSE;
+    }
+    dlon = dlat / cos (deg_to_rad (max_latitude));
+    if (fence->longitude - dlon < -180 || fence->longitude + dlon >= 180) {
+        /* across the antimeridian */
+        return FALSE;
+    }
+    *row_min = cell_row (fence->latitude - dlat);
+    *row_max = cell_row (fence->latitude + dlat);
+    *column_min = cell_column (fence->longitude - dlon);
+    *column_max = cell_column (fence->longitude + dlon);
+    return (*row_max - *row_min + 1) * (*column_max - *column_min + 1) <= MAX_FENCE_CELLS;
+}
+
+void
+geofence_index_init (GeofenceIndex *index)
+{
+    index->cells = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
+                                          (GDestroyNotify) g_ptr_array_unref);
+    index->large = g_ptr_array_new ();
+    index->inside = g_ptr_array_new ();
+    index->n_fences = 0;
+    index->stamp = 0;
+}
+
+void
+geofence_index_free (GeofenceIndex *index)
+{
+    g_hash_table_destroy (index->cells);
+    index->cells = NULL;
+    g_ptr_array_free (index->large, TRUE);
+    index->large = NULL;
+    g_ptr_array_free (index->inside, TRUE);
+    index->inside = NULL;
+    index->n_fences = 0;
+}
+
+void
+geofence_index_add (GeofenceIndex *index, Geofence *fence)
+{
+    guint row_min, row_max, column_min, column_max, row, column;
+
+    if (fence->indexed) {
+        return;
+    }
+    fence->indexed = TRUE;
+    fence->inside = FALSE;
+    fence->dwelled = FALSE;
+    index->n_fences++;
+
+    if (!fence_cells (fence, &row_min, &row_max, &column_min, &column_max)) {
+        g_ptr_array_add (index->large, fence);
+        return;
+    }
+    for (row = row_min; row <= row_max; row++) {
+        for (column = column_min; column <= column_max; column++) {
+            GPtrArray *cell = g_hash_table_lookup (index->cells, cell_key (row, column));
+
+            if (!cell) {
+                cell = g_ptr_array_new ();
+                g_hash_table_insert (index->cells, cell_key (row, column), cell);
+            }
+            g_ptr_array_add (cell, fence);
+        }
+    }
+}
+
+void
+geofence_index_remove (GeofenceIndex *index, Geofence *fence)
+{
+    guint row_min, row_max, column_min, column_max, row, column;
+
+    if (!fence->indexed) {
+        return;
+    }
+    fence->indexed = FALSE;
+    index->n_fences--;
+    if (fence->inside) {
+        g_ptr_array_remove_fast (index->inside, fence);
+        fence->inside = FALSE;
+    }
+
+    if (!fence_cells (fence, &row_min, &row_max, &column_min, &column_max)) {
+        g_ptr_array_remove_fast (index->large, fence);
+        return;
+    }
+    for (row = row_min; row <= row_max; row++) {
+        for (column = column_min; column <= column_max; column++) {
+            GPtrArray *cell = g_hash_table_lookup (index->cells, cell_key (row, column));
+
+            g_ptr_array_remove_fast (cell, fence);
+            if (cell->len == 0) {
+                g_hash_table_remove (index->cells, cell_key (row, column));
+            }
+        }
+    }
+}
+
+guint
+geofence_index_size (GeofenceIndex *index)
+{
+    return index->n_fences;
+}
+
+static void
+evaluate (GeofenceIndex *index, Geofence *fence, const GpsLocation *location,
+          double accuracy, GeofenceTransitionFunc func, gpointer user_data)
+{
+    double d;
+
+    if (fence->stamp == index->stamp) {
+        return;
+    }
+    fence->stamp = index->stamp;
+    d = geofence_distance (fence->latitude, fence->longitude,
+                           location->latitude, location->longitude);
+
+    if (!fence->inside) {
+        if (d <= fence->radius) {
+            fence->inside = TRUE;
+            fence->dwelled = FALSE;
+            fence->entered = location->timestamp;
+            g_ptr_array_add (index->inside, fence);
+            if (fence->transitions & GEOFENCE_ENTER) {
+                func (fence, GEOFENCE_ENTER, location, user_data);
+            }
+        }
+        else {
+            return;
+        }
+    }
+    /* only leave when the whole error circle is out, so that noise at the
+     * border does not toggle */
+    else if (d - accuracy > fence->radius) {
+        fence->inside = FALSE;
+        g_ptr_array_remove_fast (index->inside, fence);
+        if (fence->transitions & GEOFENCE_EXIT) {
+            func (fence, GEOFENCE_EXIT, location, user_data);
+        }
+        return;
+    }
+
+    if ((fence->transitions & GEOFENCE_DWELL) && !fence->dwelled &&
+        location->timestamp - fence->entered >= fence->dwell_time) {
+        fence->dwelled = TRUE;
+        func (fence, GEOFENCE_DWELL, location, user_data);
+    }
+}
+
+void
+geofence_index_update (GeofenceIndex          *index,
+                       const GpsLocation      *location,
+                       GeofenceTransitionFunc  func,
+                       gpointer                user_data)
+{
+    GPtrArray *cell;
+    double accuracy;
+    guint i;
+
+    if (!index->n_fences || !(location->flags & GPS_LOCATION_HAS_LAT_LONG) ||
+        isnan (location->latitude) || isnan (location->longitude)) {
+        return;
+    }
+    accuracy = (location->flags & GPS_LOCATION_HAS_ACCURACY) ? location->accuracy : 0;
+    /* every fence is looked at once per fix */
+    if (++index->stamp == 0) {
+        index->stamp = 1;
+    }
+
+    /* fences left are taken out of inside, walk it backwards */
+    for (i = index->inside->len; i > 0; i--) {
+        evaluate (index, g_ptr_array_index (index->inside, i - 1), location,
+                  accuracy, func, user_data);
+    }
+    cell = g_hash_table_lookup (index->cells,
+                                cell_key (cell_row (location->latitude),
+                                          cell_column (location->longitude)));
+    for (i = 0; cell && i < cell->len; i++) {
+        evaluate (index, g_ptr_array_index (cell, i), location, accuracy,
+                  func, user_data);
+    }
+    for (i = 0; i < index->large->len; i++) {
+        evaluate (index, g_ptr_array_index (index->large, i), location, accuracy,
+                  func, user_data);
+    }
+}
@@ -0,0 +1,89 @@
+/*
+ * Geoclue-provider-hybris
+ * geofence.h - Software geofence evaluation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef GEOFENCE_H
+#define GEOFENCE_H
+
+#include <android-config.h>
+#include <hardware/gps.h>
+
+#include <glib.h>
+
+/* Transitions, as reported on D-Bus */
+#define GEOFENCE_ENTER (1 << 0)
+#define GEOFENCE_EXIT  (1 << 1)
+#define GEOFENCE_DWELL (1 << 2)
+#define GEOFENCE_TRANSITIONS (GEOFENCE_ENTER | GEOFENCE_EXIT | GEOFENCE_DWELL)
+
+/* A circular fence. Owned by the caller, the index only links to it. */
+typedef struct {
+    guint id;
+    double latitude;
+    double longitude;
+    double radius;
+    /* GEOFENCE_* transitions to report */
+    guint transitions;
+    /* time inside before GEOFENCE_DWELL, ms */
+    guint dwell_time;
+
+    /* evaluation state */
+    gboolean inside;
+    gboolean dwelled;
+    GpsUtcTime entered;
+    gboolean indexed;
+    guint stamp;
+} Geofence;
+
+typedef void (*GeofenceTransitionFunc) (Geofence *fence, guint transition,
+                                        const GpsLocation *location,
+                                        gpointer user_data);
+
+/* Fences are bucketed in a fixed latitude/longitude grid, a fix only looks
+ * at the fences of its own cell, the fences it is inside of and the few
+ * fences too large for the grid. */
+typedef struct {
+    GHashTable *cells;
+    GPtrArray *large;
+    GPtrArray *inside;
+    guint n_fences;
+    guint stamp;
+} GeofenceIndex;
+
+void geofence_index_init (GeofenceIndex *index);
+void geofence_index_free (GeofenceIndex *index);
+
+/* Adding starts the fence outside, so a fix inside it reports an enter */
+void geofence_index_add (GeofenceIndex *index, Geofence *fence);
+void geofence_index_remove (GeofenceIndex *index, Geofence *fence);
+guint geofence_index_size (GeofenceIndex *index);
+
+/* Evaluates the fences near location and calls func for every transition
+ * they report. func must not add or remove fences. */
+void geofence_index_update (GeofenceIndex          *index,
+                            const GpsLocation      *location,
+                            GeofenceTransitionFunc  func,
+                            gpointer                user_data);
+
+/* Great circle distance, m */
+double geofence_distance (double latitude1, double longitude1,
+                          double latitude2, double longitude2);
+
+#endif /* GEOFENCE_H */
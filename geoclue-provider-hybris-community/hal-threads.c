@@ -0,0 +1,313 @@
+/*
+ * Geoclue-provider-hybris
+ * hal-threads.c - Threads created on behalf of the GPS hal
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+/* thread names and affinity */
+#define _GNU_SOURCE
+
+#include <config.h>
+
+#include <string.h>
+
+#include <errno.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <syslog.h>
+
+#include "hal-threads.h"
+
+/* pthread_setname_np takes 15 characters */
+#define THREAD_NAME_LENGTH 15
+
+typedef struct {
+    char *pattern;
+    int nice;
+    int realtime_priority;
+    char *cpus;
+    cpu_set_t cpu_set;
+} HalThreadPolicy;
+
+typedef struct {
+    char *name;
+    void (*start) (void *);
+    void *arg;
+    const HalThreadPolicy *policy;
+    pthread_t thread;
+    /* set by the thread, under the lock */
+    pid_t tid;
+    /* under the lock, cleared as the last use of the entry by the thread */
+    gboolean running;
+} HalThread;
+
+/* The hal gets the pthread_t and may join or detach the thread itself, so
+ * the threads are never joined here: an entry is dropped once its thread
+ * has returned from the start function. */
+static struct {
+    /* protects threads, policies are only added before the hal starts */
+    GMutex lock;
+    /* signalled when a thread returns */
+    GCond exited;
+    GPtrArray *threads;
+    GPtrArray *policies;
+} table;
+
+static gboolean
+parse_cpus (const char *cpus, cpu_set_t *set)
+{
+    char **ranges = g_strsplit (cpus, ",", -1);
+    gboolean ok = TRUE;
+    int i;
+
+    CPU_ZERO (set);
+    for (i = 0; ranges[i] && ok; i++) {
+        char *range = g_strstrip (ranges[i]);
+        char *end;
+        guint64 first, last, cpu;
+
+        first = g_ascii_strtoull (range, &end, 10);
+        last = first;
+        if (end == range) {
+            ok = FALSE;
+            break;
+        }
+        if (*end == '-') {
+            range = end + 1;
+            last = g_ascii_strtoull (range, &end, 10);
+            ok = end != range;
+        }
+        ok = ok && *end == '\0' && first <= last && last < CPU_SETSIZE;
+        for (cpu = first; ok && cpu <= last; cpu++) {
+            CPU_SET (cpu, set);
+        }
+    }
+    g_strfreev (ranges);
+    return ok && CPU_COUNT (set) > 0;
+}
+
+gboolean
+hal_threads_add_policy (const char *pattern, int nice,
+                        int realtime_priority, const char *cpus)
+{
+    HalThreadPolicy *policy = g_new0 (HalThreadPolicy, 1);
+
+    if (cpus && *cpus && !parse_cpus (cpus, &policy->cpu_set)) {
+        syslog(LOG_WARNING, "Invalid CPU list for hal threads %s: %s",
+               pattern ? pattern : "*", cpus);
+        g_free (policy);
+        return FALSE;
+    }
+    policy->pattern = g_strdup (pattern);
+    policy->nice = nice;
+    policy->realtime_priority = realtime_priority;
+    policy->cpus = cpus && *cpus ? g_strdup (cpus) : NULL;
+
+    if (!table.policies) {
+        table.policies = g_ptr_array_new ();
+    }
+    g_ptr_array_add (table.policies, policy);
+    return TRUE;
+}
+
+static const HalThreadPolicy *
+lookup_policy (const char *name)
+{
+    guint i;
+
+    for (i = 0; table.policies && i < table.policies->len; i++) {
+        const HalThreadPolicy *policy = g_ptr_array_index (table.policies, i);
+
+        if (!policy->pattern || g_pattern_match_simple (policy->pattern, name)) {
+            return policy;
+        }
+    }
+    return NULL;
+}
+
+/* On the thread itself, failures leave it with what it inherited */
+static void
+apply_policy (HalThread *thread)
+{
+    const HalThreadPolicy *policy = thread->policy;
+    struct sched_param param;
+
+    if (policy->realtime_priority > 0) {
+        memset (&param, 0, sizeof (param));
+        param.sched_priority = policy->realtime_priority;
+        if (sched_setscheduler (0, SCHED_FIFO, &param) < 0) {
+            syslog(LOG_WARNING, "Cannot make hal thread %s SCHED_FIFO: %s",
+                   thread->name, g_strerror (errno));
+        }
+    }
+    else if (policy->nice &&
+             setpriority (PRIO_PROCESS, thread->tid, policy->nice) < 0) {
+        syslog(LOG_WARNING, "Cannot set nice level of hal thread %s: %s",
+               thread->name, g_strerror (errno));
+    }
+    if (policy->cpus &&
+        sched_setaffinity (0, sizeof (cpu_set_t), &policy->cpu_set) < 0) {
+        syslog(LOG_WARNING, "Cannot pin hal thread %s to CPUs %s: %s",
+               thread->name, policy->cpus, g_strerror (errno));
+    }
+}
+
+static void *
+thread_main (void *data)
+{
+    HalThread *thread = data;
+    char name[THREAD_NAME_LENGTH + 1];
+
+    g_mutex_lock (&table.lock);
+    thread->tid = syscall (SYS_gettid);
+    g_mutex_unlock (&table.lock);
+    g_strlcpy (name, thread->name, sizeof (name));
+    pthread_setname_np (pthread_self (), name);
+    if (thread->policy) {
+        apply_policy (thread);
+    }
+
+    thread->start (thread->arg);
+
+    g_mutex_lock (&table.lock);
+    thread->running = FALSE;
+    g_cond_broadcast (&table.exited);
+    g_mutex_unlock (&table.lock);
+    return NULL;
+}
+
+static void
+thread_free (HalThread *thread)
+{
+    g_free (thread->name);
+    g_free (thread);
+}
+
+/* Called with the lock held, drops the threads that have returned */
+static void
+reap_locked (void)
+{
+    guint i = 0;
+
+    while (i < table.threads->len) {
+        HalThread *thread = g_ptr_array_index (table.threads, i);
+
+        if (thread->running) {
+            i++;
+            continue;
+        }
+        thread_free (thread);
+        g_ptr_array_remove_index_fast (table.threads, i);
+    }
+}
+
+pthread_t
+hal_threads_create (const char *name, void (*start) (void *), void *arg)
+{
+    HalThread *thread = g_new0 (HalThread, 1);
+    char *thread_name;
+    pthread_t handle;
+    int error;
+
+    thread->name = g_strdup (name && *name ? name : "hal");
+    thread->start = start;
+    thread->arg = arg;
+    thread->policy = lookup_policy (thread->name);
+    thread->running = TRUE;
+    /* the entry may be gone as soon as the lock is released */
+    thread_name = g_strdup (thread->name);
+
+    g_mutex_lock (&table.lock);
+    if (!table.threads) {
+        table.threads = g_ptr_array_new ();
+    }
+    reap_locked ();
+    /* Do not use a pthread_attr_t (we'd have to take care of bionic/glibc differences) */
+    error = pthread_create (&thread->thread, NULL, thread_main, thread);
+    if (error != 0) {
+        g_mutex_unlock (&table.lock);
+        syslog(LOG_ERR, "Cannot create hal thread %s: %s", thread_name,
+               g_strerror (error));
+        thread_free (thread);
+        g_free (thread_name);
+        return 0;
+    }
+    g_ptr_array_add (table.threads, thread);
+    handle = thread->thread;
+    g_mutex_unlock (&table.lock);
+
+    syslog(LOG_INFO, "Started hal thread %s", thread_name);
+    g_free (thread_name);
+    return handle;
+}
+
+void
+hal_threads_join (guint timeout)
+{
+    gint64 deadline = g_get_monotonic_time () + (gint64) timeout * 1000;
+    guint i;
+
+    if (!table.threads) {
+        return;
+    }
+
+    g_mutex_lock (&table.lock);
+    for (;;) {
+        reap_locked ();
+        if (!table.threads->len ||
+            !g_cond_wait_until (&table.exited, &table.lock, deadline)) {
+            break;
+        }
+    }
+    reap_locked ();
+    for (i = 0; i < table.threads->len; i++) {
+        HalThread *thread = g_ptr_array_index (table.threads, i);
+
+        /* stuck in the hal, nothing more can be done about it; it still
+         * uses its entry, which is left behind */
+        syslog(LOG_WARNING, "Hal thread %s did not exit", thread->name);
+    }
+    g_ptr_array_set_size (table.threads, 0);
+    g_mutex_unlock (&table.lock);
+}
+
+GVariant *
+hal_threads_describe (void)
+{
+    GVariantBuilder builder;
+    guint i;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sub(iis))"));
+    g_mutex_lock (&table.lock);
+    for (i = 0; table.threads && i < table.threads->len; i++) {
+        HalThread *thread = g_ptr_array_index (table.threads, i);
+        const HalThreadPolicy *policy = thread->policy;
+
+        g_variant_builder_add (&builder, "(sub(iis))", thread->name,
+                               (guint32) thread->tid,
+                               thread->running,
+                               policy ? policy->nice : 0,
+                               policy ? policy->realtime_priority : 0,
+                               policy && policy->cpus ? policy->cpus : "");
+    }
+    g_mutex_unlock (&table.lock);
+    return g_variant_builder_end (&builder);
+}
@@ -0,0 +1,50 @@
+/*
+ * Geoclue-provider-hybris
+ * hal-threads.h - Threads created on behalf of the GPS hal
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef HAL_THREADS_H
+#define HAL_THREADS_H
+
+#include <pthread.h>
+
+#include <glib.h>
+
+/* Scheduling for the threads whose name matches pattern, a glob, NULL
+ * matches every thread. The first policy added that matches is used.
+ * realtime_priority > 0 runs the thread SCHED_FIFO instead of at nice,
+ * cpus is a list like "0-3,6", NULL or empty for any CPU. Returns FALSE
+ * when cpus cannot be parsed. */
+gboolean hal_threads_add_policy (const char *pattern, int nice,
+                                 int realtime_priority, const char *cpus);
+
+/* For the create_thread_cb of the hal callbacks. The thread is named, gets
+ * its policy and is kept in the thread table until it returns. The hal owns
+ * the returned handle: it is never joined or detached here. */
+pthread_t hal_threads_create (const char *name, void (*start) (void *), void *arg);
+
+/* Waits at most timeout ms in total for every thread to return, those still
+ * running are left behind. Call once the hal has been cleaned up. */
+void hal_threads_join (guint timeout);
+
+/* a(sub(iis)): name, thread id, running, and the nice level, SCHED_FIFO
+ * priority and CPUs it got */
+GVariant *hal_threads_describe (void);
+
+#endif /* HAL_THREADS_H */
@@ -0,0 +1,397 @@
+/*
+ * Geoclue-provider-hybris
+ * hal-trace.c - Binary trace of the GPS HAL callbacks
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <syslog.h>
+
+#include "hal-trace.h"
+
+/* File layout: a HalTraceHeader followed by the data area. The data area
+ * holds records of a HalTraceRecord and its payload, padded to 8 bytes.
+ * Live records run from tail to head, wrapping back to the start of the
+ * data area where a record does not fit; the rest of the area is then
+ * marked with a HAL_TRACE_WRAP record unless too short for one. */
+
+#define HAL_TRACE_MAGIC "GHTRACE"
+#define HAL_TRACE_VERSION 1
+#define HAL_TRACE_WRAP 0xffff
+#define HAL_TRACE_MIN_SIZE 4096
+
+#define HAL_TRACE_ALIGN(n) (((n) + 7) & ~(gsize) 7)
+
+typedef struct {
+    char magic[8];
+    guint32 version;
+    /* the HAL structures are traced as is, their layout must match */
+    guint32 android_version;
+    guint32 location_size;
+    guint32 sv_status_size;
+    guint64 size;
+    /* offsets into the file, updated after each record */
+    guint64 head;
+    guint64 tail;
+    guint64 count;
+    guint64 sequence;
+} HalTraceHeader;
+
+typedef struct {
+    guint16 type;
+    /* payload bytes following the record */
+    guint16 length;
+    guint32 sequence;
+    gint64 time;
+} HalTraceRecord;
+
+#define HAL_TRACE_DATA HAL_TRACE_ALIGN (sizeof (HalTraceHeader))
+
+static struct {
+    GMutex lock;
+    /* set and cleared under the lock, atomically for the unlocked peek of
+     * the hal threads */
+    guint8 *map;
+    gsize size;
+} trace;
+
+static gboolean
+header_valid (const HalTraceHeader *header, gsize size)
+{
+    return memcmp (header->magic, HAL_TRACE_MAGIC, sizeof (HAL_TRACE_MAGIC)) == 0 &&
+           header->version == HAL_TRACE_VERSION &&
+           header->android_version == ANDROID_VERSION_MAJOR &&
+           header->location_size == sizeof (GpsLocation) &&
+           header->sv_status_size == sizeof (GpsSvStatus) &&
+           header->size == size &&
+           header->head >= HAL_TRACE_DATA && header->head <= size &&
+           header->tail >= HAL_TRACE_DATA && header->tail <= size;
+}
+
+/* Recorder */
+
+gboolean
+hal_trace_open (const char *path, gsize size)
+{
+    HalTraceHeader *header;
+    struct stat st;
+    void *map;
+    int fd;
+
+    hal_trace_close ();
+
+    size = MAX (HAL_TRACE_ALIGN (size), HAL_TRACE_MIN_SIZE);
+    fd = open (path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0 || fstat (fd, &st) < 0 ||
+        ((gsize) st.st_size != size && ftruncate (fd, size) < 0)) {
+        syslog(LOG_ERR, "Cannot create HAL trace %s", path);
+        if (fd >= 0) {
+            close (fd);
+        }
+        return FALSE;
+    }
+    map = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED) {
+        syslog(LOG_ERR, "Cannot map HAL trace %s", path);
+        return FALSE;
+    }
+
+    header = map;
+    if (!header_valid (header, size)) {
+        memset (header, 0, sizeof (HalTraceHeader));
+        memcpy (header->magic, HAL_TRACE_MAGIC, sizeof (HAL_TRACE_MAGIC));
+        header->version = HAL_TRACE_VERSION;
+        header->android_version = ANDROID_VERSION_MAJOR;
+        header->location_size = sizeof (GpsLocation);
+        header->sv_status_size = sizeof (GpsSvStatus);
+        header->size = size;
+        header->head = HAL_TRACE_DATA;
+        header->tail = HAL_TRACE_DATA;
+    }
+
+    g_mutex_lock (&trace.lock);
+    trace.size = size;
+    g_atomic_pointer_set (&trace.map, map);
+    g_mutex_unlock (&trace.lock);
+
+    syslog(LOG_INFO, "Recording HAL callbacks to %s (%" G_GUINT64_FORMAT " records)",
+           path, header->count);
+    return TRUE;
+}
+
+void
+hal_trace_close (void)
+{
+    g_mutex_lock (&trace.lock);
+    if (trace.map) {
+        munmap (trace.map, trace.size);
+        g_atomic_pointer_set (&trace.map, NULL);
+        trace.size = 0;
+    }
+    g_mutex_unlock (&trace.lock);
+}
+
+static gboolean
+at_wrap (guint64 offset)
+{
+    HalTraceRecord *record = (HalTraceRecord *) (trace.map + offset);
+
+    return trace.size - offset < sizeof (HalTraceRecord) ||
+           record->type == HAL_TRACE_WRAP;
+}
+
+static void
+drop_oldest (HalTraceHeader *header)
+{
+    HalTraceRecord *record;
+    gsize length;
+
+    if (at_wrap (header->tail)) {
+        header->tail = HAL_TRACE_DATA;
+    }
+    record = (HalTraceRecord *) (trace.map + header->tail);
+    length = HAL_TRACE_ALIGN (sizeof (HalTraceRecord) + record->length);
+    if (length > trace.size - header->tail) {
+        /* a damaged trace from an earlier run, start over */
+        syslog(LOG_WARNING, "HAL trace damaged, dropping its records");
+        header->count = 0;
+        return;
+    }
+    header->tail += length;
+    header->count--;
+    if (header->count && at_wrap (header->tail)) {
+        header->tail = HAL_TRACE_DATA;
+    }
+}
+
+/* Returns the record to fill, called with the lock held */
+static HalTraceRecord *
+reserve (HalTraceType type, gsize length)
+{
+    HalTraceHeader *header = (HalTraceHeader *) trace.map;
+    gsize needed = HAL_TRACE_ALIGN (sizeof (HalTraceRecord) + length);
+    HalTraceRecord *record;
+
+    if (needed > trace.size - HAL_TRACE_DATA) {
+        return NULL;
+    }
+
+    for (;;) {
+        if (header->count == 0) {
+            header->head = header->tail = HAL_TRACE_DATA;
+        }
+        if (header->count == 0 || header->tail < header->head) {
+            /* live records between tail and head */
+            if (header->head + needed <= trace.size) {
+                break;
+            }
+            if (trace.size - header->head >= sizeof (HalTraceRecord)) {
+                ((HalTraceRecord *) (trace.map + header->head))->type = HAL_TRACE_WRAP;
+            }
+            header->head = HAL_TRACE_DATA;
+            continue;
+        }
+        /* wrapped, live records from tail to the end and from the start
+         * to head */
+        if (header->head + needed <= header->tail) {
+            break;
+        }
+        drop_oldest (header);
+    }
+
+    record = (HalTraceRecord *) (trace.map + header->head);
+    record->type = type;
+    record->length = length;
+    record->sequence = header->sequence++;
+    record->time = g_get_monotonic_time ();
+    return record;
+}
+
+static void
+commit (HalTraceRecord *record)
+{
+    HalTraceHeader *header = (HalTraceHeader *) trace.map;
+
+    header->head += HAL_TRACE_ALIGN (sizeof (HalTraceRecord) + record->length);
+    header->count++;
+}
+
+static void
+write_record (HalTraceType type, const void *data, gsize length,
+              const void *extra, gsize extra_length)
+{
+    HalTraceRecord *record;
+
+    /* unlocked peek, recording is off most of the time and a record
+     * racing with hal_trace_open() or hal_trace_close() is rechecked */
+    if (!g_atomic_pointer_get (&trace.map)) {
+        return;
+    }
+    extra_length = MIN (extra_length, G_MAXUINT16 - length);
+
+    g_mutex_lock (&trace.lock);
+    if (trace.map && (record = reserve (type, length + extra_length))) {
+        memcpy (record + 1, data, length);
+        if (extra_length) {
+            memcpy ((guint8 *) (record + 1) + length, extra, extra_length);
+        }
+        commit (record);
+    }
+    g_mutex_unlock (&trace.lock);
+}
+
+void
+hal_trace_location (const GpsLocation *location)
+{
+    write_record (HAL_TRACE_LOCATION, location,
+                  MIN (location->size, sizeof (GpsLocation)), NULL, 0);
+}
+
+void
+hal_trace_status (const GpsStatus *status)
+{
+    write_record (HAL_TRACE_STATUS, status,
+                  MIN (status->size, sizeof (GpsStatus)), NULL, 0);
+}
+
+void
+hal_trace_sv_status (const GpsSvStatus *sv_status)
+{
+    write_record (HAL_TRACE_SV_STATUS, sv_status,
+                  MIN (sv_status->size, sizeof (GpsSvStatus)), NULL, 0);
+}
+
+#if ANDROID_VERSION_MAJOR>=7
+void
+hal_trace_gnss_sv_status (const GnssSvStatus *sv_status)
+{
+    write_record (HAL_TRACE_GNSS_SV_STATUS, sv_status,
+                  MIN (sv_status->size, sizeof (GnssSvStatus)), NULL, 0);
+}
+#endif
+
+void
+hal_trace_nmea (GpsUtcTime timestamp, const char *nmea, int length)
+{
+    /* the timestamp goes first, long sentences are truncated */
+    write_record (HAL_TRACE_NMEA, &timestamp, sizeof (GpsUtcTime),
+                  nmea, MAX (length, 0));
+}
+
+void
+hal_trace_capabilities (uint32_t capabilities)
+{
+    write_record (HAL_TRACE_CAPABILITIES, &capabilities, sizeof (capabilities),
+                  NULL, 0);
+}
+
+/* Replayer */
+
+struct _HalTraceReader {
+    guint8 *map;
+    gsize size;
+    guint64 offset;
+    guint64 remaining;
+};
+
+HalTraceReader *
+hal_trace_reader_open (const char *path)
+{
+    HalTraceReader *reader;
+    HalTraceHeader *header;
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = open (path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat (fd, &st) < 0 || (gsize) st.st_size < HAL_TRACE_MIN_SIZE) {
+        close (fd);
+        return NULL;
+    }
+    map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    header = map;
+    if (!header_valid (header, st.st_size)) {
+        munmap (map, st.st_size);
+        return NULL;
+    }
+
+    reader = g_new0 (HalTraceReader, 1);
+    reader->map = map;
+    reader->size = st.st_size;
+    reader->offset = header->tail;
+    reader->remaining = header->count;
+    return reader;
+}
+
+gboolean
+hal_trace_reader_next (HalTraceReader *reader,
+                       HalTraceType   *type,
+                       gint64         *time,
+                       const void    **data,
+                       gsize          *length)
+{
+    HalTraceRecord *record;
+
+    if (!reader->remaining) {
+        return FALSE;
+    }
+    if (reader->size - reader->offset < sizeof (HalTraceRecord) ||
+        ((HalTraceRecord *) (reader->map + reader->offset))->type == HAL_TRACE_WRAP) {
+        reader->offset = HAL_TRACE_DATA;
+    }
+
+    record = (HalTraceRecord *) (reader->map + reader->offset);
+    if (reader->size - reader->offset < sizeof (HalTraceRecord) + record->length) {
+        /* damaged trace, stop here */
+        reader->remaining = 0;
+        return FALSE;
+    }
+    reader->offset += HAL_TRACE_ALIGN (sizeof (HalTraceRecord) + record->length);
+    reader->remaining--;
+
+    *type = record->type;
+    *time = record->time;
+    *data = record + 1;
+    *length = record->length;
+    return TRUE;
+}
+
+void
+hal_trace_reader_close (HalTraceReader *reader)
+{
+    munmap (reader->map, reader->size);
+    g_free (reader);
+}
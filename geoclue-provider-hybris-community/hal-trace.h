@@ -0,0 +1,71 @@
+/*
+ * Geoclue-provider-hybris
+ * hal-trace.h - Binary trace of the GPS HAL callbacks
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef HAL_TRACE_H
+#define HAL_TRACE_H
+
+#include <android-config.h>
+#include <hardware/gps.h>
+
+#include <glib.h>
+
+typedef enum {
+    HAL_TRACE_LOCATION = 1,
+    HAL_TRACE_STATUS,
+    HAL_TRACE_SV_STATUS,
+    HAL_TRACE_NMEA,
+    HAL_TRACE_CAPABILITIES,
+    HAL_TRACE_GNSS_SV_STATUS,
+} HalTraceType;
+
+/* Recorder. The trace is a ring file of size bytes mapped into memory, the
+ * oldest records are overwritten once it is full. An existing trace of the
+ * same size and layout is appended to. Recording copies the callback data
+ * into the mapping, it neither allocates nor makes system calls, and does
+ * nothing unless a trace is open. */
+gboolean hal_trace_open (const char *path, gsize size);
+void hal_trace_close (void);
+
+void hal_trace_location (const GpsLocation *location);
+void hal_trace_status (const GpsStatus *status);
+void hal_trace_sv_status (const GpsSvStatus *sv_status);
+#if ANDROID_VERSION_MAJOR>=7
+void hal_trace_gnss_sv_status (const GnssSvStatus *sv_status);
+#endif
+void hal_trace_nmea (GpsUtcTime timestamp, const char *nmea, int length);
+void hal_trace_capabilities (uint32_t capabilities);
+
+/* Replayer. Records are returned oldest first, data points into the trace
+ * and stays valid until the reader is closed. time is CLOCK_MONOTONIC in
+ * microseconds at the time of the callback. For HAL_TRACE_NMEA data is a
+ * GpsUtcTime followed by the sentence, for HAL_TRACE_CAPABILITIES an
+ * uint32_t, the HAL structure otherwise. */
+typedef struct _HalTraceReader HalTraceReader;
+
+HalTraceReader *hal_trace_reader_open (const char *path);
+gboolean hal_trace_reader_next (HalTraceReader *reader,
+                                HalTraceType   *type,
+                                gint64         *time,
+                                const void    **data,
+                                gsize          *length);
+void hal_trace_reader_close (HalTraceReader *reader);
+
+#endif /* HAL_TRACE_H */
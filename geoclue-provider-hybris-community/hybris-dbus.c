@@ -0,0 +1,523 @@
+/*
+ * Geoclue-provider-hybris
+ * hybris-dbus.c - Provider specific D-Bus interfaces
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+/* The Geoclue interfaces are exported through dbus-glib by GcProvider.
+ * The provider specific interfaces are small, so instead of generating
+ * more dbus-glib glue they are served from a filter on the same
+ * connection, with message bodies converted to and from GVariant. */
+
+#include <config.h>
+
+#include <string.h>
+
+#include <unistd.h>
+
+#include "hybris-dbus.h"
+
+typedef struct {
+    const char *interface;
+    const HybrisDBusMethod *methods;
+} HybrisDBusInterface;
+
+static GPtrArray *interfaces = NULL;
+
+void
+hybris_dbus_add_interface (const char             *interface,
+                           const HybrisDBusMethod *methods)
+{
+    HybrisDBusInterface *iface = g_new0 (HybrisDBusInterface, 1);
+
+    if (!interfaces) {
+        interfaces = g_ptr_array_new ();
+    }
+    iface->interface = interface;
+    iface->methods = methods;
+    g_ptr_array_add (interfaces, iface);
+}
+
+/* GVariant -> D-Bus */
+
+static gboolean
+append_value (DBusMessageIter *iter, GVariant *value)
+{
+    DBusMessageIter sub;
+    GVariantIter children;
+    GVariant *child;
+    gboolean ok = TRUE;
+
+    switch (g_variant_classify (value))
+    {
+        case G_VARIANT_CLASS_BOOLEAN:
+        {
+            dbus_bool_t v = g_variant_get_boolean (value);
+            return dbus_message_iter_append_basic (iter, DBUS_TYPE_BOOLEAN, &v);
+        }
+        case G_VARIANT_CLASS_BYTE:
+        {
+            unsigned char v = g_variant_get_byte (value);
+            return dbus_message_iter_append_basic (iter, DBUS_TYPE_BYTE, &v);
+        }
+        case G_VARIANT_CLASS_INT16:
+        {
+            dbus_int16_t v = g_variant_get_int16 (value);
+            return dbus_message_iter_append_basic (iter, DBUS_TYPE_INT16, &v);
+        }
+        case G_VARIANT_CLASS_UINT16:
+        {
+            dbus_uint16_t v = g_variant_get_uint16 (value);
+            return dbus_message_iter_append_basic (iter, DBUS_TYPE_UINT16, &v);
+        }
+        case G_VARIANT_CLASS_INT32:
+        {
+            dbus_int32_t v = g_variant_get_int32 (value);
+            return dbus_message_iter_append_basic (iter, DBUS_TYPE_INT32, &v);
+        }
+        case G_VARIANT_CLASS_UINT32:
+        {
+            dbus_uint32_t v = g_variant_get_uint32 (value);
+            return dbus_message_iter_append_basic (iter, DBUS_TYPE_UINT32, &v);
+        }
+        case G_VARIANT_CLASS_INT64:
+        {
+            dbus_int64_t v = g_variant_get_int64 (value);
+            return dbus_message_iter_append_basic (iter, DBUS_TYPE_INT64, &v);
+        }
+        case G_VARIANT_CLASS_UINT64:
+        {
+            dbus_uint64_t v = g_variant_get_uint64 (value);
+            return dbus_message_iter_append_basic (iter, DBUS_TYPE_UINT64, &v);
+        }
+        case G_VARIANT_CLASS_DOUBLE:
+        {
+            double v = g_variant_get_double (value);
+            return dbus_message_iter_append_basic (iter, DBUS_TYPE_DOUBLE, &v);
+        }
+        case G_VARIANT_CLASS_HANDLE:
+        {
+            /* the message keeps a duplicate */
+            int v = g_variant_get_handle (value);
+            ok = dbus_message_iter_append_basic (iter, DBUS_TYPE_UNIX_FD, &v);
+            close (v);
+            return ok;
+        }
+        case G_VARIANT_CLASS_STRING:
+        {
+            const char *v = g_variant_get_string (value, NULL);
+            return dbus_message_iter_append_basic (iter, DBUS_TYPE_STRING, &v);
+        }
+        case G_VARIANT_CLASS_OBJECT_PATH:
+        {
+            const char *v = g_variant_get_string (value, NULL);
+            return dbus_message_iter_append_basic (iter, DBUS_TYPE_OBJECT_PATH, &v);
+        }
+        case G_VARIANT_CLASS_SIGNATURE:
+        {
+            const char *v = g_variant_get_string (value, NULL);
+            return dbus_message_iter_append_basic (iter, DBUS_TYPE_SIGNATURE, &v);
+        }
+        case G_VARIANT_CLASS_VARIANT:
+        {
+            GVariant *inner = g_variant_get_variant (value);
+            if (!dbus_message_iter_open_container (iter, DBUS_TYPE_VARIANT,
+                                                   g_variant_get_type_string (inner),
+                                                   &sub)) {
+                g_variant_unref (inner);
+                return FALSE;
+            }
+            ok = append_value (&sub, inner);
+            g_variant_unref (inner);
+            return dbus_message_iter_close_container (iter, &sub) && ok;
+        }
+        case G_VARIANT_CLASS_ARRAY:
+        if (!dbus_message_iter_open_container (iter, DBUS_TYPE_ARRAY,
+                                               g_variant_get_type_string (value) + 1,
+                                               &sub)) {
+            return FALSE;
+        }
+        break;
+        case G_VARIANT_CLASS_TUPLE:
+        if (!dbus_message_iter_open_container (iter, DBUS_TYPE_STRUCT, NULL, &sub)) {
+            return FALSE;
+        }
+        break;
+        case G_VARIANT_CLASS_DICT_ENTRY:
+        if (!dbus_message_iter_open_container (iter, DBUS_TYPE_DICT_ENTRY, NULL, &sub)) {
+            return FALSE;
+        }
+        break;
+        default:
+        /* maybe types have no D-Bus representation */
+        return FALSE;
+    }
+
+    g_variant_iter_init (&children, value);
+    while (ok && (child = g_variant_iter_next_value (&children))) {
+        ok = append_value (&sub, child);
+        g_variant_unref (child);
+    }
+    return dbus_message_iter_close_container (iter, &sub) && ok;
+}
+
+gboolean
+hybris_dbus_message_append_body (DBusMessage *message, GVariant *body)
+{
+    DBusMessageIter iter;
+    GVariantIter children;
+    GVariant *child;
+    gboolean ok = TRUE;
+
+    dbus_message_iter_init_append (message, &iter);
+    g_variant_iter_init (&children, body);
+    while (ok && (child = g_variant_iter_next_value (&children))) {
+        ok = append_value (&iter, child);
+        g_variant_unref (child);
+    }
+    return ok;
+}
+
+/* D-Bus -> GVariant */
+
+static GVariant *
+iter_get_value (DBusMessageIter *iter)
+{
+    DBusMessageIter sub;
+    GVariant *value = NULL;
+    int type = dbus_message_iter_get_arg_type (iter);
+
+    switch (type)
+    {
+        case DBUS_TYPE_BOOLEAN:
+        {
+            dbus_bool_t v;
+            dbus_message_iter_get_basic (iter, &v);
+            return g_variant_new_boolean (v);
+        }
+        case DBUS_TYPE_BYTE:
+        {
+            unsigned char v;
+            dbus_message_iter_get_basic (iter, &v);
+            return g_variant_new_byte (v);
+        }
+        case DBUS_TYPE_INT16:
+        {
+            dbus_int16_t v;
+            dbus_message_iter_get_basic (iter, &v);
+            return g_variant_new_int16 (v);
+        }
+        case DBUS_TYPE_UINT16:
+        {
+            dbus_uint16_t v;
+            dbus_message_iter_get_basic (iter, &v);
+            return g_variant_new_uint16 (v);
+        }
+        case DBUS_TYPE_INT32:
+        {
+            dbus_int32_t v;
+            dbus_message_iter_get_basic (iter, &v);
+            return g_variant_new_int32 (v);
+        }
+        case DBUS_TYPE_UINT32:
+        {
+            dbus_uint32_t v;
+            dbus_message_iter_get_basic (iter, &v);
+            return g_variant_new_uint32 (v);
+        }
+        case DBUS_TYPE_INT64:
+        {
+            dbus_int64_t v;
+            dbus_message_iter_get_basic (iter, &v);
+            return g_variant_new_int64 (v);
+        }
+        case DBUS_TYPE_UINT64:
+        {
+            dbus_uint64_t v;
+            dbus_message_iter_get_basic (iter, &v);
+            return g_variant_new_uint64 (v);
+        }
+        case DBUS_TYPE_DOUBLE:
+        {
+            double v;
+            dbus_message_iter_get_basic (iter, &v);
+            return g_variant_new_double (v);
+        }
+        case DBUS_TYPE_UNIX_FD:
+        {
+            int v;
+            dbus_message_iter_get_basic (iter, &v);
+            return g_variant_new_handle (v);
+        }
+        case DBUS_TYPE_STRING:
+        {
+            const char *v;
+            dbus_message_iter_get_basic (iter, &v);
+            return g_variant_new_string (v);
+        }
+        case DBUS_TYPE_OBJECT_PATH:
+        {
+            const char *v;
+            dbus_message_iter_get_basic (iter, &v);
+            return g_variant_new_object_path (v);
+        }
+        case DBUS_TYPE_SIGNATURE:
+        {
+            const char *v;
+            dbus_message_iter_get_basic (iter, &v);
+            return g_variant_new_signature (v);
+        }
+        case DBUS_TYPE_VARIANT:
+        dbus_message_iter_recurse (iter, &sub);
+        value = iter_get_value (&sub);
+        return value ? g_variant_new_variant (value) : NULL;
+        case DBUS_TYPE_ARRAY:
+        {
+            char *signature = dbus_message_iter_get_signature (iter);
+            GVariantBuilder builder;
+            GVariant *child;
+            gboolean ok = TRUE;
+
+            g_variant_builder_init (&builder, G_VARIANT_TYPE (signature));
+            dbus_free (signature);
+            dbus_message_iter_recurse (iter, &sub);
+            while (dbus_message_iter_get_arg_type (&sub) != DBUS_TYPE_INVALID) {
+                child = iter_get_value (&sub);
+                if (!child) {
+                    ok = FALSE;
+                    break;
+                }
+                g_variant_builder_add_value (&builder, child);
+                dbus_message_iter_next (&sub);
+            }
+            if (!ok) {
+                g_variant_builder_clear (&builder);
+                return NULL;
+            }
+            return g_variant_builder_end (&builder);
+        }
+        case DBUS_TYPE_STRUCT:
+        case DBUS_TYPE_DICT_ENTRY:
+        {
+            GPtrArray *children = g_ptr_array_new ();
+            GVariant *child;
+            gboolean ok = TRUE;
+            guint i;
+
+            dbus_message_iter_recurse (iter, &sub);
+            while (dbus_message_iter_get_arg_type (&sub) != DBUS_TYPE_INVALID) {
+                child = iter_get_value (&sub);
+                if (!child) {
+                    ok = FALSE;
+                    break;
+                }
+                g_ptr_array_add (children, g_variant_ref_sink (child));
+                dbus_message_iter_next (&sub);
+            }
+            if (ok) {
+                if (type == DBUS_TYPE_STRUCT) {
+                    value = g_variant_new_tuple ((GVariant **) children->pdata,
+                                                 children->len);
+                }
+                else if (children->len == 2) {
+                    value = g_variant_new_dict_entry (children->pdata[0],
+                                                      children->pdata[1]);
+                }
+            }
+            for (i = 0; i < children->len; i++) {
+                g_variant_unref (children->pdata[i]);
+            }
+            g_ptr_array_free (children, TRUE);
+            return value;
+        }
+        default:
+        return NULL;
+    }
+}
+
+GVariant *
+hybris_dbus_message_get_body (DBusMessage *message)
+{
+    DBusMessageIter iter;
+    GPtrArray *children = g_ptr_array_new ();
+    GVariant *body = NULL;
+    GVariant *child;
+    gboolean ok = TRUE;
+    guint i;
+
+    if (dbus_message_iter_init (message, &iter)) {
+        do {
+            child = iter_get_value (&iter);
+            if (!child) {
+                ok = FALSE;
+                break;
+            }
+            g_ptr_array_add (children, g_variant_ref_sink (child));
+        }
+        while (dbus_message_iter_next (&iter));
+    }
+
+    if (ok) {
+        body = g_variant_ref_sink (g_variant_new_tuple ((GVariant **) children->pdata,
+                                                        children->len));
+    }
+    for (i = 0; i < children->len; i++) {
+        g_variant_unref (children->pdata[i]);
+    }
+    g_ptr_array_free (children, TRUE);
+
+    return body;
+}
+
+/* Dispatching */
+
+static const HybrisDBusInterface *
+lookup_interface (const char *interface)
+{
+    guint i;
+
+    if (!interfaces || !interface) {
+        return NULL;
+    }
+    for (i = 0; i < interfaces->len; i++) {
+        const HybrisDBusInterface *iface = g_ptr_array_index (interfaces, i);
+        if (strcmp (iface->interface, interface) == 0) {
+            return iface;
+        }
+    }
+    return NULL;
+}
+
+static void
+send_reply (DBusConnection *connection, DBusMessage *message, DBusMessage *reply)
+{
+    if (reply && !dbus_message_get_no_reply (message)) {
+        dbus_connection_send (connection, reply, NULL);
+    }
+    if (reply) {
+        dbus_message_unref (reply);
+    }
+}
+
+DBusHandlerResult
+hybris_dbus_dispatch (DBusConnection *connection, DBusMessage *message)
+{
+    const HybrisDBusInterface *iface;
+    const HybrisDBusMethod *method;
+    GVariant *parameters;
+    GVariant *result;
+    DBusMessage *reply;
+    GError *error = NULL;
+
+    if (dbus_message_get_type (message) != DBUS_MESSAGE_TYPE_METHOD_CALL ||
+        !dbus_message_has_path (message, HYBRIS_DBUS_PATH)) {
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    }
+    iface = lookup_interface (dbus_message_get_interface (message));
+    if (!iface) {
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    }
+
+    for (method = iface->methods; method->member; method++) {
+        if (dbus_message_has_member (message, method->member)) {
+            break;
+        }
+    }
+    if (!method->member) {
+        reply = dbus_message_new_error_printf (message, DBUS_ERROR_UNKNOWN_METHOD,
+                                               "No method %s in %s",
+                                               dbus_message_get_member (message),
+                                               iface->interface);
+        send_reply (connection, message, reply);
+        return DBUS_HANDLER_RESULT_HANDLED;
+    }
+
+    parameters = hybris_dbus_message_get_body (message);
+    if (!parameters ||
+        !g_variant_is_of_type (parameters, G_VARIANT_TYPE (method->in_signature))) {
+        reply = dbus_message_new_error_printf (message, DBUS_ERROR_INVALID_ARGS,
+                                               "Expected arguments %s",
+                                               method->in_signature);
+        send_reply (connection, message, reply);
+        if (parameters) {
+            g_variant_unref (parameters);
+        }
+        return DBUS_HANDLER_RESULT_HANDLED;
+    }
+
+    result = method->func (dbus_message_get_sender (message), parameters, &error);
+    g_variant_unref (parameters);
+
+    if (error) {
+        reply = dbus_message_new_error (message, DBUS_ERROR_FAILED, error->message);
+        g_error_free (error);
+        if (result) {
+            g_variant_unref (g_variant_ref_sink (result));
+        }
+    }
+    else {
+        reply = dbus_message_new_method_return (message);
+        if (result) {
+            g_variant_ref_sink (result);
+            if (reply && !hybris_dbus_message_append_body (reply, result)) {
+                dbus_message_unref (reply);
+                reply = dbus_message_new_error (message, DBUS_ERROR_FAILED,
+                                                "Cannot marshal reply");
+            }
+            g_variant_unref (result);
+        }
+    }
+    send_reply (connection, message, reply);
+
+    return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+gboolean
+hybris_dbus_emit_signal (DBusConnection *connection,
+                         const char     *destination,
+                         const char     *interface,
+                         const char     *member,
+                         GVariant       *body)
+{
+    DBusMessage *signal;
+    gboolean ok = TRUE;
+
+    if (body) {
+        g_variant_ref_sink (body);
+    }
+    signal = dbus_message_new_signal (HYBRIS_DBUS_PATH, interface, member);
+    if (!signal) {
+        ok = FALSE;
+    }
+    else {
+        if (destination) {
+            dbus_message_set_destination (signal, destination);
+        }
+        if (body) {
+            ok = hybris_dbus_message_append_body (signal, body);
+        }
+        if (ok) {
+            ok = dbus_connection_send (connection, signal, NULL);
+        }
+        dbus_message_unref (signal);
+    }
+    if (body) {
+        g_variant_unref (body);
+    }
+    return ok;
+}
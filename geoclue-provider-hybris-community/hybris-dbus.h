@@ -0,0 +1,68 @@
+/*
+ * Geoclue-provider-hybris
+ * hybris-dbus.h - Provider specific D-Bus interfaces
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef HYBRIS_DBUS_H
+#define HYBRIS_DBUS_H
+
+#include <glib.h>
+#include <dbus/dbus.h>
+
+#define HYBRIS_DBUS_PATH "/org/freedesktop/Geoclue/Providers/Hybris"
+#define HYBRIS_DBUS_INTERFACE_PREFIX "org.freedesktop.Geoclue.Providers.Hybris"
+
+/* Handles one method call. parameters matches in_signature, the returned
+ * tuple (floating references are sunk) is the reply body, NULL replies
+ * with no arguments unless error is set. A 'h' value is a plain file
+ * descriptor, received ones belong to the handler and returned ones are
+ * closed once the reply holds its own duplicate. */
+typedef GVariant *(*HybrisDBusMethodFunc) (const char  *sender,
+                                           GVariant    *parameters,
+                                           GError     **error);
+
+typedef struct {
+    const char *member;
+    const char *in_signature;
+    HybrisDBusMethodFunc func;
+} HybrisDBusMethod;
+
+/* methods is terminated by an entry with a NULL member and must stay
+ * valid for the lifetime of the process */
+void hybris_dbus_add_interface (const char             *interface,
+                                const HybrisDBusMethod *methods);
+
+/* Call from a connection filter, handles method calls to the interfaces
+ * added above and passes everything else on */
+DBusHandlerResult hybris_dbus_dispatch (DBusConnection *connection,
+                                        DBusMessage    *message);
+
+/* Emits a signal on HYBRIS_DBUS_PATH, body is a tuple or NULL and is
+ * consumed if floating. A non-NULL destination makes it a unicast signal. */
+gboolean hybris_dbus_emit_signal (DBusConnection *connection,
+                                  const char     *destination,
+                                  const char     *interface,
+                                  const char     *member,
+                                  GVariant       *body);
+
+GVariant *hybris_dbus_message_get_body (DBusMessage *message);
+gboolean hybris_dbus_message_append_body (DBusMessage *message,
+                                          GVariant    *body);
+
+#endif /* HYBRIS_DBUS_H */
@@ -0,0 +1,105 @@
+/*
+ * Geoclue-provider-hybris
+ * location-batch.c - Buffer of recent fixes for batched delivery
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <config.h>
+
+#include "location-batch.h"
+
+void
+location_batch_init (LocationBatch *batch, guint capacity)
+{
+    g_mutex_init (&batch->lock);
+    batch->capacity = MAX (capacity, 1);
+    batch->fixes = g_new0 (BatchFix, batch->capacity);
+    batch->head = 0;
+}
+
+void
+location_batch_free (LocationBatch *batch)
+{
+    g_free (batch->fixes);
+    batch->fixes = NULL;
+    g_mutex_clear (&batch->lock);
+}
+
+void
+location_batch_append (LocationBatch *batch, const BatchFix *fix)
+{
+    g_mutex_lock (&batch->lock);
+    batch->fixes[batch->head % batch->capacity] = *fix;
+    batch->head++;
+    g_mutex_unlock (&batch->lock);
+}
+
+guint64
+location_batch_head (LocationBatch *batch)
+{
+    guint64 head;
+
+    g_mutex_lock (&batch->lock);
+    head = batch->head;
+    g_mutex_unlock (&batch->lock);
+    return head;
+}
+
+/* Called with the lock held */
+static guint
+pending_locked (LocationBatch *batch, guint64 next)
+{
+    if (next >= batch->head) {
+        return 0;
+    }
+    /* older ones have been overwritten */
+    return MIN (batch->head - next, batch->capacity);
+}
+
+guint
+location_batch_pending (LocationBatch *batch, guint64 next)
+{
+    guint pending;
+
+    g_mutex_lock (&batch->lock);
+    pending = pending_locked (batch, next);
+    g_mutex_unlock (&batch->lock);
+    return pending;
+}
+
+GVariant *
+location_batch_collect (LocationBatch *batch, guint64 *next)
+{
+    GVariantBuilder builder;
+    guint64 n;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE (BATCH_FIXES_SIGNATURE));
+
+    g_mutex_lock (&batch->lock);
+    for (n = batch->head - pending_locked (batch, *next); n < batch->head; n++) {
+        const BatchFix *fix = &batch->fixes[n % batch->capacity];
+
+        g_variant_builder_add (&builder, "(xdddddd)", fix->timestamp,
+                               fix->latitude, fix->longitude, fix->altitude,
+                               fix->speed, fix->bearing, fix->accuracy);
+    }
+    *next = batch->head;
+    g_mutex_unlock (&batch->lock);
+
+    return g_variant_builder_end (&builder);
+}
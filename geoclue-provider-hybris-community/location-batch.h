@@ -0,0 +1,63 @@
+/*
+ * Geoclue-provider-hybris
+ * location-batch.h - Buffer of recent fixes for batched delivery
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef LOCATION_BATCH_H
+#define LOCATION_BATCH_H
+
+#include <glib.h>
+
+/* Unknown values are NAN */
+typedef struct {
+    gint64 timestamp;
+    double latitude;
+    double longitude;
+    double altitude;
+    double speed;
+    double bearing;
+    double accuracy;
+} BatchFix;
+
+/* D-Bus signature of a batch */
+#define BATCH_FIXES_SIGNATURE "a(xdddddd)"
+
+/* Ring of the last capacity fixes, allocated once. Fix number n (counted
+ * from 0 since init) is kept until n + capacity is appended, readers
+ * keep the number of the next fix they want. */
+typedef struct {
+    GMutex lock;
+    BatchFix *fixes;
+    guint capacity;
+    guint64 head;
+} LocationBatch;
+
+void location_batch_init (LocationBatch *batch, guint capacity);
+void location_batch_free (LocationBatch *batch);
+
+/* From any thread */
+void location_batch_append (LocationBatch *batch, const BatchFix *fix);
+
+guint64 location_batch_head (LocationBatch *batch);
+/* Fixes from next on still in the ring */
+guint location_batch_pending (LocationBatch *batch, guint64 next);
+/* Returns those fixes as BATCH_FIXES_SIGNATURE and moves next past them */
+GVariant *location_batch_collect (LocationBatch *batch, guint64 *next);
+
+#endif /* LOCATION_BATCH_H */
@@ -0,0 +1,298 @@
+/*
+ * Geoclue-provider-hybris
+ * location-filter.c - Kalman smoothing of the reported locations
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include <math.h>
+
+#include "location-filter.h"
+
+#define EARTH_RADIUS 6371000.0
+/* the tangent plane is moved along beyond this distance, m */
+#define MAX_PLANE_DISTANCE 10000.0
+/* for HALs that do not report an accuracy, m */
+#define DEFAULT_ACCURACY 30.0
+/* vertical accuracy is not reported, it is usually this much worse */
+#define VERTICAL_ACCURACY_FACTOR 1.5
+/* vertical accelerations are rare and small compared to horizontal ones */
+#define VERTICAL_PROCESS_NOISE_FACTOR 0.1
+
+enum {
+    AXIS_EAST,
+    AXIS_NORTH,
+    AXIS_UP,
+};
+
+static double
+deg_to_rad (double deg)
+{
+    return deg * M_PI / 180.0;
+}
+
+static double
+rad_to_deg (double rad)
+{
+    return rad * 180.0 / M_PI;
+}
+
+static void
+to_plane (LocationFilter *filter, double latitude, double longitude,
+          double *east, double *north)
+{
+    *east = deg_to_rad (longitude - filter->origin_longitude) * EARTH_RADIUS *
+            cos (deg_to_rad (filter->origin_latitude));
+    *north = deg_to_rad (latitude - filter->origin_latitude) * EARTH_RADIUS;
+}
+
+static void
+from_plane (LocationFilter *filter, double east, double north,
+            double *latitude, double *longitude)
+{
+    *latitude = filter->origin_latitude + rad_to_deg (north / EARTH_RADIUS);
+    *longitude = filter->origin_longitude +
+                 rad_to_deg (east / (EARTH_RADIUS * cos (deg_to_rad (filter->origin_latitude))));
+}
+
+/* Keeps the flat earth approximation good by moving the origin along */
+static void
+move_origin (LocationFilter *filter)
+{
+    LocationFilterAxis *east = &filter->axis[AXIS_EAST];
+    LocationFilterAxis *north = &filter->axis[AXIS_NORTH];
+    double latitude, longitude, reported_latitude, reported_longitude;
+
+    if (fabs (east->position) < MAX_PLANE_DISTANCE &&
+        fabs (north->position) < MAX_PLANE_DISTANCE) {
+        return;
+    }
+    from_plane (filter, east->position, north->position, &latitude, &longitude);
+    from_plane (filter, filter->reported[AXIS_EAST], filter->reported[AXIS_NORTH],
+                &reported_latitude, &reported_longitude);
+
+    filter->origin_latitude = latitude;
+    filter->origin_longitude = longitude;
+    east->position = 0;
+    north->position = 0;
+    to_plane (filter, reported_latitude, reported_longitude,
+              &filter->reported[AXIS_EAST], &filter->reported[AXIS_NORTH]);
+}
+
+static void
+axis_init (LocationFilterAxis *axis, double position, double position_variance,
+           double velocity, double velocity_variance)
+{
+    axis->position = position;
+    axis->velocity = velocity;
+    axis->p00 = position_variance;
+    axis->p01 = 0;
+    axis->p11 = velocity_variance;
+}
+
+static void
+axis_predict (LocationFilterAxis *axis, double dt, double q)
+{
+    axis->position += axis->velocity * dt;
+    axis->p00 += dt * (2 * axis->p01 + dt * axis->p11) + q * dt * dt * dt / 3;
+    axis->p01 += dt * axis->p11 + q * dt * dt / 2;
+    axis->p11 += q * dt;
+}
+
+/* Measurement of the position only */
+static void
+axis_update_position (LocationFilterAxis *axis, double position, double variance)
+{
+    double s = axis->p00 + variance;
+    double k0 = axis->p00 / s;
+    double k1 = axis->p01 / s;
+    double y = position - axis->position;
+
+    axis->position += k0 * y;
+    axis->velocity += k1 * y;
+    axis->p11 -= k1 * axis->p01;
+    axis->p01 -= k0 * axis->p01;
+    axis->p00 -= k0 * axis->p00;
+}
+
+/* Measurement of position and velocity */
+static void
+axis_update (LocationFilterAxis *axis, double position, double position_variance,
+             double velocity, double velocity_variance)
+{
+    double s00 = axis->p00 + position_variance;
+    double s01 = axis->p01;
+    double s11 = axis->p11 + velocity_variance;
+    double det = s00 * s11 - s01 * s01;
+    double i00 = s11 / det, i01 = -s01 / det, i11 = s00 / det;
+    double k00 = axis->p00 * i00 + axis->p01 * i01;
+    double k01 = axis->p00 * i01 + axis->p01 * i11;
+    double k10 = axis->p01 * i00 + axis->p11 * i01;
+    double k11 = axis->p01 * i01 + axis->p11 * i11;
+    double y0 = position - axis->position;
+    double y1 = velocity - axis->velocity;
+    double p00 = axis->p00, p01 = axis->p01, p11 = axis->p11;
+
+    axis->position += k00 * y0 + k01 * y1;
+    axis->velocity += k10 * y0 + k11 * y1;
+    axis->p00 = (1 - k00) * p00 - k01 * p01;
+    axis->p01 = (1 - k00) * p01 - k01 * p11;
+    axis->p11 = (1 - k11) * p11 - k10 * p01;
+}
+
+void
+location_filter_reset (LocationFilter *filter)
+{
+    memset (filter, 0, sizeof (LocationFilter));
+}
+
+gboolean
+location_filter_update (LocationFilter             *filter,
+                        const LocationFilterParams *params,
+                        GpsLocation                *location,
+                        double                     *climb)
+{
+    double east, north, accuracy, position_variance, velocity_variance;
+    double velocity_east = 0, velocity_north = 0;
+    gboolean has_velocity, has_altitude;
+    double distance = 0;
+    int i;
+
+    *climb = NAN;
+    if (!(location->flags & GPS_LOCATION_HAS_LAT_LONG) ||
+        isnan (location->latitude) || isnan (location->longitude)) {
+        return TRUE;
+    }
+
+    accuracy = (location->flags & GPS_LOCATION_HAS_ACCURACY) && location->accuracy > 0 ?
+               location->accuracy : DEFAULT_ACCURACY;
+    position_variance = accuracy * accuracy;
+    velocity_variance = params->velocity_noise * params->velocity_noise;
+    has_velocity = (location->flags & GPS_LOCATION_HAS_SPEED) &&
+                   (location->flags & GPS_LOCATION_HAS_BEARING) &&
+                   !isnan (location->speed) && !isnan (location->bearing);
+    has_altitude = (location->flags & GPS_LOCATION_HAS_ALTITUDE) &&
+                   !isnan (location->altitude);
+    if (has_velocity) {
+        velocity_east = location->speed * sin (deg_to_rad (location->bearing));
+        velocity_north = location->speed * cos (deg_to_rad (location->bearing));
+    }
+
+    if (filter->initialized &&
+        (location->timestamp <= filter->time ||
+         location->timestamp - filter->time > params->max_gap)) {
+        filter->initialized = FALSE;
+    }
+
+    if (!filter->initialized) {
+        /* without a velocity it starts at rest, with a generous margin */
+        filter->initialized = TRUE;
+        filter->origin_latitude = location->latitude;
+        filter->origin_longitude = location->longitude;
+        axis_init (&filter->axis[AXIS_EAST], 0, position_variance, velocity_east,
+                   has_velocity ? velocity_variance : 100);
+        axis_init (&filter->axis[AXIS_NORTH], 0, position_variance, velocity_north,
+                   has_velocity ? velocity_variance : 100);
+        axis_init (&filter->axis[AXIS_UP], has_altitude ? location->altitude : 0,
+                   position_variance * VERTICAL_ACCURACY_FACTOR * VERTICAL_ACCURACY_FACTOR,
+                   0, 100);
+        filter->has_altitude = has_altitude;
+        filter->time = location->timestamp;
+        memset (filter->reported, 0, sizeof (filter->reported));
+        filter->reported[AXIS_UP] = filter->axis[AXIS_UP].position;
+        if (has_altitude) {
+            *climb = 0;
+        }
+        return TRUE;
+    }
+
+    for (i = 0; i < 3; i++) {
+        axis_predict (&filter->axis[i], (location->timestamp - filter->time) / 1000.0,
+                      i == AXIS_UP ? params->process_noise * VERTICAL_PROCESS_NOISE_FACTOR :
+                      params->process_noise);
+    }
+    filter->time = location->timestamp;
+
+    to_plane (filter, location->latitude, location->longitude, &east, &north);
+    if (has_velocity) {
+        axis_update (&filter->axis[AXIS_EAST], east, position_variance,
+                     velocity_east, velocity_variance);
+        axis_update (&filter->axis[AXIS_NORTH], north, position_variance,
+                     velocity_north, velocity_variance);
+    }
+    else {
+        axis_update_position (&filter->axis[AXIS_EAST], east, position_variance);
+        axis_update_position (&filter->axis[AXIS_NORTH], north, position_variance);
+    }
+    if (has_altitude) {
+        if (!filter->has_altitude) {
+            /* first altitude of the run */
+            filter->axis[AXIS_UP].position = location->altitude;
+            filter->reported[AXIS_UP] = location->altitude;
+            filter->has_altitude = TRUE;
+        }
+        axis_update_position (&filter->axis[AXIS_UP], location->altitude,
+                              position_variance * VERTICAL_ACCURACY_FACTOR *
+                              VERTICAL_ACCURACY_FACTOR);
+    }
+    move_origin (filter);
+
+    /* write back the estimate */
+    from_plane (filter, filter->axis[AXIS_EAST].position, filter->axis[AXIS_NORTH].position,
+                &location->latitude, &location->longitude);
+    location->accuracy = sqrt (MAX (filter->axis[AXIS_EAST].p00,
+                                    filter->axis[AXIS_NORTH].p00));
+    location->flags |= GPS_LOCATION_HAS_ACCURACY;
+    if (has_altitude) {
+        location->altitude = filter->axis[AXIS_UP].position;
+        *climb = filter->axis[AXIS_UP].velocity;
+    }
+    if (has_velocity) {
+        location->speed = hypot (filter->axis[AXIS_EAST].velocity,
+                                 filter->axis[AXIS_NORTH].velocity);
+        location->bearing = rad_to_deg (atan2 (filter->axis[AXIS_EAST].velocity,
+                                               filter->axis[AXIS_NORTH].velocity));
+        if (location->bearing < 0) {
+            location->bearing += 360;
+        }
+    }
+
+    /* distance from the last reported position relative to the error
+     * ellipse of the fix */
+    for (i = 0; i < 3; i++) {
+        double d = filter->axis[i].position - filter->reported[i];
+
+        if (i == AXIS_UP) {
+            if (!has_altitude) {
+                continue;
+            }
+            d /= VERTICAL_ACCURACY_FACTOR;
+        }
+        distance += d * d / position_variance;
+    }
+    if (distance <= 1) {
+        return FALSE;
+    }
+    for (i = 0; i < 3; i++) {
+        filter->reported[i] = filter->axis[i].position;
+    }
+    return TRUE;
+}
@@ -0,0 +1,71 @@
+/*
+ * Geoclue-provider-hybris
+ * location-filter.h - Kalman smoothing of the reported locations
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef LOCATION_FILTER_H
+#define LOCATION_FILTER_H
+
+#include <android-config.h>
+#include <hardware/gps.h>
+
+#include <glib.h>
+
+typedef struct {
+    /* acceleration noise density, m^2/s^3 */
+    double process_noise;
+    /* standard deviation of the reported speed, m/s */
+    double velocity_noise;
+    /* longer gaps between fixes restart the filter, ms */
+    guint max_gap;
+} LocationFilterParams;
+
+/* Constant velocity model, each of the east, north and up axes of a local
+ * tangent plane has a position/velocity state and its covariance. */
+typedef struct {
+    double position;
+    double velocity;
+    double p00, p01, p11;
+} LocationFilterAxis;
+
+typedef struct {
+    gboolean initialized;
+    /* origin of the tangent plane, degrees */
+    double origin_latitude;
+    double origin_longitude;
+    LocationFilterAxis axis[3];
+    gboolean has_altitude;
+    GpsUtcTime time;
+    /* last position reported as a move, in tangent plane coordinates */
+    double reported[3];
+} LocationFilter;
+
+void location_filter_reset (LocationFilter *filter);
+
+/* Replaces position, speed, bearing and accuracy of location with their
+ * filtered estimates and stores the vertical speed in climb (NAN if
+ * unknown). Returns FALSE when the filtered position is still inside the
+ * error ellipse around the last position that returned TRUE. Locations
+ * without latitude/longitude are passed through. */
+gboolean location_filter_update (LocationFilter             *filter,
+                                 const LocationFilterParams *params,
+                                 GpsLocation                *location,
+                                 double                     *climb);
+
+#endif /* LOCATION_FILTER_H */
@@ -0,0 +1,517 @@
+/*
+ * Geoclue-provider-hybris
+ * measurement-stream.c - Raw GNSS measurements for subscribers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+/* mkostemp */
+#define _GNU_SOURCE
+
+#include <config.h>
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <syslog.h>
+
+#include "measurement-stream.h"
+#include "metrics.h"
+#include "sv-report.h"
+
+/* a few seconds at the highest rate, readers are expected to keep up */
+#define MEASUREMENT_RECORDS 16
+#define NAVIGATION_RECORDS 64
+#define MEASUREMENT_MAX_SUBSCRIBERS 8
+
+#define RING_ALIGN(n) (((n) + 63) & ~(gsize) 63)
+
+static struct {
+    /* the writers, and the subscribers */
+    GMutex lock;
+    guint8 *map;
+    gsize size;
+    /* read-only, dup'ed for each subscriber */
+    int ring_fd;
+    int subscribers[MEASUREMENT_MAX_SUBSCRIBERS];
+    guint watches[MEASUREMENT_MAX_SUBSCRIBERS];
+    /* the bus name of the client of each subscriber */
+    char *owners[MEASUREMENT_MAX_SUBSCRIBERS];
+    /* read without the lock to skip the work when nobody listens */
+    gint n_subscribers;
+    MeasurementStreamActiveFunc active;
+} stream = {
+    .ring_fd = -1,
+};
+
+static MeasurementRingHeader *
+ring_header (void)
+{
+    return (MeasurementRingHeader *) stream.map;
+}
+
+/* Creates the ring in /dev/shm, the file is unlinked once opened for
+ * reading so that only the subscribers can get at it */
+static gboolean
+ring_create (void)
+{
+    char path[] = "/dev/shm/geoclue-hybris-measurements-XXXXXX";
+    MeasurementRingHeader *header;
+    gsize measurement_offset, navigation_offset;
+    void *map;
+    int fd;
+
+    measurement_offset = RING_ALIGN (sizeof (MeasurementRingHeader));
+    navigation_offset = measurement_offset +
+                        RING_ALIGN (MEASUREMENT_RECORDS * sizeof (MeasurementRecord));
+    stream.size = navigation_offset + NAVIGATION_RECORDS * sizeof (NavigationRecord);
+
+    fd = mkostemp (path, O_CLOEXEC);
+    if (fd < 0) {
+        syslog(LOG_ERR, "Cannot create measurement ring: %s", g_strerror (errno));
+        return FALSE;
+    }
+    stream.ring_fd = open (path, O_RDONLY | O_CLOEXEC);
+    unlink (path);
+    if (stream.ring_fd < 0 || ftruncate (fd, stream.size) < 0) {
+        syslog(LOG_ERR, "Cannot create measurement ring: %s", g_strerror (errno));
+        goto error;
+    }
+    map = mmap (NULL, stream.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        syslog(LOG_ERR, "Cannot map measurement ring: %s", g_strerror (errno));
+        goto error;
+    }
+    close (fd);
+
+    stream.map = map;
+    header = ring_header ();
+    memcpy (header->magic, MEASUREMENT_RING_MAGIC, sizeof (MEASUREMENT_RING_MAGIC));
+    header->version = MEASUREMENT_RING_VERSION;
+    header->measurement_records = MEASUREMENT_RECORDS;
+    header->measurement_size = sizeof (MeasurementRecord);
+    header->navigation_records = NAVIGATION_RECORDS;
+    header->navigation_size = sizeof (NavigationRecord);
+    header->measurement_offset = measurement_offset;
+    header->navigation_offset = navigation_offset;
+    return TRUE;
+
+error:
+    close (fd);
+    if (stream.ring_fd >= 0) {
+        close (stream.ring_fd);
+        stream.ring_fd = -1;
+    }
+    return FALSE;
+}
+
+static void
+remove_subscriber (int i)
+{
+    int n = g_atomic_int_get (&stream.n_subscribers);
+
+    close (stream.subscribers[i]);
+    g_free (stream.owners[i]);
+    stream.subscribers[i] = stream.subscribers[n - 1];
+    stream.watches[i] = stream.watches[n - 1];
+    stream.owners[i] = stream.owners[n - 1];
+    stream.owners[n - 1] = NULL;
+    g_atomic_int_set (&stream.n_subscribers, n - 1);
+}
+
+static gboolean
+subscriber_hangup (GIOChannel *channel, GIOCondition condition, gpointer data)
+{
+    int fd = g_io_channel_unix_get_fd (channel);
+    int i, n;
+
+    g_mutex_lock (&stream.lock);
+    n = g_atomic_int_get (&stream.n_subscribers);
+    for (i = 0; i < n; i++) {
+        if (stream.subscribers[i] == fd) {
+            remove_subscriber (i);
+            n--;
+            break;
+        }
+    }
+    g_mutex_unlock (&stream.lock);
+
+    if (n == 0 && stream.active) {
+        stream.active (FALSE);
+    }
+    return FALSE;
+}
+
+void
+measurement_stream_init (MeasurementStreamActiveFunc active)
+{
+    stream.active = active;
+}
+
+void
+measurement_stream_shutdown (void)
+{
+    gboolean was_active;
+
+    g_mutex_lock (&stream.lock);
+    was_active = g_atomic_int_get (&stream.n_subscribers) > 0;
+    while (g_atomic_int_get (&stream.n_subscribers)) {
+        g_source_remove (stream.watches[0]);
+        remove_subscriber (0);
+    }
+    if (stream.map) {
+        munmap (stream.map, stream.size);
+        stream.map = NULL;
+    }
+    if (stream.ring_fd >= 0) {
+        close (stream.ring_fd);
+        stream.ring_fd = -1;
+    }
+    g_mutex_unlock (&stream.lock);
+
+    if (was_active && stream.active) {
+        stream.active (FALSE);
+    }
+    stream.active = NULL;
+}
+
+gboolean
+measurement_stream_subscribe (const char *owner, int *ring_fd, int *notify_fd)
+{
+    GIOChannel *channel;
+    int fds[2];
+    int n;
+
+    g_mutex_lock (&stream.lock);
+    n = g_atomic_int_get (&stream.n_subscribers);
+    if (n == MEASUREMENT_MAX_SUBSCRIBERS) {
+        g_mutex_unlock (&stream.lock);
+        syslog(LOG_WARNING, "Too many measurement subscribers");
+        return FALSE;
+    }
+    if (!stream.map && !ring_create ()) {
+        g_mutex_unlock (&stream.lock);
+        return FALSE;
+    }
+    if (socketpair (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+        g_mutex_unlock (&stream.lock);
+        syslog(LOG_ERR, "Cannot create measurement socket: %s", g_strerror (errno));
+        return FALSE;
+    }
+    *ring_fd = dup (stream.ring_fd);
+    if (*ring_fd < 0) {
+        g_mutex_unlock (&stream.lock);
+        close (fds[0]);
+        close (fds[1]);
+        return FALSE;
+    }
+    shutdown (fds[0], SHUT_RD);
+    shutdown (fds[1], SHUT_WR);
+    *notify_fd = fds[1];
+
+    channel = g_io_channel_unix_new (fds[0]);
+    stream.subscribers[n] = fds[0];
+    stream.owners[n] = g_strdup (owner);
+    stream.watches[n] = g_io_add_watch (channel, G_IO_HUP | G_IO_ERR,
+                                        subscriber_hangup, NULL);
+    g_io_channel_unref (channel);
+    g_atomic_int_set (&stream.n_subscribers, n + 1);
+    g_mutex_unlock (&stream.lock);
+
+    if (n == 0 && stream.active) {
+        stream.active (TRUE);
+    }
+    return TRUE;
+}
+
+void
+measurement_stream_unsubscribe (const char *owner)
+{
+    int i, n, removed = 0;
+
+    g_mutex_lock (&stream.lock);
+    n = g_atomic_int_get (&stream.n_subscribers);
+    for (i = 0; i < n; ) {
+        if (g_strcmp0 (stream.owners[i], owner) != 0) {
+            i++;
+            continue;
+        }
+        g_source_remove (stream.watches[i]);
+        remove_subscriber (i);
+        removed++;
+        n--;
+    }
+    g_mutex_unlock (&stream.lock);
+
+    if (removed && n == 0 && stream.active) {
+        stream.active (FALSE);
+    }
+}
+
+/* Writing, from the hal threads with the lock held */
+
+static MeasurementRecord *
+measurement_begin (void)
+{
+    MeasurementRingHeader *header = ring_header ();
+    MeasurementRecord *record = (MeasurementRecord *) (stream.map + header->measurement_offset) +
+                                header->measurement_count % MEASUREMENT_RECORDS;
+
+    __atomic_store_n (&record->sequence, 0, __ATOMIC_RELAXED);
+    /* the zero must be visible before the fields change */
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+    record->received = g_get_monotonic_time ();
+    return record;
+}
+
+static NavigationRecord *
+navigation_begin (void)
+{
+    MeasurementRingHeader *header = ring_header ();
+    NavigationRecord *record = (NavigationRecord *) (stream.map + header->navigation_offset) +
+                               header->navigation_count % NAVIGATION_RECORDS;
+
+    __atomic_store_n (&record->sequence, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+    record->received = g_get_monotonic_time ();
+    return record;
+}
+
+static void
+notify (char kind)
+{
+    int n = g_atomic_int_get (&stream.n_subscribers);
+    int i;
+
+    /* a full socket means the reader has notifications to catch up with,
+     * a gone one is removed by its watch */
+    for (i = 0; i < n; i++) {
+        send (stream.subscribers[i], &kind, 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+}
+
+static void
+measurement_commit (MeasurementRecord *record)
+{
+    MeasurementRingHeader *header = ring_header ();
+    guint64 count = header->measurement_count + 1;
+
+    __atomic_store_n (&record->sequence, count, __ATOMIC_RELEASE);
+    __atomic_store_n (&header->measurement_count, count, __ATOMIC_RELEASE);
+    metrics_inc (METRIC_MEASUREMENT_EPOCHS);
+    notify ('M');
+}
+
+static void
+navigation_commit (NavigationRecord *record)
+{
+    MeasurementRingHeader *header = ring_header ();
+    guint64 count = header->navigation_count + 1;
+
+    __atomic_store_n (&record->sequence, count, __ATOMIC_RELEASE);
+    __atomic_store_n (&header->navigation_count, count, __ATOMIC_RELEASE);
+    metrics_inc (METRIC_NAVIGATION_MESSAGES);
+    notify ('N');
+}
+
+static void
+navigation_copy_data (NavigationRecord *record, const guint8 *data, size_t length)
+{
+    record->data_length = length;
+    memset (record->data, 0, NAVIGATION_MAX_DATA);
+    if (data) {
+        memcpy (record->data, data, MIN (length, NAVIGATION_MAX_DATA));
+    }
+}
+
+#if ANDROID_VERSION_MAJOR>=5
+void
+measurement_stream_add_gps (const GpsData *data)
+{
+    MeasurementRecord *record;
+    guint i;
+
+    if (!g_atomic_int_get (&stream.n_subscribers)) {
+        return;
+    }
+    g_mutex_lock (&stream.lock);
+    if (!stream.map) {
+        g_mutex_unlock (&stream.lock);
+        return;
+    }
+    record = measurement_begin ();
+    record->time_ns = data->clock.time_ns;
+    record->full_bias_ns = data->clock.full_bias_ns;
+    record->time_uncertainty_ns = data->clock.time_uncertainty_ns;
+    record->bias_ns = data->clock.bias_ns;
+    record->bias_uncertainty_ns = data->clock.bias_uncertainty_ns;
+    record->drift_nsps = data->clock.drift_nsps;
+    record->drift_uncertainty_nsps = data->clock.drift_uncertainty_nsps;
+    record->clock_flags = data->clock.flags;
+    record->hw_clock_discontinuity_count = 0;
+    record->leap_second = data->clock.leap_second;
+    record->count = MIN (data->measurement_count, MIN (GPS_MAX_MEASUREMENT, MEASUREMENT_MAX_SVS));
+
+    for (i = 0; i < record->count; i++) {
+        const GpsMeasurement *m = &data->measurements[i];
+
+        record->received_sv_time_ns[i] = m->received_gps_tow_ns;
+        record->received_sv_time_uncertainty_ns[i] = m->received_gps_tow_uncertainty_ns;
+        record->carrier_cycles[i] = m->carrier_count;
+        record->time_offset_ns[i] = m->time_offset_ns;
+        record->c_n0_dbhz[i] = m->c_n0_dbhz;
+        record->pseudorange_m[i] = (m->flags & GPS_MEASUREMENT_HAS_PSEUDORANGE) ?
+                                   m->pseudorange_m : NAN;
+        record->pseudorange_rate_mps[i] = m->pseudorange_rate_mps;
+        record->pseudorange_rate_uncertainty_mps[i] = m->pseudorange_rate_uncertainty_mps;
+        record->accumulated_delta_range_m[i] = m->accumulated_delta_range_m;
+        record->accumulated_delta_range_uncertainty_m[i] = m->accumulated_delta_range_uncertainty_m;
+        record->carrier_phase[i] = m->carrier_phase;
+        record->carrier_phase_uncertainty[i] = m->carrier_phase_uncertainty;
+        record->snr_db[i] = m->snr_db;
+        record->carrier_frequency_hz[i] = m->carrier_frequency_hz;
+        record->flags[i] = m->flags;
+        record->state[i] = m->state;
+        /* the legacy hal only measures GPS */
+        record->svid[i] = m->prn;
+        record->accumulated_delta_range_state[i] = m->accumulated_delta_range_state;
+        record->constellation[i] = SV_CONSTELLATION_GPS;
+        record->multipath_indicator[i] = m->multipath_indicator;
+    }
+    measurement_commit (record);
+    g_mutex_unlock (&stream.lock);
+}
+
+void
+measurement_stream_add_gps_navigation (const GpsNavigationMessage *message)
+{
+    NavigationRecord *record;
+
+    if (!g_atomic_int_get (&stream.n_subscribers)) {
+        return;
+    }
+    g_mutex_lock (&stream.lock);
+    if (!stream.map) {
+        g_mutex_unlock (&stream.lock);
+        return;
+    }
+    record = navigation_begin ();
+    record->svid = message->prn;
+    record->constellation = SV_CONSTELLATION_GPS;
+    record->type = message->type;
+    record->status = message->status;
+    record->message_id = message->message_id;
+    record->submessage_id = message->submessage_id;
+    navigation_copy_data (record, message->data, message->data_length);
+    navigation_commit (record);
+    g_mutex_unlock (&stream.lock);
+}
+#endif
+
+#if ANDROID_VERSION_MAJOR>=7
+void
+measurement_stream_add_gnss (const GnssData *data)
+{
+    MeasurementRecord *record;
+    guint i;
+
+    if (!g_atomic_int_get (&stream.n_subscribers)) {
+        return;
+    }
+    g_mutex_lock (&stream.lock);
+    if (!stream.map) {
+        g_mutex_unlock (&stream.lock);
+        return;
+    }
+    record = measurement_begin ();
+    record->time_ns = data->clock.time_ns;
+    record->full_bias_ns = data->clock.full_bias_ns;
+    record->time_uncertainty_ns = data->clock.time_uncertainty_ns;
+    record->bias_ns = data->clock.bias_ns;
+    record->bias_uncertainty_ns = data->clock.bias_uncertainty_ns;
+    record->drift_nsps = data->clock.drift_nsps;
+    record->drift_uncertainty_nsps = data->clock.drift_uncertainty_nsps;
+    record->clock_flags = data->clock.flags;
+    record->hw_clock_discontinuity_count = data->clock.hw_clock_discontinuity_count;
+    record->leap_second = data->clock.leap_second;
+    record->count = MIN (data->measurement_count, MIN (GNSS_MAX_MEASUREMENT, MEASUREMENT_MAX_SVS));
+
+    for (i = 0; i < record->count; i++) {
+        const GnssMeasurement *m = &data->measurements[i];
+
+        record->received_sv_time_ns[i] = m->received_sv_time_in_ns;
+        record->received_sv_time_uncertainty_ns[i] = m->received_sv_time_uncertainty_in_ns;
+        record->carrier_cycles[i] = m->carrier_cycles;
+        record->time_offset_ns[i] = m->time_offset_ns;
+        record->c_n0_dbhz[i] = m->c_n0_dbhz;
+        /* derived by the reader from the clock and the received time */
+        record->pseudorange_m[i] = NAN;
+        record->pseudorange_rate_mps[i] = m->pseudorange_rate_mps;
+        record->pseudorange_rate_uncertainty_mps[i] = m->pseudorange_rate_uncertainty_mps;
+        record->accumulated_delta_range_m[i] = m->accumulated_delta_range_m;
+        record->accumulated_delta_range_uncertainty_m[i] = m->accumulated_delta_range_uncertainty_m;
+        record->carrier_phase[i] = m->carrier_phase;
+        record->carrier_phase_uncertainty[i] = m->carrier_phase_uncertainty;
+        record->snr_db[i] = m->snr_db;
+        record->carrier_frequency_hz[i] = m->carrier_frequency_hz;
+        record->flags[i] = m->flags;
+        record->state[i] = m->state;
+        record->svid[i] = m->svid;
+        record->accumulated_delta_range_state[i] = m->accumulated_delta_range_state;
+        record->constellation[i] = m->constellation < N_SV_CONSTELLATIONS ?
+                                   m->constellation : SV_CONSTELLATION_UNKNOWN;
+        record->multipath_indicator[i] = m->multipath_indicator;
+    }
+    measurement_commit (record);
+    g_mutex_unlock (&stream.lock);
+}
+
+void
+measurement_stream_add_gnss_navigation (const GnssNavigationMessage *message)
+{
+    NavigationRecord *record;
+    int constellation = (message->type >> 8) & 0xff;
+
+    if (!g_atomic_int_get (&stream.n_subscribers)) {
+        return;
+    }
+    g_mutex_lock (&stream.lock);
+    if (!stream.map) {
+        g_mutex_unlock (&stream.lock);
+        return;
+    }
+    record = navigation_begin ();
+    record->svid = message->svid;
+    /* the high byte of the type is the constellation */
+    record->constellation = constellation < N_SV_CONSTELLATIONS ?
+                            constellation : SV_CONSTELLATION_UNKNOWN;
+    record->type = message->type;
+    record->status = message->status;
+    record->message_id = message->message_id;
+    record->submessage_id = message->submessage_id;
+    navigation_copy_data (record, message->data, message->data_length);
+    navigation_commit (record);
+    g_mutex_unlock (&stream.lock);
+}
+#endif
@@ -0,0 +1,152 @@
+/*
+ * Geoclue-provider-hybris
+ * measurement-stream.h - Raw GNSS measurements for subscribers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef MEASUREMENT_STREAM_H
+#define MEASUREMENT_STREAM_H
+
+#include <android-config.h>
+#include <hardware/gps.h>
+
+#include <glib.h>
+
+/* The measurements of the GPS hal are written by the hal callback straight
+ * into a shared memory ring that subscribers map read-only, nothing is
+ * marshalled. The memory is a MeasurementRingHeader followed by
+ * measurement_records MeasurementRecord, then navigation_records
+ * NavigationRecord, each at the offset given in the header.
+ *
+ * A record is written in place: its sequence is set to 0 first and to the
+ * number of the record, counting from 1, once complete. A reader copies
+ * the record and checks that the sequence is the same before and after the
+ * copy, the record was overwritten otherwise. The header counts hold the
+ * number of records written, record n of a ring is at (n - 1) % size.
+ *
+ * Along with the ring, a subscriber gets a socket on which a byte is sent
+ * after each record, 'M' or 'N'. Bytes are not sent when the socket is
+ * full, the counts of the header are what tells what was missed. */
+
+#define MEASUREMENT_RING_MAGIC "GHMEAS"
+#define MEASUREMENT_RING_VERSION 1
+
+/* GNSS_MAX_MEASUREMENT */
+#define MEASUREMENT_MAX_SVS 64
+#define NAVIGATION_MAX_DATA 256
+
+typedef struct {
+    char magic[8];
+    guint32 version;
+    guint32 measurement_records;
+    guint32 measurement_size;
+    guint32 navigation_records;
+    guint32 navigation_size;
+    guint32 measurement_offset;
+    guint32 navigation_offset;
+    guint32 reserved;
+    guint64 measurement_count;
+    guint64 navigation_count;
+} MeasurementRingHeader;
+
+/* One epoch, each field of the measurements is a column indexed like svid,
+ * the first count entries are valid. Fields are those of GnssClock and
+ * GnssMeasurement, pseudorange_m is NAN unless the hal reports it. */
+typedef struct {
+    guint64 sequence;
+    /* monotonic time of the callback, us */
+    gint64 received;
+    /* clock */
+    gint64 time_ns;
+    gint64 full_bias_ns;
+    double time_uncertainty_ns;
+    double bias_ns;
+    double bias_uncertainty_ns;
+    double drift_nsps;
+    double drift_uncertainty_nsps;
+    guint32 clock_flags;
+    guint32 hw_clock_discontinuity_count;
+    gint16 leap_second;
+    guint16 count;
+    guint32 reserved;
+    /* measurements */
+    gint64 received_sv_time_ns[MEASUREMENT_MAX_SVS];
+    gint64 received_sv_time_uncertainty_ns[MEASUREMENT_MAX_SVS];
+    gint64 carrier_cycles[MEASUREMENT_MAX_SVS];
+    double time_offset_ns[MEASUREMENT_MAX_SVS];
+    double c_n0_dbhz[MEASUREMENT_MAX_SVS];
+    double pseudorange_m[MEASUREMENT_MAX_SVS];
+    double pseudorange_rate_mps[MEASUREMENT_MAX_SVS];
+    double pseudorange_rate_uncertainty_mps[MEASUREMENT_MAX_SVS];
+    double accumulated_delta_range_m[MEASUREMENT_MAX_SVS];
+    double accumulated_delta_range_uncertainty_m[MEASUREMENT_MAX_SVS];
+    double carrier_phase[MEASUREMENT_MAX_SVS];
+    double carrier_phase_uncertainty[MEASUREMENT_MAX_SVS];
+    double snr_db[MEASUREMENT_MAX_SVS];
+    float carrier_frequency_hz[MEASUREMENT_MAX_SVS];
+    guint32 flags[MEASUREMENT_MAX_SVS];
+    guint32 state[MEASUREMENT_MAX_SVS];
+    gint16 svid[MEASUREMENT_MAX_SVS];
+    guint16 accumulated_delta_range_state[MEASUREMENT_MAX_SVS];
+    /* SvConstellation */
+    guint8 constellation[MEASUREMENT_MAX_SVS];
+    guint8 multipath_indicator[MEASUREMENT_MAX_SVS];
+} MeasurementRecord;
+
+/* One navigation message, data_length is that reported, at most
+ * NAVIGATION_MAX_DATA bytes of it are kept */
+typedef struct {
+    guint64 sequence;
+    gint64 received;
+    gint16 svid;
+    guint8 constellation;
+    guint8 reserved;
+    gint16 type;
+    guint16 status;
+    gint16 message_id;
+    gint16 submessage_id;
+    guint32 data_length;
+    guint8 data[NAVIGATION_MAX_DATA];
+} NavigationRecord;
+
+/* Called from the main loop when the first subscriber comes and when the
+ * last one has gone, to start and stop the measurements of the hal */
+typedef void (*MeasurementStreamActiveFunc) (gboolean active);
+
+void measurement_stream_init (MeasurementStreamActiveFunc active);
+/* Drops the subscribers and unmaps the ring */
+void measurement_stream_shutdown (void);
+
+/* The ring, read-only, and the notification socket of a new subscriber for
+ * the client owner. The ring is created with the first one. */
+gboolean measurement_stream_subscribe (const char *owner, int *ring_fd, int *notify_fd);
+/* Closes the notification sockets of the subscribers of owner, the hal
+ * stops measuring with the last one */
+void measurement_stream_unsubscribe (const char *owner);
+
+/* From the hal threads */
+#if ANDROID_VERSION_MAJOR>=5
+void measurement_stream_add_gps (const GpsData *data);
+void measurement_stream_add_gps_navigation (const GpsNavigationMessage *message);
+#endif
+#if ANDROID_VERSION_MAJOR>=7
+void measurement_stream_add_gnss (const GnssData *data);
+void measurement_stream_add_gnss_navigation (const GnssNavigationMessage *message);
+#endif
+
+#endif /* MEASUREMENT_STREAM_H */
@@ -0,0 +1,292 @@
+/*
+ * Geoclue-provider-hybris
+ * metrics.c - Counters and histograms of the provider
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <syslog.h>
+
+#include "metrics.h"
+
+#define METRICS_PREFIX "geoclue_hybris_"
+#define MAX_BOUNDS 12
+
+guint64 metrics_counters[N_METRIC_COUNTERS];
+
+static const struct {
+    const char *name;
+    const char *help;
+} counter_info[N_METRIC_COUNTERS] = {
+    [METRIC_FIXES_RECEIVED] = { "fixes_received", "Fixes reported by the GPS hal" },
+    [METRIC_POSITIONS_EMITTED] = { "positions_emitted", "PositionChanged signals sent" },
+    [METRIC_POSITIONS_UNCHANGED] = { "positions_unchanged", "Fixes not signalled because the position did not change" },
+    [METRIC_VELOCITIES_EMITTED] = { "velocities_emitted", "VelocityChanged signals sent" },
+    [METRIC_SV_REPORTS] = { "sv_reports", "Satellite reports of the GPS hal" },
+    [METRIC_SV_REPORTS_SUPPRESSED] = { "sv_reports_suppressed", "Satellite reports within the hysteresis" },
+    [METRIC_SATELLITES_EMITTED] = { "satellites_emitted", "SatelliteChanged signals sent" },
+    [METRIC_STATUS_REPORTS] = { "status_reports", "Status reports of the GPS hal" },
+    [METRIC_NMEA_SENTENCES] = { "nmea_sentences", "NMEA sentences of the GPS hal" },
+    [METRIC_REPORTS_DROPPED] = { "reports_dropped", "Hal reports dropped because the main loop was behind" },
+    [METRIC_UNICAST_SIGNALS] = { "unicast_signals", "Signals sent to subscribed clients" },
+    [METRIC_ENGINE_STARTS] = { "engine_starts", "Starts of the GPS engine" },
+    [METRIC_WAKELOCK_ACQUIRES] = { "wakelock_acquires", "Times the wakelock was taken" },
+    [METRIC_MEASUREMENT_EPOCHS] = { "measurement_epochs", "Raw measurement epochs of the GPS hal" },
+    [METRIC_NAVIGATION_MESSAGES] = { "navigation_messages", "Navigation messages of the GPS hal" },
+    [METRIC_FIX_EPOCHS] = { "fix_epochs", "Fix epochs sent as FixChanged" },
+    [METRIC_FIX_EPOCHS_PARTIAL] = { "fix_epochs_partial", "Fix epochs sent before all their reports arrived" },
+};
+
+static const guint64 latency_bounds[] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 1000000
+};
+static const guint64 hold_bounds[] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 50000, 100000, 500000, 1000000, 5000000
+};
+static const guint64 ttff_bounds[] = {
+    1000, 2000, 5000, 10000, 15000, 20000, 30000, 45000, 60000, 120000, 300000, 600000
+};
+
+static struct {
+    const char *name;
+    const char *help;
+    const guint64 *bounds;
+    guint n_bounds;
+    /* per bucket, the last one is above every bound */
+    guint64 counts[MAX_BOUNDS + 1];
+    guint64 sum;
+} histograms[N_METRIC_HISTOGRAMS] = {
+    [METRIC_FIX_LATENCY] = { "fix_latency_us", "Hal fix callback to the end of its handling (us)",
+                             latency_bounds, G_N_ELEMENTS (latency_bounds) },
+    [METRIC_STATUS_LATENCY] = { "status_latency_us", "Hal status callback to the end of its handling (us)",
+                                latency_bounds, G_N_ELEMENTS (latency_bounds) },
+    [METRIC_SATELLITE_LATENCY] = { "satellite_latency_us",
+                                   "Hal SV callback to the end of its handling (us)",
+                                   latency_bounds, G_N_ELEMENTS (latency_bounds) },
+    [METRIC_NMEA_LATENCY] = { "nmea_latency_us", "Hal NMEA epoch to its sending (us)",
+                              latency_bounds, G_N_ELEMENTS (latency_bounds) },
+    [METRIC_TTFF] = { "ttff_ms", "Engine start to first fix (ms)",
+                      ttff_bounds, G_N_ELEMENTS (ttff_bounds) },
+    [METRIC_WAKELOCK_HOLD] = { "wakelock_hold_us", "Time the wakelock was held for (us)",
+                               hold_bounds, G_N_ELEMENTS (hold_bounds) },
+};
+
+static struct {
+    char *path;
+    int listen_fd;
+    guint listen_watch;
+    MetricsGaugeFunc gauges;
+} server = {
+    .listen_fd = -1,
+};
+
+void
+metrics_observe (MetricHistogram histogram, guint64 value)
+{
+    guint i;
+
+    for (i = 0; i < histograms[histogram].n_bounds; i++) {
+        if (value <= histograms[histogram].bounds[i]) {
+            break;
+        }
+    }
+    __atomic_fetch_add (&histograms[histogram].counts[i], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add (&histograms[histogram].sum, value, __ATOMIC_RELAXED);
+}
+
+GVariant *
+metrics_get_counters (void)
+{
+    GVariantBuilder builder;
+    int i;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{st}"));
+    for (i = 0; i < N_METRIC_COUNTERS; i++) {
+        g_variant_builder_add (&builder, "{st}", counter_info[i].name,
+                               metrics_get (i));
+    }
+    return g_variant_builder_end (&builder);
+}
+
+/* Cumulative counts, n_bounds + 1 of them */
+static void
+histogram_cumulative (MetricHistogram histogram, guint64 *counts)
+{
+    guint64 total = 0;
+    guint i;
+
+    for (i = 0; i <= histograms[histogram].n_bounds; i++) {
+        total += __atomic_load_n (&histograms[histogram].counts[i], __ATOMIC_RELAXED);
+        counts[i] = total;
+    }
+}
+
+GVariant *
+metrics_get_histograms (void)
+{
+    GVariantBuilder builder;
+    guint64 counts[MAX_BOUNDS + 1];
+    int i;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(satatt)"));
+    for (i = 0; i < N_METRIC_HISTOGRAMS; i++) {
+        histogram_cumulative (i, counts);
+        g_variant_builder_add_value (&builder, g_variant_new (
+            "(s@at@att)", histograms[i].name,
+            g_variant_new_fixed_array (G_VARIANT_TYPE_UINT64, histograms[i].bounds,
+                                       histograms[i].n_bounds, sizeof (guint64)),
+            g_variant_new_fixed_array (G_VARIANT_TYPE_UINT64, counts,
+                                       histograms[i].n_bounds + 1, sizeof (guint64)),
+            __atomic_load_n (&histograms[i].sum, __ATOMIC_RELAXED)));
+    }
+    return g_variant_builder_end (&builder);
+}
+
+static GString *
+format_page (void)
+{
+    GString *page = g_string_sized_new (4096);
+    guint64 counts[MAX_BOUNDS + 1];
+    guint i, j;
+
+    for (i = 0; i < N_METRIC_COUNTERS; i++) {
+        g_string_append_printf (page,
+                                "# HELP " METRICS_PREFIX "%s_total %s\n"
+                                "# TYPE " METRICS_PREFIX "%s_total counter\n"
+                                METRICS_PREFIX "%s_total %" G_GUINT64_FORMAT "\n",
+                                counter_info[i].name, counter_info[i].help,
+                                counter_info[i].name, counter_info[i].name,
+                                metrics_get (i));
+    }
+    for (i = 0; i < N_METRIC_HISTOGRAMS; i++) {
+        const char *name = histograms[i].name;
+
+        histogram_cumulative (i, counts);
+        g_string_append_printf (page,
+                                "# HELP " METRICS_PREFIX "%s %s\n"
+                                "# TYPE " METRICS_PREFIX "%s histogram\n",
+                                name, histograms[i].help, name);
+        for (j = 0; j < histograms[i].n_bounds; j++) {
+            g_string_append_printf (page,
+                                    METRICS_PREFIX "%s_bucket{le=\"%" G_GUINT64_FORMAT "\"} %"
+                                    G_GUINT64_FORMAT "\n",
+                                    name, histograms[i].bounds[j], counts[j]);
+        }
+        g_string_append_printf (page,
+                                METRICS_PREFIX "%s_bucket{le=\"+Inf\"} %" G_GUINT64_FORMAT "\n"
+                                METRICS_PREFIX "%s_sum %" G_GUINT64_FORMAT "\n"
+                                METRICS_PREFIX "%s_count %" G_GUINT64_FORMAT "\n",
+                                name, counts[j], name,
+                                __atomic_load_n (&histograms[i].sum, __ATOMIC_RELAXED),
+                                name, counts[j]);
+    }
+    if (server.gauges) {
+        server.gauges (page);
+    }
+    return page;
+}
+
+static gboolean
+listen_socket_ready (GIOChannel *channel, GIOCondition condition, gpointer data)
+{
+    int fd = accept4 (server.listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    GString *page;
+
+    if (fd < 0) {
+        if (errno == EAGAIN || errno == EINTR || errno == ECONNABORTED) {
+            return TRUE;
+        }
+        /* the connection stays queued, watching on would spin */
+        syslog(LOG_ERR, "Stopped accepting on metrics socket: %s", g_strerror (errno));
+        server.listen_watch = 0;
+        return FALSE;
+    }
+    /* a page is a few kB, it fits in the socket buffer of a new
+     * connection, a reader is never waited for */
+    page = format_page ();
+    if (send (fd, page->str, page->len, MSG_DONTWAIT | MSG_NOSIGNAL) != (ssize_t) page->len) {
+        syslog(LOG_INFO, "Metrics page not sent: %s", g_strerror (errno));
+    }
+    g_string_free (page, TRUE);
+    close (fd);
+
+    return TRUE;
+}
+
+gboolean
+metrics_listen (const char *path, MetricsGaugeFunc gauges)
+{
+    struct sockaddr_un address;
+    GIOChannel *channel;
+
+    if (strlen (path) >= sizeof (address.sun_path)) {
+        syslog(LOG_ERR, "Metrics socket path too long: %s", path);
+        return FALSE;
+    }
+    memset (&address, 0, sizeof (address));
+    address.sun_family = AF_UNIX;
+    strcpy (address.sun_path, path);
+
+    server.listen_fd = socket (AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    unlink (path);
+    if (server.listen_fd < 0 ||
+        bind (server.listen_fd, (struct sockaddr *) &address, sizeof (address)) < 0 ||
+        listen (server.listen_fd, 4) < 0) {
+        syslog(LOG_ERR, "Cannot listen on metrics socket %s: %s", path,
+               g_strerror (errno));
+        if (server.listen_fd >= 0) {
+            close (server.listen_fd);
+            server.listen_fd = -1;
+        }
+        return FALSE;
+    }
+    server.path = g_strdup (path);
+    server.gauges = gauges;
+
+    channel = g_io_channel_unix_new (server.listen_fd);
+    server.listen_watch = g_io_add_watch (channel, G_IO_IN, listen_socket_ready, NULL);
+    g_io_channel_unref (channel);
+
+    syslog(LOG_INFO, "Serving metrics on %s", path);
+    return TRUE;
+}
+
+void
+metrics_shutdown (void)
+{
+    if (server.listen_watch) {
+        g_source_remove (server.listen_watch);
+        server.listen_watch = 0;
+    }
+    if (server.listen_fd >= 0) {
+        close (server.listen_fd);
+        server.listen_fd = -1;
+        unlink (server.path);
+    }
+    g_free (server.path);
+    server.path = NULL;
+    server.gauges = NULL;
+}
@@ -0,0 +1,95 @@
+/*
+ * Geoclue-provider-hybris
+ * metrics.h - Counters and histograms of the provider
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <glib.h>
+
+/* Counters can be bumped from any thread. They are relaxed atomic adds,
+ * nothing orders against them, readers only need each value to be
+ * untorn. */
+typedef enum {
+    METRIC_FIXES_RECEIVED,
+    METRIC_POSITIONS_EMITTED,
+    METRIC_POSITIONS_UNCHANGED,
+    METRIC_VELOCITIES_EMITTED,
+    METRIC_SV_REPORTS,
+    METRIC_SV_REPORTS_SUPPRESSED,
+    METRIC_SATELLITES_EMITTED,
+    METRIC_STATUS_REPORTS,
+    METRIC_NMEA_SENTENCES,
+    METRIC_REPORTS_DROPPED,
+    METRIC_UNICAST_SIGNALS,
+    METRIC_ENGINE_STARTS,
+    METRIC_WAKELOCK_ACQUIRES,
+    METRIC_MEASUREMENT_EPOCHS,
+    METRIC_NAVIGATION_MESSAGES,
+    METRIC_FIX_EPOCHS,
+    METRIC_FIX_EPOCHS_PARTIAL,
+    N_METRIC_COUNTERS
+} MetricCounter;
+
+typedef enum {
+    /* HAL callback to the end of its handling on the main loop, us */
+    METRIC_FIX_LATENCY,
+    METRIC_STATUS_LATENCY,
+    METRIC_SATELLITE_LATENCY,
+    METRIC_NMEA_LATENCY,
+    /* engine start to first fix, ms */
+    METRIC_TTFF,
+    /* wakelock acquire to release, us */
+    METRIC_WAKELOCK_HOLD,
+    N_METRIC_HISTOGRAMS
+} MetricHistogram;
+
+extern guint64 metrics_counters[N_METRIC_COUNTERS];
+
+static inline void
+metrics_inc (MetricCounter counter)
+{
+    __atomic_fetch_add (&metrics_counters[counter], 1, __ATOMIC_RELAXED);
+}
+
+static inline guint64
+metrics_get (MetricCounter counter)
+{
+    return __atomic_load_n (&metrics_counters[counter], __ATOMIC_RELAXED);
+}
+
+/* Adds a sample to the bucket it falls in */
+void metrics_observe (MetricHistogram histogram, guint64 value);
+
+/* Counters as a{st} and histograms as a(satatt): name, upper bounds,
+ * cumulative count per bound and then for all samples, sum */
+GVariant *metrics_get_counters (void);
+GVariant *metrics_get_histograms (void);
+
+/* Appends the provider state that is not kept here, in the Prometheus
+ * text format, to the metrics page */
+typedef void (*MetricsGaugeFunc) (GString *page);
+
+/* Serves the metrics in the Prometheus text format to every connection
+ * on the Unix socket at path, from the main loop */
+gboolean metrics_listen (const char *path, MetricsGaugeFunc gauges);
+void metrics_shutdown (void);
+
+#endif /* METRICS_H */
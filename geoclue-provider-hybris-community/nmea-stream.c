@@ -0,0 +1,337 @@
+/*
+ * Geoclue-provider-hybris
+ * nmea-stream.c - NMEA sentence streaming to local subscribers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <syslog.h>
+
+#include "nmea-stream.h"
+
+/* fits the sentences of a typical epoch, an epoch is flushed early if it
+ * does not */
+#define NMEA_BUFFER_SIZE 4096
+#define NMEA_MAX_SUBSCRIBERS 16
+/* closed epochs waiting for the main loop, the oldest is dropped when the
+ * main loop falls this far behind */
+#define NMEA_QUEUE_SIZE 4
+
+typedef struct {
+    char data[NMEA_BUFFER_SIZE];
+    gsize length;
+} NmeaEpoch;
+
+static struct {
+    /* the epochs, the subscribers only change on the main loop */
+    GMutex lock;
+    /* the epoch being collected */
+    char buffer[NMEA_BUFFER_SIZE];
+    gsize used;
+    gint64 timestamp;
+    NmeaEpoch queue[NMEA_QUEUE_SIZE];
+    guint queue_head;
+    guint n_queued;
+    guint dropped;
+    /* the epoch being sent, main loop only */
+    NmeaEpoch sending;
+    int subscribers[NMEA_MAX_SUBSCRIBERS];
+    /* the bus name of the client that opened each subscription, NULL for
+     * the listening socket */
+    char *owners[NMEA_MAX_SUBSCRIBERS];
+    /* read without the lock to skip the copy when nobody listens */
+    gint n_subscribers;
+    char *path;
+    int listen_fd;
+    guint listen_watch;
+} stream = {
+    .listen_fd = -1,
+};
+
+static gboolean
+add_subscriber (int fd, const char *owner)
+{
+    int n = g_atomic_int_get (&stream.n_subscribers);
+
+    if (n == NMEA_MAX_SUBSCRIBERS) {
+        syslog(LOG_WARNING, "Too many NMEA subscribers");
+        close (fd);
+        return FALSE;
+    }
+    stream.subscribers[n] = fd;
+    stream.owners[n] = g_strdup (owner);
+    g_atomic_int_set (&stream.n_subscribers, n + 1);
+    return TRUE;
+}
+
+static void
+remove_subscriber (int i)
+{
+    int n = g_atomic_int_get (&stream.n_subscribers) - 1;
+
+    close (stream.subscribers[i]);
+    g_free (stream.owners[i]);
+    stream.subscribers[i] = stream.subscribers[n];
+    stream.owners[i] = stream.owners[n];
+    stream.owners[n] = NULL;
+    g_atomic_int_set (&stream.n_subscribers, n);
+}
+
+static void
+send_epoch (const NmeaEpoch *epoch)
+{
+    int i = 0;
+
+    while (i < g_atomic_int_get (&stream.n_subscribers)) {
+        ssize_t sent = send (stream.subscribers[i], epoch->data, epoch->length,
+                             MSG_DONTWAIT | MSG_NOSIGNAL);
+
+        if (sent == (ssize_t) epoch->length) {
+            i++;
+            continue;
+        }
+        /* gone, or too slow to take an epoch: a partial epoch would leave
+         * it with a broken sentence, so it is not kept either */
+        syslog(LOG_INFO, "Dropping NMEA subscriber: %s",
+               sent < 0 ? g_strerror (errno) : "too slow");
+        remove_subscriber (i);
+    }
+}
+
+/* Moves the epoch being collected to the queue, called with the lock held */
+static void
+close_epoch_locked (void)
+{
+    NmeaEpoch *epoch;
+
+    if (!stream.used) {
+        return;
+    }
+    if (stream.n_queued == NMEA_QUEUE_SIZE) {
+        stream.queue_head = (stream.queue_head + 1) % NMEA_QUEUE_SIZE;
+        stream.n_queued--;
+        stream.dropped++;
+    }
+    epoch = &stream.queue[(stream.queue_head + stream.n_queued) % NMEA_QUEUE_SIZE];
+    memcpy (epoch->data, stream.buffer, stream.used);
+    epoch->length = stream.used;
+    stream.n_queued++;
+    stream.used = 0;
+}
+
+gboolean
+nmea_stream_append (gint64 timestamp, const char *nmea, int length)
+{
+    gboolean closed = FALSE;
+
+    if (!g_atomic_int_get (&stream.n_subscribers) || length <= 0) {
+        return FALSE;
+    }
+    /* some HALs include the terminator */
+    while (length && (nmea[length - 1] == '\0' || nmea[length - 1] == '\n' ||
+                      nmea[length - 1] == '\r')) {
+        length--;
+    }
+    if (!length) {
+        return FALSE;
+    }
+    length = MIN (length, NMEA_BUFFER_SIZE - 2);
+
+    g_mutex_lock (&stream.lock);
+    if (stream.used && (timestamp != stream.timestamp ||
+                        stream.used + length + 2 > NMEA_BUFFER_SIZE)) {
+        close_epoch_locked ();
+        closed = TRUE;
+    }
+    stream.timestamp = timestamp;
+    memcpy (stream.buffer + stream.used, nmea, length);
+    memcpy (stream.buffer + stream.used + length, "\r\n", 2);
+    stream.used += length + 2;
+    g_mutex_unlock (&stream.lock);
+
+    return closed;
+}
+
+void
+nmea_stream_send (void)
+{
+    guint dropped;
+
+    for (;;) {
+        /* copied out, the hal thread is not held up by the sends */
+        g_mutex_lock (&stream.lock);
+        if (!stream.n_queued) {
+            g_mutex_unlock (&stream.lock);
+            break;
+        }
+        stream.sending = stream.queue[stream.queue_head];
+        stream.queue_head = (stream.queue_head + 1) % NMEA_QUEUE_SIZE;
+        stream.n_queued--;
+        g_mutex_unlock (&stream.lock);
+
+        send_epoch (&stream.sending);
+    }
+
+    g_mutex_lock (&stream.lock);
+    dropped = stream.dropped;
+    stream.dropped = 0;
+    g_mutex_unlock (&stream.lock);
+    if (dropped) {
+        syslog(LOG_WARNING, "Dropped %u NMEA epochs, main loop is too slow", dropped);
+    }
+}
+
+void
+nmea_stream_flush (void)
+{
+    if (!g_atomic_int_get (&stream.n_subscribers)) {
+        return;
+    }
+    g_mutex_lock (&stream.lock);
+    close_epoch_locked ();
+    g_mutex_unlock (&stream.lock);
+    nmea_stream_send ();
+}
+
+int
+nmea_stream_subscribe (const char *owner)
+{
+    int fds[2];
+
+    if (socketpair (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+        syslog(LOG_ERR, "Cannot create NMEA socket: %s", g_strerror (errno));
+        return -1;
+    }
+    shutdown (fds[0], SHUT_RD);
+    shutdown (fds[1], SHUT_WR);
+    if (!add_subscriber (fds[0], owner)) {
+        close (fds[1]);
+        return -1;
+    }
+
+    return fds[1];
+}
+
+void
+nmea_stream_unsubscribe (const char *owner)
+{
+    int i = 0;
+
+    while (i < g_atomic_int_get (&stream.n_subscribers)) {
+        if (g_strcmp0 (stream.owners[i], owner) == 0) {
+            remove_subscriber (i);
+        }
+        else {
+            i++;
+        }
+    }
+}
+
+static gboolean
+listen_socket_ready (GIOChannel *channel, GIOCondition condition, gpointer data)
+{
+    int fd = accept4 (stream.listen_fd, NULL, NULL, SOCK_CLOEXEC);
+
+    if (fd < 0) {
+        if (errno == EAGAIN || errno == EINTR || errno == ECONNABORTED) {
+            return TRUE;
+        }
+        /* the connection stays queued, watching on would spin */
+        syslog(LOG_ERR, "Stopped accepting on NMEA socket: %s", g_strerror (errno));
+        stream.listen_watch = 0;
+        return FALSE;
+    }
+    shutdown (fd, SHUT_RD);
+    add_subscriber (fd, NULL);
+
+    return TRUE;
+}
+
+gboolean
+nmea_stream_listen (const char *path)
+{
+    struct sockaddr_un address;
+    GIOChannel *channel;
+
+    if (strlen (path) >= sizeof (address.sun_path)) {
+        syslog(LOG_ERR, "NMEA socket path too long: %s", path);
+        return FALSE;
+    }
+    memset (&address, 0, sizeof (address));
+    address.sun_family = AF_UNIX;
+    strcpy (address.sun_path, path);
+
+    stream.listen_fd = socket (AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    unlink (path);
+    /* the position is for the user and group of the provider only, the
+     * mode is set before anybody can connect */
+    if (stream.listen_fd < 0 ||
+        bind (stream.listen_fd, (struct sockaddr *) &address, sizeof (address)) < 0 ||
+        chmod (path, 0660) < 0 ||
+        listen (stream.listen_fd, NMEA_MAX_SUBSCRIBERS) < 0) {
+        syslog(LOG_ERR, "Cannot listen on NMEA socket %s: %s", path,
+               g_strerror (errno));
+        if (stream.listen_fd >= 0) {
+            close (stream.listen_fd);
+            stream.listen_fd = -1;
+        }
+        return FALSE;
+    }
+    stream.path = g_strdup (path);
+
+    channel = g_io_channel_unix_new (stream.listen_fd);
+    stream.listen_watch = g_io_add_watch (channel, G_IO_IN, listen_socket_ready, NULL);
+    g_io_channel_unref (channel);
+
+    syslog(LOG_INFO, "Streaming NMEA on %s", path);
+    return TRUE;
+}
+
+void
+nmea_stream_shutdown (void)
+{
+    if (stream.listen_watch) {
+        g_source_remove (stream.listen_watch);
+        stream.listen_watch = 0;
+    }
+    if (stream.listen_fd >= 0) {
+        close (stream.listen_fd);
+        stream.listen_fd = -1;
+        unlink (stream.path);
+    }
+    g_free (stream.path);
+    stream.path = NULL;
+
+    while (g_atomic_int_get (&stream.n_subscribers)) {
+        remove_subscriber (0);
+    }
+
+    g_mutex_lock (&stream.lock);
+    stream.used = 0;
+    stream.n_queued = 0;
+    g_mutex_unlock (&stream.lock);
+}
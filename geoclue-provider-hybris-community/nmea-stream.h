@@ -0,0 +1,53 @@
+/*
+ * Geoclue-provider-hybris
+ * nmea-stream.h - NMEA sentence streaming to local subscribers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef NMEA_STREAM_H
+#define NMEA_STREAM_H
+
+#include <glib.h>
+
+/* Subscribers get the raw sentences, one per line, on a stream socket.
+ * The sentences of a fix epoch are collected in one buffer on the HAL
+ * thread, which is queued at the end of the epoch and sent to every
+ * subscriber from the main loop. A subscriber that cannot take a whole
+ * epoch without blocking is dropped. */
+
+/* Listens for subscribers on the Unix socket at path, which only the user
+ * and group of the provider can connect to. The rest is from the main
+ * loop too. */
+gboolean nmea_stream_listen (const char *path);
+void nmea_stream_shutdown (void);
+
+/* Returns the reading end of a new subscription for the client owner, -1
+ * on failure */
+int nmea_stream_subscribe (const char *owner);
+/* Closes the subscriptions of owner */
+void nmea_stream_unsubscribe (const char *owner);
+
+/* From the HAL thread. A sentence with a new timestamp ends the current
+ * epoch, TRUE is then returned and nmea_stream_send is due. */
+gboolean nmea_stream_append (gint64 timestamp, const char *nmea, int length);
+/* Sends the ended epochs */
+void nmea_stream_send (void);
+/* Ends the current epoch, at a location, and sends it */
+void nmea_stream_flush (void);
+
+#endif /* NMEA_STREAM_H */
@@ -0,0 +1,93 @@
+/*
+ * Geoclue-provider-hybris
+ * startup.c - Timing of the startup phases
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <config.h>
+
+#include <syslog.h>
+
+#include "startup.h"
+
+static const char *phase_names[N_STARTUP_PHASES] = {
+    [STARTUP_CONFIG] = "config",
+    [STARTUP_STATE] = "state",
+    [STARTUP_BUS] = "bus",
+    [STARTUP_HAL_OPEN] = "hal_open",
+    [STARTUP_HAL_INIT] = "hal_init",
+    [STARTUP_HAL_READY] = "hal_ready",
+    [STARTUP_SETTINGS] = "settings",
+    [STARTUP_FIRST_CLIENT] = "first_client",
+    [STARTUP_ENGINE_START] = "engine_start",
+    [STARTUP_FIRST_FIX] = "first_fix",
+};
+
+static struct {
+    /* the hal phases end on the hal-open thread */
+    GMutex lock;
+    gint64 launch;
+    /* 0 until done */
+    gint64 duration[N_STARTUP_PHASES];
+    gint64 end[N_STARTUP_PHASES];
+} startup;
+
+void
+startup_begin (void)
+{
+    startup.launch = g_get_monotonic_time ();
+}
+
+void
+startup_phase_done (StartupPhase phase, gint64 started)
+{
+    gint64 now = g_get_monotonic_time ();
+    gint64 duration = started ? now - started : 0;
+
+    g_mutex_lock (&startup.lock);
+    if (startup.end[phase]) {
+        g_mutex_unlock (&startup.lock);
+        return;
+    }
+    startup.end[phase] = MAX (now - startup.launch, 1);
+    startup.duration[phase] = duration;
+    g_mutex_unlock (&startup.lock);
+
+    syslog(LOG_INFO, "Startup %s took %.1f ms, %.1f ms after launch",
+           phase_names[phase], duration / 1000.0,
+           (now - startup.launch) / 1000.0);
+}
+
+GVariant *
+startup_describe (void)
+{
+    GVariantBuilder builder;
+    int i;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(stt)"));
+    g_mutex_lock (&startup.lock);
+    for (i = 0; i < N_STARTUP_PHASES; i++) {
+        if (startup.end[i]) {
+            g_variant_builder_add (&builder, "(stt)", phase_names[i],
+                                   (guint64) startup.duration[i],
+                                   (guint64) startup.end[i]);
+        }
+    }
+    g_mutex_unlock (&startup.lock);
+    return g_variant_builder_end (&builder);
+}
@@ -0,0 +1,63 @@
+/*
+ * Geoclue-provider-hybris
+ * startup.h - Timing of the startup phases
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef STARTUP_H
+#define STARTUP_H
+
+#include <glib.h>
+
+/* In the order they usually end, the hal phases overlap the others */
+typedef enum {
+    /* reading geoclue-hybris.conf */
+    STARTUP_CONFIG,
+    /* restoring the state cache */
+    STARTUP_STATE,
+    /* bus connections and the name */
+    STARTUP_BUS,
+    /* hw_get_module and opening the devices, on the hal-open thread */
+    STARTUP_HAL_OPEN,
+    /* init of the GPS hal and its extensions, on the hal-open thread */
+    STARTUP_HAL_INIT,
+    /* programming the hal back on the main loop */
+    STARTUP_HAL_READY,
+    /* connman reply with the location setting */
+    STARTUP_SETTINGS,
+    /* first AddReference, since the bus phase */
+    STARTUP_FIRST_CLIENT,
+    /* first engine start */
+    STARTUP_ENGINE_START,
+    /* first fix after the engine start */
+    STARTUP_FIRST_FIX,
+    N_STARTUP_PHASES
+} StartupPhase;
+
+/* Sets the launch time everything is measured from, call first thing */
+void startup_begin (void);
+
+/* The phase ran from started, a g_get_monotonic_time, until now. Logged
+ * and kept the first time only, from any thread. */
+void startup_phase_done (StartupPhase phase, gint64 started);
+
+/* a(stt): per phase done so far, its name, duration and end since the
+ * launch, in us */
+GVariant *startup_describe (void);
+
+#endif /* STARTUP_H */
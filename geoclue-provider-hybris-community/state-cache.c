@@ -0,0 +1,173 @@
+/*
+ * Geoclue-provider-hybris
+ * state-cache.c - Provider state kept across runs for warm starts
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <syslog.h>
+
+#include "state-cache.h"
+
+#define STATE_CACHE_MAGIC "GHSTATE"
+#define STATE_CACHE_VERSION 2
+
+typedef struct {
+    /* number of writes, the slot with the higher one is current */
+    guint64 sequence;
+    guint32 checksum;
+    guint32 reserved;
+    StateCacheData data;
+} StateCacheSlot;
+
+typedef struct {
+    char magic[8];
+    guint32 version;
+    guint32 android_version;
+    guint32 data_size;
+    guint32 reserved;
+    StateCacheSlot slots[2];
+} StateCacheFile;
+
+static struct {
+    StateCacheFile *map;
+    guint64 sequence;
+} cache;
+
+/* FNV-1a, catches torn writes */
+static guint32
+checksum (const StateCacheSlot *slot)
+{
+    const guint8 *p = (const guint8 *) &slot->data;
+    guint32 hash = 2166136261u;
+    gsize i;
+
+    for (i = 0; i < sizeof (StateCacheData); i++) {
+        hash = (hash ^ p[i]) * 16777619u;
+    }
+    return hash ^ (guint32) slot->sequence ^ (guint32) (slot->sequence >> 32);
+}
+
+static const StateCacheSlot *
+current_slot (void)
+{
+    const StateCacheSlot *best = NULL;
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        const StateCacheSlot *slot = &cache.map->slots[i];
+
+        if (slot->sequence && slot->checksum == checksum (slot) &&
+            (!best || slot->sequence > best->sequence)) {
+            best = slot;
+        }
+    }
+    return best;
+}
+
+gboolean
+state_cache_open (const char *path)
+{
+    const StateCacheSlot *slot;
+    char *dir = g_path_get_dirname (path);
+    void *map;
+    int fd;
+
+    state_cache_close ();
+
+    /* the location is nobody else's business */
+    g_mkdir_with_parents (dir, 0700);
+    g_free (dir);
+    fd = open (path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0 || ftruncate (fd, sizeof (StateCacheFile)) < 0) {
+        syslog(LOG_ERR, "Cannot create state file %s", path);
+        if (fd >= 0) {
+            close (fd);
+        }
+        return FALSE;
+    }
+    map = mmap (NULL, sizeof (StateCacheFile), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED) {
+        syslog(LOG_ERR, "Cannot map state file %s", path);
+        return FALSE;
+    }
+    cache.map = map;
+
+    if (memcmp (cache.map->magic, STATE_CACHE_MAGIC, sizeof (STATE_CACHE_MAGIC)) != 0 ||
+        cache.map->version != STATE_CACHE_VERSION ||
+        cache.map->android_version != ANDROID_VERSION_MAJOR ||
+        cache.map->data_size != sizeof (StateCacheData)) {
+        memset (cache.map, 0, sizeof (StateCacheFile));
+        memcpy (cache.map->magic, STATE_CACHE_MAGIC, sizeof (STATE_CACHE_MAGIC));
+        cache.map->version = STATE_CACHE_VERSION;
+        cache.map->android_version = ANDROID_VERSION_MAJOR;
+        cache.map->data_size = sizeof (StateCacheData);
+    }
+    slot = current_slot ();
+    cache.sequence = slot ? slot->sequence : 0;
+    return TRUE;
+}
+
+void
+state_cache_close (void)
+{
+    if (!cache.map) {
+        return;
+    }
+    msync (cache.map, sizeof (StateCacheFile), MS_SYNC);
+    munmap (cache.map, sizeof (StateCacheFile));
+    cache.map = NULL;
+}
+
+gboolean
+state_cache_read (StateCacheData *data)
+{
+    const StateCacheSlot *slot;
+
+    if (!cache.map || !(slot = current_slot ())) {
+        return FALSE;
+    }
+    *data = slot->data;
+    return TRUE;
+}
+
+void
+state_cache_write (const StateCacheData *data)
+{
+    StateCacheSlot *slot;
+
+    if (!cache.map) {
+        return;
+    }
+    /* the slot the previous write did not use */
+    slot = &cache.map->slots[(cache.sequence + 1) % 2];
+    slot->sequence = 0;
+    __sync_synchronize ();
+    memcpy (&slot->data, data, sizeof (StateCacheData));
+    slot->sequence = ++cache.sequence;
+    slot->checksum = checksum (slot);
+}
@@ -0,0 +1,81 @@
+/*
+ * Geoclue-provider-hybris
+ * state-cache.h - Provider state kept across runs for warm starts
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef STATE_CACHE_H
+#define STATE_CACHE_H
+
+#include <android-config.h>
+#include <hardware/gps.h>
+
+#include <glib.h>
+
+#include "assistance.h"
+#include "sv-report.h"
+
+typedef struct {
+    gint32 constellation;
+    gint32 svid;
+    gint32 azimuth;
+    gint32 elevation;
+    gint32 snr;
+    gint32 used;
+} StateCacheSatellite;
+
+/* Times are ms since the epoch, 0 when there is nothing */
+typedef struct {
+    /* last reported position and velocity, fields are the
+     * GeocluePositionFields and GeoclueVelocityFields */
+    gint64 position_time;
+    guint32 position_fields;
+    guint32 velocity_fields;
+    double latitude;
+    double longitude;
+    double altitude;
+    double accuracy;
+    double speed;
+    double bearing;
+    double climb;
+    /* injected on the next start */
+    AssistanceFix good_fix;
+    /* last satellite report */
+    gint64 satellite_time;
+    gint32 satellite_visible;
+    gint32 satellite_used;
+    StateCacheSatellite satellites[SV_MAX];
+    /* last report of satellites with ephemeris */
+    gint64 ephemeris_time;
+    guint32 ephemeris_mask;
+} StateCacheData;
+
+/* The state file is mapped into memory and holds two copies of the data.
+ * A write goes to the older copy, which then becomes the current one, so a
+ * crash or power cut while writing leaves the previous state readable. A
+ * file of another layout is reset. */
+gboolean state_cache_open (const char *path);
+/* Flushes the file to disk */
+void state_cache_close (void);
+
+/* The last state written, FALSE when there is none */
+gboolean state_cache_read (StateCacheData *data);
+/* Without a system call, the kernel writes the pages back */
+void state_cache_write (const StateCacheData *data);
+
+#endif /* STATE_CACHE_H */
@@ -0,0 +1,60 @@
+/*
+ * Geoclue-provider-hybris
+ * subscription-filter.c - When a subscriber gets the next signal
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include "geofence.h"
+#include "subscription-filter.h"
+
+void
+subscription_sent_reset (SubscriptionSent *sent)
+{
+    memset (sent, 0, sizeof (SubscriptionSent));
+}
+
+gboolean
+subscription_filter (SubscriptionSent         *sent,
+                     const SubscriptionLimits *limits,
+                     gint64                    timestamp,
+                     gboolean                  has_position,
+                     double                    latitude,
+                     double                    longitude)
+{
+    /* a time going backwards is not waited for */
+    if (sent->timestamp && timestamp >= sent->timestamp &&
+        timestamp - sent->timestamp < limits->min_interval) {
+        return FALSE;
+    }
+    if (has_position && limits->min_distance > 0 && sent->has_position &&
+        geofence_distance (sent->latitude, sent->longitude,
+                           latitude, longitude) < limits->min_distance) {
+        return FALSE;
+    }
+    sent->timestamp = timestamp;
+    if (has_position) {
+        sent->has_position = TRUE;
+        sent->latitude = latitude;
+        sent->longitude = longitude;
+    }
+    return TRUE;
+}
@@ -0,0 +1,58 @@
+/*
+ * Geoclue-provider-hybris
+ * subscription-filter.h - When a subscriber gets the next signal
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef SUBSCRIPTION_FILTER_H
+#define SUBSCRIPTION_FILTER_H
+
+#include <glib.h>
+
+/* The last signal of one subscription sent to one client. Every
+ * subscription has its own, FixChanged is not held back because a
+ * PositionChanged was sent from the same place. */
+typedef struct {
+    /* ms, 0 before the first signal */
+    gint64 timestamp;
+    /* where the signal was, for those with a position */
+    gboolean has_position;
+    double latitude;
+    double longitude;
+} SubscriptionSent;
+
+/* The Subscription interface limits of one client */
+typedef struct {
+    /* ms between signals */
+    guint min_interval;
+    /* m from the last signal with a position, 0 for any */
+    double min_distance;
+} SubscriptionLimits;
+
+void subscription_sent_reset (SubscriptionSent *sent);
+
+/* Whether a signal at timestamp, at latitude/longitude if has_position,
+ * is due under limits. If so it is recorded in sent. */
+gboolean subscription_filter (SubscriptionSent         *sent,
+                              const SubscriptionLimits *limits,
+                              gint64                    timestamp,
+                              gboolean                  has_position,
+                              double                    latitude,
+                              double                    longitude);
+
+#endif /* SUBSCRIPTION_FILTER_H */
@@ -0,0 +1,217 @@
+/*
+ * Geoclue-provider-hybris
+ * sv-report.c - Satellite reports of the GPS hal ABIs
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <config.h>
+
+#include "sv-report.h"
+
+/* Offsets of the legacy ranges, SBAS satellites are numbered from 120 */
+#define SBAS_PRN_OFFSET (-87)
+#define GLONASS_PRN_OFFSET 64
+#define BEIDOU_PRN_OFFSET 200
+#define GALILEO_PRN_OFFSET 300
+
+#define L1_FREQUENCY 1575.42e6
+#define G1_FREQUENCY 1602.0e6
+#define G1_CHANNEL_SPACING 0.5625e6
+#define B1_FREQUENCY 1561.098e6
+
+static void
+entry_from_prn (SvEntry *sv, int prn)
+{
+    if (prn >= 1 && prn <= 32) {
+        sv->constellation = SV_CONSTELLATION_GPS;
+        sv->svid = prn;
+    }
+    else if (prn >= 33 && prn <= 64) {
+        sv->constellation = SV_CONSTELLATION_SBAS;
+        sv->svid = prn - SBAS_PRN_OFFSET;
+    }
+    else if (prn >= 65 && prn <= 96) {
+        sv->constellation = SV_CONSTELLATION_GLONASS;
+        sv->svid = prn - GLONASS_PRN_OFFSET;
+    }
+    else if (prn >= 193 && prn <= 200) {
+        sv->constellation = SV_CONSTELLATION_QZSS;
+        sv->svid = prn;
+    }
+    else if (prn >= 201 && prn <= 263) {
+        sv->constellation = SV_CONSTELLATION_BEIDOU;
+        sv->svid = prn - BEIDOU_PRN_OFFSET;
+    }
+    else if (prn >= 301 && prn <= 336) {
+        sv->constellation = SV_CONSTELLATION_GALILEO;
+        sv->svid = prn - GALILEO_PRN_OFFSET;
+    }
+    else {
+        sv->constellation = SV_CONSTELLATION_UNKNOWN;
+        sv->svid = prn;
+    }
+}
+
+/* The masks have one bit per GPS satellite, a shift by 32 or more is
+ * undefined, the other satellites are not in them */
+static gboolean
+gps_mask_has (guint32 mask, const SvEntry *sv)
+{
+    return sv->constellation == SV_CONSTELLATION_GPS &&
+           (mask & (1u << (sv->svid - 1))) != 0;
+}
+
+void
+sv_report_from_gps (SvReport *report, const GpsSvStatus *status)
+{
+    int i;
+
+    report->num_svs = CLAMP (status->num_svs, 0, GPS_MAX_SVS);
+    report->ephemeris_mask = status->ephemeris_mask;
+    for (i = 0; i < report->num_svs; i++) {
+        const GpsSvInfo *info = &status->sv_list[i];
+        SvEntry *sv = &report->svs[i];
+
+        entry_from_prn (sv, info->prn);
+        sv->snr = info->snr;
+        sv->elevation = info->elevation;
+        sv->azimuth = info->azimuth;
+        sv->flags = 0;
+        if (gps_mask_has (status->used_in_fix_mask, sv)) {
+            sv->flags |= SV_FLAG_USED_IN_FIX;
+        }
+        if (gps_mask_has (status->ephemeris_mask, sv)) {
+            sv->flags |= SV_FLAG_HAS_EPHEMERIS;
+        }
+        if (gps_mask_has (status->almanac_mask, sv)) {
+            sv->flags |= SV_FLAG_HAS_ALMANAC;
+        }
+    }
+}
+
+#if ANDROID_VERSION_MAJOR>=7
+void
+sv_report_from_gnss (SvReport *report, const GnssSvStatus *status)
+{
+    int i;
+
+    report->num_svs = CLAMP (status->num_svs, 0, MIN (GNSS_MAX_SVS, SV_MAX));
+    report->ephemeris_mask = 0;
+    for (i = 0; i < report->num_svs; i++) {
+        const GnssSvInfo *info = &status->gnss_sv_list[i];
+        SvEntry *sv = &report->svs[i];
+
+        sv->constellation = info->constellation < N_SV_CONSTELLATIONS ?
+                            info->constellation : SV_CONSTELLATION_UNKNOWN;
+        sv->svid = info->svid;
+        sv->flags = info->flags & (SV_FLAG_HAS_EPHEMERIS | SV_FLAG_HAS_ALMANAC |
+                                   SV_FLAG_USED_IN_FIX);
+        sv->snr = info->c_n0_dbhz;
+        sv->elevation = info->elevation;
+        sv->azimuth = info->azimuth;
+        if ((sv->flags & SV_FLAG_HAS_EPHEMERIS) &&
+            sv->constellation == SV_CONSTELLATION_GPS &&
+            sv->svid >= 1 && sv->svid <= 32) {
+            report->ephemeris_mask |= 1u << (sv->svid - 1);
+        }
+    }
+}
+#endif
+
+int
+sv_entry_prn (const SvEntry *sv)
+{
+    switch (sv->constellation)
+    {
+        case SV_CONSTELLATION_SBAS:
+        return sv->svid + SBAS_PRN_OFFSET;
+        case SV_CONSTELLATION_GLONASS:
+        return sv->svid + GLONASS_PRN_OFFSET;
+        case SV_CONSTELLATION_BEIDOU:
+        return sv->svid + BEIDOU_PRN_OFFSET;
+        case SV_CONSTELLATION_GALILEO:
+        return sv->svid + GALILEO_PRN_OFFSET;
+        default:
+        return sv->svid;
+    }
+}
+
+double
+sv_entry_carrier_frequency (const SvEntry *sv)
+{
+    switch (sv->constellation)
+    {
+        case SV_CONSTELLATION_GPS:
+        case SV_CONSTELLATION_SBAS:
+        case SV_CONSTELLATION_QZSS:
+        case SV_CONSTELLATION_GALILEO:
+        return L1_FREQUENCY;
+        case SV_CONSTELLATION_GLONASS:
+        /* 93-106 stand for the frequency channels -7 to 6 of satellites
+         * whose slot is not known yet */
+        if (sv->svid >= 93 && sv->svid <= 106) {
+            return G1_FREQUENCY + (sv->svid - 100) * G1_CHANNEL_SPACING;
+        }
+        return G1_FREQUENCY;
+        case SV_CONSTELLATION_BEIDOU:
+        return B1_FREQUENCY;
+        default:
+        return 0;
+    }
+}
+
+static gboolean
+indexable (int constellation, int svid)
+{
+    return constellation >= 0 && constellation < N_SV_CONSTELLATIONS &&
+           svid >= 0 && svid <= 255;
+}
+
+void
+sv_index_update (SvIndex *index, const SvEntry *previous, int n_previous,
+                 const SvEntry *svs, int num_svs)
+{
+    int i;
+
+    /* only the slots in use are cleared, not the whole table */
+    for (i = 0; i < n_previous; i++) {
+        sv_index_remove (index, previous[i].constellation, previous[i].svid);
+    }
+    for (i = 0; i < num_svs; i++) {
+        if (indexable (svs[i].constellation, svs[i].svid)) {
+            index->slots[svs[i].constellation][svs[i].svid] = i + 1;
+        }
+    }
+}
+
+void
+sv_index_remove (SvIndex *index, int constellation, int svid)
+{
+    if (indexable (constellation, svid)) {
+        index->slots[constellation][svid] = 0;
+    }
+}
+
+int
+sv_index_lookup (const SvIndex *index, const SvEntry *sv)
+{
+    if (!indexable (sv->constellation, sv->svid)) {
+        return -1;
+    }
+    return index->slots[sv->constellation][sv->svid] - 1;
+}
@@ -0,0 +1,98 @@
+/*
+ * Geoclue-provider-hybris
+ * sv-report.h - Satellite reports of the GPS hal ABIs
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef SV_REPORT_H
+#define SV_REPORT_H
+
+#include <android-config.h>
+#include <hardware/gps.h>
+
+#include <glib.h>
+
+/* The GNSS hal reports up to 64 satellites, the legacy one 32 */
+#define SV_MAX 64
+
+/* Same values as GnssConstellationType */
+typedef enum {
+    SV_CONSTELLATION_UNKNOWN,
+    SV_CONSTELLATION_GPS,
+    SV_CONSTELLATION_SBAS,
+    SV_CONSTELLATION_GLONASS,
+    SV_CONSTELLATION_QZSS,
+    SV_CONSTELLATION_BEIDOU,
+    SV_CONSTELLATION_GALILEO,
+    N_SV_CONSTELLATIONS
+} SvConstellation;
+
+/* Same values as GnssSvFlags */
+#define SV_FLAG_HAS_EPHEMERIS (1 << 0)
+#define SV_FLAG_HAS_ALMANAC   (1 << 1)
+#define SV_FLAG_USED_IN_FIX   (1 << 2)
+
+typedef struct {
+    guint8 constellation;
+    guint8 flags;
+    /* number within the constellation */
+    gint16 svid;
+    /* C/N0 in dB-Hz, degrees */
+    float snr;
+    float elevation;
+    float azimuth;
+} SvEntry;
+
+/* One satellite report, whichever callback of the hal it came from */
+typedef struct {
+    int num_svs;
+    /* of the GPS satellites, bit svid-1 */
+    guint32 ephemeris_mask;
+    SvEntry svs[SV_MAX];
+} SvReport;
+
+/* The legacy report numbers every satellite in one range, the used, almanac
+ * and ephemeris masks only cover the GPS ones */
+void sv_report_from_gps (SvReport *report, const GpsSvStatus *status);
+#if ANDROID_VERSION_MAJOR>=7
+void sv_report_from_gnss (SvReport *report, const GnssSvStatus *status);
+#endif
+
+/* The number of the legacy range, used on the Geoclue interface: GPS 1-32,
+ * SBAS 33-64, GLONASS 65-96, QZSS 193-200, BeiDou 201-263, Galileo 301-336,
+ * 0 when unknown */
+int sv_entry_prn (const SvEntry *sv);
+/* Nominal carrier of the band the satellite is tracked on in Hz, 0 when
+ * unknown. The hals do not report it, this is L1 or its equivalent. */
+double sv_entry_carrier_frequency (const SvEntry *sv);
+
+/* Positions of the satellites of a report by constellation and svid, 0
+ * for none and the position + 1 otherwise */
+typedef struct {
+    guint8 slots[N_SV_CONSTELLATIONS][256];
+} SvIndex;
+
+/* Makes the index that of svs, previous the satellites it indexed */
+void sv_index_update (SvIndex *index, const SvEntry *previous, int n_previous,
+                      const SvEntry *svs, int num_svs);
+/* Forgets one satellite, for callers that keep the report in columns */
+void sv_index_remove (SvIndex *index, int constellation, int svid);
+/* The position of the satellite, -1 when not indexed */
+int sv_index_lookup (const SvIndex *index, const SvEntry *sv);
+
+#endif /* SV_REPORT_H */
@@ -0,0 +1,192 @@
+/*
+ * Geoclue-provider-hybris
+ * test-callback-ring.c - Tests of the hal thread to main loop queue
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <config.h>
+
+#include "callback-ring.h"
+
+typedef struct {
+    guint producer;
+    guint sequence;
+    /* so a torn record shows */
+    guint check;
+} TestRecord;
+
+#define N_PRODUCERS 4
+#define N_PER_PRODUCER 100000
+
+static void
+push (CallbackRing *ring, guint sequence)
+{
+    TestRecord *record = callback_ring_reserve (ring);
+
+    g_assert (record != NULL);
+    record->sequence = sequence;
+    callback_ring_commit (ring, record);
+}
+
+static guint
+pop (CallbackRing *ring)
+{
+    TestRecord *record = callback_ring_peek (ring);
+    guint sequence;
+
+    g_assert (record != NULL);
+    sequence = record->sequence;
+    callback_ring_pop (ring);
+    return sequence;
+}
+
+static void
+test_order (void)
+{
+    CallbackRing *ring = callback_ring_new (4, sizeof (TestRecord));
+    guint i;
+
+    g_assert (callback_ring_peek (ring) == NULL);
+    /* several laps around the ring */
+    for (i = 0; i < 10; i++) {
+        push (ring, 3 * i);
+        push (ring, 3 * i + 1);
+        push (ring, 3 * i + 2);
+        g_assert_cmpuint (pop (ring), ==, 3 * i);
+        g_assert_cmpuint (pop (ring), ==, 3 * i + 1);
+        g_assert_cmpuint (pop (ring), ==, 3 * i + 2);
+        g_assert (callback_ring_peek (ring) == NULL);
+    }
+    callback_ring_free (ring);
+}
+
+static void
+test_full (void)
+{
+    CallbackRing *ring = callback_ring_new (4, sizeof (TestRecord));
+    guint i;
+
+    for (i = 0; i < 4; i++) {
+        push (ring, i);
+    }
+    /* the newest report is dropped, not the oldest */
+    g_assert (callback_ring_reserve (ring) == NULL);
+    g_assert (callback_ring_reserve (ring) == NULL);
+    g_assert_cmpuint (callback_ring_take_dropped (ring), ==, 2);
+    g_assert_cmpuint (callback_ring_take_dropped (ring), ==, 0);
+
+    g_assert_cmpuint (pop (ring), ==, 0);
+    push (ring, 4);
+    for (i = 1; i <= 4; i++) {
+        g_assert_cmpuint (pop (ring), ==, i);
+    }
+    g_assert (callback_ring_peek (ring) == NULL);
+    callback_ring_free (ring);
+}
+
+static void
+test_uncommitted (void)
+{
+    CallbackRing *ring = callback_ring_new (4, sizeof (TestRecord));
+    TestRecord *first = callback_ring_reserve (ring);
+    TestRecord *second = callback_ring_reserve (ring);
+
+    g_assert (first != NULL && second != NULL && first != second);
+    second->sequence = 2;
+    callback_ring_commit (ring, second);
+    /* a record claimed earlier holds back the ones after it */
+    g_assert (callback_ring_peek (ring) == NULL);
+
+    first->sequence = 1;
+    callback_ring_commit (ring, first);
+    g_assert_cmpuint (pop (ring), ==, 1);
+    g_assert_cmpuint (pop (ring), ==, 2);
+    callback_ring_free (ring);
+}
+
+static gpointer
+producer_thread (gpointer data)
+{
+    CallbackRing *ring = data;
+    static gint next_producer;
+    guint producer = g_atomic_int_add (&next_producer, 1);
+    guint i = 0;
+
+    while (i < N_PER_PRODUCER) {
+        TestRecord *record = callback_ring_reserve (ring);
+
+        if (!record) {
+            /* full, let the consumer run */
+            g_thread_yield ();
+            continue;
+        }
+        record->producer = producer;
+        record->sequence = i;
+        record->check = producer * 1000003 + i;
+        callback_ring_commit (ring, record);
+        i++;
+    }
+    return NULL;
+}
+
+static void
+test_producers (void)
+{
+    CallbackRing *ring = callback_ring_new (32, sizeof (TestRecord));
+    GThread *threads[N_PRODUCERS];
+    guint next[N_PRODUCERS] = { 0 };
+    guint total = 0;
+    int i;
+
+    for (i = 0; i < N_PRODUCERS; i++) {
+        threads[i] = g_thread_new ("producer", producer_thread, ring);
+    }
+    while (total < N_PRODUCERS * N_PER_PRODUCER) {
+        TestRecord *record = callback_ring_peek (ring);
+
+        if (!record) {
+            g_thread_yield ();
+            continue;
+        }
+        /* complete, and in order for each producer */
+        g_assert_cmpuint (record->producer, <, N_PRODUCERS);
+        g_assert_cmpuint (record->check, ==, record->producer * 1000003 + record->sequence);
+        g_assert_cmpuint (record->sequence, ==, next[record->producer]);
+        next[record->producer]++;
+        callback_ring_pop (ring);
+        total++;
+    }
+    for (i = 0; i < N_PRODUCERS; i++) {
+        g_thread_join (threads[i]);
+    }
+    g_assert (callback_ring_peek (ring) == NULL);
+    callback_ring_free (ring);
+}
+
+int
+main (int argc, char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/callback-ring/order", test_order);
+    g_test_add_func ("/callback-ring/full", test_full);
+    g_test_add_func ("/callback-ring/uncommitted", test_uncommitted);
+    g_test_add_func ("/callback-ring/producers", test_producers);
+
+    return g_test_run ();
+}
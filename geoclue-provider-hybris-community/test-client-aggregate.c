@@ -0,0 +1,172 @@
+/*
+ * Geoclue-provider-hybris
+ * test-client-aggregate.c - Tests of what the clients want together
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include "client-aggregate.h"
+
+static void
+add (ClientAggregate *aggregate, guint interval, guint min_interval,
+     guint accuracy, gboolean single_shot)
+{
+    ClientRequest request;
+
+    memset (&request, 0, sizeof (request));
+    request.interval = interval;
+    request.min_interval = min_interval;
+    request.accuracy = accuracy;
+    request.single_shot = single_shot;
+    client_aggregate_add (aggregate, &request);
+}
+
+static void
+test_none (void)
+{
+    ClientAggregate aggregate;
+
+    client_aggregate_init (&aggregate);
+    g_assert_cmpint (aggregate.n_clients, ==, 0);
+    g_assert_cmpuint (aggregate.interval, ==, 0);
+    g_assert_cmpuint (aggregate.accuracy, ==, 0);
+    g_assert (!aggregate.tracking);
+    g_assert (!aggregate.batching);
+}
+
+static void
+test_interval (void)
+{
+    ClientAggregate aggregate;
+
+    client_aggregate_init (&aggregate);
+    add (&aggregate, 5000, 0, 0, FALSE);
+    add (&aggregate, 2000, 0, 0, FALSE);
+    add (&aggregate, 3000, 0, 0, FALSE);
+    g_assert_cmpint (aggregate.n_clients, ==, 3);
+    g_assert_cmpuint (aggregate.interval, ==, 2000);
+    g_assert (aggregate.tracking);
+}
+
+static void
+test_default_interval (void)
+{
+    ClientAggregate aggregate;
+    ClientRequest request;
+
+    /* a client without a preference is not slowed down by a slower one */
+    client_aggregate_init (&aggregate);
+    add (&aggregate, 0, 0, 0, FALSE);
+    g_assert_cmpuint (aggregate.interval, ==, DEFAULT_FIX_INTERVAL);
+    add (&aggregate, 5000, 0, 0, FALSE);
+    g_assert_cmpuint (aggregate.interval, ==, DEFAULT_FIX_INTERVAL);
+    add (&aggregate, 500, 0, 0, FALSE);
+    g_assert_cmpuint (aggregate.interval, ==, 500);
+
+    /* fences alone do not ask for fixes */
+    memset (&request, 0, sizeof (request));
+    request.fence_only = TRUE;
+    client_aggregate_init (&aggregate);
+    client_aggregate_add (&aggregate, &request);
+    g_assert_cmpuint (aggregate.interval, ==, 0);
+}
+
+static void
+test_subscriber_interval (void)
+{
+    ClientAggregate aggregate;
+
+    /* a subscriber without SetOptions asks for its minimum interval */
+    client_aggregate_init (&aggregate);
+    add (&aggregate, 0, 4000, 0, FALSE);
+    g_assert_cmpuint (aggregate.interval, ==, 4000);
+
+    /* SetOptions wins over the subscription */
+    client_aggregate_init (&aggregate);
+    add (&aggregate, 8000, 500, 0, FALSE);
+    g_assert_cmpuint (aggregate.interval, ==, 8000);
+}
+
+static void
+test_accuracy (void)
+{
+    ClientAggregate aggregate;
+
+    client_aggregate_init (&aggregate);
+    add (&aggregate, 0, 0, 0, FALSE);
+    add (&aggregate, 0, 0, 50, FALSE);
+    add (&aggregate, 0, 0, 10, FALSE);
+    add (&aggregate, 0, 0, 100, FALSE);
+    g_assert_cmpuint (aggregate.accuracy, ==, 10);
+}
+
+static void
+test_single_shot (void)
+{
+    ClientAggregate aggregate;
+
+    client_aggregate_init (&aggregate);
+    add (&aggregate, 0, 0, 0, TRUE);
+    add (&aggregate, 0, 0, 0, TRUE);
+    g_assert (aggregate.single_shot);
+    add (&aggregate, 0, 0, 0, FALSE);
+    g_assert (!aggregate.single_shot);
+}
+
+static void
+test_tracking (void)
+{
+    ClientAggregate aggregate;
+    ClientRequest request;
+
+    memset (&request, 0, sizeof (request));
+    client_aggregate_init (&aggregate);
+    request.fence_only = TRUE;
+    client_aggregate_add (&aggregate, &request);
+    g_assert (!aggregate.tracking);
+    g_assert (!aggregate.batching);
+
+    request.fence_only = FALSE;
+    request.batching = TRUE;
+    client_aggregate_add (&aggregate, &request);
+    g_assert (!aggregate.tracking);
+    g_assert (aggregate.batching);
+
+    request.batching = FALSE;
+    client_aggregate_add (&aggregate, &request);
+    g_assert (aggregate.tracking);
+}
+
+int
+main (int argc, char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/client-aggregate/none", test_none);
+    g_test_add_func ("/client-aggregate/interval", test_interval);
+    g_test_add_func ("/client-aggregate/default-interval", test_default_interval);
+    g_test_add_func ("/client-aggregate/subscriber-interval", test_subscriber_interval);
+    g_test_add_func ("/client-aggregate/accuracy", test_accuracy);
+    g_test_add_func ("/client-aggregate/single-shot", test_single_shot);
+    g_test_add_func ("/client-aggregate/tracking", test_tracking);
+
+    return g_test_run ();
+}
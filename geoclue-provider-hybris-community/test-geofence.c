@@ -0,0 +1,181 @@
+/*
+ * Geoclue-provider-hybris
+ * test-geofence.c - Tests of the geofence index
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <config.h>
+
+#include <math.h>
+#include <string.h>
+
+#include "geofence.h"
+
+#define LATITUDE 60.0
+#define LONGITUDE 24.0
+/* m per degree of latitude */
+#define DEGREE 111195.0
+
+/* The transitions reported, fence id * 10 + transition */
+static guint transitions[16];
+static guint n_transitions;
+
+static void
+record_transition (Geofence *fence, guint transition, const GpsLocation *location,
+                   gpointer user_data)
+{
+    g_assert (n_transitions < G_N_ELEMENTS (transitions));
+    transitions[n_transitions++] = fence->id * 10 + transition;
+}
+
+static void
+update (GeofenceIndex *index, GpsUtcTime timestamp, double north, double accuracy)
+{
+    GpsLocation location;
+
+    memset (&location, 0, sizeof (location));
+    location.size = sizeof (location);
+    location.flags = GPS_LOCATION_HAS_LAT_LONG | GPS_LOCATION_HAS_ACCURACY;
+    location.latitude = LATITUDE + north / DEGREE;
+    location.longitude = LONGITUDE;
+    location.accuracy = accuracy;
+    location.timestamp = timestamp;
+    n_transitions = 0;
+    geofence_index_update (index, &location, record_transition, NULL);
+}
+
+static void
+make_fence (Geofence *fence, guint id, double radius, guint transitions)
+{
+    memset (fence, 0, sizeof (Geofence));
+    fence->id = id;
+    fence->latitude = LATITUDE;
+    fence->longitude = LONGITUDE;
+    fence->radius = radius;
+    fence->transitions = transitions;
+}
+
+static void
+test_distance (void)
+{
+    g_assert (geofence_distance (LATITUDE, LONGITUDE, LATITUDE, LONGITUDE) == 0);
+    g_assert (fabs (geofence_distance (LATITUDE, LONGITUDE, LATITUDE + 1, LONGITUDE) -
+                    DEGREE) < 1);
+    /* a degree of longitude is half as long at 60 degrees */
+    g_assert (fabs (geofence_distance (LATITUDE, LONGITUDE, LATITUDE, LONGITUDE + 1) -
+                    DEGREE / 2) < 100);
+}
+
+static void
+test_enter_exit (void)
+{
+    GeofenceIndex index;
+    Geofence fence;
+
+    geofence_index_init (&index);
+    make_fence (&fence, 1, 100, GEOFENCE_ENTER | GEOFENCE_EXIT);
+    geofence_index_add (&index, &fence);
+    g_assert_cmpuint (geofence_index_size (&index), ==, 1);
+
+    update (&index, 1000, 500, 10);
+    g_assert_cmpuint (n_transitions, ==, 0);
+    update (&index, 2000, 50, 10);
+    g_assert_cmpuint (n_transitions, ==, 1);
+    g_assert_cmpuint (transitions[0], ==, 10 + GEOFENCE_ENTER);
+    update (&index, 3000, 0, 10);
+    g_assert_cmpuint (n_transitions, ==, 0);
+    /* out, but not by the whole accuracy */
+    update (&index, 4000, 120, 30);
+    g_assert_cmpuint (n_transitions, ==, 0);
+    update (&index, 5000, 150, 30);
+    g_assert_cmpuint (n_transitions, ==, 1);
+    g_assert_cmpuint (transitions[0], ==, 10 + GEOFENCE_EXIT);
+
+    geofence_index_remove (&index, &fence);
+    g_assert_cmpuint (geofence_index_size (&index), ==, 0);
+    update (&index, 6000, 0, 10);
+    g_assert_cmpuint (n_transitions, ==, 0);
+    geofence_index_free (&index);
+}
+
+static void
+test_dwell (void)
+{
+    GeofenceIndex index;
+    Geofence fence;
+
+    geofence_index_init (&index);
+    make_fence (&fence, 2, 100, GEOFENCE_DWELL);
+    fence.dwell_time = 5000;
+    geofence_index_add (&index, &fence);
+
+    update (&index, 1000, 0, 10);
+    g_assert_cmpuint (n_transitions, ==, 0);
+    update (&index, 5999, 0, 10);
+    g_assert_cmpuint (n_transitions, ==, 0);
+    update (&index, 6000, 0, 10);
+    g_assert_cmpuint (n_transitions, ==, 1);
+    g_assert_cmpuint (transitions[0], ==, 20 + GEOFENCE_DWELL);
+    /* once per stay */
+    update (&index, 9000, 0, 10);
+    g_assert_cmpuint (n_transitions, ==, 0);
+    geofence_index_free (&index);
+}
+
+static void
+test_cells (void)
+{
+    GeofenceIndex index;
+    Geofence small, large;
+
+    /* a fence too large for the grid and one a few cells away are both
+     * found, each reported once */
+    geofence_index_init (&index);
+    make_fence (&small, 3, 100, GEOFENCE_ENTER);
+    small.latitude = LATITUDE + 3000 / DEGREE;
+    make_fence (&large, 4, 20000, GEOFENCE_ENTER);
+    geofence_index_add (&index, &small);
+    geofence_index_add (&index, &large);
+    geofence_index_add (&index, &small);
+    g_assert_cmpuint (geofence_index_size (&index), ==, 2);
+
+    update (&index, 1000, 0, 10);
+    g_assert_cmpuint (n_transitions, ==, 1);
+    g_assert_cmpuint (transitions[0], ==, 40 + GEOFENCE_ENTER);
+    update (&index, 2000, 3000, 10);
+    g_assert_cmpuint (n_transitions, ==, 1);
+    g_assert_cmpuint (transitions[0], ==, 30 + GEOFENCE_ENTER);
+
+    geofence_index_remove (&index, &small);
+    geofence_index_remove (&index, &large);
+    g_assert_cmpuint (g_hash_table_size (index.cells), ==, 0);
+    geofence_index_free (&index);
+}
+
+int
+main (int argc, char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/geofence/distance", test_distance);
+    g_test_add_func ("/geofence/enter-exit", test_enter_exit);
+    g_test_add_func ("/geofence/dwell", test_dwell);
+    g_test_add_func ("/geofence/cells", test_cells);
+
+    return g_test_run ();
+}
@@ -0,0 +1,199 @@
+/*
+ * Geoclue-provider-hybris
+ * test-hal-trace.c - Tests of recording and replaying a HAL trace
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "hal-trace.h"
+
+#define TRACE_SIZE 4096
+
+static char *
+make_dir (void)
+{
+    char *dir = g_build_filename (g_get_tmp_dir (), "test-hal-trace-XXXXXX", NULL);
+
+    g_assert (mkdtemp (dir) != NULL);
+    return dir;
+}
+
+static void
+remove_dir (char *dir, char *path)
+{
+    unlink (path);
+    rmdir (dir);
+    g_free (path);
+    g_free (dir);
+}
+
+static void
+test_round_trip (void)
+{
+    char *dir = make_dir ();
+    char *path = g_build_filename (dir, "trace", NULL);
+    const char sentence[] = "$GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,*47";
+    GpsLocation location;
+    GpsStatus status;
+    HalTraceReader *reader;
+    HalTraceType type;
+    gint64 time, last_time = 0;
+    const void *data;
+    gsize length;
+    guint32 capabilities;
+    guint n;
+
+    memset (&location, 0, sizeof (location));
+    location.size = sizeof (location);
+    location.flags = GPS_LOCATION_HAS_LAT_LONG;
+    location.latitude = 60.17;
+    location.longitude = 24.94;
+    location.timestamp = 1500000000000;
+    memset (&status, 0, sizeof (status));
+    status.size = sizeof (status);
+    status.status = GPS_STATUS_SESSION_BEGIN;
+
+    g_assert (hal_trace_open (path, TRACE_SIZE));
+    hal_trace_capabilities (GPS_CAPABILITY_SCHEDULING);
+    hal_trace_status (&status);
+    hal_trace_location (&location);
+    hal_trace_nmea (location.timestamp, sentence, strlen (sentence));
+    hal_trace_close ();
+    /* nothing is recorded while closed */
+    hal_trace_capabilities (0);
+
+    reader = hal_trace_reader_open (path);
+    g_assert (reader != NULL);
+
+    g_assert (hal_trace_reader_next (reader, &type, &time, &data, &length));
+    g_assert_cmpint (type, ==, HAL_TRACE_CAPABILITIES);
+    g_assert_cmpuint (length, ==, sizeof (guint32));
+    memcpy (&capabilities, data, sizeof (capabilities));
+    g_assert_cmpuint (capabilities, ==, GPS_CAPABILITY_SCHEDULING);
+    last_time = time;
+
+    g_assert (hal_trace_reader_next (reader, &type, &time, &data, &length));
+    g_assert_cmpint (type, ==, HAL_TRACE_STATUS);
+    g_assert_cmpuint (length, ==, sizeof (GpsStatus));
+    g_assert_cmpint (((const GpsStatus *) data)->status, ==, GPS_STATUS_SESSION_BEGIN);
+    g_assert_cmpint (time, >=, last_time);
+    last_time = time;
+
+    g_assert (hal_trace_reader_next (reader, &type, &time, &data, &length));
+    g_assert_cmpint (type, ==, HAL_TRACE_LOCATION);
+    g_assert_cmpuint (length, ==, sizeof (GpsLocation));
+    g_assert (memcmp (data, &location, sizeof (GpsLocation)) == 0);
+    g_assert_cmpint (time, >=, last_time);
+
+    g_assert (hal_trace_reader_next (reader, &type, &time, &data, &length));
+    g_assert_cmpint (type, ==, HAL_TRACE_NMEA);
+    g_assert_cmpuint (length, ==, sizeof (GpsUtcTime) + strlen (sentence));
+    g_assert (memcmp (data, &location.timestamp, sizeof (GpsUtcTime)) == 0);
+    g_assert (memcmp ((const guint8 *) data + sizeof (GpsUtcTime), sentence,
+                      strlen (sentence)) == 0);
+
+    g_assert (!hal_trace_reader_next (reader, &type, &time, &data, &length));
+    hal_trace_reader_close (reader);
+
+    /* reopening appends */
+    g_assert (hal_trace_open (path, TRACE_SIZE));
+    hal_trace_capabilities (GPS_CAPABILITY_MSB);
+    hal_trace_close ();
+    reader = hal_trace_reader_open (path);
+    g_assert (reader != NULL);
+    n = 0;
+    while (hal_trace_reader_next (reader, &type, &time, &data, &length)) {
+        n++;
+    }
+    g_assert_cmpuint (n, ==, 5);
+    g_assert_cmpint (type, ==, HAL_TRACE_CAPABILITIES);
+    memcpy (&capabilities, data, sizeof (capabilities));
+    g_assert_cmpuint (capabilities, ==, GPS_CAPABILITY_MSB);
+    hal_trace_reader_close (reader);
+
+    remove_dir (dir, path);
+}
+
+static void
+test_wrap (void)
+{
+    char *dir = make_dir ();
+    char *path = g_build_filename (dir, "trace", NULL);
+    HalTraceReader *reader;
+    HalTraceType type;
+    gint64 time;
+    const void *data;
+    gsize length;
+    guint32 capabilities, expected = 0, i;
+    guint n = 0;
+
+    /* far more records than fit, the oldest are dropped */
+    g_assert (hal_trace_open (path, TRACE_SIZE));
+    for (i = 0; i < 1000; i++) {
+        hal_trace_capabilities (i);
+    }
+    hal_trace_close ();
+
+    reader = hal_trace_reader_open (path);
+    g_assert (reader != NULL);
+    while (hal_trace_reader_next (reader, &type, &time, &data, &length)) {
+        g_assert_cmpint (type, ==, HAL_TRACE_CAPABILITIES);
+        memcpy (&capabilities, data, sizeof (capabilities));
+        if (n++) {
+            g_assert_cmpuint (capabilities, ==, expected);
+        }
+        expected = capabilities + 1;
+    }
+    hal_trace_reader_close (reader);
+    g_assert_cmpuint (expected, ==, 1000);
+    g_assert_cmpuint (n, >, 100);
+    g_assert_cmpuint (n, <, 1000);
+
+    remove_dir (dir, path);
+}
+
+static void
+test_invalid (void)
+{
+    char *dir = make_dir ();
+    char *path = g_build_filename (dir, "trace", NULL);
+
+    g_assert (hal_trace_reader_open (path) == NULL);
+    g_assert (g_file_set_contents (path, "not a trace", -1, NULL));
+    g_assert (hal_trace_reader_open (path) == NULL);
+
+    remove_dir (dir, path);
+}
+
+int
+main (int argc, char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/hal-trace/round-trip", test_round_trip);
+    g_test_add_func ("/hal-trace/wrap", test_wrap);
+    g_test_add_func ("/hal-trace/invalid", test_invalid);
+
+    return g_test_run ();
+}
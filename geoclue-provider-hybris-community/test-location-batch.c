@@ -0,0 +1,125 @@
+/*
+ * Geoclue-provider-hybris
+ * test-location-batch.c - Tests of the batch ring
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <config.h>
+
+#include <math.h>
+
+#include "location-batch.h"
+
+static void
+append (LocationBatch *batch, gint64 timestamp)
+{
+    BatchFix fix = { timestamp, 60.0, 24.0, NAN, NAN, NAN, 10.0 };
+
+    location_batch_append (batch, &fix);
+}
+
+/* Checks that a batch holds the fixes first to last */
+static void
+check_batch (GVariant *fixes, gint64 first, gint64 last)
+{
+    GVariantIter iter;
+    gint64 timestamp, expected = first;
+    double latitude, longitude, altitude, speed, bearing, accuracy;
+
+    g_assert_cmpuint (g_variant_n_children (fixes), ==, last - first + 1);
+    g_variant_iter_init (&iter, fixes);
+    while (g_variant_iter_next (&iter, "(xdddddd)", &timestamp, &latitude, &longitude,
+                                &altitude, &speed, &bearing, &accuracy)) {
+        g_assert_cmpint (timestamp, ==, expected);
+        g_assert (latitude == 60.0 && accuracy == 10.0);
+        g_assert (isnan (altitude));
+        expected++;
+    }
+    g_variant_unref (fixes);
+}
+
+static void
+test_collect (void)
+{
+    LocationBatch batch;
+    guint64 next = 0;
+
+    location_batch_init (&batch, 8);
+    g_assert_cmpuint (location_batch_pending (&batch, next), ==, 0);
+    append (&batch, 1);
+    append (&batch, 2);
+    append (&batch, 3);
+    g_assert_cmpuint (location_batch_pending (&batch, next), ==, 3);
+    check_batch (g_variant_ref_sink (location_batch_collect (&batch, &next)), 1, 3);
+    g_assert_cmpuint (next, ==, 3);
+    g_assert_cmpuint (location_batch_pending (&batch, next), ==, 0);
+    append (&batch, 4);
+    check_batch (g_variant_ref_sink (location_batch_collect (&batch, &next)), 4, 4);
+    location_batch_free (&batch);
+}
+
+static void
+test_overwrite (void)
+{
+    LocationBatch batch;
+    guint64 next = 0;
+    int i;
+
+    /* a slow reader only gets the last capacity fixes */
+    location_batch_init (&batch, 4);
+    for (i = 1; i <= 10; i++) {
+        append (&batch, i);
+    }
+    g_assert_cmpuint (location_batch_head (&batch), ==, 10);
+    g_assert_cmpuint (location_batch_pending (&batch, next), ==, 4);
+    check_batch (g_variant_ref_sink (location_batch_collect (&batch, &next)), 7, 10);
+    g_assert_cmpuint (next, ==, 10);
+    location_batch_free (&batch);
+}
+
+static void
+test_readers (void)
+{
+    LocationBatch batch;
+    guint64 first = 0, second;
+    int i;
+
+    /* each reader keeps its own position, a late one starts at the head */
+    location_batch_init (&batch, 16);
+    append (&batch, 1);
+    append (&batch, 2);
+    second = location_batch_head (&batch);
+    for (i = 3; i <= 5; i++) {
+        append (&batch, i);
+    }
+    check_batch (g_variant_ref_sink (location_batch_collect (&batch, &second)), 3, 5);
+    check_batch (g_variant_ref_sink (location_batch_collect (&batch, &first)), 1, 5);
+    location_batch_free (&batch);
+}
+
+int
+main (int argc, char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/location-batch/collect", test_collect);
+    g_test_add_func ("/location-batch/overwrite", test_overwrite);
+    g_test_add_func ("/location-batch/readers", test_readers);
+
+    return g_test_run ();
+}
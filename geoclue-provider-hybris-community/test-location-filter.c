@@ -0,0 +1,144 @@
+/*
+ * Geoclue-provider-hybris
+ * test-location-filter.c - Tests of the location filter
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <config.h>
+
+#include <math.h>
+#include <string.h>
+
+#include "location-filter.h"
+
+#define LATITUDE 60.0
+#define LONGITUDE 24.0
+/* m per degree of latitude */
+#define DEGREE 111195.0
+
+static const LocationFilterParams params = { 0.5, 0.5, 10000 };
+
+static void
+make_location (GpsLocation *location, GpsUtcTime timestamp, double north, double accuracy)
+{
+    memset (location, 0, sizeof (GpsLocation));
+    location->size = sizeof (GpsLocation);
+    location->flags = GPS_LOCATION_HAS_LAT_LONG | GPS_LOCATION_HAS_ACCURACY;
+    location->latitude = LATITUDE + north / DEGREE;
+    location->longitude = LONGITUDE;
+    location->accuracy = accuracy;
+    location->timestamp = timestamp;
+}
+
+static void
+test_pass_through (void)
+{
+    LocationFilter filter;
+    GpsLocation location;
+    double climb;
+
+    location_filter_reset (&filter);
+    memset (&location, 0, sizeof (location));
+    location.flags = GPS_LOCATION_HAS_SPEED;
+    location.speed = 3;
+    g_assert (location_filter_update (&filter, &params, &location, &climb));
+    g_assert (isnan (climb));
+    g_assert (location.speed == 3);
+    g_assert (!filter.initialized);
+}
+
+static void
+test_stationary (void)
+{
+    LocationFilter filter;
+    GpsLocation location;
+    double climb;
+    int i;
+
+    location_filter_reset (&filter);
+    make_location (&location, 1000, 0, 10);
+    g_assert (location_filter_update (&filter, &params, &location, &climb));
+    /* jitter well inside the accuracy is not a move */
+    for (i = 1; i < 20; i++) {
+        make_location (&location, 1000 + i * 1000, i % 2 ? 2 : -2, 10);
+        g_assert (!location_filter_update (&filter, &params, &location, &climb));
+        g_assert (fabs ((location.latitude - LATITUDE) * DEGREE) < 2);
+        g_assert (location.accuracy < 10);
+    }
+}
+
+static void
+test_moving (void)
+{
+    LocationFilter filter;
+    GpsLocation location;
+    double climb;
+    int i, moves = 0;
+
+    location_filter_reset (&filter);
+    for (i = 0; i < 30; i++) {
+        make_location (&location, 1000 + i * 1000, i * 20.0, 5);
+        location.flags |= GPS_LOCATION_HAS_SPEED | GPS_LOCATION_HAS_BEARING |
+                          GPS_LOCATION_HAS_ALTITUDE;
+        location.speed = 20;
+        location.bearing = 0;
+        location.altitude = 100 + i;
+        if (location_filter_update (&filter, &params, &location, &climb)) {
+            moves++;
+        }
+    }
+    /* 20 m per fix at 5 m accuracy is a move every time */
+    g_assert_cmpint (moves, ==, 30);
+    g_assert (fabs ((location.latitude - LATITUDE) * DEGREE - 29 * 20.0) < 5);
+    g_assert (fabs (location.speed - 20) < 1);
+    g_assert (location.bearing < 1 || location.bearing > 359);
+    g_assert (fabs (climb - 1) < 0.5);
+}
+
+static void
+test_gap (void)
+{
+    LocationFilter filter;
+    GpsLocation location;
+    double climb;
+
+    location_filter_reset (&filter);
+    make_location (&location, 1000, 0, 10);
+    g_assert (location_filter_update (&filter, &params, &location, &climb));
+    /* after a long gap, or with time going backwards, the filter restarts
+     * at the new fix */
+    make_location (&location, 1000 + params.max_gap + 1, 3, 10);
+    g_assert (location_filter_update (&filter, &params, &location, &climb));
+    g_assert (location.latitude == LATITUDE + 3 / DEGREE);
+    make_location (&location, 500, 1, 10);
+    g_assert (location_filter_update (&filter, &params, &location, &climb));
+    g_assert (location.latitude == LATITUDE + 1 / DEGREE);
+}
+
+int
+main (int argc, char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/location-filter/pass-through", test_pass_through);
+    g_test_add_func ("/location-filter/stationary", test_stationary);
+    g_test_add_func ("/location-filter/moving", test_moving);
+    g_test_add_func ("/location-filter/gap", test_gap);
+
+    return g_test_run ();
+}
@@ -0,0 +1,135 @@
+/*
+ * Geoclue-provider-hybris
+ * test-state-cache.c - Tests of the state file
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "state-cache.h"
+
+static char *
+make_path (void)
+{
+    char *dir = g_build_filename (g_get_tmp_dir (), "test-state-cache-XXXXXX", NULL);
+
+    g_assert (mkdtemp (dir) != NULL);
+    return dir;
+}
+
+static void
+remove_path (char *dir, char *path)
+{
+    unlink (path);
+    rmdir (dir);
+    g_free (path);
+    g_free (dir);
+}
+
+static void
+fill (StateCacheData *data, int n)
+{
+    int i;
+
+    memset (data, 0, sizeof (StateCacheData));
+    data->position_time = 1500000000000 + n;
+    data->position_fields = 7;
+    data->latitude = 60.17 + n;
+    data->longitude = 24.94;
+    data->altitude = 12.5;
+    data->accuracy = 8;
+    data->satellite_time = 1500000000500 + n;
+    data->satellite_visible = 5;
+    data->satellite_used = 3;
+    for (i = 0; i < data->satellite_visible; i++) {
+        data->satellites[i].constellation = SV_CONSTELLATION_GPS;
+        data->satellites[i].svid = i + 1;
+        data->satellites[i].snr = 30 + i + n;
+        data->satellites[i].used = i < data->satellite_used;
+    }
+    data->ephemeris_time = 1500000000000;
+    data->ephemeris_mask = 0x1f;
+}
+
+static void
+test_round_trip (void)
+{
+    char *dir = make_path ();
+    char *path = g_build_filename (dir, "state", NULL);
+    StateCacheData written, read;
+
+    g_assert (state_cache_open (path));
+    g_assert (!state_cache_read (&read));
+
+    fill (&written, 0);
+    state_cache_write (&written);
+    g_assert (state_cache_read (&read));
+    g_assert (memcmp (&read, &written, sizeof (StateCacheData)) == 0);
+
+    /* the last write is current, also in the next run */
+    fill (&written, 1);
+    state_cache_write (&written);
+    fill (&written, 2);
+    state_cache_write (&written);
+    state_cache_close ();
+
+    g_assert (state_cache_open (path));
+    g_assert (state_cache_read (&read));
+    g_assert (memcmp (&read, &written, sizeof (StateCacheData)) == 0);
+    state_cache_close ();
+
+    remove_path (dir, path);
+}
+
+static void
+test_other_layout (void)
+{
+    char *dir = make_path ();
+    char *path = g_build_filename (dir, "state", NULL);
+    StateCacheData written, read;
+
+    g_assert (g_file_set_contents (path, "not a state file", -1, NULL));
+    g_assert (state_cache_open (path));
+    g_assert (!state_cache_read (&read));
+
+    fill (&written, 0);
+    state_cache_write (&written);
+    state_cache_close ();
+    g_assert (state_cache_open (path));
+    g_assert (state_cache_read (&read));
+    g_assert (memcmp (&read, &written, sizeof (StateCacheData)) == 0);
+    state_cache_close ();
+
+    remove_path (dir, path);
+}
+
+int
+main (int argc, char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/state-cache/round-trip", test_round_trip);
+    g_test_add_func ("/state-cache/other-layout", test_other_layout);
+
+    return g_test_run ();
+}
@@ -0,0 +1,108 @@
+/*
+ * Geoclue-provider-hybris
+ * test-subscription-filter.c - Tests of when a subscriber gets a signal
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <config.h>
+
+#include "subscription-filter.h"
+
+/* about 111 m per 0.001 degree of latitude */
+#define LATITUDE 60.0
+#define STEP 0.001
+
+static void
+test_interval (void)
+{
+    SubscriptionLimits limits = { 1000, 0 };
+    SubscriptionSent sent;
+
+    subscription_sent_reset (&sent);
+    g_assert (subscription_filter (&sent, &limits, 5000, FALSE, 0, 0));
+    g_assert (!subscription_filter (&sent, &limits, 5999, FALSE, 0, 0));
+    g_assert (subscription_filter (&sent, &limits, 6000, FALSE, 0, 0));
+    g_assert_cmpint (sent.timestamp, ==, 6000);
+    /* a clock going backwards is not waited for */
+    g_assert (subscription_filter (&sent, &limits, 100, FALSE, 0, 0));
+    g_assert_cmpint (sent.timestamp, ==, 100);
+}
+
+static void
+test_distance (void)
+{
+    SubscriptionLimits limits = { 0, 200 };
+    SubscriptionSent sent;
+
+    subscription_sent_reset (&sent);
+    g_assert (subscription_filter (&sent, &limits, 1000, TRUE, LATITUDE, 10));
+    g_assert (!subscription_filter (&sent, &limits, 2000, TRUE, LATITUDE + STEP, 10));
+    /* the reference stays where the last signal was */
+    g_assert (sent.latitude == LATITUDE);
+    g_assert (subscription_filter (&sent, &limits, 3000, TRUE, LATITUDE + 2 * STEP, 10));
+    g_assert (sent.latitude == LATITUDE + 2 * STEP);
+    /* signals without a position only have the interval */
+    g_assert (subscription_filter (&sent, &limits, 4000, FALSE, 0, 0));
+    g_assert (sent.latitude == LATITUDE + 2 * STEP);
+}
+
+static void
+test_first_position (void)
+{
+    SubscriptionLimits limits = { 0, 200 };
+    SubscriptionSent sent;
+
+    /* a signal without a position does not become a reference point */
+    subscription_sent_reset (&sent);
+    g_assert (subscription_filter (&sent, &limits, 1000, FALSE, 0, 0));
+    g_assert (!sent.has_position);
+    g_assert (subscription_filter (&sent, &limits, 2000, TRUE, LATITUDE, 10));
+    g_assert (sent.has_position);
+}
+
+static void
+test_separate (void)
+{
+    SubscriptionLimits limits = { 0, 200 };
+    SubscriptionSent position, fix;
+
+    /* each subscription moves from its own last signal */
+    subscription_sent_reset (&position);
+    subscription_sent_reset (&fix);
+    g_assert (subscription_filter (&position, &limits, 1000, TRUE, LATITUDE, 10));
+    g_assert (subscription_filter (&fix, &limits, 1000, TRUE, LATITUDE, 10));
+    g_assert (subscription_filter (&position, &limits, 2000, TRUE, LATITUDE + 2 * STEP, 10));
+    g_assert (subscription_filter (&fix, &limits, 2000, TRUE, LATITUDE + 2 * STEP, 10));
+    g_assert (!subscription_filter (&position, &limits, 3000, TRUE, LATITUDE + 3 * STEP, 10));
+    g_assert (subscription_filter (&fix, &limits, 3000, TRUE, LATITUDE + 4 * STEP, 10));
+    g_assert (position.latitude == LATITUDE + 2 * STEP);
+    g_assert (fix.latitude == LATITUDE + 4 * STEP);
+}
+
+int
+main (int argc, char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/subscription-filter/interval", test_interval);
+    g_test_add_func ("/subscription-filter/distance", test_distance);
+    g_test_add_func ("/subscription-filter/first-position", test_first_position);
+    g_test_add_func ("/subscription-filter/separate", test_separate);
+
+    return g_test_run ();
+}
@@ -0,0 +1,179 @@
+/*
+ * Geoclue-provider-hybris
+ * test-sv-report.c - Tests of the satellite report mapping
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include "sv-report.h"
+
+static const struct {
+    int prn;
+    SvConstellation constellation;
+    int svid;
+} legacy_prns[] = {
+    { 1, SV_CONSTELLATION_GPS, 1 },
+    { 32, SV_CONSTELLATION_GPS, 32 },
+    { 33, SV_CONSTELLATION_SBAS, 120 },
+    { 51, SV_CONSTELLATION_SBAS, 138 },
+    { 65, SV_CONSTELLATION_GLONASS, 1 },
+    { 96, SV_CONSTELLATION_GLONASS, 32 },
+    { 193, SV_CONSTELLATION_QZSS, 193 },
+    { 201, SV_CONSTELLATION_BEIDOU, 1 },
+    { 263, SV_CONSTELLATION_BEIDOU, 63 },
+    { 301, SV_CONSTELLATION_GALILEO, 1 },
+    { 336, SV_CONSTELLATION_GALILEO, 36 },
+    { 400, SV_CONSTELLATION_UNKNOWN, 400 },
+};
+
+static void
+test_from_gps (void)
+{
+    GpsSvStatus status;
+    SvReport report;
+    guint i;
+
+    memset (&status, 0, sizeof (status));
+    status.size = sizeof (status);
+    status.num_svs = G_N_ELEMENTS (legacy_prns);
+    for (i = 0; i < G_N_ELEMENTS (legacy_prns); i++) {
+        status.sv_list[i].prn = legacy_prns[i].prn;
+        status.sv_list[i].snr = 30 + i;
+        status.sv_list[i].elevation = 10 + i;
+        status.sv_list[i].azimuth = 100 + i;
+    }
+    sv_report_from_gps (&report, &status);
+
+    g_assert_cmpint (report.num_svs, ==, G_N_ELEMENTS (legacy_prns));
+    for (i = 0; i < G_N_ELEMENTS (legacy_prns); i++) {
+        const SvEntry *sv = &report.svs[i];
+
+        g_assert_cmpint (sv->constellation, ==, legacy_prns[i].constellation);
+        g_assert_cmpint (sv->svid, ==, legacy_prns[i].svid);
+        /* and back to the number on the Geoclue interface */
+        g_assert_cmpint (sv_entry_prn (sv), ==, legacy_prns[i].prn);
+        g_assert_cmpfloat (sv->snr, ==, 30 + i);
+        g_assert_cmpfloat (sv->elevation, ==, 10 + i);
+        g_assert_cmpfloat (sv->azimuth, ==, 100 + i);
+    }
+}
+
+static void
+test_gps_masks (void)
+{
+    GpsSvStatus status;
+    SvReport report;
+
+    memset (&status, 0, sizeof (status));
+    status.size = sizeof (status);
+    status.num_svs = 3;
+    status.sv_list[0].prn = 3;
+    status.sv_list[1].prn = 32;
+    status.sv_list[2].prn = 70;
+    status.used_in_fix_mask = 0xffffffff;
+    status.ephemeris_mask = 1u << 2;
+    status.almanac_mask = 1u << 31;
+    sv_report_from_gps (&report, &status);
+
+    g_assert_cmpint (report.svs[0].flags, ==, SV_FLAG_USED_IN_FIX | SV_FLAG_HAS_EPHEMERIS);
+    g_assert_cmpint (report.svs[1].flags, ==, SV_FLAG_USED_IN_FIX | SV_FLAG_HAS_ALMANAC);
+    /* the masks only cover the GPS satellites */
+    g_assert_cmpint (report.svs[2].flags, ==, 0);
+    g_assert_cmpuint (report.ephemeris_mask, ==, 1u << 2);
+}
+
+#if ANDROID_VERSION_MAJOR>=7
+static void
+test_from_gnss (void)
+{
+    GnssSvStatus status;
+    SvReport report;
+
+    memset (&status, 0, sizeof (status));
+    status.size = sizeof (status);
+    status.num_svs = 3;
+    status.gnss_sv_list[0].constellation = GNSS_CONSTELLATION_GPS;
+    status.gnss_sv_list[0].svid = 7;
+    status.gnss_sv_list[0].flags = GNSS_SV_FLAGS_HAS_EPHEMERIS_DATA | GNSS_SV_FLAGS_USED_IN_FIX;
+    status.gnss_sv_list[0].c_n0_dbhz = 42;
+    status.gnss_sv_list[1].constellation = GNSS_CONSTELLATION_GALILEO;
+    status.gnss_sv_list[1].svid = 12;
+    status.gnss_sv_list[1].flags = GNSS_SV_FLAGS_HAS_EPHEMERIS_DATA;
+    status.gnss_sv_list[2].constellation = 42;
+    status.gnss_sv_list[2].svid = 5;
+    sv_report_from_gnss (&report, &status);
+
+    g_assert_cmpint (report.num_svs, ==, 3);
+    g_assert_cmpint (report.svs[0].constellation, ==, SV_CONSTELLATION_GPS);
+    g_assert_cmpint (report.svs[0].flags, ==, SV_FLAG_HAS_EPHEMERIS | SV_FLAG_USED_IN_FIX);
+    g_assert_cmpfloat (report.svs[0].snr, ==, 42);
+    g_assert_cmpint (sv_entry_prn (&report.svs[1]), ==, 312);
+    g_assert_cmpint (report.svs[2].constellation, ==, SV_CONSTELLATION_UNKNOWN);
+    /* only GPS ephemeris goes in the mask */
+    g_assert_cmpuint (report.ephemeris_mask, ==, 1u << 6);
+}
+#endif
+
+static void
+test_index (void)
+{
+    SvEntry first[2] = {
+        { SV_CONSTELLATION_GPS, 0, 5 },
+        { SV_CONSTELLATION_GLONASS, 0, 5 },
+    };
+    SvEntry second[2] = {
+        { SV_CONSTELLATION_GLONASS, 0, 5 },
+        { SV_CONSTELLATION_BEIDOU, 0, 20 },
+    };
+    SvIndex index;
+
+    memset (&index, 0, sizeof (index));
+    sv_index_update (&index, NULL, 0, first, 2);
+    g_assert_cmpint (sv_index_lookup (&index, &first[0]), ==, 0);
+    g_assert_cmpint (sv_index_lookup (&index, &first[1]), ==, 1);
+    g_assert_cmpint (sv_index_lookup (&index, &second[1]), ==, -1);
+
+    /* the same svid in another constellation is another satellite, and
+     * the satellites of the previous report are forgotten */
+    sv_index_update (&index, first, 2, second, 2);
+    g_assert_cmpint (sv_index_lookup (&index, &first[0]), ==, -1);
+    g_assert_cmpint (sv_index_lookup (&index, &second[0]), ==, 0);
+    g_assert_cmpint (sv_index_lookup (&index, &second[1]), ==, 1);
+
+    sv_index_remove (&index, second[0].constellation, second[0].svid);
+    g_assert_cmpint (sv_index_lookup (&index, &second[0]), ==, -1);
+    g_assert_cmpint (sv_index_lookup (&index, &second[1]), ==, 1);
+}
+
+int
+main (int argc, char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/sv-report/from-gps", test_from_gps);
+    g_test_add_func ("/sv-report/gps-masks", test_gps_masks);
+#if ANDROID_VERSION_MAJOR>=7
+    g_test_add_func ("/sv-report/from-gnss", test_from_gnss);
+#endif
+    g_test_add_func ("/sv-report/index", test_index);
+
+    return g_test_run ();
+}
@@ -0,0 +1,137 @@
+/*
+ * Geoclue-provider-hybris
+ * wakelock.c - Keeping the system awake while reports are handled
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <syslog.h>
+
+#include "metrics.h"
+#include "wakelock.h"
+
+#define WAKE_LOCK_PATH "/sys/power/wake_lock"
+#define WAKE_UNLOCK_PATH "/sys/power/wake_unlock"
+
+static struct {
+    /* the count and the kernel state change together */
+    GMutex lock;
+    int lock_fd;
+    int unlock_fd;
+    char *name;
+    int count;
+    gint64 since;
+    guint acquisitions;
+    guint64 held_time;
+} wakelock = {
+    .lock_fd = -1,
+    .unlock_fd = -1,
+};
+
+static void
+write_name (int fd, const char *path)
+{
+    if (write (fd, wakelock.name, strlen (wakelock.name)) < 0) {
+        syslog(LOG_WARNING, "Cannot write %s: %s", path, g_strerror (errno));
+    }
+}
+
+gboolean
+wakelock_init (const char *name)
+{
+    wakelock.lock_fd = open (WAKE_LOCK_PATH, O_WRONLY | O_CLOEXEC);
+    wakelock.unlock_fd = open (WAKE_UNLOCK_PATH, O_WRONLY | O_CLOEXEC);
+    if (wakelock.lock_fd < 0 || wakelock.unlock_fd < 0) {
+        syslog(LOG_INFO, "No wakelocks: %s", g_strerror (errno));
+        wakelock_shutdown ();
+        return FALSE;
+    }
+    wakelock.name = g_strdup (name);
+    return TRUE;
+}
+
+void
+wakelock_shutdown (void)
+{
+    g_mutex_lock (&wakelock.lock);
+    if (wakelock.count && wakelock.unlock_fd >= 0) {
+        write_name (wakelock.unlock_fd, WAKE_UNLOCK_PATH);
+    }
+    wakelock.count = 0;
+    if (wakelock.lock_fd >= 0) {
+        close (wakelock.lock_fd);
+        wakelock.lock_fd = -1;
+    }
+    if (wakelock.unlock_fd >= 0) {
+        close (wakelock.unlock_fd);
+        wakelock.unlock_fd = -1;
+    }
+    g_free (wakelock.name);
+    wakelock.name = NULL;
+    g_mutex_unlock (&wakelock.lock);
+}
+
+void
+wakelock_acquire (void)
+{
+    g_mutex_lock (&wakelock.lock);
+    if (wakelock.lock_fd >= 0 && wakelock.count++ == 0) {
+        write_name (wakelock.lock_fd, WAKE_LOCK_PATH);
+        wakelock.since = g_get_monotonic_time ();
+        wakelock.acquisitions++;
+        metrics_inc (METRIC_WAKELOCK_ACQUIRES);
+    }
+    g_mutex_unlock (&wakelock.lock);
+}
+
+void
+wakelock_release (void)
+{
+    gint64 hold;
+
+    g_mutex_lock (&wakelock.lock);
+    if (wakelock.count > 0 && --wakelock.count == 0) {
+        write_name (wakelock.unlock_fd, WAKE_UNLOCK_PATH);
+        hold = g_get_monotonic_time () - wakelock.since;
+        wakelock.held_time += hold;
+        metrics_observe (METRIC_WAKELOCK_HOLD, hold);
+    }
+    g_mutex_unlock (&wakelock.lock);
+}
+
+void
+wakelock_get_stats (gboolean *available, gboolean *held,
+                    guint *acquisitions, guint64 *held_time)
+{
+    g_mutex_lock (&wakelock.lock);
+    *available = wakelock.lock_fd >= 0;
+    *held = wakelock.count > 0;
+    *acquisitions = wakelock.acquisitions;
+    *held_time = wakelock.held_time;
+    if (wakelock.count) {
+        *held_time += g_get_monotonic_time () - wakelock.since;
+    }
+    g_mutex_unlock (&wakelock.lock);
+}
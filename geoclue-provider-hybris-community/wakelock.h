@@ -0,0 +1,42 @@
+/*
+ * Geoclue-provider-hybris
+ * wakelock.h - Keeping the system awake while reports are handled
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef WAKELOCK_H
+#define WAKELOCK_H
+
+#include <glib.h>
+
+/* One kernel wakelock, through /sys/power/wake_lock, shared by reference
+ * counting: it is taken by the first wakelock_acquire and dropped by the
+ * matching last wakelock_release, from any thread. Without the sysfs
+ * interface, or before wakelock_init, these do nothing. */
+gboolean wakelock_init (const char *name);
+/* Drops the wakelock if still held */
+void wakelock_shutdown (void);
+
+void wakelock_acquire (void);
+void wakelock_release (void);
+
+/* held_time in us, including the current hold */
+void wakelock_get_stats (gboolean *available, gboolean *held,
+                         guint *acquisitions, guint64 *held_time);
+
+#endif /* WAKELOCK_H */
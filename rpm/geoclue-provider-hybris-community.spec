@@ -24,6 +24,7 @@ BuildRequires: libxslt
 
 %files
 %defattr(-,root,root,-)
+%config(noreplace) %{_sysconfdir}/geoclue-hybris.conf
 %{_datadir}/dbus-1/services/org.freedesktop.Geoclue.Providers.Hybris.service
 %{_datadir}/geoclue-providers/geoclue-hybris.provider
 %{_libexecdir}/geoclue-hybris